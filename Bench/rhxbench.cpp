@@ -0,0 +1,905 @@
+//------------------------------------------------------------------------------
+//
+//  Intan Technologies RHX Data Acquisition Software
+//  Version 3.3.2
+//
+//  Copyright (c) 2020-2024 Intan Technologies
+//
+//  This file is part of the Intan Technologies RHX Data Acquisition Software.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published
+//  by the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//  This software is provided 'as-is', without any express or implied warranty.
+//  In no event will the authors be held liable for any damages arising from
+//  the use of this software.
+//
+//  See <http://www.intantech.com> for documentation and product information.
+//
+//------------------------------------------------------------------------------
+
+// rhx-bench: feeds synthetic data blocks through the acquisition processing chain (software referencing, XPU
+// filtering, USB data deinterleaving, WaveformFifo, and SaveFile) without opening any windows, and reports throughput,
+// per-batch latency percentiles, and heap allocations as JSON.  With --fifo-stress, the four WaveformFifo readers run
+// on their own threads as they do in acquisition, and each checks that it sees every sample in order.  With
+// --save-format, the save stage runs the save manager for that file format on every enabled channel, as in a
+// recording, optionally limited to the first --save-channels amplifier channels (e.g., 512 or 1024 with
+// --max-channels).  With --stream-fifo, the processing chain is skipped; instead, batches of USB data are passed
+// between two threads through DataStreamFifo and through the Semaphore-based FIFO it replaced, and the throughput and
+// latency of each are reported.
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "Semaphore.h"
+#include "datastreamfifo.h"
+#include "fileperchannelsavemanager.h"
+#include "filepersignaltypesavemanager.h"
+#include "intanfilesavemanager.h"
+#include "rawframesavemanager.h"
+#include "rhxdatablock.h"
+#include "rhxdatareader.h"
+#include "savefile.h"
+#include "signalsources.h"
+#include "softwarereferenceprocessor.h"
+#include "syntheticrhxcontroller.h"
+#include "systemstate.h"
+#include "waveformfifo.h"
+#include "xmlinterface.h"
+#include "xpucontroller.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Every heap allocation in the process goes through these replacements, including the aligned and nothrow forms, so
+// allocations made while processing a batch can be counted.  A healthy acquisition loop allocates nothing per batch.
+static atomic<int64_t> allocationCount(0);
+static atomic<int64_t> allocationBytes(0);
+
+static void* countedAllocation(size_t size) noexcept
+{
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    allocationBytes.fetch_add((int64_t) size, memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+static void* countedAlignedAllocation(size_t size, align_val_t alignment) noexcept
+{
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    allocationBytes.fetch_add((int64_t) size, memory_order_relaxed);
+    size_t align = (size_t) alignment;
+#ifdef _WIN32
+    return _aligned_malloc(size ? size : 1, align);
+#else
+    // aligned_alloc() requires the size to be a multiple of the alignment.
+    return aligned_alloc(align, ((size ? size : 1) + align - 1) / align * align);
+#endif
+}
+
+static void alignedFree(void* p) noexcept
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+void* operator new(size_t size)
+{
+    void* p = countedAllocation(size);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    void* p = countedAllocation(size);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+    return countedAllocation(size);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept
+{
+    return countedAllocation(size);
+}
+
+void* operator new(size_t size, align_val_t alignment)
+{
+    void* p = countedAlignedAllocation(size, alignment);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size, align_val_t alignment)
+{
+    void* p = countedAlignedAllocation(size, alignment);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+    return countedAlignedAllocation(size, alignment);
+}
+
+void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+    return countedAlignedAllocation(size, alignment);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept { free(p); }
+void operator delete(void* p, align_val_t) noexcept { alignedFree(p); }
+void operator delete[](void* p, align_val_t) noexcept { alignedFree(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { alignedFree(p); }
+void operator delete[](void* p, size_t, align_val_t) noexcept { alignedFree(p); }
+void operator delete(void* p, align_val_t, const nothrow_t&) noexcept { alignedFree(p); }
+void operator delete[](void* p, align_val_t, const nothrow_t&) noexcept { alignedFree(p); }
+
+namespace {
+
+enum Stage {
+    StageReference = 0,
+    StageFilter,
+    StageRead,
+    StageSave,
+    NumStages
+};
+
+const char* const StageNames[NumStages] = { "reference", "filter", "read", "save" };
+
+// Synthetic data are generated in real time, so a short pool of batches is captured once and then replayed.
+const int PoolBatches = 16;
+
+const char* const ReaderNames[WaveformFifo::NumberOfReaders] = { "display", "disk", "audio", "tcp" };
+
+struct StressReaderStats
+{
+    int64_t reads;
+    int64_t waits;
+    int64_t timeStampErrors;
+    vector<uint16_t> readBuffer;
+};
+
+struct ChannelPlanEntry
+{
+    SignalType signalType;
+    int stream;
+    int channel;
+    float* analogWaveform;
+    uint16_t* spikeWaveform;
+    uint16_t* stimWaveform;
+    GpuWaveformAddress gpuWaveformAddress;
+};
+
+json latencyStats(vector<double>& nsec)
+{
+    json stats;
+    if (nsec.empty()) return stats;
+    double total = 0.0;
+    for (double t : nsec) total += t;
+    sort(nsec.begin(), nsec.end());
+    auto percentile = [&nsec](double p) {
+        int index = (int) (p * (double) (nsec.size() - 1) + 0.5);
+        return 1.0e-3 * nsec[index];
+    };
+    stats["mean"] = 1.0e-3 * total / (double) nsec.size();
+    stats["p50"] = percentile(0.50);
+    stats["p90"] = percentile(0.90);
+    stats["p99"] = percentile(0.99);
+    stats["max"] = 1.0e-3 * nsec.back();
+    return stats;
+}
+
+// The previous DataStreamFifo implementation: two mutex/condition variable semaphores guarding the buffer indices.  Its
+// consumer polled every 100 microseconds.  Kept as the reference point for --stream-fifo.
+class SemaphoreStreamFifo
+{
+public:
+    SemaphoreStreamFifo(int bufferSize_, int maxReadLength_) :
+        buffer(bufferSize_ + maxReadLength_), bufferSize(bufferSize_), freeWords(bufferSize_),
+        usedWords(0), bufferWriteIndex(0), bufferReadIndex(0), numWordsToBeRead(0) {}
+
+    bool writeToBuffer(const uint8_t* dataSource, int numWords)
+    {
+        if (!freeWords.tryAcquire(numWords)) return false;
+        int numWordsFirstPart = min(numWords, bufferSize - bufferWriteIndex);
+        memcpy(&buffer[bufferWriteIndex], dataSource, BytesPerWord * numWordsFirstPart);
+        memcpy(&buffer[0], dataSource + BytesPerWord * numWordsFirstPart, BytesPerWord * (numWords - numWordsFirstPart));
+        bufferWriteIndex = (bufferWriteIndex + numWords) % bufferSize;
+        usedWords.release(numWords);
+        return true;
+    }
+
+    uint16_t* pointerToData(int numWordsToBeRead_)
+    {
+        numWordsToBeRead = numWordsToBeRead_;
+        if (!usedWords.tryAcquire(numWordsToBeRead)) return nullptr;
+        if (bufferReadIndex + numWordsToBeRead > bufferSize) {
+            memcpy(&buffer[bufferSize], &buffer[0], BytesPerWord * (bufferReadIndex + numWordsToBeRead - bufferSize));
+        }
+        return &buffer[bufferReadIndex];
+    }
+
+    void freeData()
+    {
+        bufferReadIndex = (bufferReadIndex + numWordsToBeRead) % bufferSize;
+        freeWords.release(numWordsToBeRead);
+    }
+
+private:
+    vector<uint16_t> buffer;
+    int bufferSize;
+    Semaphore freeWords;
+    Semaphore usedWords;
+    int bufferWriteIndex;
+    int bufferReadIndex;
+    int numWordsToBeRead;
+};
+
+// Pass numBatches batches of batchWords words from a producer thread to a consumer thread, through a FIFO that holds
+// bufferBatches batches.  With a nonzero period, the producer paces itself as acquisition does, so the consumer waits
+// between batches and the producer-to-consumer latency of each batch is recorded.  With a zero period, the producer
+// writes as soon as the FIFO has room, and only throughput is meaningful.
+template <typename Fifo, typename ReadFn>
+json measureStreamFifo(Fifo& fifo, int batchWords, int bufferBatches, int numBatches, chrono::nanoseconds period,
+                       ReadFn readBatch)
+{
+    using Clock = chrono::steady_clock;
+    vector<uint8_t> batch(BytesPerWord * batchWords, 0);
+    vector<Clock::time_point> sent(numBatches);
+    vector<double> latencyNsec(numBatches);
+    atomic<int> batchesRead(0);
+
+    Clock::time_point start = Clock::now();
+    thread consumer([&]() {
+        for (int i = 0; i < numBatches; ++i) {
+            uint16_t* data = readBatch();
+            latencyNsec[i] = (double) chrono::duration_cast<chrono::nanoseconds>(Clock::now() - sent[i]).count();
+            volatile uint16_t sink = data[batchWords - 1];
+            (void) sink;
+            fifo.freeData();
+            batchesRead.store(i + 1, memory_order_release);
+        }
+    });
+
+    Clock::time_point next = start;
+    for (int i = 0; i < numBatches; ++i) {
+        if (period.count() > 0) {
+            next += period;
+            this_thread::sleep_until(next);
+        }
+        // Wait for room rather than retrying writeToBuffer(), which reports every overrun.
+        while (i - batchesRead.load(memory_order_acquire) >= bufferBatches) {
+            this_thread::yield();
+        }
+        sent[i] = Clock::now();
+        fifo.writeToBuffer(batch.data(), batchWords);
+    }
+    consumer.join();
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+    json result;
+    result["throughputMBPerSecond"] = 1.0e-6 * (double) batch.size() * (double) numBatches / seconds;
+    if (period.count() > 0) result["latencyUs"] = latencyStats(latencyNsec);
+    return result;
+}
+
+// Compare DataStreamFifo against SemaphoreStreamFifo.  Each is run once paced at the acquisition batch period (for
+// latency), and once unpaced (for throughput).
+json compareStreamFifos(int batchWords, int numBatches, chrono::nanoseconds batchPeriod)
+{
+    const int BufferSizeInBatches = 64;
+    json result;
+    for (chrono::nanoseconds period : { batchPeriod, chrono::nanoseconds(0) }) {
+        const char* run = period.count() > 0 ? "paced" : "unpaced";
+
+        SemaphoreStreamFifo semaphoreFifo(BufferSizeInBatches * batchWords, batchWords);
+        auto readSemaphoreFifo = [&]() {
+            uint16_t* data;
+            while (!(data = semaphoreFifo.pointerToData(batchWords))) {
+                this_thread::sleep_for(chrono::microseconds(100));
+            }
+            return data;
+        };
+        result["semaphore"][run] = measureStreamFifo(semaphoreFifo, batchWords, BufferSizeInBatches, numBatches, period,
+                                                     readSemaphoreFifo);
+
+        DataStreamFifo atomicFifo(BufferSizeInBatches * batchWords, batchWords);
+        auto readAtomicFifo = [&]() {
+            uint16_t* data;
+            while (!(data = atomicFifo.pointerToData(batchWords))) {
+                atomicFifo.waitForData(batchWords);
+            }
+            return data;
+        };
+        result["atomic"][run] = measureStreamFifo(atomicFifo, batchWords, BufferSizeInBatches, numBatches, period,
+                                                  readAtomicFifo);
+    }
+    return result;
+}
+
+// Write JSON results to 'filename', or to stdout if it is empty.  Returns false if the file cannot be written.
+bool writeResult(const json& result, const QString& filename)
+{
+    string output = result.dump(2);
+    if (filename.isEmpty()) {
+        cout << output << '\n';
+        return true;
+    }
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        cerr << "rhx-bench: cannot write " << filename.toStdString() << '\n';
+        return false;
+    }
+    file.write(output.c_str(), (qint64) output.size());
+    file.write("\n");
+    file.close();
+    return true;
+}
+
+// Recordings begin by saving a settings file through XMLInterface, which depends on the GUI.  The settings file is
+// written once, outside the measured work, so the benchmark skips it.
+class SkipSettingsFile : public AbstractSettingsInterface
+{
+public:
+    bool loadSettingsFile(const QString& /* filename */, QString& /* errorMessage */) const override { return false; }
+    bool saveSettingsFile(const QString& /* filename */) const override { return true; }
+};
+
+ControllerType controllerTypeFromString(const QString& name, bool& ok)
+{
+    ok = true;
+    if (name == "rhd") return ControllerRecordUSB3;
+    if (name == "rhd-usb2") return ControllerRecordUSB2;
+    if (name == "rhs") return ControllerStimRecord;
+    ok = false;
+    return ControllerRecordUSB3;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    // Use a separate settings namespace so benchmark runs never change the application's saved settings.
+    QCoreApplication::setOrganizationName(OrganizationName);
+    QCoreApplication::setOrganizationDomain(OrganizationDomain);
+    QCoreApplication::setApplicationName("rhx-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the throughput of the RHX data processing chain on synthetic data.");
+    parser.addHelpOption();
+    QCommandLineOption controllerOption("controller", "Controller type: rhd, rhd-usb2, or rhs.", "type", "rhd");
+    QCommandLineOption rateOption("rate", "Amplifier sample rate in Hz.", "hz", "30000");
+    QCommandLineOption maxChannelsOption("max-channels", "Synthesize the maximum number of data streams instead of two headstages.");
+    QCommandLineOption streamsOption("streams", "Synthesize only the first n data streams of the maximum number (0 for "
+                                     "two headstages, or all streams with --max-channels).", "n", "0");
+    QCommandLineOption blocksOption("blocks", "Data blocks processed per batch (1 to " + QString::number(MaxNumBlocksToProcess) + ").",
+                                    "n", "1");
+    QCommandLineOption batchesOption("batches", "Number of timed batches.", "n", "2000");
+    QCommandLineOption threadsOption("cpu-threads", "CPU filter threads: Auto, 1, 2, 4, 8, or 16.", "n", "Auto");
+    QCommandLineOption openCLOption("opencl", "Allow OpenCL devices to be selected for filtering.");
+    QCommandLineOption widebandOnlyOption("wideband-only", "Skip the lowpass and highpass amplifier bands.");
+    QCommandLineOption fifoStressOption("fifo-stress", "Read the waveform FIFO from separate display, disk, audio, and TCP "
+                                        "threads at full rate, checking that no samples are lost or repeated.");
+    QCommandLineOption saveFormatOption("save-format", "Save all enabled channels as in a recording, in this file format: "
+                                        "Traditional, OneFilePerSignalType, OneFilePerChannel, or RawFrames.", "format");
+    QCommandLineOption saveChannelsOption("save-channels", "With --save-format, save only the first n amplifier channels (0 for all).",
+                                          "n", "0");
+    QCommandLineOption streamFifoOption("stream-fifo", "Instead of the processing chain, compare the throughput and "
+                                        "latency of DataStreamFifo and the Semaphore-based FIFO it replaced.");
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "Write JSON results to this file instead of stdout.", "file");
+    parser.addOptions({ controllerOption, rateOption, maxChannelsOption, streamsOption, blocksOption, batchesOption,
+                        threadsOption, openCLOption, widebandOnlyOption, fifoStressOption, saveFormatOption,
+                        saveChannelsOption, streamFifoOption, outputOption });
+    parser.process(app);
+
+    bool ok;
+    ControllerType type = controllerTypeFromString(parser.value(controllerOption), ok);
+    if (!ok) {
+        cerr << "rhx-bench: unknown controller type " << parser.value(controllerOption).toStdString() << '\n';
+        return 1;
+    }
+    AmplifierSampleRate sampleRate = AbstractRHXController::nearestSampleRate(parser.value(rateOption).toDouble());
+    if (sampleRate < 0) {
+        cerr << "rhx-bench: unsupported sample rate " << parser.value(rateOption).toStdString() << '\n';
+        return 1;
+    }
+    int numBlocks = parser.value(blocksOption).toInt();
+    int numBatches = parser.value(batchesOption).toInt();
+    if (numBlocks < 1 || numBlocks > MaxNumBlocksToProcess || numBatches < 1) {
+        cerr << "rhx-bench: invalid --blocks or --batches value" << '\n';
+        return 1;
+    }
+    int requestedStreams = parser.value(streamsOption).toInt();
+    if (requestedStreams < 0 || requestedStreams > AbstractRHXController::maxNumDataStreams(type)) {
+        cerr << "rhx-bench: --streams must be between 0 and " << AbstractRHXController::maxNumDataStreams(type) << '\n';
+        return 1;
+    }
+
+    // Same construction sequence as startSoftware() in main.cpp and the ControllerInterface constructor, minus the USB
+    // data thread and everything that belongs to the GUI.
+    unique_ptr<AbstractRHXController> rhxController(new SyntheticRHXController(type, sampleRate));
+    unique_ptr<SystemState> state(new SystemState(rhxController.get(), StimStepSize10uA, type == ControllerStimRecord ? 4 : 8,
+                                                  true, false, nullptr, false, 2));
+    unique_ptr<XPUController> xpuController(new XPUController(state.get(), parser.isSet(openCLOption)));
+    SignalSources* signalSources = state->signalSources;
+
+    // Scan ports as ControllerInterface::rescanPorts() does.  With --streams, the chips on later data streams are
+    // dropped from the scan as if they were unplugged.
+    vector<int> portIndex, commandStream, numChannelsOnPort;
+    rhxController->findConnectedChips(state->chipType, portIndex, commandStream, numChannelsOnPort,
+                                      parser.isSet(maxChannelsOption) || requestedStreams > 0,
+                                      state->manualFastSettleEnabled->getValue(), false, 0, 0, 0);
+    int numScannedStreams = 0;
+    for (int stream = 0; stream < (int) state->chipType.size(); ++stream) {
+        if (portIndex[stream] == -1) continue;
+        if (requestedStreams > 0 && numScannedStreams == requestedStreams) {
+            bool halfChip = state->chipType[stream] == RHD2216Chip || state->chipType[stream] == RHS2116Chip;
+            numChannelsOnPort[portIndex[stream]] -= halfChip ? 16 : 32;
+            state->chipType[stream] = NoChip;
+            portIndex[stream] = -1;
+            commandStream[stream] = -1;
+            rhxController->enableDataStream(stream, false);
+            continue;
+        }
+        ++numScannedStreams;
+    }
+    if (numScannedStreams < requestedStreams) {
+        cerr << "rhx-bench: only " << numScannedStreams << " data streams are available" << '\n';
+        return 1;
+    }
+    signalSources->addAmplifierChannels(state->chipType, portIndex, commandStream, numChannelsOnPort);
+    signalSources->updateChannelMap();
+    xpuController->updateNumStreams(numScannedStreams);
+    state->headstagePresent->setValue(signalSources->numAmplifierChannels() > 0);
+    state->updateForChangeHeadstages();
+
+    xpuController->runDiagnostic();
+
+    const double WaveformMemoryInSeconds = 30.0;
+    const double WaveformExtraBufferInSeconds = 15.0;
+    double samplesPerBlock = (double) RHXDataBlock::samplesPerDataBlock(type);
+    int waveformFifoMemoryDataBlocks = ceil(WaveformMemoryInSeconds * rhxController->getSampleRate() / samplesPerBlock);
+    int waveformFifoBufferDataBlocks = ceil((WaveformMemoryInSeconds + WaveformExtraBufferInSeconds) *
+                                            rhxController->getSampleRate() / samplesPerBlock);
+    waveformFifoBufferDataBlocks = MaxNumBlocksToProcess *
+            ((waveformFifoBufferDataBlocks + MaxNumBlocksToProcess - 1) / MaxNumBlocksToProcess);
+    unique_ptr<WaveformFifo> waveformFifo(new WaveformFifo(signalSources, waveformFifoBufferDataBlocks,
+                                                           waveformFifoMemoryDataBlocks, MaxNumBlocksToProcess, state.get()));
+    double memoryRequired = 0.0;
+    if (!waveformFifo->memoryWasAllocated(memoryRequired)) {
+        cerr << "rhx-bench: cannot allocate " << memoryRequired << " GB for the waveform FIFO" << '\n';
+        return 1;
+    }
+    state->cpuProcessingThreads->setValue(parser.value(threadsOption));
+
+    const int numDataStreams = rhxController->getNumEnabledDataStreams();
+    const int samplesPerDataBlock = RHXDataBlock::samplesPerDataBlock(type);
+    const int numSamples = numBlocks * samplesPerDataBlock;
+    const int numUsbWords = numBlocks * RHXDataBlock::dataBlockSizeInWords(type, numDataStreams);
+    const double batchPeriodNsec = 1.0e9 * (double) numSamples / rhxController->getSampleRate();
+
+    if (parser.isSet(streamFifoOption)) {
+        json result;
+        result["controller"] = ControllerTypeString[type].toStdString();
+        result["sampleRate"] = rhxController->getSampleRate();
+        result["dataStreams"] = numDataStreams;
+        result["blocksPerBatch"] = numBlocks;
+        result["batches"] = numBatches;
+        result["streamFifo"] = compareStreamFifos(numUsbWords, numBatches, chrono::nanoseconds((int64_t) batchPeriodNsec));
+        return writeResult(result, parser.value(outputOption)) ? 0 : 1;
+    }
+
+    // Capture a pool of synthetic USB data, converting the raw little-endian bytes to words as DataStreamFifo does.
+    vector<uint8_t> usbBytes(BytesPerWord * numUsbWords);
+    vector<uint16_t> pool((size_t) PoolBatches * numUsbWords);
+    for (int batch = 0; batch < PoolBatches; ++batch) {
+        while (rhxController->readDataBlocksRaw(numBlocks, usbBytes.data()) <= 0) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        uint16_t* words = &pool[(size_t) batch * numUsbWords];
+        for (int i = 0; i < numUsbWords; ++i) {
+            words[i] = (uint16_t) usbBytes[2 * i] | ((uint16_t) usbBytes[2 * i + 1] << 8);
+        }
+    }
+
+    // Resolve waveform locations once, as WaveformProcessorThread does.
+    vector<ChannelPlanEntry> channelPlan;
+    vector<GpuWaveformAddress> amplifierAddresses;
+    for (int group = 0; group < signalSources->numGroups(); ++group) {
+        SignalGroup* signalGroup = signalSources->groupByIndex(group);
+        for (int signal = 0; signal < signalGroup->numChannels(); ++signal) {
+            Channel* channel = signalGroup->channelByIndex(signal);
+            string waveName = channel->getNativeNameString();
+            ChannelPlanEntry entry = { channel->getSignalType(), 0, channel->getNativeChannelNumber(), nullptr, nullptr,
+                                       nullptr, { GpuWaveformSpike, 0 } };
+            if (entry.signalType == AmplifierSignal || entry.signalType == AuxInputSignal ||
+                    entry.signalType == SupplyVoltageSignal) {
+                entry.stream = channel->getBoardStream();
+                entry.channel = channel->getChipChannel();
+            }
+            if (entry.signalType == AmplifierSignal) {
+                entry.gpuWaveformAddress = waveformFifo->getGpuWaveformAddress(waveName + "|SPK");
+                entry.spikeWaveform = waveformFifo->getDigitalWaveformPointer(waveName + "|SPK");
+                amplifierAddresses.push_back(waveformFifo->getGpuWaveformAddress(waveName + "|WIDE"));
+                if (type == ControllerStimRecord) {
+                    entry.analogWaveform = waveformFifo->getAnalogWaveformPointer(waveName + "|DC");
+                    entry.stimWaveform = waveformFifo->getDigitalWaveformPointer(waveName + "|STIM");
+                }
+            } else if (entry.signalType != BoardDigitalInSignal && entry.signalType != BoardDigitalOutSignal) {
+                // Individual digital channels are read from the digital word waveforms.
+                entry.analogWaveform = waveformFifo->getAnalogWaveformPointer(waveName);
+            }
+            channelPlan.push_back(entry);
+        }
+    }
+    uint16_t* digitalInWordWaveform = waveformFifo->getDigitalWaveformPointer("DIGITAL-IN-WORD");
+    uint16_t* digitalOutWordWaveform = waveformFifo->getDigitalWaveformPointer("DIGITAL-OUT-WORD");
+
+    QTemporaryDir saveDir;
+    SaveFile saveFile(saveDir.path() + "/rhx-bench.dat", 262144);
+    if (!saveFile.isOpen()) {
+        cerr << "rhx-bench: cannot open temporary save file" << '\n';
+        return 1;
+    }
+
+    // Save managers read every enabled channel, so disable the amplifier channels beyond the requested count before
+    // opening the save files.
+    bool recordingSave = parser.isSet(saveFormatOption);
+    unique_ptr<SaveManager> saveManager;
+    int64_t headerBytes = 0;
+    int64_t recordingBytesWritten = 0;
+    int64_t blocksSaved = 0;
+    if (recordingSave) {
+        if (!state->fileFormat->setValue(parser.value(saveFormatOption))) {
+            cerr << "rhx-bench: unknown file format " << parser.value(saveFormatOption).toStdString() << '\n';
+            return 1;
+        }
+        int saveChannels = parser.value(saveChannelsOption).toInt();
+        int amplifierChannel = 0;
+        for (int group = 0; group < signalSources->numGroups(); ++group) {
+            SignalGroup* signalGroup = signalSources->groupByIndex(group);
+            for (int signal = 0; signal < signalGroup->numChannels(); ++signal) {
+                Channel* channel = signalGroup->channelByIndex(signal);
+                if (channel->getSignalType() != AmplifierSignal) continue;
+                if (saveChannels > 0 && amplifierChannel >= saveChannels) channel->setEnabled(false);
+                ++amplifierChannel;
+            }
+        }
+        state->setupGlobalSettingsLoadSave(new SkipSettingsFile);
+        state->filename->setPath(saveDir.path());
+        state->filename->setBaseFilename("rhx-bench");
+        switch (state->getFileFormatEnum()) {
+        case FileFormatFilePerSignalType:
+            saveManager.reset(new FilePerSignalTypeSaveManager(waveformFifo.get(), state.get()));
+            break;
+        case FileFormatFilePerChannel:
+            saveManager.reset(new FilePerChannelSaveManager(waveformFifo.get(), state.get()));
+            break;
+        case FileFormatRawFrames:
+            waveformFifo->setRawFrameWords(numUsbWords / numSamples);
+            saveManager.reset(new RawFrameSaveManager(waveformFifo.get(), state.get()));
+            break;
+        default:
+            saveManager.reset(new IntanFileSaveManager(waveformFifo.get(), state.get()));
+            break;
+        }
+        if (!saveManager->openAllSaveFiles()) {
+            cerr << "rhx-bench: cannot open save files" << '\n';
+            return 1;
+        }
+        headerBytes = saveManager->writeToSaveFiles(0);
+        recordingBytesWritten = headerBytes;
+    }
+
+    // Reserve everything touched inside the timed loop so that the allocation count reflects the engine alone.
+    SoftwareReferenceProcessor swRefProcessor(type, numDataStreams, numSamples, state.get());
+    swRefProcessor.updateReferenceInfo(signalSources);
+    vector<uint16_t> usbData(numUsbWords);
+    RHXDataReader dataReader(type, numDataStreams, usbData.data(), numSamples);
+    vector<uint16_t> saveBuffer(numSamples);
+    vector<uint32_t> timeStampBuffer(numSamples);
+    vector<DeinterleaveTarget> deinterleaveTargets;
+    deinterleaveTargets.reserve(3 + 2 * channelPlan.size());
+    vector<double> stageNsec[NumStages];
+    vector<double> batchNsec;
+    for (int stage = 0; stage < NumStages; ++stage) stageNsec[stage].reserve(numBatches);
+    batchNsec.reserve(numBatches);
+
+    waveformFifo->resetBuffer();
+    bool allBands = !parser.isSet(widebandOnlyOption);
+    waveformFifo->setFilterBandsEnabled(allBands, allBands);
+    xpuController->resetPrev();
+
+    const WaveformFifo::Reader otherReaders[] = { WaveformFifo::ReaderDisplay, WaveformFifo::ReaderAudio, WaveformFifo::ReaderTCP };
+
+    // Stress readers read every new sample of the timestamps and wideband amplifier data, blocking in the FIFO whenever
+    // they catch up with the writer.  The disk reader also writes what it reads to the save file.
+    bool fifoStress = parser.isSet(fifoStressOption);
+    StressReaderStats stressStats[WaveformFifo::NumberOfReaders];
+    vector<thread> stressThreads;
+    atomic<bool> stressDone(false);
+    uint32_t stressTimeStamp = 0;
+    int64_t writerStalls = 0;
+    if (fifoStress) {
+        for (int r = 0; r < WaveformFifo::NumberOfReaders; ++r) {
+            stressStats[r] = { 0, 0, 0, vector<uint16_t>(numSamples) };
+        }
+        for (int r = 0; r < WaveformFifo::NumberOfReaders; ++r) {
+            stressThreads.emplace_back([&, r]() {
+                WaveformFifo::Reader reader = (WaveformFifo::Reader) r;
+                StressReaderStats& stats = stressStats[r];
+                uint32_t expectedTimeStamp = 0;
+                while (true) {
+                    if (!waveformFifo->requestReadNewData(reader, numSamples)) {
+                        if (stressDone.load()) break;
+                        ++stats.waits;
+                        waveformFifo->waitForNewData(reader, numSamples);
+                        continue;
+                    }
+                    WaveformSpan<uint32_t> timeStamps = waveformFifo->getTimeStampSpan(reader, 0, numSamples);
+                    for (int t = 0; t < timeStamps.size(); ++t) {
+                        if (timeStamps[t] != expectedTimeStamp) ++stats.timeStampErrors;
+                        expectedTimeStamp = timeStamps[t] + 1;
+                    }
+                    for (const GpuWaveformAddress& address : amplifierAddresses) {
+                        waveformFifo->copyGpuAmplifierDataRaw(reader, stats.readBuffer.data(), address, 0, numSamples);
+                        if (reader == WaveformFifo::ReaderDisk) saveFile.writeUInt16(stats.readBuffer.data(), numSamples);
+                    }
+                    waveformFifo->freeOldData(reader);
+                    ++stats.reads;
+                }
+            });
+        }
+    }
+
+    QElapsedTimer wallTimer, stageTimer;
+    int64_t startAllocations = allocationCount.load(memory_order_relaxed);
+    int64_t startAllocationBytes = allocationBytes.load(memory_order_relaxed);
+    int64_t timedNsec = 0;
+    bool firstTime = true;
+    SaveFileWriter::resetStatistics();
+    wallTimer.start();
+
+    for (int batch = 0; batch < numBatches; ++batch) {
+        // Arrival of new USB data is not part of the measured work.
+        memcpy(usbData.data(), &pool[(size_t) (batch % PoolBatches) * numUsbWords], numUsbWords * sizeof(uint16_t));
+
+        stageTimer.start();
+        swRefProcessor.applySoftwareReferences(usbData.data());
+        int64_t referenceNsec = stageTimer.nsecsElapsed();
+
+        // Stress readers free space from their own threads, so wait for them outside the measured work.
+        while (!waveformFifo->requestWriteSpace(numBlocks)) {
+            if (!fifoStress) {
+                cerr << "rhx-bench: waveform FIFO overflow" << '\n';
+                return 1;
+            }
+            ++writerStalls;
+            this_thread::yield();
+        }
+        stageTimer.start();
+        if (!xpuController->processDataBlocks(usbData.data(), waveformFifo->pointerToGpuLowpassWriteSpace(),
+                                              waveformFifo->pointerToGpuWidebandWriteSpace(),
+                                              waveformFifo->pointerToGpuHighpassWriteSpace(),
+                                              waveformFifo->pointerToGpuSpikeTimestampsWriteSpace(),
+                                              waveformFifo->pointerToGpuSpikeIdsWriteSpace(), numBlocks)) {
+            cerr << "rhx-bench: " << xpuController->processingErrorMessage().toStdString() << '\n';
+            return 1;
+        }
+        int64_t filterNsec = stageTimer.nsecsElapsed();
+
+        stageTimer.start();
+        deinterleaveTargets.clear();
+        deinterleaveTargets.push_back({ DeinterleaveTimeStamp, 0, 0, nullptr, nullptr, waveformFifo->pointerToTimeStampWriteSpace() });
+        deinterleaveTargets.push_back({ DeinterleaveDigInWord, 0, 0, nullptr,
+                                        waveformFifo->pointerToDigitalWriteSpace(digitalInWordWaveform), nullptr });
+        deinterleaveTargets.push_back({ DeinterleaveDigOutWord, 0, 0, nullptr,
+                                        waveformFifo->pointerToDigitalWriteSpace(digitalOutWordWaveform), nullptr });
+        for (const ChannelPlanEntry& entry : channelPlan) {
+            switch (entry.signalType) {
+            case AmplifierSignal:
+                waveformFifo->extractGpuSpikeData(entry.spikeWaveform, entry.gpuWaveformAddress, numBlocks, firstTime);
+                if (type == ControllerStimRecord) {
+                    deinterleaveTargets.push_back({ DeinterleaveDcAmplifier, entry.stream, entry.channel,
+                                                    waveformFifo->pointerToAnalogWriteSpace(entry.analogWaveform), nullptr, nullptr });
+                    deinterleaveTargets.push_back({ DeinterleaveStimParams, entry.stream, entry.channel, nullptr,
+                                                    waveformFifo->pointerToDigitalWriteSpace(entry.stimWaveform), nullptr });
+                }
+                break;
+            case AuxInputSignal:
+                dataReader.readAuxInData(waveformFifo->pointerToAnalogWriteSpace(entry.analogWaveform), entry.stream, entry.channel);
+                break;
+            case SupplyVoltageSignal:
+                dataReader.readSupplyVoltageData(waveformFifo->pointerToAnalogWriteSpace(entry.analogWaveform), entry.stream);
+                break;
+            case BoardAdcSignal:
+                deinterleaveTargets.push_back({ DeinterleaveBoardAdc, 0, entry.channel,
+                                                waveformFifo->pointerToAnalogWriteSpace(entry.analogWaveform), nullptr, nullptr });
+                break;
+            case BoardDacSignal:
+                deinterleaveTargets.push_back({ DeinterleaveBoardDac, 0, entry.channel,
+                                                waveformFifo->pointerToAnalogWriteSpace(entry.analogWaveform), nullptr, nullptr });
+                break;
+            default:
+                break;
+            }
+        }
+        dataReader.deinterleave(deinterleaveTargets.data(), (int) deinterleaveTargets.size());
+        if (fifoStress) {
+            // Replayed batches repeat their timestamps, so number samples consecutively for the readers to check.
+            uint32_t* timeStamps = waveformFifo->pointerToTimeStampWriteSpace();
+            for (int t = 0; t < numSamples; ++t) timeStamps[t] = stressTimeStamp++;
+        }
+        // Raw frame recordings store the frames from before software referencing, as WaveformProcessorThread does.
+        uint16_t* rawFrames = waveformFifo->pointerToRawFrameWriteSpace();
+        if (rawFrames) {
+            memcpy(rawFrames, &pool[(size_t) (batch % PoolBatches) * numUsbWords], sizeof(uint16_t) * numUsbWords);
+        }
+        waveformFifo->commitNewData();
+        int64_t readNsec = stageTimer.nsecsElapsed();
+
+        // Save the timestamps and wideband amplifier data the way the traditional Intan file format lays them out, or
+        // with --save-format, everything a recording in that format saves.
+        stageTimer.start();
+        if (!fifoStress && recordingSave && waveformFifo->requestReadNewData(WaveformFifo::ReaderDisk, numSamples)) {
+            recordingBytesWritten = saveManager->writeToSaveFiles(numSamples);
+            blocksSaved += numBlocks;
+            waveformFifo->freeOldData(WaveformFifo::ReaderDisk);
+        } else if (!fifoStress && waveformFifo->requestReadNewData(WaveformFifo::ReaderDisk, numSamples)) {
+            waveformFifo->copyTimeStamps(WaveformFifo::ReaderDisk, timeStampBuffer.data(), 0, numSamples);
+            saveFile.writeUInt32(timeStampBuffer.data(), numSamples);
+            for (const GpuWaveformAddress& address : amplifierAddresses) {
+                waveformFifo->copyGpuAmplifierDataRaw(WaveformFifo::ReaderDisk, saveBuffer.data(), address, 0, numSamples);
+                saveFile.writeUInt16(saveBuffer.data(), numSamples);
+            }
+            waveformFifo->freeOldData(WaveformFifo::ReaderDisk);
+        }
+        int64_t saveNsec = stageTimer.nsecsElapsed();
+
+        // Readers the benchmark does not exercise must still release their data or the FIFO fills up.
+        if (!fifoStress) {
+            for (WaveformFifo::Reader reader : otherReaders) {
+                if (waveformFifo->requestReadNewData(reader, numSamples)) waveformFifo->freeOldData(reader);
+            }
+        }
+        firstTime = false;
+
+        stageNsec[StageReference].push_back((double) referenceNsec);
+        stageNsec[StageFilter].push_back((double) filterNsec);
+        stageNsec[StageRead].push_back((double) readNsec);
+        stageNsec[StageSave].push_back((double) saveNsec);
+        batchNsec.push_back((double) (referenceNsec + filterNsec + readNsec + saveNsec));
+        timedNsec += referenceNsec + filterNsec + readNsec + saveNsec;
+    }
+
+    int64_t wallNsec = wallTimer.nsecsElapsed();
+    int64_t allocations = allocationCount.load(memory_order_relaxed) - startAllocations;
+    int64_t allocatedBytes = allocationBytes.load(memory_order_relaxed) - startAllocationBytes;
+    stressDone.store(true);
+    for (int r = 0; r < (int) stressThreads.size(); ++r) {
+        waveformFifo->wakeReader((WaveformFifo::Reader) r);
+    }
+    for (thread& stressThread : stressThreads) {
+        stressThread.join();
+    }
+    saveFile.close();
+    if (saveManager) saveManager->closeAllSaveFiles();
+    SaveFileWriterStatistics diskStatistics = SaveFileWriter::statistics();
+
+    json result;
+    result["controller"] = ControllerTypeString[type].toStdString();
+    result["sampleRate"] = rhxController->getSampleRate();
+    result["dataStreams"] = numDataStreams;
+    result["amplifierChannels"] = signalSources->numAmplifierChannels();
+    result["blocksPerBatch"] = numBlocks;
+    result["batches"] = numBatches;
+    result["xpu"] = state->usedXPUIndex() == 0 ? "CPU" : state->gpuList[state->usedXPUIndex() - 1].name.toStdString();
+    result["cpuThreads"] = parser.value(threadsOption).toStdString();
+    result["widebandOnly"] = parser.isSet(widebandOnlyOption);
+
+    // XPU diagnostic times are in milliseconds for AbstractXPUInterface::DiagnosticBlocks blocks.
+    json diagnostics = json::array();
+    diagnostics.push_back({ { "name", state->cpuInfo.name.toStdString() },
+                            { "singleBlockMs", state->cpuInfo.diagnosticTime },
+                            { "batchedMs", state->cpuInfo.batchedDiagnosticTime } });
+    for (const GPUInfo& gpu : state->gpuList) {
+        diagnostics.push_back({ { "name", gpu.name.toStdString() },
+                                { "singleBlockMs", gpu.diagnosticTime },
+                                { "batchedMs", gpu.batchedDiagnosticTime } });
+    }
+    result["xpuDiagnostics"] = diagnostics;
+
+    double blocksPerSecond = 1.0e9 * (double) (numBlocks * numBatches) / (double) timedNsec;
+    result["throughput"] = { { "blocksPerSecond", blocksPerSecond },
+                             { "realTimeFactor", batchPeriodNsec * (double) numBatches / (double) timedNsec },
+                             { "wallSeconds", 1.0e-9 * (double) wallNsec } };
+
+    json latency;
+    latency["batch"] = latencyStats(batchNsec);
+    for (int stage = 0; stage < NumStages; ++stage) {
+        latency[StageNames[stage]] = latencyStats(stageNsec[stage]);
+    }
+    result["latencyUs"] = latency;
+
+    json ioThreads = json::array();
+    for (const SaveFileIOThreadStatistics& ioThread : diskStatistics.ioThreads) {
+        ioThreads.push_back({ { "bytesWritten", ioThread.bytesWritten },
+                              { "throughputMBPerSecond", ioThread.throughputMBPerSecond },
+                              { "busyFraction", ioThread.busyFraction } });
+    }
+    result["saveFile"] = { { "bytesWritten", diskStatistics.bytesWritten },
+                           { "throughputMBPerSecond", diskStatistics.throughputMBPerSecond },
+                           { "maxWriteMs", diskStatistics.maxWriteMs },
+                           { "maxFlushStallMs", diskStatistics.maxFlushStallMs },
+                           { "ioThreads", ioThreads } };
+
+    if (recordingSave) {
+        double saveSeconds = 0.0;
+        for (double nsec : stageNsec[StageSave]) saveSeconds += 1.0e-9 * nsec;
+        int64_t dataBytes = recordingBytesWritten - headerBytes;
+        result["recordingSave"] = { { "fileFormat", state->fileFormat->getValue().toStdString() },
+                                    { "amplifierChannels", signalSources->getSaveSignalList().amplifier.size() },
+                                    { "bytesPerDataBlock", blocksSaved > 0 ? dataBytes / blocksSaved : 0 },
+                                    { "serializeMBPerSecond", 1.0e-6 * (double) dataBytes / saveSeconds } };
+    }
+
+    result["allocations"] = { { "count", allocations },
+                              { "bytes", allocatedBytes },
+                              { "perBatch", (double) allocations / (double) numBatches } };
+
+    // Each reader stops one data block short of the writer (see WaveformFifo::requestReadNewData()).
+    if (fifoStress) {
+        json readers;
+        int64_t timeStampErrors = 0;
+        bool allRead = true;
+        for (int r = 0; r < WaveformFifo::NumberOfReaders; ++r) {
+            readers[ReaderNames[r]] = { { "reads", stressStats[r].reads },
+                                        { "waits", stressStats[r].waits },
+                                        { "timeStampErrors", stressStats[r].timeStampErrors } };
+            timeStampErrors += stressStats[r].timeStampErrors;
+            if (stressStats[r].reads == 0) allRead = false;
+        }
+        result["fifoStress"] = { { "readers", readers },
+                                 { "writerStalls", writerStalls },
+                                 { "passed", allRead && timeStampErrors == 0 } };
+    }
+
+    return writeResult(result, parser.value(outputOption)) ? 0 : 1;
+}
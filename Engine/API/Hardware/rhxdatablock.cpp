@@ -31,7 +31,12 @@
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <bit>
 #include <cstring>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RHX_USB_HEADER_SCAN_SSE2
+#endif
 #include "rhxglobals.h"
 #include "rhxdatablock.h"
 #include <fmt/core.h>
@@ -333,6 +338,42 @@ bool RHXDataBlock::checkUsbHeader(const uint8_t* usbBuffer, int index) const
     return checkUsbHeader(usbBuffer, index, type);
 }
 
+// Search for the next USB header at word-aligned offsets index, index + 2, ... below endIndex.  Returns the offset of
+// the first header found, or the first offset at or past endIndex (with the same word alignment) if none is found.
+// Bytes up to endIndex + USBHeaderSizeInBytes - 2 must be readable.  Candidates are located by comparing the first two
+// header bytes sixteen offsets at a time, and only those candidates are checked against the full magic number.
+int RHXDataBlock::findUsbHeader(const uint8_t* usbBuffer, int index, int endIndex, ControllerType type_)
+{
+    uint64_t header = headerMagicNumber(type_);
+    uint8_t byte0 = (uint8_t) (header & 0xffU);
+    uint8_t byte1 = (uint8_t) ((header & 0xff00U) >> 8);
+
+#ifdef RHX_USB_HEADER_SCAN_SSE2
+    const __m128i first = _mm_set1_epi8((char) byte0);
+    const __m128i second = _mm_set1_epi8((char) byte1);
+    while (index + 16 <= endIndex) {
+        __m128i v0 = _mm_loadu_si128((const __m128i*) (usbBuffer + index));
+        __m128i v1 = _mm_loadu_si128((const __m128i*) (usbBuffer + index + 1));
+        __m128i match = _mm_and_si128(_mm_cmpeq_epi8(v0, first), _mm_cmpeq_epi8(v1, second));
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(match) & 0x5555U;  // word-aligned offsets only
+        while (mask) {
+            int offset = index + std::countr_zero(mask);
+            if (checkUsbHeader(usbBuffer, offset, type_)) return offset;
+            mask &= mask - 1;
+        }
+        index += 16;
+    }
+#endif
+
+    while (index < endIndex) {
+        if (usbBuffer[index] == byte0 && usbBuffer[index + 1] == byte1 && checkUsbHeader(usbBuffer, index, type_)) {
+            return index;
+        }
+        index += 2;
+    }
+    return index;
+}
+
 // This function assumes that a command list created either by createCommandListRHDRegisterConfig
 // or createCommandListRHSRegisterConfig from RHXRegisters has been uploaded and run, and the resulting
 // RHXDataBlock read first.
@@ -84,6 +84,7 @@ public:
 
     static bool checkUsbHeader(const uint8_t* usbBuffer, int index, ControllerType type_);
     bool checkUsbHeader(const uint8_t* usbBuffer, int index) const;
+    static int findUsbHeader(const uint8_t* usbBuffer, int index, int endIndex, ControllerType type_);
     int getChipID(int stream, int auxCmdSlot, int &register59Value) const;
 
     static uint64_t headerMagicNumber(ControllerType type_);
@@ -156,7 +156,8 @@ enum SignalType {
 enum FileFormat {
     FileFormatIntan,
     FileFormatFilePerSignalType,
-    FileFormatFilePerChannel
+    FileFormatFilePerChannel,
+    FileFormatRawFrames
 };
 
 enum BoardMode {
@@ -176,6 +177,9 @@ const unsigned int FIFOCapacityInWords = 67108864;
 // Maximum number of data blocks to read at once (limited by low-frequency impedance measurements)
 const int MaxNumBlocksToRead = 56;
 
+// Maximum number of data blocks processed together by WaveformProcessorThread
+const int MaxNumBlocksToProcess = 8;
+
 // Intan 4-bit hardware board mode identifier
 const int RHDUSBInterfaceBoardMode = 0;
 const int RHDControllerBoardMode = 13;
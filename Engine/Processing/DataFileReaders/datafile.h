@@ -54,6 +54,7 @@ public:
     uint16_t readWord() const { uint16_t word; *dataStream >> word; return word; }
     int16_t readSignedWord() const { int16_t word; *dataStream >> word; return word; }
     int32_t readTimeStamp() const { int32_t timeStamp; *dataStream >> timeStamp; return timeStamp; }
+    int64_t readRawData(char* data, int64_t numBytes) const { return dataStream->readRawData(data, numBytes); }
     void close();
 
 private:
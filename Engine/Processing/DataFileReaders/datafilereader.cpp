@@ -33,6 +33,7 @@
 #include "traditionalintanfilemanager.h"
 #include "filepersignaltypemanager.h"
 #include "fileperchannelmanager.h"
+#include "rawframefilemanager.h"
 #include "datafilereader.h"
 #include "advancedstartupdialog.h"
 
@@ -251,12 +252,19 @@ DataFileReader::DataFileReader(const QString& fileName, bool& canReadFile, QStri
         // Don't check for "time" since time.dat is also found in "one file per channel" format.
 
         bool foundPerSignalTypeFile = false;
+        bool foundRawFrameFile = false;
         for (int i = 0; i < infoList.size(); ++i) {
             if (perSignalTypeFileNames.contains(infoList.at(i).baseName().toLower())) {
                 foundPerSignalTypeFile = true;
             }
+            if (infoList.at(i).baseName().toLower() == "rawframes") {
+                foundRawFrameFile = true;
+            }
         }
-        if (foundPerSignalTypeFile) {
+        if (foundRawFrameFile) {
+            format = RawFramesFormat;  // Raw USB frame format
+            dataFileManager = new RawFrameFileManager(fileName, &headerInfo, canReadFile, report, this);
+        } else if (foundPerSignalTypeFile) {
             format = FilePerSignalTypeFormat;  // "One file per signal type" format
             dataFileManager = new FilePerSignalTypeManager(fileName, &headerInfo, canReadFile, report, this);
         } else {
@@ -702,11 +710,6 @@ void DataFileReader::printHeader(const IntanHeaderInfo& info)
     cout << "time in file: " << info.timeInFile << " s" << '\n';
 }
 
-int64_t DataFileReader::blocksPresent()
-{
-    return dataFileManager->blocksPresent();
-}
-
 void DataFileReader::jumpToStart()
 {
     dataFileManager->jumpToTimeStamp(dataFileManager->getFirstTimeStamp());
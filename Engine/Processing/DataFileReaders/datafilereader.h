@@ -48,7 +48,8 @@ enum HeaderFileType {
 enum DataFileFormat {
     TraditionalIntanFormat,
     FilePerSignalTypeFormat,
-    FilePerChannelFormat
+    FilePerChannelFormat,
+    RawFramesFormat
 };
 
 struct HeaderFileChannel
@@ -203,7 +204,7 @@ public:
     void applyPlaybackPorts(IntanHeaderInfo& info, QString& report);
     static void printHeader(const IntanHeaderInfo& info);
 
-    int64_t blocksPresent();
+    int64_t blocksPresent() { return dataFileManager->blocksPresent(); }
 
 signals:
     void setPosStimAmplitude(int stream, int channel, int amplitude);
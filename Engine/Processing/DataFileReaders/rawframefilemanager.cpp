@@ -0,0 +1,165 @@
+//------------------------------------------------------------------------------
+//
+//  Intan Technologies RHX Data Acquisition Software
+//  Version 3.3.2
+//
+//  Copyright (c) 2020-2024 Intan Technologies
+//
+//  This file is part of the Intan Technologies RHX Data Acquisition Software.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published
+//  by the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//  This software is provided 'as-is', without any express or implied warranty.
+//  In no event will the authors be held liable for any damages arising from
+//  the use of this software.
+//
+//  See <http://www.intantech.com> for documentation and product information.
+//
+//------------------------------------------------------------------------------
+
+#include <QFileInfo>
+#include <iostream>
+#include "rhxglobals.h"
+#include "datafilereader.h"
+#include "rawframefilemanager.h"
+
+RawFrameFileManager::RawFrameFileManager(const QString& fileName_, IntanHeaderInfo* info_, bool& canReadFile,
+                                         QString& report, DataFileReader* parent) :
+    DataFileManager(fileName_, info_, parent),
+    rawFrameFile(nullptr),
+    bytesPerFrame(0),
+    samplesPerDataBlock(RHXDataBlock::samplesPerDataBlock(info_->controllerType))
+{
+    QFileInfo fileInfo(fileName);
+    QString path = fileInfo.path();
+
+    totalNumSamples = 0;
+    readIndex = 0;
+
+    rawFrameFile = new DataFile(path + "/" + "rawframes.dat");
+    if (!rawFrameFile->isOpen()) {
+        canReadFile = false;
+        report += "Error: rawframes.dat file not found." + EndOfLine;
+        return;
+    }
+
+    // Frames hold every channel of every data stream enabled during the recording, exactly as read over USB.
+    bytesPerFrame = 2 * (int64_t) RHXDataBlock::dataBlockSizeInWords(info->controllerType, info->numDataStreams) /
+            samplesPerDataBlock;
+    if (rawFrameFile->fileSize() < bytesPerFrame * samplesPerDataBlock) {
+        canReadFile = false;
+        report += "Error: rawframes.dat does not contain a complete data block." + EndOfLine;
+        return;
+    }
+    if (!frameHeaderValid(0) || !frameHeaderValid(1)) {
+        canReadFile = false;
+        report += "Error: rawframes.dat frames do not match the data streams listed in the header file." + EndOfLine;
+        return;
+    }
+
+    totalNumSamples = blocksPresent() * samplesPerDataBlock;
+    report += "Total recording time: " + timeString(totalNumSamples) + EndOfLine;
+
+    rawFrameFile->seek(8);
+    firstTimeStamp = rawFrameFile->readTimeStamp();
+    lastTimeStamp = firstTimeStamp + totalNumSamples - 1;
+    rawFrameFile->seek(0);
+
+    // Read and store contents of live notes file, if present.
+    QFile* liveNotesFile = openLiveNotes();
+    if (liveNotesFile) {
+        readLiveNotes(liveNotesFile);
+        liveNotesFile->close();
+        delete liveNotesFile;
+    }
+
+    canReadFile = true;
+}
+
+RawFrameFileManager::~RawFrameFileManager()
+{
+    if (rawFrameFile) delete rawFrameFile;
+}
+
+bool RawFrameFileManager::frameHeaderValid(int64_t frame)
+{
+    uint8_t header[8];
+    rawFrameFile->seek(frame * bytesPerFrame);
+    if (rawFrameFile->readRawData((char*) header, 8) != 8) return false;
+    uint64_t magicNumber = 0;
+    for (int i = 7; i >= 0; --i) {
+        magicNumber = (magicNumber << 8) | header[i];
+    }
+    return magicNumber == RHXDataBlock::headerMagicNumber(info->controllerType);
+}
+
+long RawFrameFileManager::readDataBlocksRaw(int numBlocks, uint8_t* buffer)
+{
+    if (readIndex + numBlocks * samplesPerDataBlock > totalNumSamples) {   // End of file
+        emit dataFileReader->sendSetCommand("RunMode", "Stop");
+        dataFileReader->setStatusBarEOF();
+        return 0;
+    }
+
+    // Frames were saved in USB order, so they are handed to the controller without being rebuilt sample by sample.
+    int64_t numBytes = bytesPerFrame * numBlocks * samplesPerDataBlock;
+    if (rawFrameFile->readRawData((char*) buffer, numBytes) != numBytes) {
+        cerr << "RawFrameFileManager::readDataBlocksRaw: short read from rawframes.dat" << '\n';
+        emit dataFileReader->sendSetCommand("RunMode", "Stop");
+        dataFileReader->setStatusBarEOF();
+        return 0;
+    }
+    readIndex += numBlocks * samplesPerDataBlock;
+
+    dataFileReader->setStatusBarReady();
+
+    return numBytes;
+}
+
+void RawFrameFileManager::loadDataFrame()
+{
+    // Not used: readDataBlocksRaw() copies whole frames straight from rawframes.dat.
+}
+
+QFile* RawFrameFileManager::openLiveNotes()
+{
+    QFileInfo fileInfo(fileName);
+    QString path = fileInfo.path();
+    QFile* liveNotesFile = new QFile(path + "/" + "notes.txt");
+    if (!liveNotesFile->open(QIODevice::ReadOnly)) {
+        delete liveNotesFile;
+        liveNotesFile = nullptr;
+    }
+    return liveNotesFile;
+}
+
+int64_t RawFrameFileManager::jumpToTimeStamp(int64_t target)
+{
+    if (target < firstTimeStamp) target = firstTimeStamp;
+    if (target > lastTimeStamp) target = lastTimeStamp;
+    target -= firstTimeStamp;   // firstTimeStamp can be negative in triggered recordings.
+
+    // Frames can only be replayed in whole USB data blocks.
+    target -= target % samplesPerDataBlock;
+    rawFrameFile->seek(target * bytesPerFrame);
+
+    readIndex = target;
+    return readIndex + firstTimeStamp;
+}
+
+int64_t RawFrameFileManager::blocksPresent()
+{
+    // Should remain accurate even if data file continues growing
+    return rawFrameFile->fileSize() / (bytesPerFrame * samplesPerDataBlock);
+}
@@ -28,6 +28,7 @@
 //
 //------------------------------------------------------------------------------
 
+#include <algorithm>
 #include <iostream>
 #include "fileperchannelsavemanager.h"
 
@@ -37,7 +38,12 @@ using namespace std;
 FilePerChannelSaveManager::FilePerChannelSaveManager(WaveformFifo* waveformFifo_, SystemState* state_) :
     SaveManager(waveformFifo_, state_),
     infoFile(nullptr),
-    timeStampFile(nullptr)
+    timeStampFile(nullptr),
+    numRanges(1),
+    rangeWork(1),
+    workGeneration(0),
+    rangesRemaining(0),
+    stoppingWorkers(false)
 {
     saveSpikeSnapshot = false;
     samplesPreDetect = 0;
@@ -82,6 +88,10 @@ bool FilePerChannelSaveManager::openAllSaveFiles()
 
     dateTimeStamp = getDateTimeStamp();
 
+    int numChannels = (int) signalSources->getSaveSignalList().amplifier.size();
+    numRanges = clamp(min((int) thread::hardware_concurrency() / 2, numChannels / MinChannelsPerRange), 1, MaxChannelRanges);
+    SaveFileWriter::setNumIOThreads(numRanges);
+
     QString subdirName, subdirPath;
     if (state->createNewDirectory->getValue()) {
         subdirName = state->filename->getBaseFilename() + dateTimeStamp;
@@ -184,6 +194,7 @@ bool FilePerChannelSaveManager::openAllSaveFiles()
             spikeFile->writeUInt32(samplesPostDetect);
         }
         if (type == ControllerStimRecord) {
+            stimFileIndices.push_back(saveList.stimEnabled[i] ? (int) stimFiles.size() : -1);
             if (saveList.stimEnabled[i]) {
                 stimFiles.push_back(new SaveFile(subdirPath + "stim-" + QString::fromStdString(saveList.amplifier[i]) +
                                                  DataFileExtension, bufferSize));
@@ -261,11 +272,18 @@ bool FilePerChannelSaveManager::openAllSaveFiles()
 
     writeIntanFileHeader(infoFile);
     infoFile->close();
+
+    rangeWork.resize(numRanges);
+    startWorkers();
     return true;
 }
 
 void FilePerChannelSaveManager::closeAllSaveFiles()
 {
+    stopWorkers();
+    SaveFileWriter::setNumIOThreads(1);
+    stimFileIndices.clear();
+
     if (liveNotesFile) {
         liveNotesFile->close();
         delete liveNotesFile;
@@ -401,82 +419,35 @@ int64_t FilePerChannelSaveManager::writeToSaveFiles(int numSamples, int timeInde
     }
     numBytesWritten += timeStampFile->getNumBytesWritten();
 
-    // Save amplifier data.
-    int downsampleFactor = (int) state->lowpassWaveformDownsampleRate->getNumericValue();
-    for (int i = 0; i < (int) saveList.amplifier.size(); ++i) {
-        if (state->saveWidebandAmplifierWaveforms->getValue()) {
-            waveformFifo->copyGpuAmplifierDataRaw(WaveformFifo::ReaderDisk, uint16Array, amplifierGPUWaveform[i], timeIndex,
-                                                  numSamples);
-            amplifierFiles[i]->writeUInt16AsSigned(uint16Array, numSamples);
-            numBytesWritten += amplifierFiles[i]->getNumBytesWritten();
-        }
-        if (state->saveLowpassAmplifierWaveforms->getValue()) {
-            waveformFifo->copyGpuAmplifierDataRaw(WaveformFifo::ReaderDisk, uint16Array, amplifierLowpassGPUWaveform[i], timeIndex,
-                                                  numSamples, downsampleFactor);
-            lowpassAmplifierFiles[i]->writeUInt16AsSigned(uint16Array, numSamples / downsampleFactor);
-            numBytesWritten += lowpassAmplifierFiles[i]->getNumBytesWritten();
-        }
-        if (state->saveHighpassAmplifierWaveforms->getValue()) {
-            waveformFifo->copyGpuAmplifierDataRaw(WaveformFifo::ReaderDisk, uint16Array, amplifierHighpassGPUWaveform[i], timeIndex,
-                                                  numSamples);
-            highpassAmplifierFiles[i]->writeUInt16AsSigned(uint16Array, numSamples);
-            numBytesWritten += highpassAmplifierFiles[i]->getNumBytesWritten();
+    // Save amplifier, spike, DC amplifier, and stimulation data, one range of amplifier channels per thread.
+    ChannelBatch batch;
+    batch.numSamples = numSamples;
+    batch.timeIndex = timeIndex;
+    batch.saveWideband = state->saveWidebandAmplifierWaveforms->getValue();
+    batch.saveLowpass = state->saveLowpassAmplifierWaveforms->getValue();
+    batch.saveHighpass = state->saveHighpassAmplifierWaveforms->getValue();
+    batch.saveSpikes = state->saveSpikeData->getValue();
+    batch.saveDC = type == ControllerStimRecord && state->saveDCAmplifierWaveforms->getValue();
+    batch.downsampleFactor = (int) state->lowpassWaveformDownsampleRate->getNumericValue();
+    if (numRanges <= 1) {
+        writeAmplifierChannels(0, batch);
+    } else {
+        {
+            lock_guard<mutex> lock(workMutex);
+            currentBatch = batch;
+            rangesRemaining = numRanges - 1;
+            ++workGeneration;
         }
-    }
+        workReady.notify_all();
 
-    // Save spike data.
-    if (state->saveSpikeData->getValue()) {
-        for (int i = 0; i < (int) saveList.amplifier.size(); ++i) {
-            for (int t = timeIndex - samplesPostDetect; t < timeIndex + numSamples - samplesPostDetect; ++t) {
-                uint8_t spikeId = (uint8_t) waveformFifo->getDigitalData(WaveformFifo::ReaderDisk, spikeWaveform[i], t);
-                if (spikeId != SpikeIdNoSpike) {
-                    mostRecentSpikeTimestamp[i] = waveformFifo->getTimeStamp(WaveformFifo::ReaderDisk, t) - timeStampOffset;
-                    spikeFiles[i]->writeInt32(mostRecentSpikeTimestamp[i]); // Write 32-bit timestamp
-                    spikeCounter[i]++;
-                    spikeFiles[i]->writeUInt8(spikeId);     // Write 8-bit spike ID
-                    if (saveSpikeSnapshot) {                // Optionally, write spike snapshot
-                        for (int tSnap = t - samplesPreDetect; tSnap < t + samplesPostDetect; ++tSnap) {
-                            spikeFiles[i]->writeUInt16(waveformFifo->getGpuAmplifierDataRaw(WaveformFifo::ReaderDisk,
-                                                                                            amplifierHighpassGPUWaveform[i],
-                                                                                            tSnap));
-                        }
-                    }
-                }
-            }
-        }
+        // This thread takes the first range while the workers take the rest.
+        writeAmplifierChannels(0, batch);
 
-        // Force flush all channel files for which enough spikes have accumulated and the last forced flush was at least 0.1 s ago
-        for (int i = 0; i < (int) saveList.amplifier.size(); ++i) {
-            if ((spikeCounter[i] >= 1) && (mostRecentSpikeTimestamp[i] - lastForceFlushTimestamp[i] >= tenthOfSecondTimestamps)) {
-                spikeCounter[i] = 0;
-                lastForceFlushTimestamp[i] = mostRecentSpikeTimestamp[i];
-                spikeFiles[i]->forceFlush();
-            }
-        }
+        unique_lock<mutex> lock(workMutex);
+        workDone.wait(lock, [this] { return rangesRemaining == 0; });
     }
-
-    if (type == ControllerStimRecord) {
-        // Save DC amplifier data.
-        if (state->saveDCAmplifierWaveforms->getValue()) {
-            for (int i = 0; i < (int) saveList.amplifier.size(); ++i) {
-                waveformFifo->copyAnalogData(WaveformFifo::ReaderDisk, vArray, dcAmplifierWaveform[i], timeIndex, numSamples);
-                convertDcAmplifierValue(uint16Array, vArray, numSamples);
-                dcAmplifierFiles[i]->writeUInt16(uint16Array, numSamples);
-                numBytesWritten += dcAmplifierFiles[i]->getNumBytesWritten();
-            }
-        }
-
-        // Save stimulation data.
-        int iFile = 0;  // Used to index stimFiles; stimFiles will be shorter than saveList.amplifier if stim is disabled
-                        // in some channels (as is usually the case).
-        for (int i = 0; i < (int) saveList.amplifier.size(); ++i) {
-            if (saveList.stimEnabled[i]) {
-                waveformFifo->copyDigitalData(WaveformFifo::ReaderDisk, uint16Array, stimFlagsWaveform[i], timeIndex, numSamples);
-                stimFiles[iFile]->writeUInt16StimData(uint16Array, numSamples, posStimAmplitudes[i], negStimAmplitudes[i]);
-                numBytesWritten += stimFiles[iFile]->getNumBytesWritten();
-                ++iFile;
-            }
-        }
+    for (int range = 0; range < numRanges; ++range) {
+        numBytesWritten += rangeWork[range].numBytesWritten;
     }
 
     if (type != ControllerStimRecord) {
@@ -536,6 +507,133 @@ int64_t FilePerChannelSaveManager::writeToSaveFiles(int numSamples, int timeInde
     return numBytesWritten;
 }
 
+// Write all files of the amplifier channels in range 'range' for one batch of samples.
+void FilePerChannelSaveManager::writeAmplifierChannels(int range, const ChannelBatch& batch)
+{
+    ChannelRangeWork& work = rangeWork[range];
+    work.vArray.resize(batch.numSamples);     // Only allocates when batches grow
+    work.uint16Array.resize(batch.numSamples);
+    float* vArray = work.vArray.data();
+    uint16_t* uint16Array = work.uint16Array.data();
+    int numSamples = batch.numSamples;
+    int timeIndex = batch.timeIndex;
+    int64_t numBytesWritten = 0;
+
+    for (int i = (range == 0 ? 0 : channelRangeEnd(range - 1)); i < channelRangeEnd(range); ++i) {
+        if (batch.saveWideband) {
+            waveformFifo->copyGpuAmplifierDataRaw(WaveformFifo::ReaderDisk, uint16Array, amplifierGPUWaveform[i], timeIndex,
+                                                  numSamples);
+            amplifierFiles[i]->writeUInt16AsSigned(uint16Array, numSamples);
+            numBytesWritten += amplifierFiles[i]->getNumBytesWritten();
+        }
+        if (batch.saveLowpass) {
+            waveformFifo->copyLfpDataRaw(WaveformFifo::ReaderDisk, uint16Array, amplifierLfpGPUWaveform[i], timeIndex, numSamples);
+            lowpassAmplifierFiles[i]->writeUInt16AsSigned(uint16Array, numSamples / batch.downsampleFactor);
+            numBytesWritten += lowpassAmplifierFiles[i]->getNumBytesWritten();
+        }
+        if (batch.saveHighpass) {
+            waveformFifo->copyGpuAmplifierDataRaw(WaveformFifo::ReaderDisk, uint16Array, amplifierHighpassGPUWaveform[i], timeIndex,
+                                                  numSamples);
+            highpassAmplifierFiles[i]->writeUInt16AsSigned(uint16Array, numSamples);
+            numBytesWritten += highpassAmplifierFiles[i]->getNumBytesWritten();
+        }
+
+        if (batch.saveSpikes) {
+            int firstTime = timeIndex - samplesPostDetect;
+            WaveformSpan<uint16_t> spikeIds =
+                    waveformFifo->getDigitalDataSpan(WaveformFifo::ReaderDisk, spikeWaveform[i], firstTime, numSamples);
+            for (int n = 0; n < spikeIds.size(); ++n) {
+                uint8_t spikeId = (uint8_t) spikeIds[n];
+                if (spikeId != SpikeIdNoSpike) {
+                    int t = firstTime + n;
+                    mostRecentSpikeTimestamp[i] = waveformFifo->getTimeStamp(WaveformFifo::ReaderDisk, t) - timeStampOffset;
+                    spikeFiles[i]->writeInt32(mostRecentSpikeTimestamp[i]); // Write 32-bit timestamp
+                    spikeCounter[i]++;
+                    spikeFiles[i]->writeUInt8(spikeId);     // Write 8-bit spike ID
+                    if (saveSpikeSnapshot) {                // Optionally, write spike snapshot
+                        for (int tSnap = t - samplesPreDetect; tSnap < t + samplesPostDetect; ++tSnap) {
+                            spikeFiles[i]->writeUInt16(waveformFifo->getGpuAmplifierDataRaw(WaveformFifo::ReaderDisk,
+                                                                                            amplifierHighpassGPUWaveform[i],
+                                                                                            tSnap));
+                        }
+                    }
+                }
+            }
+
+            // Force flush if enough spikes have accumulated and the last forced flush was at least 0.1 s ago
+            if ((spikeCounter[i] >= 1) && (mostRecentSpikeTimestamp[i] - lastForceFlushTimestamp[i] >= tenthOfSecondTimestamps)) {
+                spikeCounter[i] = 0;
+                lastForceFlushTimestamp[i] = mostRecentSpikeTimestamp[i];
+                spikeFiles[i]->forceFlush();
+            }
+        }
+
+        if (type == ControllerStimRecord) {
+            if (batch.saveDC) {
+                waveformFifo->copyAnalogData(WaveformFifo::ReaderDisk, vArray, dcAmplifierWaveform[i], timeIndex, numSamples);
+                convertDcAmplifierValue(uint16Array, vArray, numSamples);
+                dcAmplifierFiles[i]->writeUInt16(uint16Array, numSamples);
+                numBytesWritten += dcAmplifierFiles[i]->getNumBytesWritten();
+            }
+
+            // stimFiles is shorter than saveList.amplifier if stim is disabled in some channels (as is usually the case).
+            int iFile = stimFileIndices[i];
+            if (iFile >= 0) {
+                waveformFifo->copyDigitalData(WaveformFifo::ReaderDisk, uint16Array, stimFlagsWaveform[i], timeIndex, numSamples);
+                stimFiles[iFile]->writeUInt16StimData(uint16Array, numSamples, posStimAmplitudes[i], negStimAmplitudes[i]);
+                numBytesWritten += stimFiles[iFile]->getNumBytesWritten();
+            }
+        }
+    }
+    work.numBytesWritten = numBytesWritten;
+}
+
+// Amplifier channel index past range 'range'.
+int FilePerChannelSaveManager::channelRangeEnd(int range) const
+{
+    return (range + 1) * (int) saveList.amplifier.size() / numRanges;
+}
+
+void FilePerChannelSaveManager::startWorkers()
+{
+    stoppingWorkers = false;
+    for (int worker = 1; worker < numRanges; ++worker) {
+        workers.emplace_back(&FilePerChannelSaveManager::workerLoop, this, worker, workGeneration);
+    }
+}
+
+void FilePerChannelSaveManager::stopWorkers()
+{
+    {
+        lock_guard<mutex> lock(workMutex);
+        stoppingWorkers = true;
+    }
+    workReady.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void FilePerChannelSaveManager::workerLoop(int range, uint64_t lastGeneration)
+{
+    while (true) {
+        ChannelBatch batch;
+        {
+            unique_lock<mutex> lock(workMutex);
+            workReady.wait(lock, [&] { return stoppingWorkers || workGeneration != lastGeneration; });
+            if (stoppingWorkers) return;
+            lastGeneration = workGeneration;
+            batch = currentBatch;
+        }
+
+        writeAmplifierChannels(range, batch);
+
+        lock_guard<mutex> lock(workMutex);
+        if (--rangesRemaining == 0) workDone.notify_one();
+    }
+}
+
 double FilePerChannelSaveManager::bytesPerMinute() const
 {
     double bytes = 0.0;
@@ -31,6 +31,9 @@
 #ifndef FILEPERCHANNELSAVEMANAGER_H
 #define FILEPERCHANNELSAVEMANAGER_H
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include "waveformfifo.h"
 #include "systemstate.h"
 #include "savemanager.h"
@@ -74,6 +77,49 @@ private:
     int *mostRecentSpikeTimestamp;
     int tenthOfSecondTimestamps;
     int *lastForceFlushTimestamp;
+
+    // Amplifier channels, which account for most of the files, are written in contiguous ranges: range 0 by the calling
+    // thread and the others by persistent workers, so each file is only ever touched by one thread.  The disk writes
+    // are spread over the same number of SaveFileWriter I/O threads.
+    static const int MinChannelsPerRange = 32;
+    static constexpr int MaxChannelRanges = 8;
+
+    struct ChannelBatch
+    {
+        int numSamples;
+        int timeIndex;
+        bool saveWideband;
+        bool saveLowpass;
+        bool saveHighpass;
+        bool saveSpikes;
+        bool saveDC;
+        int downsampleFactor;
+    };
+
+    struct ChannelRangeWork
+    {
+        vector<float> vArray;
+        vector<uint16_t> uint16Array;
+        int64_t numBytesWritten;
+    };
+
+    vector<int> stimFileIndices;    // Index in stimFiles of each amplifier channel, or -1 if its stim data are not saved
+    int numRanges;
+    vector<ChannelRangeWork> rangeWork;
+    vector<thread> workers;
+    mutex workMutex;
+    condition_variable workReady;
+    condition_variable workDone;
+    ChannelBatch currentBatch;
+    uint64_t workGeneration;
+    int rangesRemaining;
+    bool stoppingWorkers;
+
+    void startWorkers();
+    void stopWorkers();
+    void workerLoop(int range, uint64_t lastGeneration);
+    int channelRangeEnd(int range) const;
+    void writeAmplifierChannels(int range, const ChannelBatch& batch);
 };
 
 #endif // FILEPERCHANNELSAVEMANAGER_H
@@ -105,6 +105,7 @@ bool FilePerSignalTypeSaveManager::openAllSaveFiles()
     liveNotesFileName = subdirPath + "notes.txt";
 
     getAllWaveformPointers();
+    planAmplifierGather();
 
     if (!saveList.amplifier.empty()) {
         if (state->saveWidebandAmplifierWaveforms->getValue()) {
@@ -336,6 +337,48 @@ void FilePerSignalTypeSaveManager::closeAllSaveFiles()
     }
 }
 
+void FilePerSignalTypeSaveManager::planAmplifierGather()
+{
+    amplifierGather.clear();
+    bool nativeOrder = (int) amplifierGPUWaveform.size() == waveformFifo->numGpuAmplifierChannels();
+    for (int i = 0; i < (int) amplifierGPUWaveform.size() && nativeOrder; ++i) {
+        if (amplifierGPUWaveform[i].waveformIndex != i) nativeOrder = false;
+    }
+    if (nativeOrder) return;
+    for (const GpuWaveformAddress& address : amplifierGPUWaveform) {
+        amplifierGather.push_back(address.waveformIndex);
+    }
+}
+
+// Write numSamples rows of saved amplifier channels from one GPU amplifier band, converted to signed values.  When every
+// channel is saved, the FIFO rows are written directly; otherwise the saved channels are gathered into scratch first.
+void FilePerSignalTypeSaveManager::writeAmplifierRows(SaveFile* saveFile, GpuWaveformType waveformType, int timeIndex,
+                                                      int numSamples, uint16_t* scratch)
+{
+    WaveformSpan<uint16_t> rows = waveformFifo->getGpuAmplifierSpan(WaveformFifo::ReaderDisk, waveformType, timeIndex, numSamples);
+    if (rows.size() == 0) return;
+
+    if (amplifierGather.empty()) {
+        saveFile->writeUInt16AsSigned(rows.first, rows.firstLength);
+        if (rows.secondLength > 0) saveFile->writeUInt16AsSigned(rows.second, rows.secondLength);
+        return;
+    }
+
+    int rowLength = waveformFifo->numGpuAmplifierChannels();
+    int numGather = (int) amplifierGather.size();
+    uint16_t* pWrite = scratch;
+    const uint16_t* row = rows.first;
+    for (int t = 0; t < numSamples; ++t) {
+        if (row == rows.first + rows.firstLength) row = rows.second;
+        for (int j = 0; j < numGather; ++j) {
+            pWrite[j] = row[amplifierGather[j]];
+        }
+        pWrite += numGather;
+        row += rowLength;
+    }
+    saveFile->writeUInt16AsSigned(scratch, numSamples * numGather);
+}
+
 int64_t FilePerSignalTypeSaveManager::writeToSaveFiles(int numSamples, int timeIndex)
 {
     int maxColumns = 1;
@@ -362,10 +405,10 @@ int64_t FilePerSignalTypeSaveManager::writeToSaveFiles(int numSamples, int timeI
 
     // Save amplifier data.
     if (amplifierFile) {
-        waveformFifo->copyGpuAmplifierDataArrayRaw(WaveformFifo::ReaderDisk, uint16Array, amplifierGPUWaveform, timeIndex, numSamples);
         if (!saveAuxInsWithAmps) {
-            amplifierFile->writeUInt16AsSigned(uint16Array, numSamples * (int) saveList.amplifier.size());
+            writeAmplifierRows(amplifierFile, GpuWaveformWideband, timeIndex, numSamples, uint16Array);
         } else {
+            waveformFifo->copyGpuAmplifierDataArrayRaw(WaveformFifo::ReaderDisk, uint16Array, amplifierGPUWaveform, timeIndex, numSamples);
             waveformFifo->copyAnalogDataArray(WaveformFifo::ReaderDisk, vArray, auxInputWaveform, timeIndex, numSamples);
             mergeAmpAndAuxValues(uint16Array2, uint16Array, vArray, numSamples, (int) saveList.amplifier.size(), (int) auxInputWaveform.size());
             // Note: When amplifier data and auxiliary input data are saved together in the same amplifier.dat file, we save
@@ -376,14 +419,13 @@ int64_t FilePerSignalTypeSaveManager::writeToSaveFiles(int numSamples, int timeI
     }
     if (lowpassAmplifierFile) {
         int downsampleFactor = (int) state->lowpassWaveformDownsampleRate->getNumericValue();
-        waveformFifo->copyGpuAmplifierDataArrayRaw(WaveformFifo::ReaderDisk, uint16Array, amplifierLowpassGPUWaveform, timeIndex, numSamples,
-                                                   downsampleFactor);
+        // Lowpass waveforms are saved from the LFP band, which is anti-alias filtered before downsampling.
+        waveformFifo->copyLfpDataArrayRaw(WaveformFifo::ReaderDisk, uint16Array, amplifierLfpGPUWaveform, timeIndex, numSamples);
         lowpassAmplifierFile->writeUInt16AsSigned(uint16Array, (numSamples / downsampleFactor) * (int) saveList.amplifier.size());
         numBytesWritten += lowpassAmplifierFile->getNumBytesWritten();
     }
     if (highpassAmplifierFile) {
-        waveformFifo->copyGpuAmplifierDataArrayRaw(WaveformFifo::ReaderDisk, uint16Array, amplifierHighpassGPUWaveform, timeIndex, numSamples);
-        highpassAmplifierFile->writeUInt16AsSigned(uint16Array, numSamples * (int) saveList.amplifier.size());
+        writeAmplifierRows(highpassAmplifierFile, GpuWaveformHighpass, timeIndex, numSamples, uint16Array);
         numBytesWritten += highpassAmplifierFile->getNumBytesWritten();
     }
 
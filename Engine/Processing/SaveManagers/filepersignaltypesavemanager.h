@@ -73,6 +73,14 @@ private:
     int mostRecentSpikeTimestamp;
     int tenthOfSecondTimestamps;
     int lastForceFlushTimestamp;
+
+    // Indices of the saved amplifier channels in the rows of the sample-major GPU amplifier buffers, or empty if every
+    // channel is saved in native order, in which case the rows are already in amplifier.dat layout.
+    vector<int> amplifierGather;
+
+    void planAmplifierGather();
+    void writeAmplifierRows(SaveFile* saveFile, GpuWaveformType waveformType, int timeIndex, int numSamples,
+                            uint16_t* scratch);
 };
 
 #endif // FILEPERSIGNALTYPESAVEMANAGER_H
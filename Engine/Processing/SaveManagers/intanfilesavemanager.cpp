@@ -27,6 +27,9 @@
 //  See <http://www.intantech.com> for documentation and product information.
 //
 //------------------------------------------------------------------------------
+#include <algorithm>
+#include <bit>
+#include <cstring>
 #include <iostream>
 #include "intanfilesavemanager.h"
 
@@ -80,6 +83,7 @@ bool IntanFileSaveManager::openAllSaveFiles()
     liveNotesFileName = subdirPath + "notes.txt";
     writeIntanFileHeader(saveFile);
     getAllWaveformPointers();
+    planDataBlock();
     return true;
 }
 
@@ -100,95 +104,164 @@ void IntanFileSaveManager::closeAllSaveFiles()
 
 int64_t IntanFileSaveManager::writeToSaveFiles(int numSamples, int timeIndex)
 {
-    float* vArray = new float [numSamples];
-    uint16_t* uint16Array = new uint16_t [numSamples];
     int samplesPerDataBlock = RHXDataBlock::samplesPerDataBlock(type);
 
     for (int block = 0; block < numSamples / samplesPerDataBlock; ++block) {
-        // Save timestamp data.
-        for (int t = 0; t < samplesPerDataBlock; ++t) {
-            saveFile->writeInt32((int) waveformFifo->getTimeStamp(WaveformFifo::ReaderDisk, timeIndex + t) - timeStampOffset);
+        for (const BlockSection& section : blockPlan) {
+            writeBlockSection(section, timeIndex);
         }
+        timeIndex += samplesPerDataBlock;
+    }
 
-        // Save amplifier data.
-        for (int i = 0; i < (int) saveList.amplifier.size(); ++i) {
-            waveformFifo->copyGpuAmplifierDataRaw(WaveformFifo::ReaderDisk, uint16Array, amplifierGPUWaveform[i], timeIndex, samplesPerDataBlock);
-            saveFile->writeUInt16(uint16Array, samplesPerDataBlock);
-        }
+    return saveFile->getNumBytesWritten();
+}
 
-        if (type == ControllerStimRecord) {
-            // Save DC amplifier data.
-            if (state->saveDCAmplifierWaveforms->getValue()) {
-                for (int i = 0; i < (int) saveList.amplifier.size(); ++i) {
-                    waveformFifo->copyAnalogData(WaveformFifo::ReaderDisk, vArray, dcAmplifierWaveform[i], timeIndex, samplesPerDataBlock);
-                    convertDcAmplifierValue(uint16Array, vArray, samplesPerDataBlock);
-                    saveFile->writeUInt16(uint16Array, samplesPerDataBlock);
-                }
-            }
+// Plan the sections of one data block, in file order.
+void IntanFileSaveManager::planDataBlock()
+{
+    int samplesPerDataBlock = RHXDataBlock::samplesPerDataBlock(type);
+    blockPlan.clear();
 
-            // Save stimulation data.
-            for (int i = 0; i < (int) saveList.amplifier.size(); ++i) {
-                waveformFifo->copyDigitalData(WaveformFifo::ReaderDisk, uint16Array, stimFlagsWaveform[i], timeIndex, samplesPerDataBlock);
-                saveFile->writeUInt16StimData(uint16Array, samplesPerDataBlock, posStimAmplitudes[i], negStimAmplitudes[i]);
-            }
+    addBlockSection(SectionTimeStamps, 1, 2 * samplesPerDataBlock);     // 32-bit timestamps, as pairs of words
+    addBlockSection(SectionAmplifier, (int) saveList.amplifier.size(), samplesPerDataBlock);
+    if (type == ControllerStimRecord) {
+        if (state->saveDCAmplifierWaveforms->getValue()) {
+            addBlockSection(SectionDcAmplifier, (int) saveList.amplifier.size(), samplesPerDataBlock);
         }
+        addBlockSection(SectionStim, (int) saveList.amplifier.size(), samplesPerDataBlock);
+    } else {
+        // The FIFO stores auxiliary inputs and supply voltages at the same native rates as this file format.
+        addBlockSection(SectionAuxInput, (int) saveList.auxInput.size(), samplesPerDataBlock / WaveformFifo::AuxInputDivisor);
+        addBlockSection(SectionSupplyVoltage, (int) saveList.supplyVoltage.size(), 1);
+    }
+    addBlockSection(SectionBoardAdc, (int) saveList.boardAdc.size(), samplesPerDataBlock);
+    if (type == ControllerStimRecord) {
+        addBlockSection(SectionBoardDac, (int) saveList.boardDac.size(), samplesPerDataBlock);
+    }
+    // If ANY digital inputs (or outputs) are enabled, we save ALL 16 channels, since we are writing 16-bit chunks of data.
+    if (!saveList.boardDigitalIn.empty()) addBlockSection(SectionDigitalIn, 1, samplesPerDataBlock);
+    if (!saveList.boardDigitalOut.empty()) addBlockSection(SectionDigitalOut, 1, samplesPerDataBlock);
 
-        if (type != ControllerStimRecord) {
-            // Save auxiliary input data.
-            float v;
-            for (int i = 0; i < (int) saveList.auxInput.size(); ++i) {
-                for (int t = 0; t < samplesPerDataBlock; t += 4) {
-                    v = waveformFifo->getAnalogData(WaveformFifo::ReaderDisk, auxInputWaveform[i], timeIndex + t);
-                    saveFile->writeUInt16(convertAuxInputValue(v));
-                }
-            }
+    size_t scratchWords = 0;
+    for (const BlockSection& section : blockPlan) {
+        scratchWords = max(scratchWords, (size_t) section.waveformsPerRun * section.wordsPerWaveform);
+    }
+    wordScratch.assign(scratchWords, 0);
+}
+
+void IntanFileSaveManager::addBlockSection(BlockSectionType sectionType, int numWaveforms, int wordsPerWaveform)
+{
+    if (numWaveforms == 0) return;
+    BlockSection section;
+    section.type = sectionType;
+    section.numWaveforms = numWaveforms;
+    section.wordsPerWaveform = wordsPerWaveform;
+    section.waveformsPerRun = min(numWaveforms, max(1, saveFile->getBufferSize() / (2 * wordsPerWaveform)));
+    blockPlan.push_back(section);
+}
+
+// Data blocks are serialized as native 16-bit words, which matches the file format only on little-endian hosts.
+static_assert(endian::native == endian::little, "IntanFileSaveManager requires a little-endian host");
 
-            // Save supply voltage data.
-            for (int i = 0; i < (int) saveList.supplyVoltage.size(); ++i) {
-                for (int t = 0; t < samplesPerDataBlock; t += samplesPerDataBlock) {
-                    v = waveformFifo->getAnalogData(WaveformFifo::ReaderDisk, supplyVoltageWaveform[i], timeIndex + t);
-                    saveFile->writeUInt16(convertSupplyVoltageValue(v));
-                }
+void IntanFileSaveManager::writeBlockSection(const BlockSection& section, int timeIndex)
+{
+    const int WordSize = 2;
+    for (int first = 0; first < section.numWaveforms; first += section.waveformsPerRun) {
+        int numWaveforms = min(section.waveformsPerRun, section.numWaveforms - first);
+        int numBytes = WordSize * numWaveforms * section.wordsPerWaveform;
+        // Intan files consist of 16- and 32-bit fields only, so runs start word-aligned in the save file buffer and are
+        // converted in place.  The scratch array covers anything that does not fit.
+        if (numBytes <= saveFile->getBufferSize()) {
+            char* dest = saveFile->reserve(numBytes);
+            if (reinterpret_cast<uintptr_t>(dest) % alignof(uint16_t) == 0) {
+                convertWaveforms(section, first, numWaveforms, reinterpret_cast<uint16_t*>(dest), timeIndex);
+                saveFile->commit(numBytes);
+                continue;
             }
         }
+        convertWaveforms(section, first, numWaveforms, wordScratch.data(), timeIndex);
+        saveFile->writeUInt16(wordScratch.data(), numBytes / WordSize);
+    }
+}
 
-        // Save board ADC data.
-        for (int i = 0; i < (int) saveList.boardAdc.size(); ++i) {
-            waveformFifo->copyAnalogData(WaveformFifo::ReaderDisk, vArray, boardAdcWaveform[i], timeIndex, samplesPerDataBlock);
-            convertBoardAdcValue(uint16Array, vArray, samplesPerDataBlock);
-            saveFile->writeUInt16(uint16Array, samplesPerDataBlock);
-        }
+// Convert one data block of numWaveforms consecutive waveforms of section, starting with firstWaveform, to dest.
+void IntanFileSaveManager::convertWaveforms(const BlockSection& section, int firstWaveform, int numWaveforms,
+                                            uint16_t* dest, int timeIndex)
+{
+    const WaveformFifo::Reader Reader = WaveformFifo::ReaderDisk;
+    int samplesPerDataBlock = RHXDataBlock::samplesPerDataBlock(type);
+    const vector<float*>* analogWaveforms = nullptr;
+    void (SaveManager::*convert)(uint16_t*, const float*, int) const = nullptr;
 
-        if (type == ControllerStimRecord) {
-            // Save board DAC data.
-            for (int i = 0; i < (int) saveList.boardDac.size(); ++i) {
-                waveformFifo->copyAnalogData(WaveformFifo::ReaderDisk, vArray, boardDacWaveform[i], timeIndex, samplesPerDataBlock);
-                convertBoardDacValue(uint16Array, vArray, samplesPerDataBlock);
-                saveFile->writeUInt16(uint16Array, samplesPerDataBlock);
+    switch (section.type) {
+    case SectionTimeStamps:
+    {
+        WaveformSpan<uint32_t> timeStamps = waveformFifo->getTimeStampSpan(Reader, timeIndex, samplesPerDataBlock);
+        for (int t = 0; t < timeStamps.size(); ++t) {
+            uint32_t timeStamp = (uint32_t) ((int) timeStamps[t] - timeStampOffset);
+            dest[2 * t] = (uint16_t) (timeStamp & 0x0000ffffU);
+            dest[2 * t + 1] = (uint16_t) (timeStamp >> 16);
+        }
+        break;
+    }
+    case SectionAmplifier:
+        waveformFifo->copyGpuAmplifierDataBlockRaw(Reader, dest, &amplifierGPUWaveform[firstWaveform], numWaveforms,
+                                                   timeIndex, samplesPerDataBlock);
+        break;
+    case SectionDcAmplifier:
+        analogWaveforms = &dcAmplifierWaveform;
+        convert = &IntanFileSaveManager::convertDcAmplifierValue;
+        break;
+    case SectionStim:
+        for (int i = firstWaveform; i < firstWaveform + numWaveforms; ++i) {
+            WaveformSpan<uint16_t> flags = waveformFifo->getDigitalDataSpan(Reader, stimFlagsWaveform[i], timeIndex, samplesPerDataBlock);
+            for (int t = 0; t < flags.size(); ++t) {
+                dest[t] = SaveFile::stimWordWithAmplitude(flags[t], posStimAmplitudes[i], negStimAmplitudes[i]);
             }
+            dest += section.wordsPerWaveform;
         }
-
-        // Save board digital input data.
-        if (!saveList.boardDigitalIn.empty()) {
-            // If ANY digital inputs are enabled, we save ALL 16 channels, since we are writing 16-bit chunks of data.
-            waveformFifo->copyDigitalData(WaveformFifo::ReaderDisk, uint16Array, boardDigitalInWaveform, timeIndex, samplesPerDataBlock);
-            saveFile->writeUInt16(uint16Array, samplesPerDataBlock);
+        break;
+    case SectionAuxInput:
+        analogWaveforms = &auxInputWaveform;
+        convert = &IntanFileSaveManager::convertAuxInputValue;
+        break;
+    case SectionSupplyVoltage:
+        // One sample per data block.
+        for (int i = firstWaveform; i < firstWaveform + numWaveforms; ++i) {
+            WaveformSpan<float> voltage = waveformFifo->getAnalogDataSpan(Reader, supplyVoltageWaveform[i], timeIndex, samplesPerDataBlock);
+            *dest = voltage.size() > 0 ? convertSupplyVoltageValue(voltage[0]) : 0;
+            ++dest;
         }
+        break;
+    case SectionBoardAdc:
+        analogWaveforms = &boardAdcWaveform;
+        convert = &IntanFileSaveManager::convertBoardAdcValue;
+        break;
+    case SectionBoardDac:
+        analogWaveforms = &boardDacWaveform;
+        convert = &IntanFileSaveManager::convertBoardDacValue;
+        break;
+    case SectionDigitalIn:
+    case SectionDigitalOut:
+    {
+        WaveformSpan<uint16_t> words = waveformFifo->getDigitalDataSpan(
+                    Reader, section.type == SectionDigitalIn ? boardDigitalInWaveform : boardDigitalOutWaveform,
+                    timeIndex, samplesPerDataBlock);
+        if (words.firstLength > 0) memcpy(dest, words.first, words.firstLength * sizeof(uint16_t));
+        if (words.secondLength > 0) memcpy(dest + words.firstLength, words.second, words.secondLength * sizeof(uint16_t));
+        break;
+    }
+    }
 
-        // Save board digital output data, optionally.
-        if (!saveList.boardDigitalOut.empty()) {
-            // Save all 16 channels, since we are writing 16-bit chunks of data.
-            waveformFifo->copyDigitalData(WaveformFifo::ReaderDisk, uint16Array, boardDigitalOutWaveform, timeIndex, samplesPerDataBlock);
-            saveFile->writeUInt16(uint16Array, samplesPerDataBlock);
+    // Analog waveforms are read at their native rates and converted to file units directly from the FIFO.
+    if (analogWaveforms) {
+        for (int i = firstWaveform; i < firstWaveform + numWaveforms; ++i) {
+            WaveformSpan<float> voltage = waveformFifo->getAnalogDataSpan(Reader, (*analogWaveforms)[i], timeIndex, samplesPerDataBlock);
+            (this->*convert)(dest, voltage.first, voltage.firstLength);
+            (this->*convert)(dest + voltage.firstLength, voltage.second, voltage.secondLength);
+            dest += section.wordsPerWaveform;
         }
-
-        timeIndex += samplesPerDataBlock;
     }
-
-    delete [] vArray;
-    delete [] uint16Array;
-
-    return saveFile->getNumBytesWritten();
 }
 
 int IntanFileSaveManager::maxSamplesInFile() const
@@ -53,6 +53,37 @@ private:
     SaveFile* saveFile;
 
     QString subdirName;
+
+    // Layout of one data block, planned once by openAllSaveFiles() so that writeToSaveFiles() can convert each section
+    // straight into the save file buffer without allocating or looking anything up.
+    enum BlockSectionType {
+        SectionTimeStamps,
+        SectionAmplifier,
+        SectionDcAmplifier,
+        SectionStim,
+        SectionAuxInput,
+        SectionSupplyVoltage,
+        SectionBoardAdc,
+        SectionBoardDac,
+        SectionDigitalIn,
+        SectionDigitalOut
+    };
+
+    struct BlockSection
+    {
+        BlockSectionType type;
+        int numWaveforms;
+        int wordsPerWaveform;
+        int waveformsPerRun;    // Waveforms converted per reserved run of the save file buffer
+    };
+
+    vector<BlockSection> blockPlan;
+    vector<uint16_t> wordScratch;   // Used only for runs that cannot be written in place
+
+    void planDataBlock();
+    void addBlockSection(BlockSectionType sectionType, int numWaveforms, int wordsPerWaveform);
+    void writeBlockSection(const BlockSection& section, int timeIndex);
+    void convertWaveforms(const BlockSection& section, int firstWaveform, int numWaveforms, uint16_t* dest, int timeIndex);
 };
 
 #endif // INTANFILESAVEMANAGER_H
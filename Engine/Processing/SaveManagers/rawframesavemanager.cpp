@@ -0,0 +1,135 @@
+//------------------------------------------------------------------------------
+//
+//  Intan Technologies RHX Data Acquisition Software
+//  Version 3.3.2
+//
+//  Copyright (c) 2020-2024 Intan Technologies
+//
+//  This file is part of the Intan Technologies RHX Data Acquisition Software.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published
+//  by the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//  This software is provided 'as-is', without any express or implied warranty.
+//  In no event will the authors be held liable for any damages arising from
+//  the use of this software.
+//
+//  See <http://www.intantech.com> for documentation and product information.
+//
+//------------------------------------------------------------------------------
+
+#include <iostream>
+#include "rawframesavemanager.h"
+
+using namespace std;
+
+RawFrameSaveManager::RawFrameSaveManager(WaveformFifo* waveformFifo_, SystemState* state_) :
+    SaveManager(waveformFifo_, state_),
+    infoFile(nullptr),
+    rawFrameFile(nullptr)
+{
+}
+
+RawFrameSaveManager::~RawFrameSaveManager()
+{
+    closeAllSaveFiles();
+}
+
+bool RawFrameSaveManager::openAllSaveFiles()
+{
+    if (waveformFifo->rawFrameWords() == 0) {
+        cerr << "RawFrameSaveManager::openAllSaveFiles: raw frames are not being stored." << '\n';
+        return false;
+    }
+
+    dateTimeStamp = getDateTimeStamp();
+    int bufferSize = calculateBufferSize(state);
+
+    QString subdirName, subdirPath;
+    if (state->createNewDirectory->getValue()) {
+        subdirName = state->filename->getBaseFilename() + dateTimeStamp;
+        QDir dir(state->filename->getPath());
+        if (!dir.mkdir(subdirName)) {
+            return false; // Cannot create subdirectory.
+        }
+        subdirPath = state->filename->getPath() + "/" + subdirName + "/";
+    } else {
+        subdirName = state->filename->getFullFilename();
+        subdirPath = subdirName + "/";
+    }
+
+    // Write settings file.
+    state->saveGlobalSettings(subdirPath + "settings.xml");
+
+    infoFile = new SaveFile(subdirPath + "info" + intanFileExtension(), bufferSize);
+    if (!infoFile->isOpen()) {
+        closeAllSaveFiles();
+        return false;
+    }
+    rawFrameFile = new SaveFile(subdirPath + "rawframes.dat", bufferSize);
+    if (!rawFrameFile->isOpen()) {
+        closeAllSaveFiles();
+        return false;
+    }
+    liveNotesFileName = subdirPath + "notes.txt";
+
+    // The saved channel list is kept in the header, so that playback and conversion use the same channels that were
+    // enabled for this recording.  The frames themselves hold every channel on every enabled data stream.
+    getAllWaveformPointers();
+
+    writeIntanFileHeader(infoFile);
+    infoFile->close();
+    return true;
+}
+
+void RawFrameSaveManager::closeAllSaveFiles()
+{
+    if (liveNotesFile) {
+        liveNotesFile->close();
+        delete liveNotesFile;
+        liveNotesFile = nullptr;
+    }
+
+    if (infoFile) {
+        infoFile->close();
+        delete infoFile;
+        infoFile = nullptr;
+    }
+
+    if (rawFrameFile) {
+        rawFrameFile->close();
+        delete rawFrameFile;
+        rawFrameFile = nullptr;
+    }
+}
+
+int64_t RawFrameSaveManager::writeToSaveFiles(int numSamples, int timeIndex)
+{
+    if (!rawFrameFile) return 0;
+    if (numSamples == 0) return rawFrameFile->getNumBytesWritten();
+
+    // Frames are stored as they arrived over USB, so they are copied to disk without any conversion.
+    WaveformSpan<uint16_t> frames = waveformFifo->getRawFrameSpan(WaveformFifo::ReaderDisk, timeIndex, numSamples);
+    rawFrameFile->writeBytes(frames.first, sizeof(uint16_t) * (int64_t) frames.firstLength);
+    if (frames.secondLength > 0) {
+        rawFrameFile->writeBytes(frames.second, sizeof(uint16_t) * (int64_t) frames.secondLength);
+    }
+    return rawFrameFile->getNumBytesWritten();
+}
+
+double RawFrameSaveManager::bytesPerMinute() const
+{
+    double bytes = 2.0 * waveformFifo->rawFrameWords();
+    double samplesPerMinute = 60.0 * state->sampleRate->getNumericValue();
+    return bytes * samplesPerMinute;
+}
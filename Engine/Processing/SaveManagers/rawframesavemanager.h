@@ -0,0 +1,59 @@
+//------------------------------------------------------------------------------
+//
+//  Intan Technologies RHX Data Acquisition Software
+//  Version 3.3.2
+//
+//  Copyright (c) 2020-2024 Intan Technologies
+//
+//  This file is part of the Intan Technologies RHX Data Acquisition Software.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published
+//  by the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//  This software is provided 'as-is', without any express or implied warranty.
+//  In no event will the authors be held liable for any damages arising from
+//  the use of this software.
+//
+//  See <http://www.intantech.com> for documentation and product information.
+//
+//------------------------------------------------------------------------------
+
+#ifndef RAWFRAMESAVEMANAGER_H
+#define RAWFRAMESAVEMANAGER_H
+
+#include "waveformfifo.h"
+#include "systemstate.h"
+#include "savemanager.h"
+
+// Raw frame file format: the data frames read from the controller are written to rawframes.dat in the standard USB
+// data block layout, before software referencing or filtering, next to an info.rhd/info.rhs header file and
+// settings.xml, so recording costs little more than the disk write.  These recordings are played back directly, and
+// may be converted to any other file format by recording during playback.
+class RawFrameSaveManager : public SaveManager
+{
+public:
+    RawFrameSaveManager(WaveformFifo* waveformFifo_, SystemState* state_);
+    ~RawFrameSaveManager();
+
+    bool openAllSaveFiles() override;
+    int64_t writeToSaveFiles(int numSamples, int timeIndex = 0) override;
+    void closeAllSaveFiles() override;
+    bool mustSaveCompleteDataBlocks() const override { return true; }  // Playback reads whole data blocks of frames.
+    double bytesPerMinute() const override;
+
+private:
+    SaveFile* infoFile;
+    SaveFile* rawFrameFile;
+};
+
+#endif // RAWFRAMESAVEMANAGER_H
@@ -28,6 +28,8 @@
 //
 //------------------------------------------------------------------------------
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include "savefile.h"
 
@@ -36,21 +38,12 @@ using namespace std;
 SaveFile::SaveFile(const QString& fileName_, int bufferSize_) :
     bufferSize(bufferSize_),
     fileName(fileName_),
-    file(nullptr),
-    dataStream(nullptr)
+    writer(nullptr)
 {
-    file = new QFile(fileName);
-    if (!file->open(QIODevice::WriteOnly)) {
-        cerr << "SaveFile: Cannot open file " << fileName.toStdString() << " for writing: " <<
-                qPrintable(file->errorString()) << '\n';
-        if (file) delete file;
-        file = nullptr;
-        return;
-    }
-    createDataStream(file);
-
-    buffer = new char [bufferSize];
+    writer = new SaveFileWriter(fileName, bufferSize, false);
+    buffer = writer->buffer();
     bufferIndex = 0;
+    bufferStart = 0;
     bufferSizeMinus4 = bufferSize - 4;  // Precompute to save time.
     bufferSizeMinus2 = bufferSize - 2;  // Precompute to save time.
 
@@ -60,7 +53,7 @@ SaveFile::SaveFile(const QString& fileName_, int bufferSize_) :
 SaveFile::~SaveFile()
 {
     close();
-    delete [] buffer;
+    delete writer;
 }
 
 void SaveFile::writeInt32(int32_t word)
@@ -220,6 +213,18 @@ void SaveFile::writeBitAsUInt16(const uint16_t* wordArray, int numSamples, int b
     }
 }
 
+// Convert a stim flags word from the waveform FIFO to its saved form: the LSB (stim on marker) is cleared, and if stim is
+// on, the amplitude for its polarity is added to the 8 LSBs; otherwise the polarity bit is cleared too.
+uint16_t SaveFile::stimWordWithAmplitude(uint16_t word, uint8_t posAmplitude, uint8_t negAmplitude)
+{
+    uint16_t stimWord = word & 0xfffeU;
+    if ((word & 0x0001U) != 0) {
+        bool polarityIsNegative = (stimWord & 0x0100U) != 0;
+        return stimWord | (polarityIsNegative ? negAmplitude : posAmplitude);
+    }
+    return stimWord & 0xfe00U;
+}
+
 void SaveFile::writeUInt16StimData(const uint16_t* wordArray, int numSamples, uint8_t posAmplitude, uint8_t negAmplitude)
 {
     const uint16_t* word = wordArray;
@@ -227,14 +232,7 @@ void SaveFile::writeUInt16StimData(const uint16_t* wordArray, int numSamples, ui
     if (bufferIndex > bufferSize - WordSize * numSamples) flush();
     while (WordSize * numSamples > bufferSize) {
         for (int i = 0; i < bufferSize / WordSize; ++i) {
-            uint16_t stimWord = (*word) & 0xfffeU;     // Set LSB (stim on marker) to zero.
-            bool stimOn = ((*word) & 0x0001U) != 0;
-            if (stimOn) {   // If stim on, add amplitude to 8 LSBs.
-                bool polarityIsNegative = (stimWord & 0x0100U) != 0;
-                stimWord = stimWord | (polarityIsNegative ? negAmplitude : posAmplitude);
-            } else {
-                stimWord = stimWord & 0xfe00U;  // Zero out polarity bit if stim is off.
-            }
+            uint16_t stimWord = stimWordWithAmplitude(*word, posAmplitude, negAmplitude);
             buffer[bufferIndex++] = (char)  (stimWord & 0x00ffU);
             buffer[bufferIndex++] = (char) ((stimWord & 0xff00U) >> 8);
             ++word;
@@ -243,14 +241,7 @@ void SaveFile::writeUInt16StimData(const uint16_t* wordArray, int numSamples, ui
         numSamples -= bufferSize / WordSize;
     }
     for (int i = 0; i < numSamples; ++i) {
-        uint16_t stimWord = (*word) & 0xfffeU;     // Set LSB (stim on marker) to zero.
-        bool stimOn = ((*word) & 0x0001U) != 0;
-        if (stimOn) {   // If stim on, add amplitude to 8 LSBs.
-            bool polarityIsNegative = (stimWord & 0x0100U) != 0;
-            stimWord = stimWord | (polarityIsNegative ? negAmplitude : posAmplitude);
-        } else {
-            stimWord = stimWord & 0xfe00U;  // Zero out polarity bit if stim is off.
-        }
+        uint16_t stimWord = stimWordWithAmplitude(*word, posAmplitude, negAmplitude);
         buffer[bufferIndex++] = (char)  (stimWord & 0x00ffU);
         buffer[bufferIndex++] = (char) ((stimWord & 0xff00U) >> 8);
         ++word;
@@ -267,14 +258,7 @@ void SaveFile::writeUInt16StimDataArray(const uint16_t* wordArray, int numSample
     int waveformIndex = 0;
     while (WordSize * numWords > bufferSize) {
         for (int i = 0; i < bufferSize / WordSize; ++i) {
-            uint16_t stimWord = (*word) & 0xfffeU;     // Set LSB (stim on marker) to zero.
-            bool stimOn = ((*word) & 0x0001U) != 0;
-            if (stimOn) {   // If stim on, add amplitude to 8 LSBs.
-                bool polarityIsNegative = (stimWord & 0x0100U) != 0;
-                stimWord = stimWord | (polarityIsNegative ? negAmplitudes[waveformIndex] : posAmplitudes[waveformIndex]);
-            } else {
-                stimWord = stimWord & 0xfe00U;  // Zero out polarity bit if stim is off.
-            }
+            uint16_t stimWord = stimWordWithAmplitude(*word, posAmplitudes[waveformIndex], negAmplitudes[waveformIndex]);
             buffer[bufferIndex++] = (char)  (stimWord & 0x00ffU);
             buffer[bufferIndex++] = (char) ((stimWord & 0xff00U) >> 8);
             ++word;
@@ -285,14 +269,7 @@ void SaveFile::writeUInt16StimDataArray(const uint16_t* wordArray, int numSample
         numWords -= bufferSize / WordSize;
     }
     for (int i = 0; i < numWords; ++i) {
-        uint16_t stimWord = (*word) & 0xfffeU;     // Set LSB (stim on marker) to zero.
-        bool stimOn = ((*word) & 0x0001U) != 0;
-        if (stimOn) {   // If stim on, add amplitude to 8 LSBs.
-            bool polarityIsNegative = (stimWord & 0x0100U) != 0;
-            stimWord = stimWord | (polarityIsNegative ? negAmplitudes[waveformIndex] : posAmplitudes[waveformIndex]);
-        } else {
-            stimWord = stimWord & 0xfe00U;  // Zero out polarity bit if stim is off.
-        }
+        uint16_t stimWord = stimWordWithAmplitude(*word, posAmplitudes[waveformIndex], negAmplitudes[waveformIndex]);
         buffer[bufferIndex++] = (char)  (stimWord & 0x00ffU);
         buffer[bufferIndex++] = (char) ((stimWord & 0xff00U) >> 8);
         ++word;
@@ -304,26 +281,22 @@ void SaveFile::writeUInt16StimDataArray(const uint16_t* wordArray, int numSample
     }
 }
 
+// Converts in one pass per buffer-sized chunk, straight into the buffer; with no per-byte index updates, the compiler
+// can vectorize the loop.
 void SaveFile::writeUInt16AsSigned(const uint16_t* wordArray, int numSamples)
 {
-    const uint16_t* word = wordArray;
     const int WordSize = 2;
-    if (bufferIndex > bufferSize - WordSize * numSamples) flush();
-    while (WordSize * numSamples > bufferSize) {
-        for (int i = 0; i < bufferSize / WordSize; ++i) {
-            uint16_t asSigned = (*word) ^ 0x8000U;   // convert from offset to two's complement
-            buffer[bufferIndex++] = (char)  (asSigned & 0x00ffU);
-            buffer[bufferIndex++] = (char) ((asSigned & 0xff00U) >> 8);
-            ++word;
+    while (numSamples > 0) {
+        int numWords = min(numSamples, bufferSize / WordSize);
+        char* dest = reserve(WordSize * numWords);
+        for (int i = 0; i < numWords; ++i) {
+            uint16_t asSigned = wordArray[i] ^ 0x8000U;   // convert from offset to two's complement
+            dest[2 * i] = (char) (asSigned & 0x00ffU);
+            dest[2 * i + 1] = (char) ((asSigned & 0xff00U) >> 8);
         }
-        flush();
-        numSamples -= bufferSize / WordSize;
-    }
-    for (int i = 0; i < numSamples; ++i) {
-        uint16_t asSigned = (*word) ^ 0x8000U;   // convert from offset to two's complement
-        buffer[bufferIndex++] = (char)  (asSigned & 0x00ffU);
-        buffer[bufferIndex++] = (char) ((asSigned & 0xff00U) >> 8);
-        ++word;
+        commit(WordSize * numWords);
+        wordArray += numWords;
+        numSamples -= numWords;
     }
 }
 
@@ -333,26 +306,30 @@ void SaveFile::writeUInt8(uint8_t byte)
     buffer[bufferIndex++] = (char) byte;
 }
 
+// Doubles are written as 32-bit single-precision floats, as QDataStream does with SinglePrecision set.
 void SaveFile::writeDouble(double x)
 {
-    if (bufferIndex > 0) flush();
-    *dataStream << x;   // Low-performance write; this method is not fast like writeIntXX and writeUIntXX.
-    numBytesWritten += 4; // There are 32 bits per double since we set floating point precision to single precision.
+    float value = (float) x;
+    uint32_t word;
+    std::memcpy(&word, &value, sizeof(word));
+    writeUInt32(word);
 }
 
+// Same layout as QDataStream: a 32-bit length in bytes (0xffffffff for a null string), then 16-bit characters.
 void SaveFile::writeQString(const QString& s)
 {
-    if (bufferIndex > 0) flush();
-    *dataStream << s;   // Low-performance write; this method is not fast like writeIntXX and writeUIntXX.
-    numBytesWritten += 4 + 2 * s.size();  // A QString consists of a 32-bit 'string length' field plus 16-bit characters.
+    writeUInt32(s.isNull() ? 0xffffffffU : (uint32_t) (2 * s.size()));
+    for (int i = 0; i < s.size(); ++i) {
+        writeUInt16(s[i].unicode());
+    }
 }
 
 void SaveFile::writeQStringAsAsciiText(const QString& s)
 {
-    if (bufferIndex > 0) flush();
-    // Low-performance write; this method is not fast like writeIntXX and writeUIntXX.
-    dataStream->writeRawData(s.toLatin1().constData(), s.length());
-    numBytesWritten += s.size();
+    QByteArray latin1 = s.toLatin1();
+    for (int i = 0; i < latin1.size(); ++i) {
+        writeUInt8((uint8_t) latin1[i]);
+    }
 }
 
 void SaveFile::writeStringAsCharArray(const string& s)
@@ -365,6 +342,20 @@ void SaveFile::writeStringAsCharArray(const string& s)
     // Does not write 0 at end of string.
 }
 
+// Copies data that is already in file byte order, such as raw USB frames, filling each buffer completely.
+void SaveFile::writeBytes(const void* data, int64_t numBytes)
+{
+    const char* source = static_cast<const char*>(data);
+    while (numBytes > 0) {
+        if (bufferIndex >= bufferSize) flush();
+        int chunkBytes = (int) min(numBytes, (int64_t) (bufferSize - bufferIndex));
+        std::memcpy(buffer + bufferIndex, source, chunkBytes);
+        commit(chunkBytes);
+        source += chunkBytes;
+        numBytes -= chunkBytes;
+    }
+}
+
 void SaveFile::writeSignalSources(const SignalSources* signalSources)
 {
     writeInt16(signalSources->numGroups());
@@ -411,75 +402,49 @@ void SaveFile::writeSignalGroup(const SignalGroup* signalGroup)
 
 void SaveFile::close()
 {
-    if (!file) return;
+    if (!isOpen()) return;
     flush();
-    file->close();
-    if (dataStream) {
-        delete dataStream;
-        dataStream = nullptr;
-    }
-    delete file;
-    file = nullptr;
+    writer->close(bufferIndex);
 }
 
-void SaveFile::flush()
+// Return space for numBytes (no more than the buffer size) at the current write position, flushing first if necessary.
+// The caller fills the space in directly and then calls commit(), for bulk serialization without intermediate arrays.
+char* SaveFile::reserve(int numBytes)
 {
-    if (!dataStream) return;
-    dataStream->writeRawData(buffer, bufferIndex);
-    numBytesWritten += bufferIndex;
-    bufferIndex = 0;
+    if (bufferIndex > bufferSize - numBytes) flush();
+    return buffer + bufferIndex;
 }
 
-
-// For Windows 10, it appears that there's an internal buffer of 16 KB when writing to files.
-// This is most cumbersome when writing spike.dat files, which can go long periods with minimal data writing.
-// Even when flushing, if less than 16 KB of data is to be written, it doesn't appear to actually get written,
-// unless the file is closed. A flush can thus be forced by closing then reopening the file.
-void SaveFile::forceFlush()
+// Hand the filled buffer to the writer, which writes it from its own thread while this SaveFile fills the other.
+void SaveFile::flush()
 {
-    if (!file) return;
-    flush();
-    file->close();
-    if (dataStream) {
-        delete dataStream;
-        dataStream = nullptr;
-    }
-
-    if (!file->open(QIODevice::Append)) {
-        cerr << "SaveFile:: Cannot open file " << fileName.toStdString() << " for writing: " <<
-                qPrintable(file->errorString()) << '\n';
-        if (file) delete file;
-        file = nullptr;
+    if (!isOpen()) {
+        bufferIndex = 0;
+        bufferStart = 0;
         return;
     }
-    createDataStream(file);
+    numBytesWritten += bufferIndex - bufferStart;
+    bufferIndex = writer->submit(bufferIndex);
+    bufferStart = bufferIndex;
+    buffer = writer->buffer();
 }
 
-void SaveFile::openForAppend()
+// Make everything written so far visible in the file (e.g., for spike.dat files, which can go long periods with minimal
+// data writing).
+void SaveFile::forceFlush()
 {
-    if (isOpen()) return;
-
-    file = new QFile(fileName);
-    if (!file->open(QIODevice::Append)) {
-        cerr << "SaveFile: Cannot open file " << fileName.toStdString() << " for appended writing: " <<
-                qPrintable(file->errorString()) << '\n';
-        if (file) delete file;
-        file = nullptr;
-        return;
-    }
-    createDataStream(file);
+    if (!isOpen()) return;
+    flush();
+    writer->sync(bufferIndex);
 }
 
-void SaveFile::createDataStream(QFile* file_)
+void SaveFile::openForAppend()
 {
-    dataStream = new QDataStream(file_);
-
-    // Maintain bit-level compatibility with existing code.
-    dataStream->setVersion(QDataStream::Qt_5_11);
-
-    // Set to little endian mode for compatibilty with MATLAB, which is little endian on all platforms.
-    dataStream->setByteOrder(QDataStream::LittleEndian);
+    if (isOpen()) return;
 
-    // Write 4-byte floating-point numbers (instead of the default 8-byte numbers) to save disk space.
-    dataStream->setFloatingPointPrecision(QDataStream::SinglePrecision);
+    delete writer;
+    writer = new SaveFileWriter(fileName, bufferSize, true);
+    buffer = writer->buffer();
+    bufferIndex = 0;
+    bufferStart = 0;
 }
@@ -32,10 +32,9 @@
 #define SAVEFILE_H
 
 #include <QString>
-#include <QFile>
-#include <QDataStream>
 #include <vector>
 #include <string>
+#include "savefilewriter.h"
 #include "signalsources.h"
 
 using namespace std;
@@ -67,29 +66,33 @@ public:
     void writeQString(const QString& s);
     void writeQStringAsAsciiText(const QString& s);
     void writeStringAsCharArray(const string& s);
+    void writeBytes(const void* data, int64_t numBytes);
     void writeSignalSources(const SignalSources* signalSources);
     void writeSignalGroup(const SignalGroup* signalGroup);
+    char* reserve(int numBytes);
+    inline void commit(int numBytes) { bufferIndex += numBytes; }
     void close();
     void flush();
     void forceFlush();
-    bool isOpen() const { return file != nullptr; }
+    bool isOpen() const { return writer && writer->isOpen(); }
     void openForAppend();
     inline int64_t getNumBytesWritten() const { return numBytesWritten; }
     inline void resetNumBytesWritten() { numBytesWritten = 0; }
+    inline int getBufferSize() const { return bufferSize; }
+
+    static uint16_t stimWordWithAmplitude(uint16_t word, uint8_t posAmplitude, uint8_t negAmplitude);
 
 private:
     int bufferSize;
     int bufferSizeMinus4;
     int bufferSizeMinus2;
     int bufferIndex;
+    int bufferStart;    // Bytes at the start of buffer carried from the previous flush, and already counted as written
     int64_t numBytesWritten;
-    char* buffer;
+    char* buffer;       // Owned by writer
 
     QString fileName;
-    QFile* file;
-    QDataStream* dataStream;
-
-    void createDataStream(QFile* file_);
+    SaveFileWriter* writer;
 };
 
 #endif // SAVEFILE_H
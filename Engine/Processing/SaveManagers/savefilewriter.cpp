@@ -0,0 +1,391 @@
+//------------------------------------------------------------------------------
+//
+//  Intan Technologies RHX Data Acquisition Software
+//  Version 3.3.2
+//
+//  Copyright (c) 2020-2024 Intan Technologies
+//
+//  This file is part of the Intan Technologies RHX Data Acquisition Software.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published
+//  by the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//  This software is provided 'as-is', without any express or implied warranty.
+//  In no event will the authors be held liable for any damages arising from
+//  the use of this software.
+//
+//  See <http://www.intantech.com> for documentation and product information.
+//
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <thread>
+#include <vector>
+#include "savefilewriter.h"
+
+#if defined(__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+struct WriteRequest
+{
+    SaveFileWriter* writer;
+    int bufferIndex;
+    int numBytes;
+    int64_t offset;
+};
+
+// Each I/O thread takes requests for its writers in the order they are submitted.
+struct IOThread
+{
+    thread worker;
+    mutex ioMutex;
+    condition_variable requestReady;
+    bool stopping = false;
+    bool idle = false;      // Waiting for requests; submitters only notify an idle thread, so a busy thread picks up
+                            // requests queued while it was writing without any further wakeups.
+
+    // Circular queue of requests, which only allocates when more requests are outstanding than ever before.
+    vector<WriteRequest> requests;
+    int firstRequest = 0;
+    int numRequests = 0;
+
+    atomic<int64_t> bytesWritten{0};
+    atomic<int64_t> busyNsec{0};
+
+    void pushRequest(const WriteRequest& request)
+    {
+        if (numRequests == (int) requests.size()) {
+            rotate(requests.begin(), requests.begin() + firstRequest, requests.end());
+            requests.resize(max(16, 2 * (int) requests.size()));
+            firstRequest = 0;
+        }
+        requests[(firstRequest + numRequests) % requests.size()] = request;
+        ++numRequests;
+    }
+
+    WriteRequest popRequest()
+    {
+        WriteRequest request = requests[firstRequest];
+        firstRequest = (firstRequest + 1) % requests.size();
+        --numRequests;
+        return request;
+    }
+};
+
+// The pool runs while at least one writer exists.
+mutex ioLifecycleMutex;     // Serializes starting and stopping the pool, and assigning writers to its threads
+int numWriters = 0;
+IOThread ioThreads[SaveFileWriter::MaxIOThreads];
+int numIOThreads = 0;
+int requestedNumIOThreads = 1;
+int nextIOThread = 0;
+
+int64_t nowNsec()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+atomic<int64_t> statisticsStartNsec(nowNsec());
+atomic<int64_t> bytesWritten(0);
+atomic<int64_t> maxWriteNsec(0);
+atomic<int64_t> maxFlushStallNsec(0);
+atomic<int> numIOThreadsUsed(0);     // I/O threads with statistics since resetStatistics()
+
+void updateMaximum(atomic<int64_t>& maximum, int64_t value)
+{
+    int64_t current = maximum.load(memory_order_relaxed);
+    while (value > current && !maximum.compare_exchange_weak(current, value, memory_order_relaxed)) {}
+}
+
+}  // namespace
+
+SaveFileWriter::SaveFileWriter(const QString& fileName_, int bufferSize_, bool append) :
+    fileName(fileName_),
+    bufferSize(bufferSize_),
+    open(false),
+    directIO(false),
+    failed(false),
+    fileDescriptor(-1),
+    file(nullptr),
+    fileOffset(0),
+    ioThreadIndex(0),
+    fillIndex(0)
+{
+    for (int i = 0; i < 2; ++i) {
+        // Leave room after bufferSize bytes for up to DirectIOAlignment - 1 bytes carried from the previous buffer.
+        buffers[i] = new (align_val_t(DirectIOAlignment)) char [bufferSize + DirectIOAlignment];
+        writing[i] = false;
+    }
+
+#if defined(__linux__)
+    if (!append && bufferSize >= MinDirectIOBufferSize) {
+        fileDescriptor = ::open(QFile::encodeName(fileName).constData(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        directIO = fileDescriptor >= 0;  // Some file systems (e.g., tmpfs) refuse O_DIRECT; use buffered writes there.
+    }
+#endif
+    if (!directIO) {
+        // Data arrive in large buffers already, so skip QFile's own buffering.
+        file = new QFile(fileName);
+        QIODevice::OpenMode mode = (append ? QIODevice::Append : QIODevice::WriteOnly) | QIODevice::Unbuffered;
+        if (!file->open(mode)) {
+            cerr << "SaveFile: Cannot open file " << fileName.toStdString() << " for writing: " <<
+                    qPrintable(file->errorString()) << '\n';
+            delete file;
+            file = nullptr;
+            return;
+        }
+    }
+    open = true;
+    ioThreadIndex = startIOThread();
+}
+
+SaveFileWriter::~SaveFileWriter()
+{
+    close(0);
+    for (int i = 0; i < 2; ++i) {
+        operator delete[](buffers[i], align_val_t(DirectIOAlignment));
+    }
+}
+
+int SaveFileWriter::submit(int numBytes)
+{
+    int next = 1 - fillIndex;
+    int64_t stallStart = nowNsec();
+    waitForBuffer(next);
+    updateMaximum(maxFlushStallNsec, nowNsec() - stallStart);
+
+    int carry = directIO ? numBytes % DirectIOAlignment : 0;
+    std::memcpy(buffers[next], buffers[fillIndex] + numBytes - carry, carry);
+    int numBytesToWrite = numBytes - carry;
+    if (open && numBytesToWrite > 0) {
+        {
+            lock_guard<mutex> lock(writerMutex);
+            writing[fillIndex] = true;
+        }
+        IOThread& ioThread = ioThreads[ioThreadIndex];
+        bool wake;
+        {
+            lock_guard<mutex> lock(ioThread.ioMutex);
+            ioThread.pushRequest({ this, fillIndex, numBytesToWrite, fileOffset });
+            wake = ioThread.idle;
+        }
+        if (wake) ioThread.requestReady.notify_one();
+        fileOffset += numBytesToWrite;
+    }
+    fillIndex = next;
+    return carry;
+}
+
+void SaveFileWriter::sync(int numBytes)
+{
+    if (!open) return;
+    waitForAllBuffers();
+    // Carried bytes are written now so the file is complete, and rewritten with the following data by the next direct
+    // write, which starts at the same offset.
+    if (numBytes > 0) writeUnaligned(buffers[fillIndex], numBytes, fileOffset);
+    if (file) file->flush();
+}
+
+void SaveFileWriter::close(int numBytes)
+{
+    if (!open) return;
+    sync(numBytes);
+#if defined(__linux__)
+    if (fileDescriptor >= 0) {
+        ::close(fileDescriptor);
+        fileDescriptor = -1;
+    }
+#endif
+    if (file) {
+        file->close();
+        delete file;
+        file = nullptr;
+    }
+    open = false;
+    stopIOThread();
+}
+
+void SaveFileWriter::waitForBuffer(int index)
+{
+    unique_lock<mutex> lock(writerMutex);
+    writeDone.wait(lock, [this, index] { return !writing[index]; });
+}
+
+void SaveFileWriter::waitForAllBuffers()
+{
+    unique_lock<mutex> lock(writerMutex);
+    writeDone.wait(lock, [this] { return !writing[0] && !writing[1]; });
+}
+
+// Called from the I/O thread for queued buffers, and from the owning thread only once no buffers are queued.
+void SaveFileWriter::writeToDisk(const char* data, int numBytes, int64_t offset)
+{
+    if (failed) return;
+#if defined(__linux__)
+    if (fileDescriptor >= 0) {
+        while (numBytes > 0) {
+            ssize_t written = pwrite(fileDescriptor, data, numBytes, offset);
+            if (written < 0 && errno == EINTR) continue;
+            if (written < 0 && errno == EINVAL && (fcntl(fileDescriptor, F_GETFL) & O_DIRECT)) {
+                // The file system accepted O_DIRECT at open() but refuses direct writes; continue with buffered writes.
+                fcntl(fileDescriptor, F_SETFL, fcntl(fileDescriptor, F_GETFL) & ~O_DIRECT);
+                continue;
+            }
+            if (written <= 0) {
+                cerr << "SaveFile: Error writing file " << fileName.toStdString() << ": " << strerror(errno) << '\n';
+                failed = true;
+                return;
+            }
+            data += written;
+            numBytes -= (int) written;
+            offset += written;
+        }
+        return;
+    }
+#endif
+    if (file->write(data, numBytes) != numBytes) {
+        cerr << "SaveFile: Error writing file " << fileName.toStdString() << ": " << qPrintable(file->errorString()) << '\n';
+        failed = true;
+    }
+}
+
+// Write bytes that are not a whole number of direct I/O blocks by briefly turning off O_DIRECT for this file.
+void SaveFileWriter::writeUnaligned(const char* data, int numBytes, int64_t offset)
+{
+#if defined(__linux__)
+    if (fileDescriptor >= 0) {
+        int flags = fcntl(fileDescriptor, F_GETFL);
+        fcntl(fileDescriptor, F_SETFL, flags & ~O_DIRECT);
+        writeToDisk(data, numBytes, offset);
+        fcntl(fileDescriptor, F_SETFL, flags);
+        return;
+    }
+#endif
+    writeToDisk(data, numBytes, offset);
+}
+
+SaveFileWriterStatistics SaveFileWriter::statistics()
+{
+    SaveFileWriterStatistics stats;
+    stats.bytesWritten = bytesWritten.load();
+    stats.seconds = 1.0e-9 * (double) (nowNsec() - statisticsStartNsec.load());
+    stats.throughputMBPerSecond = stats.seconds > 0.0 ? (double) stats.bytesWritten / (1024.0 * 1024.0) / stats.seconds : 0.0;
+    stats.maxWriteMs = 1.0e-6 * (double) maxWriteNsec.load();
+    stats.maxFlushStallMs = 1.0e-6 * (double) maxFlushStallNsec.load();
+    for (int i = 0; i < numIOThreadsUsed.load(); ++i) {
+        SaveFileIOThreadStatistics threadStats;
+        threadStats.bytesWritten = ioThreads[i].bytesWritten.load();
+        threadStats.throughputMBPerSecond = stats.seconds > 0.0 ?
+                    (double) threadStats.bytesWritten / (1024.0 * 1024.0) / stats.seconds : 0.0;
+        threadStats.busyFraction = stats.seconds > 0.0 ? 1.0e-9 * (double) ioThreads[i].busyNsec.load() / stats.seconds : 0.0;
+        stats.ioThreads.push_back(threadStats);
+    }
+    return stats;
+}
+
+void SaveFileWriter::resetStatistics()
+{
+    statisticsStartNsec.store(nowNsec());
+    bytesWritten.store(0);
+    maxWriteNsec.store(0);
+    maxFlushStallNsec.store(0);
+    for (IOThread& ioThread : ioThreads) {
+        ioThread.bytesWritten.store(0);
+        ioThread.busyNsec.store(0);
+    }
+    lock_guard<mutex> lifecycleLock(ioLifecycleMutex);
+    numIOThreadsUsed.store(numIOThreads);
+}
+
+void SaveFileWriter::setNumIOThreads(int numThreads)
+{
+    lock_guard<mutex> lifecycleLock(ioLifecycleMutex);
+    requestedNumIOThreads = clamp(numThreads, 1, MaxIOThreads);
+}
+
+// Start the pool if this is the first writer, and return the I/O thread that will write the new writer's file.
+int SaveFileWriter::startIOThread()
+{
+    lock_guard<mutex> lifecycleLock(ioLifecycleMutex);
+    if (numWriters++ == 0) {
+        numIOThreads = requestedNumIOThreads;
+        nextIOThread = 0;
+        for (int i = 0; i < numIOThreads; ++i) {
+            ioThreads[i].stopping = false;
+            ioThreads[i].worker = thread(&SaveFileWriter::ioThreadLoop, i);
+        }
+        numIOThreadsUsed.store(max(numIOThreadsUsed.load(), numIOThreads));
+    }
+    int index = nextIOThread;
+    nextIOThread = (nextIOThread + 1) % numIOThreads;
+    return index;
+}
+
+// Every writer waits for its own buffers before closing, so no requests are left when the last writer stops the pool.
+void SaveFileWriter::stopIOThread()
+{
+    lock_guard<mutex> lifecycleLock(ioLifecycleMutex);
+    if (--numWriters > 0) return;
+    for (int i = 0; i < numIOThreads; ++i) {
+        {
+            lock_guard<mutex> lock(ioThreads[i].ioMutex);
+            ioThreads[i].stopping = true;
+        }
+        ioThreads[i].requestReady.notify_all();
+        ioThreads[i].worker.join();
+    }
+    numIOThreads = 0;
+}
+
+void SaveFileWriter::ioThreadLoop(int index)
+{
+    IOThread& ioThread = ioThreads[index];
+    unique_lock<mutex> lock(ioThread.ioMutex);
+    while (true) {
+        ioThread.idle = true;
+        ioThread.requestReady.wait(lock, [&ioThread] { return ioThread.stopping || ioThread.numRequests > 0; });
+        ioThread.idle = false;
+        if (ioThread.numRequests == 0) return;
+        WriteRequest request = ioThread.popRequest();
+        lock.unlock();
+
+        SaveFileWriter* writer = request.writer;
+        int64_t start = nowNsec();
+        writer->writeToDisk(writer->buffers[request.bufferIndex], request.numBytes, request.offset);
+        int64_t writeNsec = nowNsec() - start;
+        updateMaximum(maxWriteNsec, writeNsec);
+        bytesWritten.fetch_add(request.numBytes, memory_order_relaxed);
+        ioThread.bytesWritten.fetch_add(request.numBytes, memory_order_relaxed);
+        ioThread.busyNsec.fetch_add(writeNsec, memory_order_relaxed);
+        {
+            // Notify while holding the lock, since the writer may be destroyed as soon as its owner sees the buffer free.
+            lock_guard<mutex> writerLock(writer->writerMutex);
+            writer->writing[request.bufferIndex] = false;
+            writer->writeDone.notify_all();
+        }
+
+        lock.lock();
+    }
+}
@@ -0,0 +1,124 @@
+//------------------------------------------------------------------------------
+//
+//  Intan Technologies RHX Data Acquisition Software
+//  Version 3.3.2
+//
+//  Copyright (c) 2020-2024 Intan Technologies
+//
+//  This file is part of the Intan Technologies RHX Data Acquisition Software.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published
+//  by the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//  This software is provided 'as-is', without any express or implied warranty.
+//  In no event will the authors be held liable for any damages arising from
+//  the use of this software.
+//
+//  See <http://www.intantech.com> for documentation and product information.
+//
+//------------------------------------------------------------------------------
+
+#ifndef SAVEFILEWRITER_H
+#define SAVEFILEWRITER_H
+
+#include <QFile>
+#include <QString>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+struct SaveFileIOThreadStatistics
+{
+    int64_t bytesWritten;           // Bytes this I/O thread wrote since resetStatistics()
+    double throughputMBPerSecond;   // Those bytes over the time since resetStatistics()
+    double busyFraction;            // Fraction of that time spent writing; near 1 means the pool needs more threads
+};
+
+struct SaveFileWriterStatistics
+{
+    int64_t bytesWritten;           // Bytes written to disk since resetStatistics()
+    double seconds;                 // Time since resetStatistics()
+    double throughputMBPerSecond;   // Sustained write throughput over that time
+    double maxWriteMs;              // Longest single write to disk
+    double maxFlushStallMs;         // Longest time a SaveFile::flush() waited for the disk to free a buffer
+    vector<SaveFileIOThreadStatistics> ioThreads;   // Each I/O thread used since resetStatistics()
+};
+
+// Disk backend for SaveFile.  Each writer owns two buffers; SaveFile fills one while an I/O thread writes the other, so
+// the thread filling a SaveFile only blocks when the disk falls a whole buffer behind.  Writers are spread round-robin
+// over a pool of I/O threads (one by default; see setNumIOThreads()), and each writer's buffers are always written by
+// the same thread, in order.
+// On Linux, large-buffer files are opened with O_DIRECT so writes bypass the page cache.  Direct writes must be whole
+// multiples of DirectIOAlignment, so any remainder is carried to the start of the next buffer and written in a later
+// flush.  Other platforms, small buffers, appended files, and file systems that refuse O_DIRECT use buffered writes.
+class SaveFileWriter
+{
+public:
+    SaveFileWriter(const QString& fileName_, int bufferSize_, bool append);
+    ~SaveFileWriter();
+
+    static const int DirectIOAlignment = 4096;
+    static const int MinDirectIOBufferSize = 65536;
+
+    bool isOpen() const { return open; }
+    bool usingDirectIO() const { return directIO; }
+
+    // Buffer to fill, with room for bufferSize bytes after any carried bytes at its start.
+    char* buffer() const { return buffers[fillIndex]; }
+    // Queue the first numBytes bytes of buffer() for writing and switch to the other buffer.  Returns the number of
+    // bytes carried to the start of the new buffer.
+    int submit(int numBytes);
+    // Write everything queued plus the first numBytes bytes of buffer(), and wait until it is all on disk.
+    void sync(int numBytes);
+    void close(int numBytes);
+
+    // Process-wide statistics for monitoring disk performance.
+    static SaveFileWriterStatistics statistics();
+    static void resetStatistics();
+
+    // Size of the I/O thread pool, applied the next time the pool starts (when the first writer opens after all others
+    // have closed).
+    static constexpr int MaxIOThreads = 16;
+    static void setNumIOThreads(int numThreads);
+
+private:
+    QString fileName;
+    int bufferSize;
+    bool open;
+    bool directIO;
+    bool failed;
+    int fileDescriptor;     // Used for direct I/O
+    QFile* file;            // Used for buffered I/O
+    int64_t fileOffset;     // Where the next queued direct write starts
+    int ioThreadIndex;      // I/O thread that writes this file
+
+    char* buffers[2];
+    int fillIndex;
+    bool writing[2];        // Buffer is queued or being written by the I/O thread
+    mutex writerMutex;
+    condition_variable writeDone;
+
+    void waitForBuffer(int index);
+    void waitForAllBuffers();
+    void writeToDisk(const char* data, int numBytes, int64_t offset);
+    void writeUnaligned(const char* data, int numBytes, int64_t offset);
+
+    static int startIOThread();
+    static void stopIOThread();
+    static void ioThreadLoop(int index);
+};
+
+#endif // SAVEFILEWRITER_H
@@ -373,11 +373,13 @@ void SaveManager::getAllWaveformPointers()
     amplifierGPUWaveform.resize(saveList.amplifier.size());
     amplifierLowpassGPUWaveform.resize(saveList.amplifier.size());
     amplifierHighpassGPUWaveform.resize(saveList.amplifier.size());
+    amplifierLfpGPUWaveform.resize(saveList.amplifier.size());
     spikeWaveform.resize(saveList.amplifier.size());
     for (int i = 0; i < (int) saveList.amplifier.size(); ++i) {
         amplifierGPUWaveform[i] = waveformFifo->getGpuWaveformAddress(saveList.amplifier[i] + "|WIDE");
         amplifierLowpassGPUWaveform[i] = waveformFifo->getGpuWaveformAddress(saveList.amplifier[i] + "|LOW");
         amplifierHighpassGPUWaveform[i] = waveformFifo->getGpuWaveformAddress(saveList.amplifier[i] + "|HIGH");
+        amplifierLfpGPUWaveform[i] = waveformFifo->getGpuWaveformAddress(saveList.amplifier[i] + "|LFP");
         spikeWaveform[i] = waveformFifo->getDigitalWaveformPointer(saveList.amplifier[i] + "|SPK");
     }
 
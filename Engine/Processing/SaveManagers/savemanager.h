@@ -69,6 +69,7 @@ protected:
     vector<GpuWaveformAddress> amplifierGPUWaveform;
     vector<GpuWaveformAddress> amplifierLowpassGPUWaveform;
     vector<GpuWaveformAddress> amplifierHighpassGPUWaveform;
+    vector<GpuWaveformAddress> amplifierLfpGPUWaveform;
     vector<float*> dcAmplifierWaveform;
     vector<uint16_t*> spikeWaveform;
     vector<uint16_t*> stimFlagsWaveform;
@@ -28,6 +28,7 @@
 //
 //------------------------------------------------------------------------------
 
+#include <algorithm>
 #include "xpucontroller.h"
 
 AbstractXPUInterface::AbstractXPUInterface(SystemState* state_, QObject *parent) :
@@ -53,6 +54,7 @@ AbstractXPUInterface::AbstractXPUInterface(SystemState* state_, QObject *parent)
         channelsPerStream = 16;
     }
     sampleRate = state->sampleRate->getNumericValue();
+    setActiveChannels(vector<bool>(channels, true));
 }
 
 void AbstractXPUInterface::resetPrev()
@@ -94,6 +96,13 @@ void AbstractXPUInterface::updateNumStreams(int numStreams_)
     totalSnippetsPerBlock = numStreams * channelsPerStream * SnippetsPerBlock;
     totalSamplesPerBlock = channels * FramesPerBlock;
 
+    // Every channel is active until updateFromState() reads which channels are enabled.
+    activeChannels.clear();
+    inactiveChannels.clear();
+    for (int c = 0; c < channels; ++c) {
+        activeChannels.push_back(c);
+    }
+
     // Update global parameters to reflect new number.
     globalParameters.numStreams = numStreams;
     globalParameters.wordsPerFrame = wordsPerFrame;
@@ -103,6 +112,25 @@ void AbstractXPUInterface::updateNumStreams(int numStreams_)
     updateMemory();
 }
 
+// Process numBlocks consecutive data blocks.  Outputs for each block follow those of the previous
+// block, so filter state and the spike detector's look-back into the previous block's high-pass output
+// carry across block boundaries exactly as they do when blocks are processed one call at a time.  lowChunk
+// and highChunk may be nullptr if the caller is not storing that band.
+bool AbstractXPUInterface::processDataBlocks(uint16_t* data, uint16_t* lowChunk, uint16_t* wideChunk, uint16_t* highChunk,
+                                             uint32_t* spikeChunk, uint8_t* spikeIDChunk, int numBlocks)
+{
+    for (int block = 0; block < numBlocks; ++block) {
+        if (!processDataBlock(data, lowChunk, wideChunk, highChunk, spikeChunk, spikeIDChunk)) return false;
+        data += wordsPerBlock;
+        if (lowChunk) lowChunk += FramesPerBlock * channels;
+        wideChunk += FramesPerBlock * channels;
+        if (highChunk) highChunk += FramesPerBlock * channels;
+        spikeChunk += SnippetsPerBlock * channels;
+        spikeIDChunk += SnippetsPerBlock * channels;
+    }
+    return true;
+}
+
 void AbstractXPUInterface::runDiagnostic(int XPUIndex)
 { 
     uint16_t* dataOriginal = new uint16_t[DiagnosticBlocks * wordsPerBlock];
@@ -127,9 +155,10 @@ void AbstractXPUInterface::runDiagnostic(int XPUIndex)
     uint32_t* spike_ = spike;
     uint8_t* spikeIDs_ = spikeIDs;
 
+    bool processed = true;
     auto start = std::chrono::steady_clock::now();
-    for (int block = 0; block < DiagnosticBlocks; block++) {
-        processDataBlock(data_, low_, wide_, high_, spike_, spikeIDs_);
+    for (int block = 0; block < DiagnosticBlocks && processed; block++) {
+        processed = processDataBlock(data_, low_, wide_, high_, spike_, spikeIDs_);
         data_ += wordsPerBlock;
         low_ += FramesPerBlock * channels;
         wide_ += FramesPerBlock * channels;
@@ -139,15 +168,31 @@ void AbstractXPUInterface::runDiagnostic(int XPUIndex)
     }
     auto end = std::chrono::steady_clock::now();
 
+    // Run the same blocks again in the largest batches WaveformProcessorThread uses, which lets an XPU overlap
+    // transfers with processing.
+    auto batchedStart = std::chrono::steady_clock::now();
+    for (int block = 0; block < DiagnosticBlocks && processed; block += MaxNumBlocksToProcess) {
+        int numBlocks = std::min(MaxNumBlocksToProcess, DiagnosticBlocks - block);
+        processed = processDataBlocks(dataOriginal + block * wordsPerBlock, lowOriginal + block * FramesPerBlock * channels,
+                                      wideOriginal + block * FramesPerBlock * channels, highOriginal + block * FramesPerBlock * channels,
+                                      spike + block * SnippetsPerBlock * channels, spikeIDs + block * SnippetsPerBlock * channels, numBlocks);
+    }
+    auto batchedEnd = std::chrono::steady_clock::now();
+
     delete [] dataOriginal;
     delete [] lowOriginal;
     delete [] wideOriginal;
     delete [] highOriginal;
 
+    if (!processed) {
+        state->writeToLog("Diagnostic processing failed: " + processingError);
+    }
+
     float elapsedMs = (float) std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-    if (XPUIndex == 0) state->cpuInfo.diagnosticTime = elapsedMs;
-    else state->gpuList[XPUIndex - 1].diagnosticTime = elapsedMs;
-    qDebug() << "Elapsed time: " << elapsedMs << " ms\n";
+    float batchedElapsedMs = (float) std::chrono::duration_cast<std::chrono::milliseconds>(batchedEnd - batchedStart).count();
+    CPUInfo& info = (XPUIndex == 0) ? state->cpuInfo : state->gpuList[XPUIndex - 1];
+    info.diagnosticTime = elapsedMs;
+    info.batchedDiagnosticTime = batchedElapsedMs;
 }
 
 void AbstractXPUInterface::updateFilters()
@@ -254,12 +299,16 @@ void AbstractXPUInterface::updateFromState()
     updateFilters();
 
     // If any AmplifierSignal spikeThresholds have changed, update value in 'hoops' to inform XPU
+    // Also note which channels are enabled, so that disabled channels are not processed.
     vector<string> ampChannelNames = state->signalSources->amplifierChannelsNameList();
+    vector<bool> enabled(channels, false);
     for (auto name : ampChannelNames) {
         int channelIndex = state->getSerialIndex(QString::fromStdString(name));
         Channel* thisChannel = state->signalSources->channelByName(QString::fromStdString(name));
         hoops[channelIndex].threshold = thisChannel->getSpikeThreshold();
+        if (channelIndex < channels) enabled[channelIndex] = thisChannel->isEnabled();
     }
+    setActiveChannels(enabled);
 
     // If spikeMax or suppressionEnabled have changed, update them.
     if (globalParameters.spikeMax != state->suppressionThreshold->getValue())
@@ -279,6 +328,51 @@ void AbstractXPUInterface::updateHoopsVariables()
 {
 }
 
+void AbstractXPUInterface::setActiveChannels(const vector<bool>& enabled)
+{
+    vector<bool> wasActive(channels, false);
+    for (int c : activeChannels) {
+        if (c < channels) wasActive[c] = true;
+    }
+
+    vector<int> active, inactive, newlyActive;
+    for (int c = 0; c < (int) enabled.size(); ++c) {
+        if (enabled[c]) {
+            active.push_back(c);
+            if (!wasActive[c]) newlyActive.push_back(c);
+        } else {
+            inactive.push_back(c);
+        }
+    }
+    if (active == activeChannels) return;
+
+    activeChannels.swap(active);
+    inactiveChannels.swap(inactive);
+    updateActiveChannels(newlyActive);
+}
+
+// Channels that are enabled again start filtering from silence rather than from the state they were disabled with.
+// Reimplemented by GPUInterface, which also uploads the new channel list.
+void AbstractXPUInterface::updateActiveChannels(const vector<int>& newlyActive)
+{
+    if (!allocated) return;
+    for (int c : newlyActive) {
+        fill(prevLast2 + c * 20, prevLast2 + (c + 1) * 20, 0.0f);
+        startSearchPos[c] = 0;
+    }
+}
+
+// Mark every disabled channel as having no spikes in one block of spike detector output.
+void AbstractXPUInterface::clearInactiveSpikes(uint32_t* spikeChunk, uint8_t* spikeIDChunk) const
+{
+    for (int c : inactiveChannels) {
+        for (int s = 0; s < SnippetsPerBlock; ++s) {
+            spikeChunk[s * channels + c] = 0;
+            spikeIDChunk[s * channels + c] = 0;
+        }
+    }
+}
+
 // Default impementation - do nothing (should only be reimplemented by GPUInterface)
 void AbstractXPUInterface::updateFilterConstArray()
 {
@@ -99,31 +99,39 @@ class AbstractXPUInterface : public QObject
 public:
     explicit AbstractXPUInterface(SystemState* state_, QObject *parent = nullptr);
 
-    void resetPrev();
-    virtual void processDataBlock(uint16_t* data, uint16_t* lowChunk, uint16_t* wideChunk,
+    virtual void resetPrev();
+    // Return false if the data could not be processed; processingErrorMessage() then describes the failure.
+    virtual bool processDataBlock(uint16_t* data, uint16_t* lowChunk, uint16_t* wideChunk,
                                   uint16_t* highChunk, uint32_t* spikeChunk, uint8_t* spikeIDChunk) = 0;
+    virtual bool processDataBlocks(uint16_t* data, uint16_t* lowChunk, uint16_t* wideChunk, uint16_t* highChunk,
+                                   uint32_t* spikeChunk, uint8_t* spikeIDChunk, int numBlocks);
+    QString processingErrorMessage() const { return processingError; }
     void updateNumStreams(int numStreams_);
     void updateFromState();
     virtual void speedTest() = 0;
     virtual bool setupMemory() = 0;
     virtual bool cleanupMemory() = 0;
 
+    static const int DiagnosticBlocks = 300;
+
 protected:
     virtual void updateMemory();
     void runDiagnostic(int XPUIndex);
     void updateFilters();
     virtual void updateHoopsVariables();
+    virtual void updateActiveChannels(const vector<int>& newlyActive);
+    void clearInactiveSpikes(uint32_t* spikeChunk, uint8_t* spikeIDChunk) const;
     virtual void updateFilterConstArray();
     virtual void updateConstChars();
     virtual void updateConstFloats();
     mutex filterMutex;
+    QString processingError;
 
     bool allocated;
     double sampleRate;
     SystemState* state;
     int numStreams;
     ControllerType type;
-    static const int DiagnosticBlocks = 300;
     const int SnippetsPerBlock = (int) (ceil((double) FramesPerBlock / (double) SnippetSize) + 1.0);
     int totalSnippetsPerBlock;
     int wordsPerFrame;
@@ -140,11 +148,17 @@ protected:
     uint16_t* startSearchPos;
     ChannelHoopsStruct* hoops;
 
+    // USB amplifier channel indices that are enabled, in ascending order, and those that are not.  Only enabled
+    // channels are filtered and spike-detected; outputs for the others are left as they were, with no spikes.
+    vector<int> activeChannels;
+    vector<int> inactiveChannels;
+
     uint16_t* parsedPrevHighOriginal;
     uint16_t* parsedPrevHigh;
     uint64_t* inputIndex, outputIndex, spikeIndex;
 
 private:
+    void setActiveChannels(const vector<bool>& enabled);
     void calculateNotchConstants();
     void calculateLowConstants();
     void calculateHighConstants();
@@ -28,520 +28,795 @@
 //
 //------------------------------------------------------------------------------
 
+#include <algorithm>
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RHX_FILTER_SSE2
+#endif
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RHX_FILTER_AVX
+#endif
 #include "cpuinterface.h"
 
-CPUInterface::CPUInterface(SystemState *state_, QObject *parent) :
-    AbstractXPUInterface(state_, parent)
+// Filter state and waveforms are laid out channel-major: each row holds one sample of FilterLanes adjacent channels,
+// so one vector instruction advances the filter of several channels by one sample.
+const int FilterLanes = 16;
+// Two rows of history from the previous data block, followed by this block's samples.
+const int FilterRows = FramesPerBlock + 2;
+
+namespace {
+
+// One biquad stage across FilterLanes channels.  x and y point to the first history row; the operations are performed
+// in the same order as the original per-channel scalar code so results are bit-identical on every path.
+void biquadScalar(const float* x, float* y, const FilterIterationParamStruct& p)
 {
-    updateFromState();
+    for (int row = 2; row < FilterRows; ++row) {
+        const float* x0 = x + row * FilterLanes;
+        float* y0 = y + row * FilterLanes;
+        for (int lane = 0; lane < FilterLanes; ++lane) {
+            y0[lane] = p.b2 * x0[lane - 2 * FilterLanes] + p.b1 * x0[lane - FilterLanes] + p.b0 * x0[lane] -
+                    p.a2 * y0[lane - 2 * FilterLanes] - p.a1 * y0[lane - FilterLanes];
+        }
+    }
 }
 
-CPUInterface::~CPUInterface()
+// Clamp filtered samples to +/-6389 uV and convert them to offset-binary words, writing 'lanes' adjacent channels of
+// each sample to dest (rows destStride words apart).
+void convertOutputScalar(const float* src, uint16_t* dest, int destStride, int lanes)
 {
-    if (allocated) {
-        freeMemory();
+    for (int s = 0; s < FramesPerBlock; ++s) {
+        for (int lane = 0; lane < lanes; ++lane) {
+            float value = src[s * FilterLanes + lane];
+            if (value > 6389.0f) value = 6389.0f;
+            else if (value < -6389.0f) value = -6389.0f;
+            dest[s * destStride + lane] = (uint16_t) round((value / 0.195f) + 32768);
+        }
     }
 }
 
-void CPUInterface::processDataBlock(uint16_t * data, uint16_t *lowChunk, uint16_t *wideChunk, uint16_t *highChunk,
-                                    uint32_t *spikeChunk, uint8_t *spikeIDChunk)
+#ifdef RHX_FILTER_SSE2
+void biquadSSE2(const float* x, float* y, const FilterIterationParamStruct& p)
 {
-    lock_guard<mutex> lockFilter(filterMutex);
+    const __m128 b2 = _mm_set1_ps(p.b2);
+    const __m128 b1 = _mm_set1_ps(p.b1);
+    const __m128 b0 = _mm_set1_ps(p.b0);
+    const __m128 a2 = _mm_set1_ps(p.a2);
+    const __m128 a1 = _mm_set1_ps(p.a1);
+    for (int row = 2; row < FilterRows; ++row) {
+        const float* x0 = x + row * FilterLanes;
+        float* y0 = y + row * FilterLanes;
+        for (int lane = 0; lane < FilterLanes; lane += 4) {
+            __m128 sum = _mm_mul_ps(b2, _mm_loadu_ps(x0 + lane - 2 * FilterLanes));
+            sum = _mm_add_ps(sum, _mm_mul_ps(b1, _mm_loadu_ps(x0 + lane - FilterLanes)));
+            sum = _mm_add_ps(sum, _mm_mul_ps(b0, _mm_loadu_ps(x0 + lane)));
+            sum = _mm_sub_ps(sum, _mm_mul_ps(a2, _mm_loadu_ps(y0 + lane - 2 * FilterLanes)));
+            sum = _mm_sub_ps(sum, _mm_mul_ps(a1, _mm_loadu_ps(y0 + lane - FilterLanes)));
+            _mm_storeu_ps(y0 + lane, sum);
+        }
+    }
+}
+
+// round() rounds halfway cases away from zero, while the SSE conversions round them to even.  Since every clamped
+// value is positive, truncate and add one where the discarded fraction is at least one half instead.
+inline __m128i roundOutputSSE2(__m128 value)
+{
+    const __m128 limit = _mm_set1_ps(6389.0f);
+    const __m128 negLimit = _mm_set1_ps(-6389.0f);
+    value = _mm_min_ps(_mm_max_ps(value, negLimit), limit);
+    value = _mm_add_ps(_mm_div_ps(value, _mm_set1_ps(0.195f)), _mm_set1_ps(32768.0f));
+    __m128i truncated = _mm_cvttps_epi32(value);
+    __m128 fraction = _mm_sub_ps(value, _mm_cvtepi32_ps(truncated));
+    __m128i roundUp = _mm_castps_si128(_mm_cmpge_ps(fraction, _mm_set1_ps(0.5f)));
+    return _mm_sub_epi32(truncated, roundUp);
+}
 
-    if (channels == 0)
+void convertOutputSSE2(const float* src, uint16_t* dest, int destStride, int lanes)
+{
+    if (lanes < FilterLanes) {
+        convertOutputScalar(src, dest, destStride, lanes);
         return;
+    }
+    // Words are packed with signed saturation, so shift them to two's complement and back.
+    const __m128i offset = _mm_set1_epi32(32768);
+    const __m128i signBit = _mm_set1_epi16((short) 0x8000);
+    for (int s = 0; s < FramesPerBlock; ++s) {
+        for (int lane = 0; lane < FilterLanes; lane += 8) {
+            __m128i low = _mm_sub_epi32(roundOutputSSE2(_mm_loadu_ps(src + s * FilterLanes + lane)), offset);
+            __m128i high = _mm_sub_epi32(roundOutputSSE2(_mm_loadu_ps(src + s * FilterLanes + lane + 4)), offset);
+            _mm_storeu_si128((__m128i*) (dest + s * destStride + lane),
+                             _mm_xor_si128(_mm_packs_epi32(low, high), signBit));
+        }
+    }
+}
+#endif
+
+#ifdef RHX_FILTER_AVX
+__attribute__((target("avx2")))
+void biquadAVX2(const float* x, float* y, const FilterIterationParamStruct& p)
+{
+    const __m256 b2 = _mm256_set1_ps(p.b2);
+    const __m256 b1 = _mm256_set1_ps(p.b1);
+    const __m256 b0 = _mm256_set1_ps(p.b0);
+    const __m256 a2 = _mm256_set1_ps(p.a2);
+    const __m256 a1 = _mm256_set1_ps(p.a1);
+    for (int row = 2; row < FilterRows; ++row) {
+        const float* x0 = x + row * FilterLanes;
+        float* y0 = y + row * FilterLanes;
+        for (int lane = 0; lane < FilterLanes; lane += 8) {
+            __m256 sum = _mm256_mul_ps(b2, _mm256_loadu_ps(x0 + lane - 2 * FilterLanes));
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(b1, _mm256_loadu_ps(x0 + lane - FilterLanes)));
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(b0, _mm256_loadu_ps(x0 + lane)));
+            sum = _mm256_sub_ps(sum, _mm256_mul_ps(a2, _mm256_loadu_ps(y0 + lane - 2 * FilterLanes)));
+            sum = _mm256_sub_ps(sum, _mm256_mul_ps(a1, _mm256_loadu_ps(y0 + lane - FilterLanes)));
+            _mm256_storeu_ps(y0 + lane, sum);
+        }
+    }
+}
 
-    uint16_t* rawBlock = data;
+__attribute__((target("avx2")))
+inline __m256i roundOutputAVX2(__m256 value)
+{
+    const __m256 limit = _mm256_set1_ps(6389.0f);
+    const __m256 negLimit = _mm256_set1_ps(-6389.0f);
+    value = _mm256_min_ps(_mm256_max_ps(value, negLimit), limit);
+    value = _mm256_add_ps(_mm256_div_ps(value, _mm256_set1_ps(0.195f)), _mm256_set1_ps(32768.0f));
+    __m256i truncated = _mm256_cvttps_epi32(value);
+    __m256 fraction = _mm256_sub_ps(value, _mm256_cvtepi32_ps(truncated));
+    __m256i roundUp = _mm256_castps_si256(_mm256_cmp_ps(fraction, _mm256_set1_ps(0.5f), _CMP_GE_OQ));
+    return _mm256_sub_epi32(truncated, roundUp);
+}
 
-    float samplePeriod = 1.0f / sampleRate;
+__attribute__((target("avx2")))
+void convertOutputAVX2(const float* src, uint16_t* dest, int destStride, int lanes)
+{
+    if (lanes < FilterLanes) {
+        convertOutputScalar(src, dest, destStride, lanes);
+        return;
+    }
+    const __m256i offset = _mm256_set1_epi32(32768);
+    const __m256i signBit = _mm256_set1_epi16((short) 0x8000);
+    for (int s = 0; s < FramesPerBlock; ++s) {
+        __m256i low = _mm256_sub_epi32(roundOutputAVX2(_mm256_loadu_ps(src + s * FilterLanes)), offset);
+        __m256i high = _mm256_sub_epi32(roundOutputAVX2(_mm256_loadu_ps(src + s * FilterLanes + 8)), offset);
+        // _mm256_packs_epi32 packs within 128-bit lanes; restore sample order before storing.
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xd8);
+        _mm256_storeu_si256((__m256i*) (dest + s * destStride), _mm256_xor_si256(packed, signBit));
+    }
+}
 
-    float notchB2 = filterParameters.notchParams.b2;
-    float notchB1 = filterParameters.notchParams.b1;
-    float notchB0 = filterParameters.notchParams.b0;
-    float notchA2 = filterParameters.notchParams.a2;
-    float notchA1 = filterParameters.notchParams.a1;
-
-    float lowB2[4];
-    float lowB1[4];
-    float lowB0[4];
-    float lowA2[4];
-    float lowA1[4];
-
-    for (uint8_t filterIndex = 0; filterIndex < 4; ++filterIndex) {
-        lowB2[filterIndex] = filterParameters.lowParams[filterIndex].b2;
-        lowB1[filterIndex] = filterParameters.lowParams[filterIndex].b1;
-        lowB0[filterIndex] = filterParameters.lowParams[filterIndex].b0;
-        lowA2[filterIndex] = filterParameters.lowParams[filterIndex].a2;
-        lowA1[filterIndex] = filterParameters.lowParams[filterIndex].a1;
+__attribute__((target("avx512f")))
+void biquadAVX512(const float* x, float* y, const FilterIterationParamStruct& p)
+{
+    const __m512 b2 = _mm512_set1_ps(p.b2);
+    const __m512 b1 = _mm512_set1_ps(p.b1);
+    const __m512 b0 = _mm512_set1_ps(p.b0);
+    const __m512 a2 = _mm512_set1_ps(p.a2);
+    const __m512 a1 = _mm512_set1_ps(p.a1);
+    for (int row = 2; row < FilterRows; ++row) {
+        const float* x0 = x + row * FilterLanes;
+        float* y0 = y + row * FilterLanes;
+        // Explicit rounding keeps the compiler from contracting these into fused multiply-adds, which would change
+        // the results.
+        const int rounding = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+        __m512 sum = _mm512_mul_round_ps(b2, _mm512_loadu_ps(x0 - 2 * FilterLanes), rounding);
+        sum = _mm512_add_round_ps(sum, _mm512_mul_round_ps(b1, _mm512_loadu_ps(x0 - FilterLanes), rounding), rounding);
+        sum = _mm512_add_round_ps(sum, _mm512_mul_round_ps(b0, _mm512_loadu_ps(x0), rounding), rounding);
+        sum = _mm512_sub_round_ps(sum, _mm512_mul_round_ps(a2, _mm512_loadu_ps(y0 - 2 * FilterLanes), rounding),
+                                  rounding);
+        sum = _mm512_sub_round_ps(sum, _mm512_mul_round_ps(a1, _mm512_loadu_ps(y0 - FilterLanes), rounding), rounding);
+        _mm512_storeu_ps(y0, sum);
     }
+}
 
-    float highB2[4];
-    float highB1[4];
-    float highB0[4];
-    float highA2[4];
-    float highA1[4];
-
-    for (uint8_t filterIndex = 0; filterIndex < 4; ++filterIndex) {
-        highB2[filterIndex] = filterParameters.highParams[filterIndex].b2;
-        highB1[filterIndex] = filterParameters.highParams[filterIndex].b1;
-        highB0[filterIndex] = filterParameters.highParams[filterIndex].b0;
-        highA2[filterIndex] = filterParameters.highParams[filterIndex].a2;
-        highA1[filterIndex] = filterParameters.highParams[filterIndex].a1;
+__attribute__((target("avx512f")))
+void convertOutputAVX512(const float* src, uint16_t* dest, int destStride, int lanes)
+{
+    if (lanes < FilterLanes) {
+        convertOutputScalar(src, dest, destStride, lanes);
+        return;
+    }
+    const __m512 limit = _mm512_set1_ps(6389.0f);
+    const __m512 negLimit = _mm512_set1_ps(-6389.0f);
+    const __m512 scale = _mm512_set1_ps(0.195f);
+    const __m512 offset = _mm512_set1_ps(32768.0f);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512i one = _mm512_set1_epi32(1);
+    for (int s = 0; s < FramesPerBlock; ++s) {
+        __m512 value = _mm512_min_ps(_mm512_max_ps(_mm512_loadu_ps(src + s * FilterLanes), negLimit), limit);
+        value = _mm512_add_ps(_mm512_div_ps(value, scale), offset);
+        __m512i truncated = _mm512_cvttps_epi32(value);
+        __m512 fraction = _mm512_sub_ps(value, _mm512_cvtepi32_ps(truncated));
+        __mmask16 roundUp = _mm512_cmp_ps_mask(fraction, half, _CMP_GE_OQ);
+        __m512i rounded = _mm512_mask_add_epi32(truncated, roundUp, truncated, one);
+        _mm256_storeu_si256((__m256i*) (dest + s * destStride), _mm512_cvtepi32_epi16(rounded));
     }
+}
+#endif
 
-    const unsigned int snippetsPerBlock = (int) ceil((double) ((double) FramesPerBlock / (double) SnippetSize) + 1.0);
+struct FilterKernels
+{
+    void (*biquad)(const float*, float*, const FilterIterationParamStruct&);
+    void (*convertOutput)(const float*, uint16_t*, int, int);
+};
 
-    float inFloat[FramesPerBlock];
-    float prevHighFloat[FramesPerBlock];
-    float lowFloat[4][FramesPerBlock];
-    float wideFloat[FramesPerBlock];
-    float highFloat[4][FramesPerBlock];
-
-    for (int a = 0; a < FramesPerBlock; ++a) {
-        inFloat[a] = 0.0f;
-        prevHighFloat[a] = 0.0f;
-        wideFloat[a] = 0.0f;
-        for (int b = 0; b < 4; ++b) {
-            lowFloat[b][a] = 0.0f;
-            highFloat[b][a] = 0.0f;
+// Select the widest kernels this CPU supports.
+FilterKernels selectFilterKernels()
+{
+#ifdef RHX_FILTER_AVX
+    if (__builtin_cpu_supports("avx512f")) return { biquadAVX512, convertOutputAVX512 };
+    if (__builtin_cpu_supports("avx2")) return { biquadAVX2, convertOutputAVX2 };
+#endif
+#ifdef RHX_FILTER_SSE2
+    return { biquadSSE2, convertOutputSSE2 };
+#else
+    return { biquadScalar, convertOutputScalar };
+#endif
+}
+
+// Convert one group's filtered samples to uint16_t and write each lane to its own channel's column of dest.
+void storeScattered(const FilterKernels& kernels, const float* src, uint16_t* dest, int destStride, const int* laneChannel,
+                    int lanes)
+{
+    alignas(64) uint16_t converted[FramesPerBlock * FilterLanes];
+    kernels.convertOutput(src, converted, FilterLanes, lanes);
+    for (int s = 0; s < FramesPerBlock; ++s) {
+        for (int lane = 0; lane < lanes; ++lane) {
+            dest[s * destStride + laneChannel[lane]] = converted[s * FilterLanes + lane];
         }
     }
+}
 
-    uint32_t low2ndToLastIndex[4];
-    uint32_t lowLastIndex[4];
-    uint32_t high2ndToLastIndex[4];
-    uint32_t highLastIndex[4];
+// Bind the calling thread to one logical processor.  macOS offers no way to do this, so there threads stay unbound.
+void pinCurrentThread(int processor)
+{
+#if defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), ((DWORD_PTR) 1) << (processor % (8 * sizeof(DWORD_PTR))));
+#elif defined(__linux__)
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(processor, &cpuSet);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+#else
+    (void) processor;
+#endif
+}
 
-    uint32_t outIndex;
-    uint32_t s;
+}
 
-    float low2ndToLast[4];
-    float lowLast[4];
-    float high2ndToLast[4];
-    float highLast[4];
+CPUInterface::CPUInterface(SystemState *state_, QObject *parent) :
+    AbstractXPUInterface(state_, parent),
+    requestedNumThreads(0),
+    requestedPinThreads(false),
+    numThreads(1),
+    pinThreads(false),
+    workGeneration(0),
+    activeRanges(0),
+    rangesRemaining(0),
+    stoppingWorkers(false)
+{
+    updateFromState();
+}
 
-    for (int channelIndex = 0; channelIndex < channels; channelIndex++) {
-        uint32_t lastDataStart = channelIndex * 20;
+CPUInterface::~CPUInterface()
+{
+    stopWorkers();
+    if (allocated) {
+        freeMemory();
+    }
+}
 
-        for (int i = 0; i < 4; ++i) {
-            low2ndToLastIndex[i] = lastDataStart + i;
-            lowLastIndex[i] = lastDataStart + 4 + i;
-            high2ndToLastIndex[i] = lastDataStart + 8 + i;
-            highLastIndex[i] = lastDataStart + 12 + i;
-        }
-        uint32_t in2ndToLastIndex = lastDataStart + 16;
-        uint32_t inLastIndex = lastDataStart + 17;
-        uint32_t wide2ndToLastIndex = lastDataStart + 18;
-        uint32_t wideLastIndex = lastDataStart + 19;
-
-        int32_t snippetIndex = 0;
-
-        for (int i = 0; i < 4; ++i) {
-            low2ndToLast[i] = prevLast2[low2ndToLastIndex[i]];
-            lowLast[i] = prevLast2[lowLastIndex[i]];
-            high2ndToLast[i] = prevLast2[high2ndToLastIndex[i]];
-            highLast[i] = prevLast2[highLastIndex[i]];
-        }
+// Set the number of threads that filter channels in parallel (0 selects one per physical core), and whether worker
+// threads are bound to their own logical processors.  Takes effect with the next data block processed.
+void CPUInterface::setThreading(int numThreads_, bool pinThreads_)
+{
+    requestedNumThreads = numThreads_;
+    requestedPinThreads = pinThreads_;
+}
 
-        float in2ndToLast = prevLast2[in2ndToLastIndex];
-        float inLast = prevLast2[inLastIndex];
-        float wide2ndToLast = prevLast2[wide2ndToLastIndex];
-        float wideLast = prevLast2[wideLastIndex];
-        float threshold = hoops[channelIndex].threshold;
-        bool useHoops = (hoops[channelIndex].useHoops == 1) ? true : false;
+bool CPUInterface::processDataBlock(uint16_t * data, uint16_t *lowChunk, uint16_t *wideChunk, uint16_t *highChunk,
+                                    uint32_t *spikeChunk, uint8_t *spikeIDChunk)
+{
+    return processDataBlocks(data, lowChunk, wideChunk, highChunk, spikeChunk, spikeIDChunk, 1);
+}
 
-        for (s = 0; s < snippetsPerBlock; ++s) {
-            spikeChunk[s * channels + channelIndex] = 0;
-            spikeIDChunk[s * channels + channelIndex] = 0;
-        }
+// Channels are independent, so each thread filters its own range of channels through every block of the batch, and
+// the threads only meet once at the end of the batch.
+bool CPUInterface::processDataBlocks(uint16_t *data, uint16_t *lowChunk, uint16_t *wideChunk, uint16_t *highChunk,
+                                     uint32_t *spikeChunk, uint8_t *spikeIDChunk, int numBlocks)
+{
+    lock_guard<mutex> lockFilter(filterMutex);
 
-        for (s = 0; s < SnippetSize; ++s) {
-            prevHighFloat[s] = (float) (0.195f * (((double)parsedPrevHigh[s * channels + channelIndex]) - 32768));
-        }
+    if (channels == 0 || numBlocks <= 0)
+        return true;
 
-        int32_t inIndexStream, inIndexChannel;
-        if (type == ControllerRecordUSB2 || type == ControllerRecordUSB3) {
-            inIndexStream = channelIndex / 32;
-            inIndexChannel = channelIndex % 32;
-        } else {
-            inIndexStream = channelIndex / 16;
-            inIndexChannel = channelIndex % 16;
-        }
+    int wantedThreads = requestedNumThreads;
+    if (wantedThreads <= 0) wantedThreads = max(1, (int) thread::hardware_concurrency() / 2);
+    if (wantedThreads != numThreads || requestedPinThreads != pinThreads) {
+        stopWorkers();
+        numThreads = wantedThreads;
+        pinThreads = requestedPinThreads;
+        startWorkers();
+    }
 
-        // (0) Index this channel's input data from the rawBlock and convert it to float.
-        for (int frame = 0; frame < FramesPerBlock; ++frame) {
-            uint16_t acSample;
-            if (type == ControllerStimRecord) {
-                acSample = rawBlock[wordsPerFrame * frame + 6 + (numStreams * 3 * 2) +
-                        (inIndexChannel * numStreams * 2) + (2 * inIndexStream + 1)];
-            } else {
-                acSample = rawBlock[wordsPerFrame * frame + 6 + (numStreams * 3) +
-                        inIndexChannel * numStreams + inIndexStream];
+    // Spike detection always needs the high-pass output of the previous block, so if the caller is not storing the
+    // high-pass band it is written to scratch memory instead.
+    if (!highChunk) {
+        size_t scratchSize = (size_t) numBlocks * FramesPerBlock * channels;
+        if (highScratch.size() < scratchSize) {
+            // Growing the scratch memory may move it, so keep a copy of any tail it holds for the first block.
+            if (parsedPrevHigh != parsedPrevHighOriginal) {
+                copy(parsedPrevHigh, parsedPrevHigh + SnippetSize * channels, parsedPrevHighOriginal);
+                parsedPrevHigh = parsedPrevHighOriginal;
             }
-            inFloat[frame] = (float)(0.195f * (((double)acSample) - 32768));
+            highScratch.resize(scratchSize);
         }
+        highChunk = highScratch.data();
+    }
 
-        int numLowFilterIterations = floor((float)(filterParameters.lowOrder - 1) / 2.0f) + 1;
-        int numHighFilterIterations = floor((float)(filterParameters.highOrder - 1) / 2.0f) + 1;
+    BlockBatch batch = { data, lowChunk, wideChunk, highChunk, spikeChunk, spikeIDChunk, numBlocks, parsedPrevHigh };
+
+    int numActive = (int) activeChannels.size();
+    int numRanges = min(numThreads, (numActive + FilterLanes - 1) / FilterLanes);
+    if (numRanges <= 1) {
+        processChannels(0, numActive, batch);
+    } else {
+        {
+            lock_guard<mutex> lock(workMutex);
+            currentBatch = batch;
+            activeRanges = numRanges;
+            rangesRemaining = numRanges - 1;
+            ++workGeneration;
+        }
+        workReady.notify_all();
 
-        // s == 0 condition
-        // (1) IIR notch filter into wideFloat
+        // This thread takes the first range while the workers take the rest.
+        processChannels(0, channelRangeEnd(0, numRanges), batch);
 
-        wideFloat[0] = notchB2 * in2ndToLast + notchB1 * inLast + notchB0 * inFloat[0] - notchA2 * wide2ndToLast -
-                notchA1 * wideLast;
+        unique_lock<mutex> lock(workMutex);
+        workDone.wait(lock, [this] { return rangesRemaining == 0; });
+    }
 
-        // (2) IIR Nth-order low-pass
-        // 1st iteration: use wideFloat as input
-        lowFloat[0][0] = lowB2[0] * wide2ndToLast + lowB1[0] * wideLast + lowB0[0] * wideFloat[0] -
-                lowA2[0] * low2ndToLast[0] - lowA1[0] * lowLast[0];
+    for (int block = 0; block < numBlocks; ++block) {
+        clearInactiveSpikes(spikeChunk + block * SnippetsPerBlock * channels, spikeIDChunk + block * SnippetsPerBlock * channels);
+    }
 
-        // All other iterations: use lowFloat[filterIndex - 1] as input.
-        for (uint8_t filterIndex = 1; filterIndex < numLowFilterIterations; ++filterIndex) {
-            lowFloat[filterIndex][0] = lowB2[filterIndex] * low2ndToLast[filterIndex - 1] +
-                    lowB1[filterIndex] * lowLast[filterIndex - 1] +
-                    lowB0[filterIndex] * lowFloat[filterIndex - 1][0] -
-                    lowA2[filterIndex] * low2ndToLast[filterIndex] -
-                    lowA1[filterIndex] * lowLast[filterIndex];
-        }
+    // Set the last 50 samples of high to parsedPrevHigh so that they can be used in the next data block
+    parsedPrevHigh = &highChunk[((numBlocks - 1) * FramesPerBlock + FramesPerBlock - SnippetSize) * channels];
+    return true;
+}
 
-        // (3) IIR Nth-order high-pass
-        // 1st iteration: use wideFloat as input.
+// First position in 'activeChannels' past range 'range' of 'numRanges'.  Ranges are whole groups of FilterLanes
+// channels.
+int CPUInterface::channelRangeEnd(int range, int numRanges) const
+{
+    int numActive = (int) activeChannels.size();
+    int numGroups = (numActive + FilterLanes - 1) / FilterLanes;
+    return min(numActive, ((range + 1) * numGroups / numRanges) * FilterLanes);
+}
 
-        highFloat[0][0] = highB2[0] * wide2ndToLast + highB1[0] * wideLast + highB0[0] * wideFloat[0] -
-                highA2[0] * high2ndToLast[0] - highA1[0] * highLast[0];
+void CPUInterface::startWorkers()
+{
+    // New workers start at the current generation, so they wait for the next batch instead of running the last one
+    // (whose buffers may be gone) again.
+    lock_guard<mutex> lock(workMutex);
+    stoppingWorkers = false;
+    for (int worker = 1; worker < numThreads; ++worker) {
+        workers.emplace_back(&CPUInterface::workerLoop, this, worker, workGeneration);
+    }
+}
 
-        // All other iterations: use highFloat[filterIndex - 1] as input.
-        for (uint8_t filterIndex = 1; filterIndex < numHighFilterIterations; ++filterIndex) {
-            highFloat[filterIndex][0] = highB2[filterIndex] * high2ndToLast[filterIndex - 1] +
-                    highB1[filterIndex] * highLast[filterIndex - 1] +
-                    highB0[filterIndex] * highFloat[filterIndex - 1][0] -
-                    highA2[filterIndex] * high2ndToLast[filterIndex] -
-                    highA1[filterIndex] * highLast[filterIndex];
-        }
+void CPUInterface::stopWorkers()
+{
+    {
+        lock_guard<mutex> lock(workMutex);
+        stoppingWorkers = true;
+    }
+    workReady.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
 
-        // s == 1 condition
-        // (1) IIR notch filter into wideFloat
-        wideFloat[1] = notchB2 * inLast + notchB1 * inFloat[0] + notchB0 * inFloat[1] - notchA2 * wideLast -
-                notchA1 * wideFloat[0];
-
-        // (2) IIR Nth-order low-pass
-        // 1st iteration: use wideFloat as input.
-        lowFloat[0][1] = lowB2[0] * wideLast + lowB1[0] * wideFloat[0] + lowB0[0] * wideFloat[1] -
-                lowA2[0] * lowLast[0] - lowA1[0] * lowFloat[0][0];
-
-        // All other iterations: use lowFloat[filterIndex - 1] as input.
-        for (uint8_t filterIndex = 1; filterIndex < numLowFilterIterations; ++filterIndex) {
-            lowFloat[filterIndex][1] = lowB2[filterIndex] * lowLast[filterIndex - 1] +
-                    lowB1[filterIndex] * lowFloat[filterIndex - 1][0] +
-                    lowB0[filterIndex] * lowFloat[filterIndex - 1][1] -
-                    lowA2[filterIndex] * lowLast[filterIndex] -
-                    lowA1[filterIndex] * lowFloat[filterIndex][0];
+void CPUInterface::workerLoop(int range, uint64_t lastGeneration)
+{
+    if (pinThreads) pinCurrentThread(range % max(1, (int) thread::hardware_concurrency()));
+
+    while (true) {
+        BlockBatch batch;
+        int numRanges;
+        {
+            unique_lock<mutex> lock(workMutex);
+            workReady.wait(lock, [&] { return stoppingWorkers || workGeneration != lastGeneration; });
+            if (stoppingWorkers) return;
+            lastGeneration = workGeneration;
+            batch = currentBatch;
+            numRanges = activeRanges;
         }
+        if (range >= numRanges) continue;
 
-        // (3) IIR Nth-order high-pass
-        // 1st iteration: use wideFloat as input.
-        highFloat[0][1] = highB2[0] * wideLast + highB1[0] * wideFloat[0] + highB0[0] * wideFloat[1] -
-                highA2[0] * highLast[0] - highA1[0] * highFloat[0][0];
-
-        // All other iterations: use highFloat[filterIndex - 1] as input.
-        for (uint8_t filterIndex = 1; filterIndex < numHighFilterIterations; ++filterIndex) {
-            highFloat[filterIndex][1] = highB2[filterIndex] * highLast[filterIndex - 1] +
-                    highB1[filterIndex] * highFloat[filterIndex - 1][0] +
-                    highB0[filterIndex] * highFloat[filterIndex - 1][1] -
-                    highA2[filterIndex] * highLast[filterIndex] -
-                    highA1[filterIndex] * highFloat[filterIndex][0];
-        }
+        processChannels(channelRangeEnd(range - 1, numRanges), channelRangeEnd(range, numRanges), batch);
 
-        for (s = 2; s < FramesPerBlock; ++s) {
+        lock_guard<mutex> lock(workMutex);
+        if (--rangesRemaining == 0) workDone.notify_one();
+    }
+}
+
+// Filter the enabled channels at positions [beginPosition, endPosition) of 'activeChannels' through every block of the
+// batch, and detect their spikes.
+void CPUInterface::processChannels(int beginPosition, int endPosition, const BlockBatch& batch)
+{
+    static const FilterKernels kernels = selectFilterKernels();
+
+    int numLowFilterIterations = floor((float)(filterParameters.lowOrder - 1) / 2.0f) + 1;
+    int numHighFilterIterations = floor((float)(filterParameters.highOrder - 1) / 2.0f) + 1;
+
+    alignas(64) float inFloat[FilterRows * FilterLanes];
+    alignas(64) float wideFloat[FilterRows * FilterLanes];
+    alignas(64) float lowFloat[4][FilterRows * FilterLanes];
+    alignas(64) float highFloat[4][FilterRows * FilterLanes];
+
+    int inputOffset[FilterLanes];
+    int laneChannel[FilterLanes];
+    float filteredHigh[FramesPerBlock];
+    float prevHighFloat[FramesPerBlock];
+
+    for (int block = 0; block < batch.numBlocks; ++block) {
+        const uint16_t* rawBlock = batch.data + block * wordsPerBlock;
+        uint16_t* lowChunk = batch.lowChunk ? batch.lowChunk + block * FramesPerBlock * channels : nullptr;
+        uint16_t* wideChunk = batch.wideChunk + block * FramesPerBlock * channels;
+        uint16_t* highChunk = batch.highChunk + block * FramesPerBlock * channels;
+        uint32_t* spikeChunk = batch.spikeChunk + block * SnippetsPerBlock * channels;
+        uint8_t* spikeIDChunk = batch.spikeIDChunk + block * SnippetsPerBlock * channels;
+        // Spike detection looks back into the last SnippetSize samples of the previous block's high-pass output.
+        const uint16_t* prevHigh = (block == 0) ? batch.prevHigh : highChunk - SnippetSize * channels;
+
+        for (int firstPosition = beginPosition; firstPosition < endPosition; firstPosition += FilterLanes) {
+            int lanes = min(FilterLanes, endPosition - firstPosition);
+            for (int lane = 0; lane < FilterLanes; ++lane) {
+                laneChannel[lane] = activeChannels[firstPosition + (lane < lanes ? lane : 0)];
+            }
+            // With no disabled channels in the group, outputs can be written straight to adjacent columns.
+            int firstChannel = laneChannel[0];
+            bool contiguous = laneChannel[lanes - 1] == firstChannel + lanes - 1;
+
+            // (0) Load the last two samples of each filter stage from 'prevLast2', and index these channels' input data
+            // from the rawBlock and convert it to float.  Unused lanes of a partial group are filtered as silence.
+            for (int lane = 0; lane < FilterLanes; ++lane) {
+                bool used = lane < lanes;
+                const float* last = prevLast2 + laneChannel[lane] * 20;
+                for (int row = 0; row < 2; ++row) {
+                    for (int i = 0; i < 4; ++i) {
+                        lowFloat[i][row * FilterLanes + lane] = used ? last[4 * row + i] : 0.0f;
+                        highFloat[i][row * FilterLanes + lane] = used ? last[8 + 4 * row + i] : 0.0f;
+                    }
+                    inFloat[row * FilterLanes + lane] = used ? last[16 + row] : 0.0f;
+                    wideFloat[row * FilterLanes + lane] = used ? last[18 + row] : 0.0f;
+                }
+
+                int channelIndex = laneChannel[lane];
+                int32_t inIndexStream, inIndexChannel;
+                if (type == ControllerRecordUSB2 || type == ControllerRecordUSB3) {
+                    inIndexStream = channelIndex / 32;
+                    inIndexChannel = channelIndex % 32;
+                } else {
+                    inIndexStream = channelIndex / 16;
+                    inIndexChannel = channelIndex % 16;
+                }
+                if (type == ControllerStimRecord) {
+                    inputOffset[lane] = 6 + (numStreams * 3 * 2) + (inIndexChannel * numStreams * 2) + (2 * inIndexStream + 1);
+                } else {
+                    inputOffset[lane] = 6 + (numStreams * 3) + inIndexChannel * numStreams + inIndexStream;
+                }
+            }
+
+            for (int frame = 0; frame < FramesPerBlock; ++frame) {
+                const uint16_t* frameWords = rawBlock + wordsPerFrame * frame;
+                float* row = inFloat + (frame + 2) * FilterLanes;
+                for (int lane = 0; lane < FilterLanes; ++lane) {
+                    row[lane] = (float)(0.195f * (((double)frameWords[inputOffset[lane]]) - 32768));
+                }
+            }
 
             // (1) IIR notch filter into wideFloat
-            wideFloat[s] = notchB2 * inFloat[s - 2] + notchB1 * inFloat[s - 1] + notchB0 * inFloat[s] -
-                    notchA2 * wideFloat[s - 2] - notchA1 * wideFloat[s - 1];
-
-            // (2) IIR Nth-order low-pass
-            // 1st iteration: use wideFloat as input.
-            lowFloat[0][s] = lowB2[0] * wideFloat[s - 2] + lowB1[0] * wideFloat[s - 1] + lowB0[0] * wideFloat[s] -
-                    lowA2[0] * lowFloat[0][s - 2] - lowA1[0] * lowFloat[0][s - 1];
-
-            // All other iterations: use lowfloat[filterIndex - 1] as input.
-            for (uint8_t filterIndex = 1; filterIndex < numLowFilterIterations; ++filterIndex) {
-                lowFloat[filterIndex][s] = lowB2[filterIndex] * lowFloat[filterIndex - 1][s - 2] +
-                        lowB1[filterIndex] * lowFloat[filterIndex - 1][s - 1] +
-                        lowB0[filterIndex] * lowFloat[filterIndex - 1][s] -
-                        lowA2[filterIndex] * lowFloat[filterIndex][s - 2] -
-                        lowA1[filterIndex] * lowFloat[filterIndex][s - 1];
+            kernels.biquad(inFloat, wideFloat, filterParameters.notchParams);
+
+            // (2) IIR Nth-order low-pass, skipped if the low-pass band is not being stored.
+            // 1st iteration: use wideFloat as input.  All other iterations: use lowFloat[filterIndex - 1] as input.
+            if (lowChunk) {
+                kernels.biquad(wideFloat, lowFloat[0], filterParameters.lowParams[0]);
+                for (int filterIndex = 1; filterIndex < numLowFilterIterations; ++filterIndex) {
+                    kernels.biquad(lowFloat[filterIndex - 1], lowFloat[filterIndex], filterParameters.lowParams[filterIndex]);
+                }
             }
 
             // (3) IIR Nth-order high-pass
-            // 1st iteration: use wideFloat as input.
-            highFloat[0][s] = highB2[0] * wideFloat[s - 2] + highB1[0] * wideFloat[s - 1] + highB0[0] * wideFloat[s] -
-                    highA2[0] * highFloat[0][s - 2] - highA1[0] * highFloat[0][s - 1];
-
-            // All other iterations: use highFloat[filterIndex - 1] as input.
-            for (uint8_t filterIndex = 1; filterIndex < numHighFilterIterations; ++filterIndex) {
-                highFloat[filterIndex][s] = highB2[filterIndex] * highFloat[filterIndex - 1][s - 2] +
-                        highB1[filterIndex] * highFloat[filterIndex - 1][s - 1] +
-                        highB0[filterIndex] * highFloat[filterIndex - 1][s] -
-                        highA2[filterIndex] * highFloat[filterIndex][s - 2] -
-                        highA1[filterIndex] * highFloat[filterIndex][s - 1];
+            // 1st iteration: use wideFloat as input.  All other iterations: use highFloat[filterIndex - 1] as input.
+            kernels.biquad(wideFloat, highFloat[0], filterParameters.highParams[0]);
+            for (int filterIndex = 1; filterIndex < numHighFilterIterations; ++filterIndex) {
+                kernels.biquad(highFloat[filterIndex - 1], highFloat[filterIndex], filterParameters.highParams[filterIndex]);
             }
-        }
 
-        float filteredHigh[FramesPerBlock];
-        float filteredLow[FramesPerBlock];
+            const float* filteredLowRows = lowFloat[numLowFilterIterations - 1] + 2 * FilterLanes;
+            const float* filteredHighRows = highFloat[numHighFilterIterations - 1] + 2 * FilterLanes;
+
+            // Spike detection reads the previous block's high-pass output, so it must run before this group's output is
+            // written in case both share a buffer.
+            for (int lane = 0; lane < lanes; ++lane) {
+                int channelIndex = laneChannel[lane];
+                for (int s = 0; s < FramesPerBlock; ++s) {
+                    filteredHigh[s] = filteredHighRows[s * FilterLanes + lane];
+                }
+                for (int s = 0; s < SnippetSize; ++s) {
+                    prevHighFloat[s] = (float) (0.195f * (((double)prevHigh[s * channels + channelIndex]) - 32768));
+                }
+                detectSpikes(channelIndex, filteredHigh, prevHighFloat, rawBlock, spikeChunk, spikeIDChunk);
+            }
+
+            // (4) Convert outputs to uint16_t.
+            if (contiguous) {
+                if (lowChunk) kernels.convertOutput(filteredLowRows, lowChunk + firstChannel, channels, lanes);
+                kernels.convertOutput(wideFloat + 2 * FilterLanes, wideChunk + firstChannel, channels, lanes);
+                kernels.convertOutput(filteredHighRows, highChunk + firstChannel, channels, lanes);
+            } else {
+                if (lowChunk) storeScattered(kernels, filteredLowRows, lowChunk, channels, laneChannel, lanes);
+                storeScattered(kernels, wideFloat + 2 * FilterLanes, wideChunk, channels, laneChannel, lanes);
+                storeScattered(kernels, filteredHighRows, highChunk, channels, laneChannel, lanes);
+            }
 
-        for (int s = 0; s < FramesPerBlock; ++s) {
-            filteredHigh[s] = highFloat[numHighFilterIterations - 1][s];
-            filteredLow[s] = lowFloat[numLowFilterIterations - 1][s];
+            // Update 'prevLast2' array with this block's samples.  Stages beyond the current filter order, and the
+            // low-pass stages while that band is skipped, are reset so they start from silence when next used, and the
+            // notch filter history is kept clamped to the range of the wideband output.
+            for (int lane = 0; lane < lanes; ++lane) {
+                float* last = prevLast2 + laneChannel[lane] * 20;
+                for (int row = 0; row < 2; ++row) {
+                    int index = (FramesPerBlock + row) * FilterLanes + lane;
+                    for (int i = 0; i < 4; ++i) {
+                        last[4 * row + i] = (lowChunk && i < numLowFilterIterations) ? lowFloat[i][index] : 0.0f;
+                        last[8 + 4 * row + i] = i < numHighFilterIterations ? highFloat[i][index] : 0.0f;
+                    }
+                    last[16 + row] = inFloat[index];
+                    last[18 + row] = min(max(wideFloat[index], -6389.0f), 6389.0f);
+                }
+            }
         }
+    }
+}
 
-        // Across this block, look for any valid rectangle and look back to this block and the previous block to
-        // determine valid t0. Add earliest t0 for each rectangle to 'spike' output.
-        snippetIndex = 0;
+// Look for threshold crossings in one channel's high-pass output, and write their timestamps and IDs to the spike
+// outputs.
+void CPUInterface::detectSpikes(int channelIndex, const float* filteredHigh, const float* prevHighFloat,
+                                const uint16_t* rawBlock, uint32_t* spikeChunk, uint8_t* spikeIDChunk)
+{
+    const unsigned int snippetsPerBlock = (int) ceil((double) ((double) FramesPerBlock / (double) SnippetSize) + 1.0);
+
+    float samplePeriod = 1.0f / sampleRate;
+    float threshold = hoops[channelIndex].threshold;
+    bool useHoops = (hoops[channelIndex].useHoops == 1) ? true : false;
+
+    for (unsigned int s = 0; s < snippetsPerBlock; ++s) {
+        spikeChunk[s * channels + channelIndex] = 0;
+        spikeIDChunk[s * channels + channelIndex] = 0;
+    }
 
-        // Start with threshS = startSearchPos[channelIndex]. This is 0 unless the previous data block ended with a spike.
-        // In that case, threshS is a non-zero offset to avoid double-detecting a snippet.
-        for (int threshS = startSearchPos[channelIndex] - SnippetSize; threshS < FramesPerBlock - SnippetSize; ++threshS) {
+    // Across this block, look for any valid rectangle and look back to this block and the previous block to
+    // determine valid t0. Add earliest t0 for each rectangle to 'spike' output.
+    int32_t snippetIndex = 0;
 
-            startSearchPos[channelIndex] = 0;
+    // Start with threshS = startSearchPos[channelIndex]. This is 0 unless the previous data block ended with a spike.
+    // In that case, threshS is a non-zero offset to avoid double-detecting a snippet.
+    for (int threshS = startSearchPos[channelIndex] - SnippetSize; threshS < FramesPerBlock - SnippetSize; ++threshS) {
 
-            // Look to both this data block and the previous block to determine if the threshold was surpassed.
-            bool surpassed = false;
+        startSearchPos[channelIndex] = 0;
+
+        // Look to both this data block and the previous block to determine if the threshold was surpassed.
+        bool surpassed = false;
+
+        if (threshold >= 0) {  // If threshold was positive:
+            if (threshS >= 0) {
+                if (filteredHigh[threshS] > threshold) surpassed = true;
+            } else {
+                if (prevHighFloat[SnippetSize + threshS] > threshold) surpassed = true;
+            }
+        } else {  // If threshold was negative:
+            if (threshS >= 0) {
+                if (filteredHigh[threshS] < threshold) surpassed = true;
+            } else {
+                if (prevHighFloat[SnippetSize + threshS] < threshold) surpassed = true;
+            }
+        }
 
-            if (threshold >= 0) {  // If threshold was positive:
-                if (threshS >= 0) {
-                    if (filteredHigh[threshS] > threshold) surpassed = true;
+        // Threshold was surpassed.
+        if (surpassed) {
+            // For ease of understanding, move the samples from [threshS, threshS + SnippetSize] to [0, snippetSize].
+            float thisSnippet[FramesPerBlock];
+            for (int i = 0; i < SnippetSize; ++i) {
+                int thisS = threshS + i;
+                if (thisS < 0) {
+                    thisSnippet[i] = prevHighFloat[SnippetSize + thisS];
                 } else {
-                    if (prevHighFloat[SnippetSize + threshS] > threshold) surpassed = true;
+                    thisSnippet[i] = filteredHigh[thisS];
                 }
-            } else {  // If threshold was negative:
-                if (threshS >= 0) {
-                    if (filteredHigh[threshS] < threshold) surpassed = true;
-                } else {
-                    if (prevHighFloat[SnippetSize + threshS] < threshold) surpassed = true;
+            }
+
+            // Create a struct to hold this channel's hoop info.
+            ChannelDetectionStruct detection;
+            for (int unit = 0; unit < 4; ++unit) {
+                for (int hoop = 0; hoop < 4; ++hoop) {
+                    detection.units[unit].hoops[hoop] = false;
                 }
             }
+            detection.maxSurpassed = false;
 
-            // Threshold was surpassed.
-            if (surpassed) {
-                // For ease of understanding, move the samples from [threshS, threshS + SnippetSize] to [0, snippetSize].
-                float thisSnippet[FramesPerBlock];
+            // If spikeMaxEnabled is true, then see if any samples in this snippet surpass spikeMax. If they do,
+            // then mark detetion.maxSurpassed as true and save which sample.
+            if (globalParameters.spikeMaxEnabled) {
                 for (int i = 0; i < SnippetSize; ++i) {
-                    int thisS = threshS + i;
-                    if (thisS < 0) {
-                        thisSnippet[i] = prevHighFloat[SnippetSize + thisS];
-                    } else {
-                        thisSnippet[i] = filteredHigh[thisS];
+                    if (globalParameters.spikeMax >= 0 && thisSnippet[i] >= globalParameters.spikeMax) {
+                        detection.maxSurpassed = true;
+                        break;
+                    }
+                    if (globalParameters.spikeMax < 0 && thisSnippet[i] <= globalParameters.spikeMax) {
+                        detection.maxSurpassed = true;
+                        break;
                     }
                 }
+            }
 
-                // Create a struct to hold this channel's hoop info.
-                ChannelDetectionStruct detection;
+            // If useHoops is true, then go through all units populating detection.units[unit].hoops[hoop].
+            if (useHoops) {
+                // Go through all units.
                 for (int unit = 0; unit < 4; ++unit) {
-                    for (int hoop = 0; hoop < 4; ++hoop) {
-                        detection.units[unit].hoops[hoop] = false;
-                    }
-                }
-                detection.maxSurpassed = false;
-
-                // If spikeMaxEnabled is true, then see if any samples in this snippet surpass spikeMax. If they do,
-                // then mark detetion.maxSurpassed as true and save which sample.
-                if (globalParameters.spikeMaxEnabled) {
-                    for (int i = 0; i < SnippetSize; ++i) {
-                        if (globalParameters.spikeMax >= 0 && thisSnippet[i] >= globalParameters.spikeMax) {
-                            detection.maxSurpassed = true;
-                            break;
-                        }
-                        if (globalParameters.spikeMax < 0 && thisSnippet[i] <= globalParameters.spikeMax) {
-                            detection.maxSurpassed = true;
-                            break;
-                        }
+
+                    // If this unit has no valid hoops (all tA values are -1.0f), then this is an inactive unit which
+                    // should be treated as having no intersect; just go on to the next unit.
+                    if (hoops[channelIndex].unitHoops[unit].hoopInfo[0].tA == -1.0f &&
+                            hoops[channelIndex].unitHoops[unit].hoopInfo[1].tA == -1.0f &&
+                            hoops[channelIndex].unitHoops[unit].hoopInfo[2].tA == -1.0f &&
+                            hoops[channelIndex].unitHoops[unit].hoopInfo[3].tA == -1.0f) {
+                        continue;
                     }
-                }
 
-                // If useHoops is true, then go through all units populating detection.units[unit].hoops[hoop].
-                if (useHoops) {
-                    // Go through all units.
-                    for (int unit = 0; unit < 4; ++unit) {
-
-                        // If this unit has no valid hoops (all tA values are -1.0f), then this is an inactive unit which
-                        // should be treated as having no intersect; just go on to the next unit.
-                        if (hoops[channelIndex].unitHoops[unit].hoopInfo[0].tA == -1.0f &&
-                                hoops[channelIndex].unitHoops[unit].hoopInfo[1].tA == -1.0f &&
-                                hoops[channelIndex].unitHoops[unit].hoopInfo[2].tA == -1.0f &&
-                                hoops[channelIndex].unitHoops[unit].hoopInfo[3].tA == -1.0f) {
+                    // Go through all hoops.
+                    for (int hoop = 0; hoop < 4; ++hoop) {
+                        HoopInfoStruct thisHoop = hoops[channelIndex].unitHoops[unit].hoopInfo[hoop];
+
+                        // If this hoop info is invalid (tA is -1.0f), then this is an inactive hoop, which by default passes.
+                        // Set true and continue. If all hoops are inactive, then we would have already passed on to the next
+                        // unit without flaggin an intersect.
+                        if (thisHoop.tA == -1.0f) {
+                            detection.units[unit].hoops[hoop] = true;
                             continue;
                         }
 
-                        // Go through all hoops.
-                        for (int hoop = 0; hoop < 4; ++hoop) {
-                            HoopInfoStruct thisHoop = hoops[channelIndex].unitHoops[unit].hoopInfo[hoop];
+                        float tA = thisHoop.tA;
+                        float yA = thisHoop.yA;
+                        float tB = thisHoop.tB;
+                        float yB = thisHoop.yB;
 
-                            // If this hoop info is invalid (tA is -1.0f), then this is an inactive hoop, which by default passes.
-                            // Set true and continue. If all hoops are inactive, then we would have already passed on to the next
-                            // unit without flaggin an intersect.
-                            if (thisHoop.tA == -1.0f) {
-                                detection.units[unit].hoops[hoop] = true;
-                                continue;
-                            }
+                        // In range [tA, tB], does line segment from (t1, y1) to (t2, y2) intersect user-defined hoop?
+                        // If so, mark hoop as jumped through by setting intersect to true.
+                        bool intersect = false;
 
-                            float tA = thisHoop.tA;
-                            float yA = thisHoop.yA;
-                            float tB = thisHoop.tB;
-                            float yB = thisHoop.yB;
-
-                            // In range [tA, tB], does line segment from (t1, y1) to (t2, y2) intersect user-defined hoop?
-                            // If so, mark hoop as jumped through by setting intersect to true.
-                            bool intersect = false;
-
-                            // Round tA down and tB up to the nearest discrete sample.
-                            int sA = floor(sampleRate * tA);
-                            int sB = ceil(sampleRate * tB);
-
-                            // Special case: vertical hoop
-                            if (sA == sB) {
-                                float y1Data = thisSnippet[sA];
-                                if (yB > yA) {
-                                    intersect = (y1Data < yB && y1Data > yA);
-                                } else {
-                                    intersect = (y1Data > yB && y1Data < yA);
-                                }
+                        // Round tA down and tB up to the nearest discrete sample.
+                        int sA = floor(sampleRate * tA);
+                        int sB = ceil(sampleRate * tB);
+
+                        // Special case: vertical hoop
+                        if (sA == sB) {
+                            float y1Data = thisSnippet[sA];
+                            if (yB > yA) {
+                                intersect = (y1Data < yB && y1Data > yA);
                             } else {
-                                // General case: non-vertical hoop
-                                float slope = (yB - yA) / (tB - tA);
-                                // Examine every two adjacent samples in the range [sA, sB] and determine if they intersect the hoop.
-                                for (int s1 = sA; s1 < sB - 1; ++s1) {
-                                    int s2 = s1 + 1;
-                                    float y1Data = thisSnippet[s1];
-                                    float y2Data = thisSnippet[s2];
-
-                                    // Convert s1 and s2 to the float t1 and t2 domain.
-                                    float t1 = ((float) s1) * samplePeriod;
-                                    float t2 = ((float) s2) * samplePeriod;
-
-                                    float y1Hoop = yA + slope * (t1 - tA);
-                                    float y2Hoop = yA + slope * (t2 - tA);
-
-                                    // If the data transitions from below to above the hoop (or vice versa), then an intersection
-                                    // occurred. Break the loop for checking this hoop.
-                                    if ((y1Data >= y1Hoop && y2Data <= y2Hoop) ||
-                                            (y1Data <= y1Hoop && y2Data >= y2Hoop)) {
-                                        intersect = true;
-                                        break;
-                                    }
-
-                                    // Otherwise, keep looking over the course of this hoop.
-                                }
+                                intersect = (y1Data > yB && y1Data < yA);
                             }
+                        } else {
+                            // General case: non-vertical hoop
+                            float slope = (yB - yA) / (tB - tA);
+                            // Examine every two adjacent samples in the range [sA, sB] and determine if they intersect the hoop.
+                            for (int s1 = sA; s1 < sB - 1; ++s1) {
+                                int s2 = s1 + 1;
+                                float y1Data = thisSnippet[s1];
+                                float y2Data = thisSnippet[s2];
+
+                                // Convert s1 and s2 to the float t1 and t2 domain.
+                                float t1 = ((float) s1) * samplePeriod;
+                                float t2 = ((float) s2) * samplePeriod;
+
+                                float y1Hoop = yA + slope * (t1 - tA);
+                                float y2Hoop = yA + slope * (t2 - tA);
+
+                                // If the data transitions from below to above the hoop (or vice versa), then an intersection
+                                // occurred. Break the loop for checking this hoop.
+                                if ((y1Data >= y1Hoop && y2Data <= y2Hoop) ||
+                                        (y1Data <= y1Hoop && y2Data >= y2Hoop)) {
+                                    intersect = true;
+                                    break;
+                                }
 
-                            if (intersect) {  // If intersect occurred, mark this hoop as jumped through.
-                                detection.units[unit].hoops[hoop] = true;
-                            } else {
-                                // If not, exit the hoop loop (default value is false, so effectively setting it false)
-                                // and move on to the next unit.
-                                break;
+                                // Otherwise, keep looking over the course of this hoop.
                             }
-                        } // End loop across all hoops.
-                    } // End loop across all units.
-                } else {  // If useHoops is false, then just populate detection.units[unit].hoops[hoop] with true.
-                    for (int unit = 0; unit < 4; ++unit) {
-                        for (int hoop = 0; hoop < 4; ++hoop) {
+                        }
+
+                        if (intersect) {  // If intersect occurred, mark this hoop as jumped through.
                             detection.units[unit].hoops[hoop] = true;
+                        } else {
+                            // If not, exit the hoop loop (default value is false, so effectively setting it false)
+                            // and move on to the next unit.
+                            break;
                         }
+                    } // End loop across all hoops.
+                } // End loop across all units.
+            } else {  // If useHoops is false, then just populate detection.units[unit].hoops[hoop] with true.
+                for (int unit = 0; unit < 4; ++unit) {
+                    for (int hoop = 0; hoop < 4; ++hoop) {
+                        detection.units[unit].hoops[hoop] = true;
                     }
                 }
+            }
 
-                uchar ID = 0;
-                // Determine correct ID
+            uchar ID = 0;
+            // Determine correct ID
 
 
-                if (detection.maxSurpassed) {  // If max has been detected, ID is 128 for max surpassing.
-                    ID = 128;
-                } else if (true) {
-                //} else if (!useHoops) {  // If useHoops is false, ID is 1 to signify threshold crossing.
-                    ID = 1;
-                } else {  // If useHoops is true, ID is either (a) an active unit or (b) just a threshold crossing.
-                    // (a) If a unit is active, ID is either 1, 2, 4, or 8 for the unit.
-                    for (uint8_t unit = 0; unit < 4; ++unit) {
-                        if (detection.units[unit].hoops[0] && detection.units[unit].hoops[1] &&
-                                detection.units[unit].hoops[2] && detection.units[unit].hoops[3]) {
+            if (detection.maxSurpassed) {  // If max has been detected, ID is 128 for max surpassing.
+                ID = 128;
+            } else if (true) {
+            //} else if (!useHoops) {  // If useHoops is false, ID is 1 to signify threshold crossing.
+                ID = 1;
+            } else {  // If useHoops is true, ID is either (a) an active unit or (b) just a threshold crossing.
+                // (a) If a unit is active, ID is either 1, 2, 4, or 8 for the unit.
+                for (uint8_t unit = 0; unit < 4; ++unit) {
+                    if (detection.units[unit].hoops[0] && detection.units[unit].hoops[1] &&
+                            detection.units[unit].hoops[2] && detection.units[unit].hoops[3]) {
 //                            ID = (uint8_t) pow(2.0f, (float) unit);
-                            ID = 1u << unit;  // faster implementation of 2^unit
-                            break;
-                        }
+                        ID = 1u << unit;  // faster implementation of 2^unit
+                        break;
                     }
-
-                    // (b) If no unit is active, ID is 64 to signify threshold crossing.
-                    if (ID == 0) ID = 64;
                 }
 
-                // Populate spike with timestamp
-                // Extract the timestamp of the first frame in this data block
-                uint32_t timestampLSW = rawBlock[4]; // Timestamp is always the bytes 8-11 of the datablock (16-bit words 4-5).
-                uint32_t timestampMSW = rawBlock[5];
-                uint32_t timestamp = (timestampMSW << 16) + timestampLSW;
-
-                // Add threshS to this timestamp to index right (for positive threshS) or left (for negative threshS).
-                timestamp += threshS;
-
-                // Write spike detection at this timestamp.
-                spikeChunk[snippetIndex * channels + channelIndex] = timestamp;
-
-                // Populate spikeID with correct ID.
-                spikeIDChunk[snippetIndex * channels + channelIndex] = ID;
-
-                // Advance by SnippetSize samples since activity up until then will already be flagged as a spike.
-                threshS += SnippetSize;
-
-                // Continue detection, preparing for another spike in this block to take the next snippetIndex;
-                ++snippetIndex;
-
-                // If the end of this spike snippet is encroaching on the territory of the next data block
-                // (with SnippetSize of the next block's start), populate startSearchPos[channel] with
-                // the end position of this snippet. This allows the next block to start at a later sample,
-                // so there's no risk of double-counting a spike.
-                if (threshS > FramesPerBlock - SnippetSize) {
-                    startSearchPos[channelIndex] = threshS - (FramesPerBlock - SnippetSize);
-                }
+                // (b) If no unit is active, ID is 64 to signify threshold crossing.
+                if (ID == 0) ID = 64;
             }
-        }
 
-        for (s = 0; s < FramesPerBlock; ++s) {
-            // Boundary check to make sure result will fit in a uint16_t.
-            if (wideFloat[s] > 6389.0f) wideFloat[s] = 6389.0f;
-            else if (wideFloat[s] < -6389.0f) wideFloat[s] = -6389.0f;
+            // Populate spike with timestamp
+            // Extract the timestamp of the first frame in this data block
+            uint32_t timestampLSW = rawBlock[4]; // Timestamp is always the bytes 8-11 of the datablock (16-bit words 4-5).
+            uint32_t timestampMSW = rawBlock[5];
+            uint32_t timestamp = (timestampMSW << 16) + timestampLSW;
 
-            if (filteredLow[s] > 6389.0f) filteredLow[s] = 6389.0f;
-            else if (filteredLow[s] < -6389.0f) filteredLow[s] = -6389.0f;
+            // Add threshS to this timestamp to index right (for positive threshS) or left (for negative threshS).
+            timestamp += threshS;
 
-            if (filteredHigh[s] > 6389.0f) filteredHigh[s] = 6389.0f;
-            else if (filteredHigh[s] < -6389.0f) filteredHigh[s] = -6389.0f;
+            // Write spike detection at this timestamp.
+            spikeChunk[snippetIndex * channels + channelIndex] = timestamp;
 
-            // (4) Convert outputs to uint16_t.
-            outIndex = s * channels + channelIndex;
+            // Populate spikeID with correct ID.
+            spikeIDChunk[snippetIndex * channels + channelIndex] = ID;
 
-            lowChunk[outIndex] = (uint16_t) round((filteredLow[s] / 0.195f) + 32768);
-            wideChunk[outIndex] = (uint16_t) round((wideFloat[s] / 0.195f) + 32768);
-            highChunk[outIndex] = (uint16_t) round((filteredHigh[s] / 0.195f) + 32768);
-        }
+            // Advance by SnippetSize samples since activity up until then will already be flagged as a spike.
+            threshS += SnippetSize;
 
-        // Update 'prevLast2' array with this block's samples.
-        for (int filterIndex = 0; filterIndex < 4; ++filterIndex) {
-            prevLast2[low2ndToLastIndex[filterIndex]] = lowFloat[filterIndex][FramesPerBlock - 2];
-            prevLast2[lowLastIndex[filterIndex]] = lowFloat[filterIndex][FramesPerBlock - 1];
-            prevLast2[high2ndToLastIndex[filterIndex]] = highFloat[filterIndex][FramesPerBlock - 2];
-            prevLast2[highLastIndex[filterIndex]] = highFloat[filterIndex][FramesPerBlock - 1];
-        }
+            // Continue detection, preparing for another spike in this block to take the next snippetIndex;
+            ++snippetIndex;
 
-        prevLast2[in2ndToLastIndex] = inFloat[FramesPerBlock - 2];
-        prevLast2[inLastIndex] = inFloat[FramesPerBlock - 1];
-        prevLast2[wide2ndToLastIndex] = wideFloat[FramesPerBlock - 2];
-        prevLast2[wideLastIndex] = wideFloat[FramesPerBlock - 1];
+            // If the end of this spike snippet is encroaching on the territory of the next data block
+            // (with SnippetSize of the next block's start), populate startSearchPos[channel] with
+            // the end position of this snippet. This allows the next block to start at a later sample,
+            // so there's no risk of double-counting a spike.
+            if (threshS > FramesPerBlock - SnippetSize) {
+                startSearchPos[channelIndex] = threshS - (FramesPerBlock - SnippetSize);
+            }
+        }
     }
-
-    // Set the last 50 samples of high to parsedPrevHigh so that they can be used in the next data block
-//    memcpy(parsedPrevHigh, &highChunk[(FramesPerBlock - SnippetSize) * channels], SnippetSize * sizeof(uint16_t));
-    parsedPrevHigh = &highChunk[(FramesPerBlock - SnippetSize) * channels];
 }
 
 void CPUInterface::freeMemory()
@@ -552,6 +827,7 @@ void CPUInterface::freeMemory()
     delete [] startSearchPos;
     delete [] hoops;
     delete [] parsedPrevHighOriginal;
+    vector<uint16_t>().swap(highScratch);
 
     allocated = false;
 }
@@ -559,6 +835,7 @@ void CPUInterface::freeMemory()
 void CPUInterface::speedTest()
 {
     state->cpuInfo.diagnosticTime = -1.0f;
+    state->cpuInfo.batchedDiagnosticTime = -1.0f;
     state->cpuInfo.name = "CPU";
     state->cpuInfo.rank = -1;
     state->cpuInfo.used = false;
@@ -31,6 +31,10 @@
 #ifndef CPUINTERFACE_H
 #define CPUINTERFACE_H
 
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include <vector>
 #include "abstractxpuinterface.h"
 
 typedef struct _UnitDetection
@@ -51,15 +55,57 @@ public:
     explicit CPUInterface(SystemState* state_, QObject *parent = nullptr);
     ~CPUInterface();
 
-    void processDataBlock(uint16_t* data, uint16_t* lowChunk, uint16_t* wideChunk,
+    bool processDataBlock(uint16_t* data, uint16_t* lowChunk, uint16_t* wideChunk,
                           uint16_t* highChunk, uint32_t* spikeChunk, uint8_t* spikeIDChunk) override;
+    bool processDataBlocks(uint16_t* data, uint16_t* lowChunk, uint16_t* wideChunk, uint16_t* highChunk,
+                           uint32_t* spikeChunk, uint8_t* spikeIDChunk, int numBlocks) override;
+    void setThreading(int numThreads_, bool pinThreads_);
     void speedTest() override;
     bool setupMemory() override;
     bool cleanupMemory() override;
 
 private:
+    struct BlockBatch
+    {
+        uint16_t* data;
+        uint16_t* lowChunk;
+        uint16_t* wideChunk;
+        uint16_t* highChunk;
+        uint32_t* spikeChunk;
+        uint8_t* spikeIDChunk;
+        int numBlocks;
+        const uint16_t* prevHigh;
+    };
+
     void initializeMemory();
     void freeMemory();
+    void processChannels(int beginPosition, int endPosition, const BlockBatch& batch);
+    void detectSpikes(int channelIndex, const float* filteredHigh, const float* prevHighFloat, const uint16_t* rawBlock,
+                      uint32_t* spikeChunk, uint8_t* spikeIDChunk);
+    int channelRangeEnd(int range, int numRanges) const;
+    void startWorkers();
+    void stopWorkers();
+    void workerLoop(int range, uint64_t lastGeneration);
+
+    atomic<int> requestedNumThreads;
+    atomic<bool> requestedPinThreads;
+    int numThreads;
+    bool pinThreads;
+
+    // Persistent worker threads; worker n filters channel range n of each batch, and this interface's caller filters
+    // range 0.
+    vector<thread> workers;
+    mutex workMutex;
+    condition_variable workReady;
+    condition_variable workDone;
+    BlockBatch currentBatch;
+    uint64_t workGeneration;
+    int activeRanges;
+    int rangesRemaining;
+    bool stoppingWorkers;
+
+    // High-pass output for spike detection when the caller is not storing the high-pass band.
+    vector<uint16_t> highScratch;
 };
 
 #endif // CPUINTERFACE_H
@@ -28,11 +28,31 @@
 //
 //------------------------------------------------------------------------------
 
+#include <cstring>
+#include <iostream>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QSaveFile>
+#include <QStandardPaths>
 #include "gpuinterface.h"
 
 GPUInterface::GPUInterface(SystemState *state_, QObject *parent) :
-    AbstractXPUInterface(state_, parent)
+    AbstractXPUInterface(state_, parent),
+    parametersDirty(true),
+    prevLast2Dirty(true),
+    searchStateDirty(true),
+    activeChannelsDirty(true),
+    readbackLow(true),
+    readbackHigh(true)
 {
+    for (int slot = 0; slot < PipelineDepth; ++slot) {
+        uploadDone[slot] = nullptr;
+        kernelDone[slot] = nullptr;
+        readbackDone[slot] = nullptr;
+    }
     updateFromState();
 }
 
@@ -43,64 +63,261 @@ GPUInterface::~GPUInterface()
     }
 }
 
-void GPUInterface::processDataBlock(uint16_t *data, uint16_t *lowChunk, uint16_t *wideChunk, uint16_t *highChunk, uint32_t *spikeChunk, uint8_t *spikeIDChunk)
+bool GPUInterface::processDataBlock(uint16_t *data, uint16_t *lowChunk, uint16_t *wideChunk, uint16_t *highChunk, uint32_t *spikeChunk, uint8_t *spikeIDChunk)
+{
+    return processDataBlocks(data, lowChunk, wideChunk, highChunk, spikeChunk, spikeIDChunk, 1);
+}
+
+// Blocks are pipelined two deep: while the kernel filters block n, block n + 1 is uploaded and block n - 1's outputs
+// are read back and handed to the caller.  All work is complete when this returns, so the pipeline only spans the
+// blocks of one batch; with one block per batch (the lowest processing latency setting), transfers and the kernel do
+// not overlap.  If any OpenCL call fails, the batch is abandoned and false is returned; outputs for the failed block
+// and any later blocks are not written.
+bool GPUInterface::processDataBlocks(uint16_t *data, uint16_t *lowChunk, uint16_t *wideChunk, uint16_t *highChunk,
+                                     uint32_t *spikeChunk, uint8_t *spikeIDChunk, int numBlocks)
 {
     lock_guard<mutex> lockFilter(filterMutex);
 
-    if (channels == 0)
-        return;
+    if (channels == 0 || numBlocks <= 0)
+        return true;
+
+    if (!uploadChangedState()) return abandonBatch();
+
+    // Bands the caller is not storing are neither written by the kernel nor read back.
+    readbackLow = lowChunk != nullptr;
+    readbackHigh = highChunk != nullptr;
+
+    if (!enqueueUpload(data, 0) || !enqueueKernel(0)) return abandonBatch();
+    for (int block = 0; block < numBlocks; ++block) {
+        int slot = block % PipelineDepth;
+        bool moreBlocks = block + 1 < numBlocks;
+        if (moreBlocks && !enqueueUpload(data + (block + 1) * wordsPerBlock, (block + 1) % PipelineDepth)) return abandonBatch();
+        if (!enqueueReadback(slot)) return abandonBatch();
+        if (moreBlocks && !enqueueKernel((block + 1) % PipelineDepth)) return abandonBatch();
+
+        if (!checkResult(clFlush(transferQueue), "Submitting the transfer queue") ||
+            !checkResult(clFlush(commandQueue), "Submitting the command queue")) return abandonBatch();
+
+        if (!copyOutputs(slot, readbackLow ? lowChunk + block * FramesPerBlock * channels : nullptr,
+                         wideChunk + block * FramesPerBlock * channels,
+                         readbackHigh ? highChunk + block * FramesPerBlock * channels : nullptr,
+                         spikeChunk + block * SnippetsPerBlock * channels, spikeIDChunk + block * SnippetsPerBlock * channels)) {
+            return abandonBatch();
+        }
+    }
+
+    // Parameter uploads read from host memory that may change once the filter mutex is released.
+    if (!checkResult(clFinish(commandQueue), "Finishing the command queue")) return abandonBatch();
+
+    // Set the last 50 samples of high to parsedPrevHigh so that they can be used in the next data block.  The device
+    // keeps its own copy, so without a high-pass readback this only matters if the search state is later re-uploaded.
+    if (readbackHigh) {
+        parsedPrevHigh = &highChunk[((numBlocks - 1) * FramesPerBlock + FramesPerBlock - SnippetSize) * channels];
+    } else {
+        parsedPrevHigh = parsedPrevHighOriginal;
+    }
+    return true;
+}
+
+// Record a failed OpenCL call made while processing data.  Returns false if result is an error.
+bool GPUInterface::checkResult(cl_int result, const char* operation)
+{
+    if (result == CL_SUCCESS) return true;
+    processingError = QString(operation) + " failed with OpenCL error " + QString::number(result) + ".";
+    cerr << "GPUInterface: " << processingError.toStdString() << '\n';
+    return false;
+}
+
+// Wait for whatever part of a failed batch was enqueued to drain, so that no command still refers to pinned memory
+// or to events, then release the batch's events.  Always returns false.
+bool GPUInterface::abandonBatch()
+{
+    clFinish(transferQueue);
+    clFinish(commandQueue);
+    for (int slot = 0; slot < PipelineDepth; ++slot) {
+        releaseEvents(slot);
+    }
+    return false;
+}
+
+void GPUInterface::releaseEvents(int slot)
+{
+    cl_event* events[3] = { &uploadDone[slot], &kernelDone[slot], &readbackDone[slot] };
+    for (cl_event* event : events) {
+        if (*event) clReleaseEvent(*event);
+        *event = nullptr;
+    }
+}
+
+void GPUInterface::resetPrev()
+{
+    AbstractXPUInterface::resetPrev();
+    prevLast2Dirty = true;
+}
 
-    // Load all inputs
-    ret = clEnqueueWriteBuffer(commandQueue, globalParametersHandle, CL_TRUE, 0, sizeof(GlobalParamStruct), &globalParameters, 0, nullptr, nullptr);
-    if (ret != CL_SUCCESS) qDebug() << "Error A0";
+// Called at the end of updateFromState(), after filter, threshold, and spike suppression parameters are updated.
+void GPUInterface::updateHoopsVariables()
+{
+    parametersDirty = true;
+}
+
+void GPUInterface::updateConstChars()
+{
+    parametersDirty = true;
+}
+
+void GPUInterface::updateActiveChannels(const vector<int>& newlyActive)
+{
+    AbstractXPUInterface::updateActiveChannels(newlyActive);
+    resetChannels.insert(resetChannels.end(), newlyActive.begin(), newlyActive.end());
+    activeChannelsDirty = true;
+}
+
+// Upload parameters and filter state that have changed on the host since the last block.  Each group stays marked
+// as changed until all of its uploads have been enqueued.
+bool GPUInterface::uploadChangedState()
+{
+    if (parametersDirty) {
+        ret = clEnqueueWriteBuffer(commandQueue, globalParametersHandle, CL_FALSE, 0, sizeof(GlobalParamStruct), &globalParameters, 0, nullptr, nullptr);
+        if (!checkResult(ret, "Uploading global parameters")) return false;
+
+        ret = clEnqueueWriteBuffer(commandQueue, filterParametersHandle, CL_FALSE, 0, sizeof(FilterParamStruct), &filterParameters, 0, nullptr, nullptr);
+        if (!checkResult(ret, "Uploading filter parameters")) return false;
+
+        ret = clEnqueueWriteBuffer(commandQueue, gpuHoopsHandle, CL_FALSE, 0, channels * sizeof(ChannelHoopsStruct), hoops, 0, nullptr, nullptr);
+        if (!checkResult(ret, "Uploading spike detection hoops")) return false;
+
+        parametersDirty = false;
+    }
+
+    if (prevLast2Dirty) {
+        ret = clEnqueueWriteBuffer(commandQueue, gpuPrevLast2BuffHandle, CL_FALSE, 0, channels * 20 * sizeof(float), prevLast2, 0, nullptr, nullptr);
+        if (!checkResult(ret, "Uploading filter state")) return false;
+
+        prevLast2Dirty = false;
+    }
 
-    ret = clEnqueueWriteBuffer(commandQueue, filterParametersHandle, CL_TRUE, 0, sizeof(FilterParamStruct), &filterParameters, 0, nullptr, nullptr);
-    if (ret != CL_SUCCESS) qDebug() << "Error A1";
+    if (searchStateDirty) {
+        ret = clEnqueueWriteBuffer(commandQueue, gpuPrevHighHandle, CL_FALSE, 0, SnippetSize * channels * sizeof(uint16_t), parsedPrevHigh, 0, nullptr, nullptr);
+        if (!checkResult(ret, "Uploading previous high-pass samples")) return false;
 
-    ret = clEnqueueWriteBuffer(commandQueue, gpuHoopsHandle, CL_TRUE, 0, channels * sizeof(ChannelHoopsStruct), hoops, 0, nullptr, nullptr);
-    if (ret != CL_SUCCESS) qDebug() << "Error A2";
+        ret = clEnqueueWriteBuffer(commandQueue, gpuStartSearchPosHandle, CL_FALSE, 0, channels * sizeof(uint16_t), startSearchPos, 0, nullptr, nullptr);
+        if (!checkResult(ret, "Uploading spike search positions")) return false;
 
-    ret = clEnqueueWriteBuffer(commandQueue, gpuDatablockBuffHandle, CL_TRUE, 0, wordsPerBlock * sizeof(uint16_t), data, 0, nullptr, nullptr);
-    if (ret != CL_SUCCESS) qDebug() << "Error A3";
+        searchStateDirty = false;
+    }
 
-    ret = clEnqueueWriteBuffer(commandQueue, gpuPrevLast2BuffHandle, CL_TRUE, 0, channels * 20 * sizeof(float), prevLast2, 0, nullptr, nullptr);
-    if (ret != CL_SUCCESS) qDebug() << "Error A4";
+    if (activeChannelsDirty) {
+        if (!activeChannels.empty()) {
+            ret = clEnqueueWriteBuffer(commandQueue, gpuActiveChannelsHandle, CL_FALSE, 0, activeChannels.size() * sizeof(cl_uint),
+                                       activeChannels.data(), 0, nullptr, nullptr);
+            if (!checkResult(ret, "Uploading enabled channel list")) return false;
+        }
 
-    ret = clEnqueueWriteBuffer(commandQueue, gpuPrevHighHandle, CL_TRUE, 0, SnippetSize * channels * sizeof(uint16_t), parsedPrevHigh, 0, nullptr, nullptr);
-    if (ret != CL_SUCCESS) qDebug() << "Error A5";
+        // The host copies of these channels' state were cleared by AbstractXPUInterface::updateActiveChannels().
+        for (int c : resetChannels) {
+            ret = clEnqueueWriteBuffer(commandQueue, gpuPrevLast2BuffHandle, CL_FALSE, c * 20 * sizeof(float), 20 * sizeof(float),
+                                       prevLast2 + c * 20, 0, nullptr, nullptr);
+            if (!checkResult(ret, "Clearing filter state of a newly enabled channel")) return false;
 
-    ret = clEnqueueWriteBuffer(commandQueue, gpuStartSearchPosHandle, CL_TRUE, 0, channels * sizeof(uint16_t), startSearchPos, 0, nullptr, nullptr);
-    if (ret != CL_SUCCESS) qDebug() << "Error A7";
+            ret = clEnqueueWriteBuffer(commandQueue, gpuStartSearchPosHandle, CL_FALSE, c * sizeof(uint16_t), sizeof(uint16_t),
+                                       startSearchPos + c, 0, nullptr, nullptr);
+            if (!checkResult(ret, "Clearing spike search position of a newly enabled channel")) return false;
+        }
+        resetChannels.clear();
 
-    // Execute kernel
-    size_t globalItemSize = channels;
-    ret = clEnqueueNDRangeKernel(commandQueue, kernel, 1, nullptr, &globalItemSize, nullptr, 0, nullptr, nullptr);
-    if (ret != CL_SUCCESS) qDebug() << "clEnqueueNDRangeKernel() failed. Ret: " << ret;
+        activeChannelsDirty = false;
+    }
+    return true;
+}
 
-    // Read all outputs
-    ret = clEnqueueReadBuffer(commandQueue, gpuPrevLast2BuffHandle, CL_TRUE, 0, channels * 20 * sizeof(float), prevLast2, 0, nullptr, nullptr);
-    if (ret != CL_SUCCESS) qDebug() << "Error C0";
+// Stage one data block in pinned memory and upload it.  The previous block using this slot has already been read
+// back, so its kernel (and therefore its upload) is complete.
+bool GPUInterface::enqueueUpload(const uint16_t* data, int slot)
+{
+    memcpy(pinnedInput[slot], data, wordsPerBlock * sizeof(uint16_t));
+    ret = clEnqueueWriteBuffer(transferQueue, gpuDatablockBuffHandle[slot], CL_FALSE, 0, wordsPerBlock * sizeof(uint16_t), pinnedInput[slot],
+                               0, nullptr, &uploadDone[slot]);
+    return checkResult(ret, "Uploading a data block");
+}
 
-    ret = clEnqueueReadBuffer(commandQueue, gpuStartSearchPosHandle, CL_TRUE, 0, channels * sizeof(uint16_t), startSearchPos, 0, nullptr, nullptr);
-    if (ret != CL_SUCCESS) qDebug() << "Error C1";
+// Kernels run in order on commandQueue, so each one sees the filter state left by the previous block.
+bool GPUInterface::enqueueKernel(int slot)
+{
+    ret = clSetKernelArg(kernel, 3, sizeof(cl_mem), (void*)&gpuDatablockBuffHandle[slot]);
+    if (ret == CL_SUCCESS) ret = clSetKernelArg(kernel, 6, sizeof(cl_mem), (void*)&gpuLowBuffHandle[slot]);
+    if (ret == CL_SUCCESS) ret = clSetKernelArg(kernel, 7, sizeof(cl_mem), (void*)&gpuWideBuffHandle[slot]);
+    if (ret == CL_SUCCESS) ret = clSetKernelArg(kernel, 8, sizeof(cl_mem), (void*)&gpuHighBuffHandle[slot]);
+    if (ret == CL_SUCCESS) ret = clSetKernelArg(kernel, 9, sizeof(cl_mem), (void*)&gpuSpikeBuffHandle[slot]);
+    if (ret == CL_SUCCESS) ret = clSetKernelArg(kernel, 10, sizeof(cl_mem), (void*)&gpuSpikeIDsHandle[slot]);
+    cl_uint storeBands = (readbackLow ? 1 : 0) | (readbackHigh ? 2 : 0);
+    if (ret == CL_SUCCESS) ret = clSetKernelArg(kernel, 14, sizeof(cl_uint), (void*)&storeBands);
+    if (!checkResult(ret, "Setting kernel data block arguments")) return false;
+
+    // One work item per enabled channel.  With every channel disabled there is no work, but readback still waits on an
+    // event for this block.
+    size_t globalItemSize = activeChannels.size();
+    if (globalItemSize > 0) {
+        ret = clEnqueueNDRangeKernel(commandQueue, kernel, 1, nullptr, &globalItemSize, nullptr, 1, &uploadDone[slot], &kernelDone[slot]);
+        if (!checkResult(ret, "Enqueueing the filter kernel")) return false;
+    } else {
+        ret = clEnqueueMarkerWithWaitList(commandQueue, 1, &uploadDone[slot], &kernelDone[slot]);
+        if (!checkResult(ret, "Enqueueing a marker for a block with no enabled channels")) return false;
+    }
+
+    // Keep the last SnippetSize samples of high-pass output on the device for the next block's spike detection.
+    ret = clEnqueueCopyBuffer(commandQueue, gpuHighBuffHandle[slot], gpuPrevHighHandle, (FramesPerBlock - SnippetSize) * channels * sizeof(uint16_t), 0,
+                              SnippetSize * channels * sizeof(uint16_t), 0, nullptr, nullptr);
+    return checkResult(ret, "Copying high-pass samples for the next block");
+}
+
+bool GPUInterface::enqueueReadback(int slot)
+{
+    size_t chunkBytes = FramesPerBlock * channels * sizeof(uint16_t);
+    size_t spikeBytes = channels * SnippetsPerBlock * sizeof(uint32_t);
+    uint8_t* output = pinnedOutput[slot];
 
-    ret = clEnqueueReadBuffer(commandQueue, gpuLowBuffHandle, CL_TRUE, 0, FramesPerBlock * channels * sizeof(uint16_t), lowChunk, 0, nullptr, nullptr);
-    if (ret != CL_SUCCESS) qDebug() << "Error C2";
+    // transferQueue is in order, so only the first read needs to wait for the kernel.
+    ret = clEnqueueReadBuffer(transferQueue, gpuWideBuffHandle[slot], CL_FALSE, 0, chunkBytes, output + chunkBytes, 1, &kernelDone[slot], nullptr);
+    if (!checkResult(ret, "Reading back wideband data")) return false;
 
-    ret = clEnqueueReadBuffer(commandQueue, gpuWideBuffHandle, CL_TRUE, 0, FramesPerBlock * channels * sizeof(uint16_t), wideChunk, 0, nullptr, nullptr);
-    if (ret != CL_SUCCESS) qDebug() << "Error C3";
+    if (readbackLow) {
+        ret = clEnqueueReadBuffer(transferQueue, gpuLowBuffHandle[slot], CL_FALSE, 0, chunkBytes, output, 0, nullptr, nullptr);
+        if (!checkResult(ret, "Reading back low-pass data")) return false;
+    }
 
-    ret = clEnqueueReadBuffer(commandQueue, gpuHighBuffHandle, CL_TRUE, 0, FramesPerBlock * channels * sizeof(uint16_t), highChunk, 0, nullptr, nullptr);
-    if (ret != CL_SUCCESS) qDebug() << "Error C4";
+    if (readbackHigh) {
+        ret = clEnqueueReadBuffer(transferQueue, gpuHighBuffHandle[slot], CL_FALSE, 0, chunkBytes, output + 2 * chunkBytes, 0, nullptr, nullptr);
+        if (!checkResult(ret, "Reading back high-pass data")) return false;
+    }
 
-    ret = clEnqueueReadBuffer(commandQueue, gpuSpikeBuffHandle, CL_TRUE, 0, channels * SnippetsPerBlock * sizeof(uint32_t), spikeChunk, 0, nullptr, nullptr);
-    if (ret != CL_SUCCESS) qDebug() << "Error C5";
+    ret = clEnqueueReadBuffer(transferQueue, gpuSpikeBuffHandle[slot], CL_FALSE, 0, spikeBytes, output + 3 * chunkBytes, 0, nullptr, nullptr);
+    if (!checkResult(ret, "Reading back spike timestamps")) return false;
 
-    ret = clEnqueueReadBuffer(commandQueue, gpuSpikeIDsHandle, CL_TRUE, 0, channels * SnippetsPerBlock * sizeof(uint8_t), spikeIDChunk, 0, nullptr, nullptr);
-    if (ret != CL_SUCCESS) qDebug() << "Error C6";
+    ret = clEnqueueReadBuffer(transferQueue, gpuSpikeIDsHandle[slot], CL_FALSE, 0, channels * SnippetsPerBlock * sizeof(uint8_t),
+                              output + 3 * chunkBytes + spikeBytes, 0, nullptr, &readbackDone[slot]);
+    return checkResult(ret, "Reading back spike IDs");
+}
 
-    // Set the last 50 samples of high to parsedPrevHigh so that they can be used in the next data block.
-    parsedPrevHigh = &highChunk[(FramesPerBlock - SnippetSize) * channels];
+// Wait for one block's readback to complete, copy its outputs to the caller's arrays, and retire its events.
+bool GPUInterface::copyOutputs(int slot, uint16_t* lowChunk, uint16_t* wideChunk, uint16_t* highChunk, uint32_t* spikeChunk,
+                               uint8_t* spikeIDChunk)
+{
+    ret = clWaitForEvents(1, &readbackDone[slot]);
+    if (!checkResult(ret, "Waiting for readback")) return false;
+
+    size_t chunkBytes = FramesPerBlock * channels * sizeof(uint16_t);
+    size_t spikeBytes = channels * SnippetsPerBlock * sizeof(uint32_t);
+    const uint8_t* output = pinnedOutput[slot];
+    if (lowChunk) memcpy(lowChunk, output, chunkBytes);
+    memcpy(wideChunk, output + chunkBytes, chunkBytes);
+    if (highChunk) memcpy(highChunk, output + 2 * chunkBytes, chunkBytes);
+    memcpy(spikeChunk, output + 3 * chunkBytes, spikeBytes);
+    memcpy(spikeIDChunk, output + 3 * chunkBytes + spikeBytes, channels * SnippetsPerBlock * sizeof(uint8_t));
+    clearInactiveSpikes(spikeChunk, spikeIDChunk);
+
+    releaseEvents(slot);
+    return true;
 }
 
 void GPUInterface::speedTest()
@@ -131,40 +348,60 @@ void GPUInterface::initializeKernelMemory()
     hoops = new ChannelHoopsStruct[channels];
 
     globalParametersHandle = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(GlobalParamStruct), nullptr, &ret);
-    if (ret != CL_SUCCESS) qDebug() << "Error I0";
+    if (ret != CL_SUCCESS) qDebug() << "Error creating global parameters buffer. Ret: " << ret;
 
     filterParametersHandle = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(FilterParamStruct), nullptr, &ret);
-    if (ret != CL_SUCCESS) qDebug() << "Error I1";
+    if (ret != CL_SUCCESS) qDebug() << "Error creating filter parameters buffer. Ret: " << ret;
 
     gpuHoopsHandle = clCreateBuffer(context, CL_MEM_READ_ONLY, channels * sizeof(ChannelHoopsStruct), nullptr, &ret);
-    if (ret != CL_SUCCESS) qDebug() << "Error I2";
-
-    gpuDatablockBuffHandle = clCreateBuffer(context, CL_MEM_READ_ONLY, wordsPerBlock * sizeof(uint16_t), nullptr, &ret);
-    if (ret != CL_SUCCESS) qDebug() << "Error I3";
+    if (ret != CL_SUCCESS) qDebug() << "Error creating spike detection hoops buffer. Ret: " << ret;
 
     gpuPrevLast2BuffHandle = clCreateBuffer(context, CL_MEM_READ_WRITE, channels * 20 * sizeof(float), nullptr, &ret);
-    if (ret != CL_SUCCESS) qDebug() << "Error I4";
+    if (ret != CL_SUCCESS) qDebug() << "Error creating filter state buffer. Ret: " << ret;
 
-    gpuPrevHighHandle = clCreateBuffer(context, CL_MEM_READ_ONLY, SnippetSize * channels * sizeof(uint16_t), nullptr, &ret);
-    if (ret != CL_SUCCESS) qDebug() << "Error I5";
+    // Besides being read by the kernel, this is the destination of each block's high-pass tail copy.
+    gpuPrevHighHandle = clCreateBuffer(context, CL_MEM_READ_WRITE, SnippetSize * channels * sizeof(uint16_t), nullptr, &ret);
+    if (ret != CL_SUCCESS) qDebug() << "Error creating previous high-pass samples buffer. Ret: " << ret;
 
-    gpuLowBuffHandle = clCreateBuffer(context, CL_MEM_WRITE_ONLY, channels * FramesPerBlock * sizeof(uint16_t), nullptr, &ret);
-    if (ret != CL_SUCCESS) qDebug() << "Error I6";
+    gpuStartSearchPosHandle = clCreateBuffer(context, CL_MEM_READ_WRITE, channels * sizeof(uint16_t), nullptr, &ret);
+    if (ret != CL_SUCCESS) qDebug() << "Error creating spike search position buffer. Ret: " << ret;
 
-    gpuWideBuffHandle = clCreateBuffer(context, CL_MEM_WRITE_ONLY, channels * FramesPerBlock * sizeof(uint16_t), nullptr, &ret);
-    if (ret != CL_SUCCESS) qDebug() << "Error I7";
+    gpuActiveChannelsHandle = clCreateBuffer(context, CL_MEM_READ_ONLY, channels * sizeof(cl_uint), nullptr, &ret);
+    if (ret != CL_SUCCESS) qDebug() << "Error creating enabled channel list buffer. Ret: " << ret;
 
-    gpuHighBuffHandle = clCreateBuffer(context, CL_MEM_WRITE_ONLY, channels * FramesPerBlock * sizeof(uint16_t), nullptr, &ret);
-    if (ret != CL_SUCCESS) qDebug() << "Error I8";
+    size_t outputBytes = 3 * channels * FramesPerBlock * sizeof(uint16_t) + totalSnippetsPerBlock * (sizeof(uint32_t) + sizeof(uint8_t));
+    for (int slot = 0; slot < PipelineDepth; ++slot) {
+        gpuDatablockBuffHandle[slot] = clCreateBuffer(context, CL_MEM_READ_ONLY, wordsPerBlock * sizeof(uint16_t), nullptr, &ret);
+        if (ret != CL_SUCCESS) qDebug() << "Error creating data block buffer. Ret: " << ret;
 
-    gpuSpikeBuffHandle = clCreateBuffer(context, CL_MEM_WRITE_ONLY, totalSnippetsPerBlock * sizeof(uint32_t), nullptr, &ret);
-    if (ret != CL_SUCCESS) qDebug() << "Error I9";
+        gpuLowBuffHandle[slot] = clCreateBuffer(context, CL_MEM_WRITE_ONLY, channels * FramesPerBlock * sizeof(uint16_t), nullptr, &ret);
+        if (ret != CL_SUCCESS) qDebug() << "Error creating low-pass output buffer. Ret: " << ret;
 
-    gpuSpikeIDsHandle = clCreateBuffer(context, CL_MEM_WRITE_ONLY, totalSnippetsPerBlock * sizeof(uint8_t), nullptr, &ret);
-    if (ret != CL_SUCCESS) qDebug() << "Error I10";
+        gpuWideBuffHandle[slot] = clCreateBuffer(context, CL_MEM_WRITE_ONLY, channels * FramesPerBlock * sizeof(uint16_t), nullptr, &ret);
+        if (ret != CL_SUCCESS) qDebug() << "Error creating wideband output buffer. Ret: " << ret;
 
-    gpuStartSearchPosHandle = clCreateBuffer(context, CL_MEM_READ_WRITE, channels * sizeof(uint16_t), nullptr, &ret);
-    if (ret != CL_SUCCESS) qDebug() << "Error I11";
+        gpuHighBuffHandle[slot] = clCreateBuffer(context, CL_MEM_WRITE_ONLY, channels * FramesPerBlock * sizeof(uint16_t), nullptr, &ret);
+        if (ret != CL_SUCCESS) qDebug() << "Error creating high-pass output buffer. Ret: " << ret;
+
+        gpuSpikeBuffHandle[slot] = clCreateBuffer(context, CL_MEM_WRITE_ONLY, totalSnippetsPerBlock * sizeof(uint32_t), nullptr, &ret);
+        if (ret != CL_SUCCESS) qDebug() << "Error creating spike timestamp buffer. Ret: " << ret;
+
+        gpuSpikeIDsHandle[slot] = clCreateBuffer(context, CL_MEM_WRITE_ONLY, totalSnippetsPerBlock * sizeof(uint8_t), nullptr, &ret);
+        if (ret != CL_SUCCESS) qDebug() << "Error creating spike ID buffer. Ret: " << ret;
+
+        // CL_MEM_ALLOC_HOST_PTR asks the runtime for page-locked memory, which it can transfer without an extra copy.
+        pinnedInputHandle[slot] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, wordsPerBlock * sizeof(uint16_t), nullptr, &ret);
+        if (ret != CL_SUCCESS) qDebug() << "Error creating pinned input buffer. Ret: " << ret;
+        pinnedInput[slot] = (uint16_t*) clEnqueueMapBuffer(commandQueue, pinnedInputHandle[slot], CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0,
+                                                           wordsPerBlock * sizeof(uint16_t), 0, nullptr, nullptr, &ret);
+        if (ret != CL_SUCCESS) qDebug() << "Error mapping pinned input buffer. Ret: " << ret;
+
+        pinnedOutputHandle[slot] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, outputBytes, nullptr, &ret);
+        if (ret != CL_SUCCESS) qDebug() << "Error creating pinned output buffer. Ret: " << ret;
+        pinnedOutput[slot] = (uint8_t*) clEnqueueMapBuffer(commandQueue, pinnedOutputHandle[slot], CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0,
+                                                           outputBytes, 0, nullptr, nullptr, &ret);
+        if (ret != CL_SUCCESS) qDebug() << "Error mapping pinned output buffer. Ret: " << ret;
+    }
 
     // Initialize sources and sinks.
     spike = new uint32_t[totalSnippetsPerBlock * DiagnosticBlocks];
@@ -227,40 +464,31 @@ void GPUInterface::initializeKernelMemory()
 
     // Set kernel args.
     ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void*)&globalParametersHandle);
-    if (ret != CL_SUCCESS) qDebug() << "J0";
+    if (ret != CL_SUCCESS) qDebug() << "Error setting global parameters kernel argument. Ret: " << ret;
 
     ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), (void*)&filterParametersHandle);
-    if (ret != CL_SUCCESS) qDebug() << "J1";
+    if (ret != CL_SUCCESS) qDebug() << "Error setting filter parameters kernel argument. Ret: " << ret;
 
     ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), (void*)&gpuHoopsHandle);
-    if (ret != CL_SUCCESS) qDebug() << "J2";
-
-    ret = clSetKernelArg(kernel, 3, sizeof(cl_mem), (void*)&gpuDatablockBuffHandle);
-    if (ret != CL_SUCCESS) qDebug() << "J3";
+    if (ret != CL_SUCCESS) qDebug() << "Error setting spike detection hoops kernel argument. Ret: " << ret;
 
     ret = clSetKernelArg(kernel, 4, sizeof(cl_mem), (void*)&gpuPrevLast2BuffHandle);
-    if (ret != CL_SUCCESS) qDebug() << "J4";
+    if (ret != CL_SUCCESS) qDebug() << "Error setting filter state kernel argument. Ret: " << ret;
 
     ret = clSetKernelArg(kernel, 5, sizeof(cl_mem), (void*)&gpuPrevHighHandle);
-    if (ret != CL_SUCCESS) qDebug() << "J5";
-
-    ret = clSetKernelArg(kernel, 6, sizeof(cl_mem), (void*)&gpuLowBuffHandle);
-    if (ret != CL_SUCCESS) qDebug() << "J6";
-
-    ret = clSetKernelArg(kernel, 7, sizeof(cl_mem), (void*)&gpuWideBuffHandle);
-    if (ret != CL_SUCCESS) qDebug() << "J7";
+    if (ret != CL_SUCCESS) qDebug() << "Error setting previous high-pass samples kernel argument. Ret: " << ret;
 
-    ret = clSetKernelArg(kernel, 8, sizeof(cl_mem), (void*)&gpuHighBuffHandle);
-    if (ret != CL_SUCCESS) qDebug( )<< "J8";
+    // Arguments 3 and 6-10 (the data block and outputs) are set per block by enqueueKernel().
 
-    ret = clSetKernelArg(kernel, 9, sizeof(cl_mem), (void*)&gpuSpikeBuffHandle);
-    if (ret != CL_SUCCESS) qDebug() << "J9";
+    ret = clSetKernelArg(kernel, 11, sizeof(cl_mem), (void*)&gpuStartSearchPosHandle);
+    if (ret != CL_SUCCESS) qDebug() << "Error setting spike search position kernel argument. Ret: " << ret;
 
-    ret = clSetKernelArg(kernel, 10, sizeof(cl_mem), (void*)&gpuSpikeIDsHandle);
-    if (ret != CL_SUCCESS) qDebug() << "J10";
+    ret = clSetKernelArg(kernel, 12, sizeof(cl_mem), (void*)&gpuActiveChannelsHandle);
+    if (ret != CL_SUCCESS) qDebug() << "Error setting enabled channel list kernel argument. Ret: " << ret;
 
-    ret = clSetKernelArg(kernel, 11, sizeof(cl_mem), (void*)&gpuStartSearchPosHandle);
-    if (ret != CL_SUCCESS) qDebug() << "J11";
+    cl_uint numChannels = channels;
+    ret = clSetKernelArg(kernel, 13, sizeof(cl_uint), (void*)&numChannels);
+    if (ret != CL_SUCCESS) qDebug() << "Error setting channel count kernel argument. Ret: " << ret;
 
     // Populate global parameters.
     globalParameters.wordsPerFrame = wordsPerFrame;
@@ -280,6 +508,12 @@ void GPUInterface::initializeKernelMemory()
     }
     parsedPrevHigh = parsedPrevHighOriginal;
     inputIndex = 0, outputIndex = 0, spikeIndex = 0;
+
+    parametersDirty = true;
+    prevLast2Dirty = true;
+    searchStateDirty = true;
+    activeChannelsDirty = true;
+    resetChannels.clear();
     allocated = true;
 }
 
@@ -332,25 +566,40 @@ void GPUInterface::freeKernelMemory()
     ret = clFinish(commandQueue);
     if (ret != CL_SUCCESS) state->writeToLog("Error finishing command queue. Ret: " + QString::number(ret));
 
+    ret = clFinish(transferQueue);
+    if (ret != CL_SUCCESS) state->writeToLog("Error finishing transfer queue. Ret: " + QString::number(ret));
+
     ret = clReleaseKernel(kernel);
     if (ret != CL_SUCCESS) state->writeToLog("Error releasing kernel. Ret: " + QString::number(ret));
 
     ret = clReleaseProgram(program);
     if (ret != CL_SUCCESS) state->writeToLog("Error releasing program. Ret: " + QString::number(ret));
 
+    for (int slot = 0; slot < PipelineDepth; ++slot) {
+        clEnqueueUnmapMemObject(commandQueue, pinnedInputHandle[slot], pinnedInput[slot], 0, nullptr, nullptr);
+        clEnqueueUnmapMemObject(commandQueue, pinnedOutputHandle[slot], pinnedOutput[slot], 0, nullptr, nullptr);
+    }
+    clFinish(commandQueue);
+
     clReleaseMemObject(globalParametersHandle);
     clReleaseMemObject(filterParametersHandle);
     clReleaseMemObject(gpuHoopsHandle);
-    clReleaseMemObject(gpuDatablockBuffHandle);
     clReleaseMemObject(gpuPrevLast2BuffHandle);
     clReleaseMemObject(gpuPrevHighHandle);
-    clReleaseMemObject(gpuLowBuffHandle);
-    clReleaseMemObject(gpuWideBuffHandle);
-    clReleaseMemObject(gpuHighBuffHandle);
-    clReleaseMemObject(gpuSpikeBuffHandle);
-    clReleaseMemObject(gpuSpikeIDsHandle);
     clReleaseMemObject(gpuStartSearchPosHandle);
+    clReleaseMemObject(gpuActiveChannelsHandle);
+    for (int slot = 0; slot < PipelineDepth; ++slot) {
+        clReleaseMemObject(gpuDatablockBuffHandle[slot]);
+        clReleaseMemObject(gpuLowBuffHandle[slot]);
+        clReleaseMemObject(gpuWideBuffHandle[slot]);
+        clReleaseMemObject(gpuHighBuffHandle[slot]);
+        clReleaseMemObject(gpuSpikeBuffHandle[slot]);
+        clReleaseMemObject(gpuSpikeIDsHandle[slot]);
+        clReleaseMemObject(pinnedInputHandle[slot]);
+        clReleaseMemObject(pinnedOutputHandle[slot]);
+    }
 
+    clReleaseCommandQueue(transferQueue);
     clReleaseCommandQueue(commandQueue);
     clReleaseContext(context);
     state->writeToLog("Finished CL releases");
@@ -431,6 +680,7 @@ bool GPUInterface::findPlatformDevices()
             thisGPU.deviceId = deviceIds[device];
             thisGPU.platformId = platformIds[platformIndex];
             thisGPU.diagnosticTime = -1.0F;
+            thisGPU.batchedDiagnosticTime = -1.0F;
             thisGPU.rank = -1;
             thisGPU.used = false;
             state->gpuList.append(thisGPU);
@@ -551,6 +801,12 @@ bool GPUInterface::createKernel(int devIndex)
         gpuErrorMessage("Error creating OpenCL commandqueue. Returned error code: " + QString::number(ret));
         return false;
     }
+    transferQueue = clCreateCommandQueue(context, id, 0, &ret);
+    if (ret != CL_SUCCESS) {
+        state->writeToLog("Failure creating OpenCL transfer commandqueue. Ret: " + QString::number(ret));
+        gpuErrorMessage("Error creating OpenCL commandqueue. Returned error code: " + QString::number(ret));
+        return false;
+    }
     state->writeToLog("Completed clCreateCommandQueue");
 
     QString filename(qApp->applicationDirPath() + "/kernel.cl");
@@ -566,40 +822,56 @@ bool GPUInterface::createKernel(int devIndex)
 
     delete file;
 
-    state->writeToLog("About to call clCreateProgramWithSource()");
-
-    // Create a program from the kernel source.
-    program = clCreateProgramWithSource(context, 1, (const char**) &sourceStr, (const size_t*) &sourceSize, &ret);
-    if (ret != CL_SUCCESS) {
-        gpuErrorMessage(tr("Error creating OpenCL program."));
-        return false;
-    }
-    delete [] sourceStr;
-    state->writeToLog("Called clCreateProgramWithSource()");
-
-    state->writeToLog("About to call clBuildProgram()");
-    // Build the program.
-    //char options[] = "-cl-opt-disable";
-    //ret = clBuildProgram(program, 1, &id, options, nullptr, nullptr);
-    ret = clBuildProgram(program, 1, &id, nullptr, nullptr, nullptr);
-    if (ret != CL_SUCCESS) {
-
-        // Change for users to get more info on OpenCL build failure
-        size_t len = 0;
-        ret = clGetProgramBuildInfo(program, id, CL_PROGRAM_BUILD_LOG, 0, nullptr, &len);
-        char *buffer = new char[len];
-        ret = clGetProgramBuildInfo(program, id, CL_PROGRAM_BUILD_LOG, len, buffer, nullptr);
+    // Building kernel.cl from source can take several seconds, so the compiled binary is cached on disk.  The cache
+    // file name is a hash of everything the binary depends on; a changed device, driver, or kernel source simply
+    // misses the cache and is rebuilt.
+    QElapsedTimer programTimer;
+    programTimer.start();
+    QString cacheFilename = programCacheFilename(sourceStr, sourceSize);
+    bool loadedFromCache = loadProgramBinary(cacheFilename);
+    if (!loadedFromCache) {
+        state->writeToLog("About to call clCreateProgramWithSource()");
+
+        // Create a program from the kernel source.
+        program = clCreateProgramWithSource(context, 1, (const char**) &sourceStr, (const size_t*) &sourceSize, &ret);
         if (ret != CL_SUCCESS) {
-            gpuErrorMessage(tr("Error building OpenCL program... build log inaccessible"));
+            gpuErrorMessage(tr("Error creating OpenCL program."));
+            delete [] sourceStr;
+            return false;
         }
-        else {
-            QString errorString(buffer);
-            gpuErrorMessage("Error building OpenCL program... contents of build log:\n" + errorString);
+        state->writeToLog("Called clCreateProgramWithSource()");
+
+        state->writeToLog("About to call clBuildProgram()");
+        // Build the program.
+        //char options[] = "-cl-opt-disable";
+        //ret = clBuildProgram(program, 1, &id, options, nullptr, nullptr);
+        ret = clBuildProgram(program, 1, &id, nullptr, nullptr, nullptr);
+        if (ret != CL_SUCCESS) {
+
+            // Change for users to get more info on OpenCL build failure
+            size_t len = 0;
+            ret = clGetProgramBuildInfo(program, id, CL_PROGRAM_BUILD_LOG, 0, nullptr, &len);
+            char *buffer = new char[len];
+            ret = clGetProgramBuildInfo(program, id, CL_PROGRAM_BUILD_LOG, len, buffer, nullptr);
+            if (ret != CL_SUCCESS) {
+                gpuErrorMessage(tr("Error building OpenCL program... build log inaccessible"));
+            }
+            else {
+                QString errorString(buffer);
+                gpuErrorMessage("Error building OpenCL program... contents of build log:\n" + errorString);
+            }
+            delete [] buffer;
+            delete [] sourceStr;
+            return false;
         }
-        delete [] buffer;
-        return false;
+        state->writeToLog("Finished clBuildProgram(), reported success");
+
+        saveProgramBinary(cacheFilename);
     }
-    state->writeToLog("Finished clBuildProgram(), reported success");
+    delete [] sourceStr;
+    QString programTimeString = QString::number(programTimer.elapsed()) + " ms";
+    state->writeToLog("OpenCL program " + QString(loadedFromCache ? "loaded from cached binary" : "built from source") +
+                      " in " + programTimeString);
 
     // Create the OpenCL kernel.
     state->writeToLog("About to call clCreateKernel()");
@@ -609,7 +881,78 @@ bool GPUInterface::createKernel(int devIndex)
     return true;
 }
 
+QString GPUInterface::programCacheFilename(const char* source, size_t sourceSize) const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    const cl_device_info keyInfo[] = { CL_DEVICE_NAME, CL_DEVICE_VENDOR, CL_DEVICE_VERSION, CL_DRIVER_VERSION };
+    for (cl_device_info info : keyInfo) {
+        size_t size = 0;
+        clGetDeviceInfo(id, info, 0, nullptr, &size);
+        QByteArray value((qsizetype) size, '\0');
+        clGetDeviceInfo(id, info, size, value.data(), nullptr);
+        hash.addData(value);
+    }
+    hash.addData(QByteArrayView(source, (qsizetype) sourceSize));
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/kernels/" +
+           QString::fromLatin1(hash.result().toHex()) + ".bin";
+}
+
+bool GPUInterface::loadProgramBinary(const QString& filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+    QByteArray binary = file.readAll();
+    file.close();
+    if (binary.isEmpty()) return false;
+
+    size_t binarySize = binary.size();
+    const unsigned char* binaryData = (const unsigned char*) binary.constData();
+    cl_int binaryStatus = CL_SUCCESS;
+    program = clCreateProgramWithBinary(context, 1, &id, &binarySize, &binaryData, &binaryStatus, &ret);
+    if (ret != CL_SUCCESS || binaryStatus != CL_SUCCESS) {
+        state->writeToLog("Cached OpenCL program binary rejected. Ret: " + QString::number(ret));
+        if (program) clReleaseProgram(program);
+        QFile::remove(filename);
+        return false;
+    }
+    ret = clBuildProgram(program, 1, &id, nullptr, nullptr, nullptr);
+    if (ret != CL_SUCCESS) {
+        state->writeToLog("Building cached OpenCL program binary failed. Ret: " + QString::number(ret));
+        clReleaseProgram(program);
+        QFile::remove(filename);
+        return false;
+    }
+    return true;
+}
+
+void GPUInterface::saveProgramBinary(const QString& filename)
+{
+    size_t binarySize = 0;
+    ret = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(binarySize), &binarySize, nullptr);
+    if (ret != CL_SUCCESS || binarySize == 0) {
+        state->writeToLog("OpenCL program binary unavailable; not caching. Ret: " + QString::number(ret));
+        return;
+    }
+    QByteArray binary((qsizetype) binarySize, '\0');
+    unsigned char* binaryData = (unsigned char*) binary.data();
+    ret = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binaryData), &binaryData, nullptr);
+    if (ret != CL_SUCCESS) {
+        state->writeToLog("Error reading OpenCL program binary. Ret: " + QString::number(ret));
+        return;
+    }
+
+    // QSaveFile writes to a temporary file and renames it, so a concurrent or interrupted launch never sees a
+    // partial binary.
+    QDir().mkpath(QFileInfo(filename).absolutePath());
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly) || file.write(binary) != binary.size() || !file.commit()) {
+        state->writeToLog("Error writing OpenCL program binary cache " + filename);
+        return;
+    }
+    state->writeToLog("Cached OpenCL program binary in " + filename);
+}
+
 void GPUInterface::gpuErrorMessage(const QString& errorMessage)
 {
-    QMessageBox::warning(nullptr, tr("OpenCL Error"), errorMessage);
+    SystemState::showWarning(tr("OpenCL Error"), errorMessage);
 }
@@ -31,8 +31,6 @@
 #ifndef GPUINTERFACE_H
 #define GPUINTERFACE_H
 
-#include <QMessageBox>
-
 #include "abstractxpuinterface.h"
 
 class GPUInterface : public AbstractXPUInterface
@@ -43,18 +41,42 @@ public:
     ~GPUInterface();
 
     // Called within class in runDiagnostic(), and externally in waveformprocessorthread
-    void processDataBlock(uint16_t* data, uint16_t* lowChunk, uint16_t* wideChunk,
+    bool processDataBlock(uint16_t* data, uint16_t* lowChunk, uint16_t* wideChunk,
                           uint16_t* highChunk, uint32_t* spikeChunk, uint8_t* spikeIDChunk) override;
+    bool processDataBlocks(uint16_t* data, uint16_t* lowChunk, uint16_t* wideChunk, uint16_t* highChunk,
+                           uint32_t* spikeChunk, uint8_t* spikeIDChunk, int numBlocks) override;
+    void resetPrev() override;
     bool setupMemory() override;
     bool cleanupMemory() override;
     void speedTest() override;
 
+protected:
+    void updateHoopsVariables() override;
+    void updateConstChars() override;
+    void updateActiveChannels(const vector<int>& newlyActive) override;
+
 private:
+    // Device buffers and pinned host staging buffers are duplicated so that one block can be transferred while the
+    // previous block's kernel runs.  This needs at least two blocks per batch.
+    static const int PipelineDepth = 2;
+
     bool findPlatformDevices();
     void initializeKernelMemory();
     bool createKernel(int devIndex);
+    QString programCacheFilename(const char* source, size_t sourceSize) const;
+    bool loadProgramBinary(const QString& filename);
+    void saveProgramBinary(const QString& filename);
     void freeKernelMemory();
     void gpuErrorMessage(const QString& errorMessage);
+    bool checkResult(cl_int result, const char* operation);
+    bool abandonBatch();
+    void releaseEvents(int slot);
+    bool uploadChangedState();
+    bool enqueueUpload(const uint16_t* data, int slot);
+    bool enqueueKernel(int slot);
+    bool enqueueReadback(int slot);
+    bool copyOutputs(int slot, uint16_t* lowChunk, uint16_t* wideChunk, uint16_t* highChunk, uint32_t* spikeChunk,
+                     uint8_t* spikeIDChunk);
 
     cl_platform_id* platformIds;
     cl_device_id* deviceIds;
@@ -64,22 +86,49 @@ private:
     cl_bool deviceAvailable;
     cl_device_id id;
     cl_context context;
-    cl_command_queue commandQueue;
+    cl_command_queue commandQueue;      // parameter uploads and kernels
+    cl_command_queue transferQueue;     // data block uploads and output readback
     cl_program program;
     cl_kernel kernel;
 
     cl_mem globalParametersHandle;
     cl_mem filterParametersHandle;
     cl_mem gpuHoopsHandle;
-    cl_mem gpuDatablockBuffHandle;
+    cl_mem gpuDatablockBuffHandle[PipelineDepth];
     cl_mem gpuPrevLast2BuffHandle;
     cl_mem gpuPrevHighHandle;
-    cl_mem gpuLowBuffHandle;
-    cl_mem gpuWideBuffHandle;
-    cl_mem gpuHighBuffHandle;
-    cl_mem gpuSpikeBuffHandle;
-    cl_mem gpuSpikeIDsHandle;
+    cl_mem gpuLowBuffHandle[PipelineDepth];
+    cl_mem gpuWideBuffHandle[PipelineDepth];
+    cl_mem gpuHighBuffHandle[PipelineDepth];
+    cl_mem gpuSpikeBuffHandle[PipelineDepth];
+    cl_mem gpuSpikeIDsHandle[PipelineDepth];
     cl_mem gpuStartSearchPosHandle;
+    cl_mem gpuActiveChannelsHandle;
+
+    // Pinned host memory, mapped for as long as it is allocated.  Each output staging buffer holds low, wide, and
+    // high chunks followed by spikes and spike IDs.
+    cl_mem pinnedInputHandle[PipelineDepth];
+    cl_mem pinnedOutputHandle[PipelineDepth];
+    uint16_t* pinnedInput[PipelineDepth];
+    uint8_t* pinnedOutput[PipelineDepth];
+
+    cl_event uploadDone[PipelineDepth];
+    cl_event kernelDone[PipelineDepth];
+    cl_event readbackDone[PipelineDepth];
+
+    // Filter state (prevLast2, startSearchPos, and the previous block's high-pass tail) stays on the device between
+    // blocks; these flags mark host copies that must be uploaded before the next kernel.
+    bool parametersDirty;
+    bool prevLast2Dirty;
+    bool searchStateDirty;
+    bool activeChannelsDirty;
+
+    // Channels enabled since the last upload, whose filter and spike search state must be cleared on the device.
+    vector<int> resetChannels;
+
+    // Whether the current batch stores the low-pass and high-pass outputs on the device and reads them back.
+    bool readbackLow;
+    bool readbackHigh;
 };
 
 #endif // GPUINTERFACE_H
@@ -58,10 +58,21 @@ void XPUController::resetPrev()
     activeInterface->resetPrev();
 }
 
-void XPUController::processDataBlock(uint16_t *data, uint16_t *lowChunk, uint16_t *wideChunk,
+bool XPUController::processDataBlock(uint16_t *data, uint16_t *lowChunk, uint16_t *wideChunk,
                                           uint16_t *highChunk, uint32_t *spikeChunk, uint8_t *spikeIDChunk)
 {
-    activeInterface->processDataBlock(data, lowChunk, wideChunk, highChunk, spikeChunk, spikeIDChunk);
+    return activeInterface->processDataBlock(data, lowChunk, wideChunk, highChunk, spikeChunk, spikeIDChunk);
+}
+
+bool XPUController::processDataBlocks(uint16_t *data, uint16_t *lowChunk, uint16_t *wideChunk, uint16_t *highChunk,
+                                      uint32_t *spikeChunk, uint8_t *spikeIDChunk, int numBlocks)
+{
+    return activeInterface->processDataBlocks(data, lowChunk, wideChunk, highChunk, spikeChunk, spikeIDChunk, numBlocks);
+}
+
+QString XPUController::processingErrorMessage() const
+{
+    return activeInterface->processingErrorMessage();
 }
 
 void XPUController::updateNumStreams(int numStreams)
@@ -80,6 +91,21 @@ void XPUController::runDiagnostic()
         gpuInterface->speedTest();
     }
     compare();
+
+    // Report throughput of each XPU, one block per call and in batches.
+    auto report = [this](const CPUInfo& info) {
+        if (info.diagnosticTime <= 0.0f || info.batchedDiagnosticTime <= 0.0f) return;
+        double blocksPerSecond = 1000.0 * AbstractXPUInterface::DiagnosticBlocks / info.diagnosticTime;
+        double batchedBlocksPerSecond = 1000.0 * AbstractXPUInterface::DiagnosticBlocks / info.batchedDiagnosticTime;
+        QString line = info.name + ": " + QString::number(blocksPerSecond, 'f', 0) + " blocks/s one at a time, " +
+                QString::number(batchedBlocksPerSecond, 'f', 0) + " blocks/s in batches of " +
+                QString::number(MaxNumBlocksToProcess);
+        state->writeToLog(line);
+    };
+    report(state->cpuInfo);
+    for (const GPUInfo& gpu : state->gpuList) {
+        report(gpu);
+    }
 }
 
 void XPUController::compare()
@@ -133,5 +159,7 @@ void XPUController::updateFromState()
         }
         activeInterface->setupMemory();
     }
+    cpuInterface->setThreading((int) state->cpuProcessingThreads->getNumericValue(),
+                               state->pinCPUProcessingThreads->getValue());
     activeInterface->updateFromState();
 }
@@ -45,8 +45,11 @@ public:
     ~XPUController();
 
     void resetPrev();
-    void processDataBlock(uint16_t* data, uint16_t* lowChunk, uint16_t* wideChunk,
+    bool processDataBlock(uint16_t* data, uint16_t* lowChunk, uint16_t* wideChunk,
                           uint16_t* highChunk, uint32_t* spikeChunk, uint8_t* spikeIDChunk);
+    bool processDataBlocks(uint16_t* data, uint16_t* lowChunk, uint16_t* wideChunk, uint16_t* highChunk,
+                           uint32_t* spikeChunk, uint8_t* spikeIDChunk, int numBlocks);
+    QString processingErrorMessage() const;
     void updateNumStreams(int numStreams);
     void runDiagnostic();
 
@@ -56,6 +56,7 @@ Channel::Channel(SignalType signalType_, const QString &customChannelName_, cons
     outputToTcp(nullptr),
     outputToTcpLow(nullptr),
     outputToTcpHigh(nullptr),
+    outputToTcpLfp(nullptr),
     outputToTcpSpike(nullptr),
     outputToTcpDc(nullptr),
     outputToTcpStim(nullptr),
@@ -86,6 +87,7 @@ Channel::Channel(SignalType signalType_, const QString &customChannelName_, cons
         spikeThreshold = new IntRangeItem("SpikeThresholdMicroVolts", channelItems, state, -5000, 5000, -70, XMLGroupSpikeSettings);
         outputToTcpLow = new BooleanItem("TCPDataOutputEnabledLow", channelItems, state, false, XMLGroupNone);
         outputToTcpHigh = new BooleanItem("TCPDataOutputEnabledHigh", channelItems, state, false, XMLGroupNone);
+        outputToTcpLfp = new BooleanItem("TCPDataOutputEnabledLfp", channelItems, state, false, XMLGroupNone);
         outputToTcpSpike = new BooleanItem("TCPDataOutputEnabledSpike", channelItems, state, false, XMLGroupNone);
         outputToTcpDc = new BooleanItem("TCPDataOutputEnabledDC", channelItems, state, false, XMLGroupNone, TypeDependencyStim);
         outputToTcpStim = new BooleanItem("TCPDataOutputEnabledStim", channelItems, state, false, XMLGroupNone, TypeDependencyStim);
@@ -146,6 +148,7 @@ QStringList Channel::getTcpBandNames() const
         if (getSignalType() == AmplifierSignal) {
             if (outputToTcpLow->getValue()) tcpBandNames.append(nativeChannelName->getValue() + "|LOW");
             if (outputToTcpHigh->getValue()) tcpBandNames.append(nativeChannelName->getValue() + "|HIGH");
+            if (outputToTcpLfp->getValue()) tcpBandNames.append(nativeChannelName->getValue() + "|LFP");
             if (outputToTcpSpike->getValue()) tcpBandNames.append(nativeChannelName->getValue() + "|SPK");
             // We're treating spike differently through tcp, so don't append the SPK name here
             if (state->getControllerTypeEnum() == ControllerStimRecord) {
@@ -260,6 +263,7 @@ void Channel::clearTCPDataOutput()
     if (signalType == AmplifierSignal) {
         outputToTcpLow->setValue(false);
         outputToTcpHigh->setValue(false);
+        outputToTcpLfp->setValue(false);
         outputToTcpSpike->setValue(false);
         if (state->getControllerTypeEnum() == ControllerStimRecord) {
             outputToTcpDc->setValue(false);
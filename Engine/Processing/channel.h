@@ -109,6 +109,8 @@ public:
     void setOutputToTcpLow(bool output) { outputToTcpLow->setValue(output); }
     bool getOutputToTcpHigh() const { return outputToTcpHigh->getValue(); }
     void setOutputToTcpHigh(bool output) { outputToTcpHigh->setValue(output); }
+    bool getOutputToTcpLfp() const { return outputToTcpLfp->getValue(); }
+    void setOutputToTcpLfp(bool output) { outputToTcpLfp->setValue(output); }
     bool getOutputToTcpSpike() const { return outputToTcpSpike->getValue(); }
     void setOutputToTcpSpike(bool output) { outputToTcpSpike->setValue(output); }
     bool getOutputToTcpDc() const { return outputToTcpDc->getValue(); }
@@ -147,6 +149,7 @@ private:
     BooleanItem *outputToTcp;  // Wideband for amplifier channels, unfiltered for all other channels
     BooleanItem *outputToTcpLow;  // Only applies to amplifier channels
     BooleanItem *outputToTcpHigh;  // Only applies to amplifier channels
+    BooleanItem *outputToTcpLfp;  // Only applies to amplifier channels
     BooleanItem *outputToTcpSpike;  // Only applies to amplifier channels
     BooleanItem *outputToTcpDc;  // Only applies to Stim amplifier channels
     BooleanItem *outputToTcpStim;  // Only applies to Stim amplifier channels
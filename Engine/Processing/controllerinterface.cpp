@@ -57,6 +57,9 @@ ControllerInterface::ControllerInterface(SystemState* state_, AbstractRHXControl
     spikeSortingDialog(nullptr),
     audioThread(nullptr),
     saveToDiskThread(nullptr),
+    lowpassBandInUse(true),
+    highpassBandInUse(true),
+    lfpBandInUse(false),
     is7310(is7310_)
 {
     openController(boardSerialNumber);
@@ -105,7 +108,9 @@ ControllerInterface::ControllerInterface(SystemState* state_, AbstractRHXControl
     double samplesPerDataBlock = (double) RHXDataBlock::samplesPerDataBlock(state->getControllerTypeEnum());
     int waveformFifoMemoryDataBlocks = ceil(waveformMemoryInSeconds * sampleRate / samplesPerDataBlock);
     int waveformFifoBufferDataBlocks = ceil((waveformMemoryInSeconds + waveformExtraBufferInSeconds) * sampleRate / samplesPerDataBlock);
-    waveformFifo = new WaveformFifo(state->signalSources, waveformFifoBufferDataBlocks, waveformFifoMemoryDataBlocks, 1, state);
+    // Round up to a multiple of the largest processing batch so that batched writes never overhang the end of the buffer.
+    waveformFifoBufferDataBlocks = MaxNumBlocksToProcess * ((waveformFifoBufferDataBlocks + MaxNumBlocksToProcess - 1) / MaxNumBlocksToProcess);
+    waveformFifo = new WaveformFifo(state->signalSources, waveformFifoBufferDataBlocks, waveformFifoMemoryDataBlocks, MaxNumBlocksToProcess, state);
     if (!waveformFifo->memoryWasAllocated(memoryRequired)) {
         outOfMemoryError(memoryRequired);
     }
@@ -188,6 +193,67 @@ void ControllerInterface::updateFromState()
     if (!tcpDataOutputEnabled && state->running && state->getTCPDataOutputChannels().length() > 0) {
         runTCPDataOutputThread();
     }
+
+    updateFilterBandsInUse();
+}
+
+// Determine which of the lowpass, highpass, and LFP amplifier bands are read by the display, audio, disk, or TCP, so
+// the waveform processor can skip the others.  Spike detection does not need the highpass band to be stored.  Without
+// downsampling, the LFP band is read from the lowpass band.  The display also loads bands it is not showing, and data
+// from before a band was enabled reads as zero (see WaveformFifo::getStoredGpuAmplifierRange()).  When the CPU enables
+// the lowpass band again, its filter restarts from zero, with the same start-up transient as at the start of a run.
+void ControllerInterface::updateFilterBandsInUse()
+{
+    lowpassBandInUse = false;
+    highpassBandInUse = false;
+    lfpBandInUse = false;
+    bool lfpDecimated = state->lowpassWaveformDownsampleRate->getNumericValue() > 1.0;
+
+    DiscreteItemList* filterDisplays[4] = { state->filterDisplay1, state->filterDisplay2, state->filterDisplay3, state->filterDisplay4 };
+    for (DiscreteItemList* filterDisplay : filterDisplays) {
+        QString band = filterDisplay->getDisplayValueString();
+        if (band == "LOW") lowpassBandInUse = true;
+        else if (band == "HIGH") highpassBandInUse = true;
+    }
+
+    if (state->audioEnabled->getValue()) {
+        QString band = state->audioFilter->getDisplayValueString();
+        if (band == "LOW") lowpassBandInUse = true;
+        else if (band == "HIGH") highpassBandInUse = true;
+    }
+
+    // The traditional file format saves wideband amplifier data only, and raw frame recordings save no filtered bands.
+    if (state->getFileFormatEnum() != FileFormatIntan && state->getFileFormatEnum() != FileFormatRawFrames) {
+        if (state->saveLowpassAmplifierWaveforms->getValue()) {
+            if (lfpDecimated) lfpBandInUse = true;
+            else lowpassBandInUse = true;
+        }
+        if (state->saveHighpassAmplifierWaveforms->getValue()) highpassBandInUse = true;
+        if (state->saveSpikeData->getValue() && state->saveSpikeSnapshots->getValue()) highpassBandInUse = true;
+    }
+
+    vector<string> waveNameList = state->signalSources->amplifierChannelsNameList();
+    for (int i = 0; i < (int) waveNameList.size() && !(lowpassBandInUse && highpassBandInUse && lfpBandInUse); ++i) {
+        Channel* channel = state->signalSources->channelByName(waveNameList[i]);
+        if (channel) {
+            if (channel->getOutputToTcpLow()) lowpassBandInUse = true;
+            if (channel->getOutputToTcpHigh()) highpassBandInUse = true;
+            if (channel->getOutputToTcpLfp()) {
+                if (lfpDecimated) lfpBandInUse = true;
+                else lowpassBandInUse = true;
+            }
+        }
+    }
+
+    enableFilterBandsInUse();
+}
+
+// The spike scope is checked separately, since opening it does not change any state item.
+void ControllerInterface::enableFilterBandsInUse()
+{
+    bool spikeScopeOpen = spikeSortingDialog && spikeSortingDialog->isVisible();
+    waveformFifo->setFilterBandsEnabled(lowpassBandInUse, highpassBandInUse || spikeScopeOpen);
+    waveformFifo->setLfpBandEnabled(lfpBandInUse);
 }
 
 void ControllerInterface::toggleAudioThread(bool enabled)
@@ -255,7 +321,7 @@ void ControllerInterface::rescanPorts(bool updateDisplay)
     } else {
         vector<int> portIndex, commandStream, numChannelsOnPort;
         numDataStreams = scanPorts(state->chipType, portIndex, commandStream, numChannelsOnPort);
-        addAmplifierChannels(state->chipType, portIndex, commandStream, numChannelsOnPort);
+        state->signalSources->addAmplifierChannels(state->chipType, portIndex, commandStream, numChannelsOnPort);
         setManualCableDelays();
     }
 
@@ -342,102 +408,6 @@ int ControllerInterface::scanPorts(vector<ChipType> &chipType, vector<int> &port
     return numDataStreams;
 }
 
-void ControllerInterface::addAmplifierChannels(const vector<ChipType> &chipType, const vector<int> &portIndex,
-                                               const vector<int> &commandStream, const vector<int> &numChannelsOnPort)
-{
-    state->signalSources->undoManager->clearUndoStack();
-
-    int numDataStreams = (int) chipType.size();
-
-    for (int port = 0; port < state->numSPIPorts; port++) {
-        SignalGroup* group = state->signalSources->portGroupByIndex(port);
-        if (numChannelsOnPort[port] == 0) {
-            group->removeAllChannels();
-            group->setEnabled(false);
-        } else if (group->numChannels(AmplifierSignal) != numChannelsOnPort[port]) {
-            // If number of channels on port has changed...
-            group->removeAllChannels();  // ...clear existing channels...
-            group->setEnabled(true);
-            // ...and create new ones.
-            int channel = 0;
-            // Create amplifier channels for each chip.
-            for (int stream = 0; stream < numDataStreams; stream++) {
-                if (portIndex[stream] == port) {
-                    if (chipType[stream] == RHD2216Chip ||
-                        chipType[stream] == RHS2116Chip) {
-                        for (int i = 0; i < 16; i++) {
-                            group->addAmplifierChannel(channel, stream, commandStream[stream], i);
-                            channel++;
-                        }
-                    } else if (chipType[stream] == RHD2132Chip ||
-                               chipType[stream] == RHD2164Chip ||
-                               chipType[stream] == RHD2164MISOBChip) {
-                        for (int i = 0; i < 32; i++) {
-                            group->addAmplifierChannel(channel, stream, commandStream[stream], i);
-                            channel++;
-                        }
-                    }
-                }
-            }
-            //  Now create auxiliary input channels and supply voltage channels for each chip.
-            int auxName = 1;
-            int vddName = 1;
-            for (int stream = 0; stream < numDataStreams; stream++) {
-                if (portIndex[stream] == port) {
-                    if (chipType[stream] == RHD2216Chip ||
-                        chipType[stream] == RHD2132Chip ||
-                        chipType[stream] == RHD2164Chip) {
-                        group->addAuxInputChannel(channel++, stream, 0, auxName++);
-                        group->addAuxInputChannel(channel++, stream, 1, auxName++);
-                        group->addAuxInputChannel(channel++, stream, 2, auxName++);
-                        group->addSupplyVoltageChannel(channel++, stream, vddName++);
-                    }
-                }
-            }
-        } else {    // If number of channels on port has not changed, don't create new channels (since this
-                    // would clear all user-defined channel names.  But we must update the data stream indices
-                    // on the port.
-            int channel = 0;
-            // Update stream indices for amplifier channels.
-            for (int stream = 0; stream < numDataStreams; stream++) {
-                if (portIndex[stream] == port) {
-                    if (chipType[stream] == RHD2216Chip ||
-                        chipType[stream] == RHS2116Chip) {
-                        for (int i = channel; i < channel + 16; i++) {
-                            Channel* channel = group->channelByIndex(i);
-                            channel->setBoardStream(stream);
-                            channel->setCommandStream(commandStream[stream]);
-                        }
-                        channel += 16;
-                    } else if (chipType[stream] == RHD2132Chip ||
-                               chipType[stream] == RHD2164Chip ||
-                               chipType[stream] == RHD2164MISOBChip) {
-                        for (int i = channel; i < channel + 32; i++) {
-                            Channel* channel = group->channelByIndex(i);
-                            channel->setBoardStream(stream);
-                            channel->setCommandStream(commandStream[stream]);
-                        }
-                        channel += 32;
-                    }
-                }
-            }
-            // Update stream indices for auxiliary channels and supply voltage channels.
-            for (int stream = 0; stream < numDataStreams; ++stream) {
-                if (portIndex[stream] == port) {
-                    if (chipType[stream] == RHD2216Chip ||
-                        chipType[stream] == RHD2132Chip ||
-                        chipType[stream] == RHD2164Chip) {
-                        group->channelByIndex(channel++)->setBoardStream(stream);
-                        group->channelByIndex(channel++)->setBoardStream(stream);
-                        group->channelByIndex(channel++)->setBoardStream(stream);
-                        group->channelByIndex(channel++)->setBoardStream(stream);
-                   }
-                }
-            }
-        }
-    }
-}
-
 void ControllerInterface::enablePlaybackChannels()
 {
     if (!dataFileReader) return;
@@ -750,6 +720,18 @@ void ControllerInterface::runController()
         return;
     }
 
+    // The LFP downsample factor cannot change while running, so the LFP buffer is sized before any thread starts.
+    waveformFifo->setLfpDownsampleFactor((int) state->lowpassWaveformDownsampleRate->getNumericValue());
+
+    // Likewise, the raw frame buffer is sized for the enabled data streams, and is freed when raw frames are not saved.
+    int rawFrameWords = 0;
+    if (state->getFileFormatEnum() == FileFormatRawFrames) {
+        ControllerType type = state->getControllerTypeEnum();
+        rawFrameWords = RHXDataBlock::dataBlockSizeInWords(type, rhxController->getNumEnabledDataStreams()) /
+                RHXDataBlock::samplesPerDataBlock(type);
+    }
+    waveformFifo->setRawFrameWords(rawFrameWords);
+
     usbDataThread->start();
     waveformProcessorThread->start();
     saveToDiskThread->start();
@@ -780,6 +762,7 @@ void ControllerInterface::runController()
     currentSweepPosition = 0;
     waveformFifo->resetBuffer();  // Clear any memory in waveform FIFO from previous running.
     display->reset();
+    updateFilterBandsInUse();
 
     int triggerWaitNotify = 0;
     YScaleUsed yScaleUsed;
@@ -877,6 +860,7 @@ void ControllerInterface::runController()
             if (psthDialog) psthDialog->updatePSTH(waveformFifo, numSamples);
             if (spectrogramDialog) spectrogramDialog->updateSpectrogram(waveformFifo, numSamples);
             if (spikeSortingDialog) spikeSortingDialog->updateSpikeScope(waveformFifo, numSamples);
+            enableFilterBandsInUse();
 
             waveformFifo->freeOldData(WaveformFifo::ReaderDisplay);
 
@@ -954,6 +938,10 @@ void ControllerInterface::runController()
     while (usbDataThread->isActive()) { // Important: Must wait for usbDataThread to fully stop before we reset usbStreamFifo buffer!
         qApp->processEvents(); // Stay responsive to GUI events during this loop.
     }
+    if (usbDataThread->resyncCount() > 0) {
+        state->writeToLog("USB data: " + QString::number(usbDataThread->resyncCount()) + " header resynchronizations, " +
+                          QString::number(usbDataThread->bytesDiscardedCount()) + " bytes discarded");
+    }
     QThread::usleep(1000); // Pause briefly to make sure tail end of data gets through waveformProcessorThread before it is also destroyed
 
     waveformProcessorThread->stopRunning();
@@ -999,6 +987,7 @@ void ControllerInterface::runControllerSilently(double nSeconds, QProgressDialog
     waveformProcessorThread->startRunning(rhxController->getNumEnabledDataStreams());
 
     waveformFifo->resetBuffer();  // Clear any memory in waveform FIFO from previous running.
+    waveformFifo->setFilterBandsEnabled(true, true);  // Measurements made after a silent run may read any band.
 
     QElapsedTimer mainTimer, tickTimer;
     mainTimer.start();
@@ -123,6 +123,9 @@ public:
     void setExternalFastSettleChannel(int channel);
 
     SaveToDiskThread* saveThread() const { return saveToDiskThread; }
+    WaveformProcessorThread* waveformThread() const { return waveformProcessorThread; }
+    XPUController* xpu() const { return xpuController; }
+    WaveformFifo* waveforms() const { return waveformFifo; }
 
     QString playbackFileName() const;
     QString currentTimePlaybackFile() const;
@@ -170,11 +173,12 @@ private:
     void initializeController();
     int scanPorts(vector<ChipType> &chipType, vector<int> &portIndex, vector<int> &commandStream,
                   vector<int> &numChannelsOnPort);
-    void addAmplifierChannels(const vector<ChipType> &chipType, const vector<int> &portIndex,
-                              const vector<int> &commandStream, const vector<int> &numChannelsOnPort);
     void enablePlaybackChannels();
     void addPlaybackHeadstageChannels();
 
+    void updateFilterBandsInUse();
+    void enableFilterBandsInUse();
+
     void sendTCPError(QString errorMessage);
     void pipeReadErrorMessage(int errorID);
 
@@ -205,6 +209,11 @@ private:
     bool audioEnabled;
     bool tcpDataOutputEnabled;
 
+    // Whether any consumer other than the spike scope reads the lowpass, highpass, or decimated LFP amplifier band.
+    bool lowpassBandInUse;
+    bool highpassBandInUse;
+    bool lfpBandInUse;
+
     QString currentAudioChannel;
 
     double hardwareFifoPercentFull;
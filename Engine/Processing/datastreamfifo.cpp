@@ -41,7 +41,11 @@ using namespace std;
 // be read using readFromBuffer(), then maxReadLength can be omitted.
 DataStreamFifo::DataStreamFifo(int bufferSize_, int maxReadLength_) :
     bufferSize(bufferSize_),
-    maxReadLength(maxReadLength_)
+    maxReadLength(maxReadLength_),
+    usedWords(0),
+    writeSequence(0),
+    readerWaiting(false),
+    wakeRequested(false)
 {
     int bufferSizeWithExtra = bufferSize + maxReadLength;
     memoryNeededGB = sizeof(uint16_t) * bufferSizeWithExtra / (1024.0 * 1024.0 * 1024.0);
@@ -67,51 +71,113 @@ DataStreamFifo::~DataStreamFifo()
     delete [] buffer;
 }
 
+// Make numWords newly written words visible to the reader, waking it only if it is blocked in
+// waitForData().
+void DataStreamFifo::publish(int numWords)
+{
+    usedWords.fetch_add(numWords);
+    writeSequence.fetch_add(1);
+    if (readerWaiting.load()) {
+        writeSequence.notify_one();
+    }
+}
+
 bool DataStreamFifo::writeToBuffer(const uint8_t* dataSource, int numWords)
 {
-    const uint8_t* pRead = dataSource;
-    uint16_t highByte, lowByte;
-
-    if (freeWords.tryAcquire(numWords)) {
-        for (int i = 0; i < numWords; ++i) {
-            // TODO: Try using bitfields or unions to speed up 2 x byte --> uint16.
-            lowByte = (uint16_t) (*pRead);
-            pRead++;
-            highByte = (uint16_t) (*pRead);
-            pRead++;
-            buffer[bufferWriteIndex++] = lowByte | (highByte << 8);
-            if (bufferWriteIndex >= bufferSize) {
+    int freeWords = bufferSize - usedWords.load(std::memory_order_acquire);
+    if (numWords <= freeWords) {
+        // USB data arrives as little-endian 16-bit words, which matches the in-memory layout of uint16_t
+        // on all supported platforms, so the words can be copied directly.
+        if (bufferWriteIndex + numWords <= bufferSize) {
+            std::memcpy(&buffer[bufferWriteIndex], dataSource, BytesPerWord * numWords);
+            bufferWriteIndex += numWords;
+            if (bufferWriteIndex == bufferSize) {
                 bufferWriteIndex = 0;
             }
+        } else {
+            int numWordsFirstPart = bufferSize - bufferWriteIndex;
+            std::memcpy(&buffer[bufferWriteIndex], dataSource, BytesPerWord * numWordsFirstPart);
+            int numWordsSecondPart = numWords - numWordsFirstPart;
+            std::memcpy(buffer, dataSource + BytesPerWord * numWordsFirstPart, BytesPerWord * numWordsSecondPart);
+            bufferWriteIndex = numWordsSecondPart;
         }
-        usedWords.release(numWords);
+        publish(numWords);
         return true;
     } else {
         cerr << "DataStreamFifo: Buffer overrun on request of " << numWords << " words." << '\n';
-        cerr << "   ...only " << freeWords.available() << " words are available." << '\n';
+        cerr << "   ...only " << freeWords << " words are available." << '\n';
         return false;  // Buffer overrun error
     }
 }
 
+// Alternate method of writing data: Return a pointer to a contiguous region of free space in the
+// circular buffer so the producer can assemble data in place without a staging copy.  If the region
+// extends beyond the 'end' of the buffer, the extra space allocated for pointerToData() is used and
+// the overhang is moved to the start of the buffer in commitWrite().  We assume that the user will
+// call commitWrite() after writing numWordsToBeWritten_ words to this location.
+// This method returns nullptr if there is insufficient free space in the circular buffer.
+uint16_t* DataStreamFifo::pointerToWriteSpace(int numWordsToBeWritten_)
+{
+    if (numWordsToBeWritten_ > maxReadLength) {
+        cerr << "DataStreamFifo::pointerToWriteSpace: numWordsToBeWritten exceeds maxReadLength." << '\n';
+        return nullptr;
+    }
+    int freeWords = bufferSize - usedWords.load(std::memory_order_acquire);
+    if (numWordsToBeWritten_ > freeWords) {
+        cerr << "DataStreamFifo: Buffer overrun on request of " << numWordsToBeWritten_ << " words." << '\n';
+        cerr << "   ...only " << freeWords << " words are available." << '\n';
+        return nullptr;  // Buffer overrun error
+    }
+    numWordsToBeWritten = numWordsToBeWritten_;
+    return &buffer[bufferWriteIndex];
+}
+
+// This function should only be called after first calling pointerToWriteSpace() and then writing
+// data to the location returned by that pointer.
+void DataStreamFifo::commitWrite()
+{
+    commitWrite(numWordsToBeWritten);
+}
+
+// Commit only the first numWordsWritten words of the space returned by pointerToWriteSpace(), for
+// producers that lease space for the most data they might write.
+void DataStreamFifo::commitWrite(int numWordsWritten)
+{
+    if (numWordsWritten > numWordsToBeWritten) {
+        cerr << "DataStreamFifo::commitWrite: numWordsWritten exceeds space requested." << '\n';
+        numWordsWritten = numWordsToBeWritten;
+    }
+    numWordsToBeWritten = numWordsWritten;
+    if (bufferWriteIndex + numWordsToBeWritten > bufferSize) {
+        // Words written past the 'end' of the buffer belong at the start.  These indices are free, so
+        // they cannot overlap data the reader has mirrored into the extra space.
+        int extraWords = bufferWriteIndex + numWordsToBeWritten - bufferSize;
+        std::memcpy(&buffer[0], &buffer[bufferSize], BytesPerWord * extraWords);
+    }
+    bufferWriteIndex = (bufferWriteIndex + numWordsToBeWritten) % bufferSize;
+    publish(numWordsToBeWritten);
+    numWordsToBeWritten = 0;
+}
+
 bool DataStreamFifo::dataAvailable(unsigned int numWords) const
 {
-    return ((unsigned int)(usedWords.available()) >= numWords);
+    return ((unsigned int)(usedWords.load(std::memory_order_acquire)) >= numWords);
 }
 
 int DataStreamFifo::wordsAvailable() const
 {
-    return usedWords.available();
+    return usedWords.load(std::memory_order_relaxed);
 }
 
 double DataStreamFifo::percentFull() const
 {
-    return 100.0 * ((double)usedWords.available() / (double)bufferSize);
+    return 100.0 * ((double)usedWords.load(std::memory_order_relaxed) / (double)bufferSize);
 }
 
 // Copy numWords of data from the circular buffer to memory location dataSink.
 bool DataStreamFifo::readFromBuffer(uint16_t *dataSink, int numWords)
 {
-    if (!usedWords.tryAcquire(numWords)) {
+    if (usedWords.load(std::memory_order_acquire) < numWords) {
         return false;  // Not enough data available in buffer
     }
 
@@ -129,7 +195,7 @@ bool DataStreamFifo::readFromBuffer(uint16_t *dataSink, int numWords)
         std::memcpy(&dataSink[numWordsFirstPart], buffer, BytesPerWord * numWordsSecondPart);
         bufferReadIndex = numWordsSecondPart;
     }
-    freeWords.release(numWords);
+    usedWords.fetch_sub(numWords, std::memory_order_release);
     return true;
 }
 
@@ -144,7 +210,7 @@ uint16_t* DataStreamFifo::pointerToData(int numWordsBeToRead_)
         cerr << "DataStreamFifo::pointerToData: numWordsToBeRead exceeds maxReadLength." << '\n';
         return nullptr;
     }
-    if (!usedWords.tryAcquire(numWordsToBeRead)) {
+    if (usedWords.load(std::memory_order_acquire) < numWordsToBeRead) {
         return nullptr;  // not enough data available to read
     }
     if (bufferReadIndex + numWordsToBeRead > bufferSize) {
@@ -165,16 +231,46 @@ uint16_t* DataStreamFifo::pointerToData(int numWordsBeToRead_)
 void DataStreamFifo::freeData()
 {
     bufferReadIndex = (bufferReadIndex + numWordsToBeRead) % bufferSize; // okay to use % operator since first quantity must be positive
-    freeWords.release(numWordsToBeRead);
+    usedWords.fetch_sub(numWordsToBeRead, std::memory_order_release);
+}
+
+// Block the consumer until at least numWords words are available to read, or until wakeReader() is
+// called.  Returns true if the data is available.  The writer only issues a wakeup when the reader is
+// actually parked here, so the common case of data already being present never enters the kernel.
+bool DataStreamFifo::waitForData(int numWords)
+{
+    while (true) {
+        uint32_t sequence = writeSequence.load();
+        if (wakeRequested.exchange(false)) {
+            return dataAvailable(numWords);
+        }
+        if (dataAvailable(numWords)) {
+            return true;
+        }
+        readerWaiting.store(true);
+        if (dataAvailable(numWords)) {
+            readerWaiting.store(false);
+            return true;
+        }
+        writeSequence.wait(sequence);
+        readerWaiting.store(false);
+    }
 }
 
+// Release a consumer blocked in waitForData() (e.g., when its thread is being stopped).
+void DataStreamFifo::wakeReader()
+{
+    wakeRequested.store(true);
+    writeSequence.fetch_add(1);
+    writeSequence.notify_all();
+}
+
+// This function should only be called while neither the producer nor the consumer is active.
 void DataStreamFifo::resetBuffer()
 {
-    freeWords.acquire(freeWords.available());
-    usedWords.acquire(usedWords.available());
+    usedWords.store(0);
     bufferWriteIndex = 0;
     bufferReadIndex = 0;
-    freeWords.release(bufferSize);
     numWordsToBeRead = 0;
+    numWordsToBeWritten = 0;
 }
-
@@ -30,8 +30,13 @@
 #ifndef DATASTREAMFIFO_H
 #define DATASTREAMFIFO_H
 
-#include "Semaphore.h"
+#include <atomic>
+#include <cstdint>
 
+// Single-producer, single-consumer circular buffer for USB data.  The producer (USBDataThread) and
+// the consumer (WaveformProcessorThread) coordinate through one atomic word count, so neither side
+// takes a lock.  The consumer may block in waitForData(), which only enters the kernel when the
+// buffer does not yet hold the requested data.
 class DataStreamFifo
 {
 public:
@@ -39,11 +44,17 @@ public:
     ~DataStreamFifo();
 
     bool writeToBuffer(const uint8_t* dataSource, int numWords);
+    uint16_t* pointerToWriteSpace(int numWordsToBeWritten_);
+    void commitWrite();
+    void commitWrite(int numWordsWritten);
+    int maxWriteLength() const { return maxReadLength; }
     bool dataAvailable(unsigned int numWords) const;
 
     bool readFromBuffer(uint16_t *dataSink, int numWords);
     uint16_t* pointerToData(int numWordsToBeRead_);
     void freeData();
+    bool waitForData(int numWords);
+    void wakeReader();
 
     void resetBuffer();
     int wordsAvailable() const;
@@ -56,10 +67,17 @@ private:
     int bufferSize;
     int maxReadLength;
     int numWordsToBeRead;
-    Semaphore freeWords;
-    Semaphore usedWords;
-    int bufferWriteIndex;
-    int bufferReadIndex;
+    int numWordsToBeWritten;
+    int bufferWriteIndex;   // Only touched by the producer
+    int bufferReadIndex;    // Only touched by the consumer
+
+    // Keep the shared counters on separate cache lines from each other and from the indices above.
+    alignas(64) std::atomic<int> usedWords;
+    alignas(64) std::atomic<uint32_t> writeSequence;   // Bumped on every commit; the reader waits on this
+    std::atomic<bool> readerWaiting;
+    std::atomic<bool> wakeRequested;
+
+    void publish(int numWords);
 
     bool memoryAllocated;
     double memoryNeededGB;
@@ -34,7 +34,6 @@
 #include <vector>
 #include <QString>
 #include <QColor>
-#include "scrollbar.h"
 
 using namespace std;
 
@@ -61,6 +60,15 @@ struct SignalGroupState
     vector<ChannelState> signalChannels;
 };
 
+struct ScrollBarState
+{
+    int range;                // Scroll bar operates from 0 to this value.
+    vector<int> topPosition;  // Current position of scroll bar on each page; always between 0 and (range - pageSize)
+    int pageSize;             // Size of one page.  Must be <= range.  Sets scroll bar size.  Increment of movement for page up/down.
+    int stepSize;             // Increment of movement from up/down button or cursor up/down
+    double zoomFactor;        // Number from 1.0 to ZoomLimit used to expand display
+};
+
 struct DisplayColumnState
 {
     QStringList pinnedWaveNames;
@@ -76,6 +84,16 @@ struct DisplayState
     vector<SignalGroupState> groups;
 };
 
+// Implemented by the waveform display, so that SignalSources can save and restore the state of each display column
+// without depending on GUI classes.
+class AbstractDisplayColumns
+{
+public:
+    virtual ~AbstractDisplayColumns() {}
+    virtual void saveColumnStates(vector<DisplayColumnState>& columns) const = 0;
+    virtual void restoreColumnStates(const vector<DisplayColumnState>& columns) = 0;
+};
+
 
 class DisplayUndoManager
 {
@@ -0,0 +1,208 @@
+//------------------------------------------------------------------------------
+//
+//  Intan Technologies RHX Data Acquisition Software
+//  Version 3.3.2
+//
+//  Copyright (c) 2020-2024 Intan Technologies
+//
+//  This file is part of the Intan Technologies RHX Data Acquisition Software.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published
+//  by the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//  This software is provided 'as-is', without any express or implied warranty.
+//  In no event will the authors be held liable for any damages arising from
+//  the use of this software.
+//
+//  See <http://www.intantech.com> for documentation and product information.
+//
+//------------------------------------------------------------------------------
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RHX_LFP_SSE2
+#endif
+#include "filter.h"
+#include "lfpdecimator.h"
+
+using namespace std;
+
+namespace {
+
+inline uint16_t toOffsetWord(float value)
+{
+    long word = lrintf(value);
+    return (uint16_t) (min(max(word, -32768L), 32767L) + 32768L);
+}
+
+}
+
+LfpDecimator::LfpDecimator(int numChannels_, double sampleRate_, int downsampleFactor_, SystemState* state_) :
+    numChannels(numChannels_),
+    sampleRate(sampleRate_),
+    downsampleFactor(downsampleFactor_),
+    state(state_),
+    lowOrder(0),
+    lowTypeIndex(-1),
+    lowCutoff(0.0)
+{
+    if (downsampleFactor < 1) {
+        cerr << "LfpDecimator: downsampleFactor must be one or greater." << '\n';
+        downsampleFactor = 1;
+    }
+    updateFilters();
+}
+
+void LfpDecimator::updateFilters()
+{
+    if (state->lowOrder->getValue() == lowOrder && state->lowType->getIndex() == lowTypeIndex &&
+            state->lowSWCutoffFreq->getValue() == lowCutoff) {
+        return;
+    }
+    lowOrder = state->lowOrder->getValue();
+    lowTypeIndex = state->lowType->getIndex();
+    lowCutoff = state->lowSWCutoffFreq->getValue();
+    buildFilters();
+}
+
+void LfpDecimator::buildFilters()
+{
+    vector<BiquadFilter> sections;
+    if (state->lowType->getValue().toLower() == "bessel") {
+        sections = BesselLowpassFilter(lowOrder, lowCutoff, sampleRate).getFilters();
+    } else {
+        sections = ButterworthLowpassFilter(lowOrder, lowCutoff, sampleRate).getFilters();
+    }
+    vector<BiquadFilter> antiAlias = ButterworthLowpassFilter(8, 0.3 * sampleRate / downsampleFactor, sampleRate).getFilters();
+    sections.insert(sections.end(), antiAlias.begin(), antiAlias.end());
+
+    int numSections = (int) sections.size();
+    b0.resize(numSections);
+    b1.resize(numSections);
+    b2.resize(numSections);
+    a1.resize(numSections);
+    a2.resize(numSections);
+    for (int k = 0; k < numSections; ++k) {
+        b0[k] = sections[k].getB0();
+        b1[k] = sections[k].getB1();
+        b2[k] = sections[k].getB2();
+        a1[k] = sections[k].getA1();
+        a2[k] = sections[k].getA2();
+    }
+    z1.assign(numSections * numChannels, 0.0F);
+    z2.assign(numSections * numChannels, 0.0F);
+}
+
+void LfpDecimator::reset()
+{
+    fill(z1.begin(), z1.end(), 0.0F);
+    fill(z2.begin(), z2.end(), 0.0F);
+}
+
+// Filter numSamples samples of LfpLanes adjacent channels, held in rows of LfpLanes values, through section k.  The
+// lanes are independent, so their dependency chains overlap while the section's state stays in registers.
+void LfpDecimator::filterSection(int k, int firstChannel, float* rows, int numSamples)
+{
+    float* s1 = &z1[k * numChannels + firstChannel];
+    float* s2 = &z2[k * numChannels + firstChannel];
+#ifdef RHX_LFP_SSE2
+    const __m128 vb0 = _mm_set1_ps(b0[k]);
+    const __m128 vb1 = _mm_set1_ps(b1[k]);
+    const __m128 vb2 = _mm_set1_ps(b2[k]);
+    const __m128 va1 = _mm_set1_ps(a1[k]);
+    const __m128 va2 = _mm_set1_ps(a2[k]);
+    __m128 s1v[LfpLanes / 4], s2v[LfpLanes / 4];
+    for (int v = 0; v < LfpLanes / 4; ++v) {
+        s1v[v] = _mm_loadu_ps(s1 + 4 * v);
+        s2v[v] = _mm_loadu_ps(s2 + 4 * v);
+    }
+    for (int t = 0; t < numSamples; ++t) {
+        float* row = rows + t * LfpLanes;
+        for (int v = 0; v < LfpLanes / 4; ++v) {
+            __m128 in = _mm_loadu_ps(row + 4 * v);
+            // Terms that do not depend on y are summed first, to keep the recursive path short.
+            __m128 partial = _mm_add_ps(_mm_mul_ps(vb1, in), s2v[v]);
+            __m128 y = _mm_add_ps(_mm_mul_ps(vb0, in), s1v[v]);
+            s1v[v] = _mm_sub_ps(partial, _mm_mul_ps(va1, y));
+            s2v[v] = _mm_sub_ps(_mm_mul_ps(vb2, in), _mm_mul_ps(va2, y));
+            _mm_storeu_ps(row + 4 * v, y);
+        }
+    }
+    for (int v = 0; v < LfpLanes / 4; ++v) {
+        _mm_storeu_ps(s1 + 4 * v, s1v[v]);
+        _mm_storeu_ps(s2 + 4 * v, s2v[v]);
+    }
+#else
+    const float sb0 = b0[k], sb1 = b1[k], sb2 = b2[k], sa1 = a1[k], sa2 = a2[k];
+    for (int t = 0; t < numSamples; ++t) {
+        float* row = rows + t * LfpLanes;
+        for (int lane = 0; lane < LfpLanes; ++lane) {
+            float partial = sb1 * row[lane] + s2[lane];
+            float y = sb0 * row[lane] + s1[lane];
+            s1[lane] = partial - sa1 * y;
+            s2[lane] = sb2 * row[lane] - sa2 * y;
+            row[lane] = y;
+        }
+    }
+#endif
+}
+
+void LfpDecimator::process(const uint16_t* wide, uint16_t* lfp, int numSamples)
+{
+    const int numSections = (int) b0.size();
+    if ((int) work.size() < numSamples * LfpLanes) {
+        work.resize(numSamples * LfpLanes);
+    }
+    float* rows = work.data();
+
+    // Channels are filtered LfpLanes at a time through the whole batch of samples.  Any remaining channels (there
+    // are none for whole numbers of 16- or 32-channel streams) go through the scalar filter one sample at a time.
+    int firstChannel = 0;
+    for (; firstChannel + LfpLanes <= numChannels; firstChannel += LfpLanes) {
+        for (int t = 0; t < numSamples; ++t) {
+            const uint16_t* in = wide + t * numChannels + firstChannel;
+            for (int lane = 0; lane < LfpLanes; ++lane) {
+                rows[t * LfpLanes + lane] = (float) in[lane] - 32768.0F;
+            }
+        }
+        for (int k = 0; k < numSections; ++k) {
+            filterSection(k, firstChannel, rows, numSamples);
+        }
+        for (int t = 0; t < numSamples; t += downsampleFactor) {
+            uint16_t* out = lfp + (t / downsampleFactor) * numChannels + firstChannel;
+            for (int lane = 0; lane < LfpLanes; ++lane) {
+                out[lane] = toOffsetWord(rows[t * LfpLanes + lane]);
+            }
+        }
+    }
+
+    for (int c = firstChannel; c < numChannels; ++c) {
+        for (int t = 0; t < numSamples; ++t) {
+            float x = (float) wide[t * numChannels + c] - 32768.0F;
+            for (int k = 0; k < numSections; ++k) {
+                float& s1 = z1[k * numChannels + c];
+                float& s2 = z2[k * numChannels + c];
+                float partial = b1[k] * x + s2;
+                float y = b0[k] * x + s1;
+                s1 = partial - a1[k] * y;
+                s2 = b2[k] * x - a2[k] * y;
+                x = y;
+            }
+            if (t % downsampleFactor == 0) {
+                lfp[(t / downsampleFactor) * numChannels + c] = toOffsetWord(x);
+            }
+        }
+    }
+}
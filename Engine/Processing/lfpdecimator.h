@@ -0,0 +1,81 @@
+//------------------------------------------------------------------------------
+//
+//  Intan Technologies RHX Data Acquisition Software
+//  Version 3.3.2
+//
+//  Copyright (c) 2020-2024 Intan Technologies
+//
+//  This file is part of the Intan Technologies RHX Data Acquisition Software.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published
+//  by the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//  This software is provided 'as-is', without any express or implied warranty.
+//  In no event will the authors be held liable for any damages arising from
+//  the use of this software.
+//
+//  See <http://www.intantech.com> for documentation and product information.
+//
+//------------------------------------------------------------------------------
+
+#ifndef LFPDECIMATOR_H
+#define LFPDECIMATOR_H
+
+#include <cstdint>
+#include <vector>
+#include "systemstate.h"
+
+using namespace std;
+
+// Produces the decimated LFP (local field potential) band from the wideband amplifier output.  Each channel passes
+// through the software lowpass filter selected by the user, then through an 8th-order Butterworth anti-alias filter
+// with a cutoff of 30% of the decimated sample rate, and every downsampleFactor-th sample is kept.  Amplifier data
+// are interleaved by channel ([sample][channel]) on input and output, in the 16-bit offset format used by
+// WaveformFifo.
+class LfpDecimator
+{
+    static const int LfpLanes = 16;
+
+public:
+    LfpDecimator(int numChannels_, double sampleRate_, int downsampleFactor_, SystemState* state_);
+
+    void updateFilters();   // Rebuild the filters if the software lowpass filter settings have changed.
+    void reset();           // Restart all channels from silence.
+
+    // Filter numSamples samples of wideband data, and write numSamples / downsampleFactor LFP samples.  The first
+    // input sample must fall on a decimation boundary (i.e., numSamples is a multiple of downsampleFactor).
+    void process(const uint16_t* wide, uint16_t* lfp, int numSamples);
+
+    int getDownsampleFactor() const { return downsampleFactor; }
+
+private:
+    int numChannels;
+    double sampleRate;
+    int downsampleFactor;
+    SystemState* state;
+
+    // Software lowpass filter settings the current filters were built from.
+    int lowOrder;
+    int lowTypeIndex;
+    double lowCutoff;
+
+    // Biquad coefficients for each filter section, and transposed direct form II state for each section and channel.
+    vector<float> b0, b1, b2, a1, a2;
+    vector<float> z1, z2;
+    vector<float> work;     // numSamples rows of LfpLanes channels
+
+    void buildFilters();
+    void filterSection(int k, int firstChannel, float* rows, int numSamples);
+};
+
+#endif // LFPDECIMATOR_H
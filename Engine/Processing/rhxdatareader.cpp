@@ -28,11 +28,188 @@
 //
 //------------------------------------------------------------------------------
 
+#include <algorithm>
 #include <iostream>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RHX_DEINTERLEAVE_SSE2
+#endif
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RHX_DEINTERLEAVE_AVX2
+#endif
 #include "rhxdatareader.h"
 
 using namespace std;
 
+// Number of frames transposed together by deinterleave().  The transposed tile stays in L1 cache while every waveform
+// is converted from it, instead of each waveform making its own strided pass over the whole data block.
+const int DeinterleaveTileFrames = 16;
+// Frames are transposed in chunks of this many consecutive words.
+const int DeinterleaveChunkWords = 8;
+
+namespace {
+
+// Convert raw words to scale * (word - offset) volts or microvolts, as the read*Data() functions do one word at a time.
+void convertWordsScalar(const uint16_t* src, float* dest, int n, int offset, float scale)
+{
+    for (int i = 0; i < n; ++i) {
+        dest[i] = scale * (float)((int) src[i] - offset);
+    }
+}
+
+#ifndef RHX_DEINTERLEAVE_SSE2
+// Transpose DeinterleaveChunkWords consecutive words from each of DeinterleaveTileFrames frames (frameStride words
+// apart) into DeinterleaveChunkWords rows of DeinterleaveTileFrames samples.
+void transposeTileScalar(const uint16_t* src, int frameStride, uint16_t* rows)
+{
+    for (int t = 0; t < DeinterleaveTileFrames; ++t) {
+        for (int w = 0; w < DeinterleaveChunkWords; ++w) {
+            rows[w * DeinterleaveTileFrames + t] = src[w];
+        }
+        src += frameStride;
+    }
+}
+#endif
+
+#ifdef RHX_DEINTERLEAVE_SSE2
+// 8 x 8 transpose of 16-bit words; on return, row w holds word w of each of the eight frames.
+inline void transpose8x8SSE2(__m128i* a)
+{
+    __m128i b0 = _mm_unpacklo_epi16(a[0], a[1]);
+    __m128i b1 = _mm_unpackhi_epi16(a[0], a[1]);
+    __m128i b2 = _mm_unpacklo_epi16(a[2], a[3]);
+    __m128i b3 = _mm_unpackhi_epi16(a[2], a[3]);
+    __m128i b4 = _mm_unpacklo_epi16(a[4], a[5]);
+    __m128i b5 = _mm_unpackhi_epi16(a[4], a[5]);
+    __m128i b6 = _mm_unpacklo_epi16(a[6], a[7]);
+    __m128i b7 = _mm_unpackhi_epi16(a[6], a[7]);
+    __m128i c0 = _mm_unpacklo_epi32(b0, b2);
+    __m128i c1 = _mm_unpackhi_epi32(b0, b2);
+    __m128i c2 = _mm_unpacklo_epi32(b1, b3);
+    __m128i c3 = _mm_unpackhi_epi32(b1, b3);
+    __m128i c4 = _mm_unpacklo_epi32(b4, b6);
+    __m128i c5 = _mm_unpackhi_epi32(b4, b6);
+    __m128i c6 = _mm_unpacklo_epi32(b5, b7);
+    __m128i c7 = _mm_unpackhi_epi32(b5, b7);
+    a[0] = _mm_unpacklo_epi64(c0, c4);
+    a[1] = _mm_unpackhi_epi64(c0, c4);
+    a[2] = _mm_unpacklo_epi64(c1, c5);
+    a[3] = _mm_unpackhi_epi64(c1, c5);
+    a[4] = _mm_unpacklo_epi64(c2, c6);
+    a[5] = _mm_unpackhi_epi64(c2, c6);
+    a[6] = _mm_unpacklo_epi64(c3, c7);
+    a[7] = _mm_unpackhi_epi64(c3, c7);
+}
+
+void transposeTileSSE2(const uint16_t* src, int frameStride, uint16_t* rows)
+{
+    for (int group = 0; group < DeinterleaveTileFrames; group += 8) {
+        __m128i a[8];
+        for (int t = 0; t < 8; ++t) {
+            a[t] = _mm_loadu_si128((const __m128i*) (src + (group + t) * frameStride));
+        }
+        transpose8x8SSE2(a);
+        for (int w = 0; w < 8; ++w) {
+            _mm_storeu_si128((__m128i*) (rows + w * DeinterleaveTileFrames + group), a[w]);
+        }
+    }
+}
+
+void convertWordsSSE2(const uint16_t* src, float* dest, int n, int offset, float scale)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i offsetVector = _mm_set1_epi32(offset);
+    const __m128 scaleVector = _mm_set1_ps(scale);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i words = _mm_loadu_si128((const __m128i*) (src + i));
+        __m128i low = _mm_sub_epi32(_mm_unpacklo_epi16(words, zero), offsetVector);
+        __m128i high = _mm_sub_epi32(_mm_unpackhi_epi16(words, zero), offsetVector);
+        _mm_storeu_ps(dest + i, _mm_mul_ps(scaleVector, _mm_cvtepi32_ps(low)));
+        _mm_storeu_ps(dest + i + 4, _mm_mul_ps(scaleVector, _mm_cvtepi32_ps(high)));
+    }
+    convertWordsScalar(src + i, dest + i, n - i, offset, scale);
+}
+#endif
+
+#ifdef RHX_DEINTERLEAVE_AVX2
+// Two 8 x 8 transposes at once: frames 0-7 in the low lanes and frames 8-15 in the high lanes, so each resulting row
+// holds word w of all sixteen frames.
+__attribute__((target("avx2")))
+void transposeTileAVX2(const uint16_t* src, int frameStride, uint16_t* rows)
+{
+    __m256i a[8];
+    for (int t = 0; t < 8; ++t) {
+        __m128i low = _mm_loadu_si128((const __m128i*) (src + t * frameStride));
+        __m128i high = _mm_loadu_si128((const __m128i*) (src + (t + 8) * frameStride));
+        a[t] = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+    }
+    __m256i b0 = _mm256_unpacklo_epi16(a[0], a[1]);
+    __m256i b1 = _mm256_unpackhi_epi16(a[0], a[1]);
+    __m256i b2 = _mm256_unpacklo_epi16(a[2], a[3]);
+    __m256i b3 = _mm256_unpackhi_epi16(a[2], a[3]);
+    __m256i b4 = _mm256_unpacklo_epi16(a[4], a[5]);
+    __m256i b5 = _mm256_unpackhi_epi16(a[4], a[5]);
+    __m256i b6 = _mm256_unpacklo_epi16(a[6], a[7]);
+    __m256i b7 = _mm256_unpackhi_epi16(a[6], a[7]);
+    __m256i c0 = _mm256_unpacklo_epi32(b0, b2);
+    __m256i c1 = _mm256_unpackhi_epi32(b0, b2);
+    __m256i c2 = _mm256_unpacklo_epi32(b1, b3);
+    __m256i c3 = _mm256_unpackhi_epi32(b1, b3);
+    __m256i c4 = _mm256_unpacklo_epi32(b4, b6);
+    __m256i c5 = _mm256_unpackhi_epi32(b4, b6);
+    __m256i c6 = _mm256_unpacklo_epi32(b5, b7);
+    __m256i c7 = _mm256_unpackhi_epi32(b5, b7);
+    _mm256_storeu_si256((__m256i*) (rows + 0 * DeinterleaveTileFrames), _mm256_unpacklo_epi64(c0, c4));
+    _mm256_storeu_si256((__m256i*) (rows + 1 * DeinterleaveTileFrames), _mm256_unpackhi_epi64(c0, c4));
+    _mm256_storeu_si256((__m256i*) (rows + 2 * DeinterleaveTileFrames), _mm256_unpacklo_epi64(c1, c5));
+    _mm256_storeu_si256((__m256i*) (rows + 3 * DeinterleaveTileFrames), _mm256_unpackhi_epi64(c1, c5));
+    _mm256_storeu_si256((__m256i*) (rows + 4 * DeinterleaveTileFrames), _mm256_unpacklo_epi64(c2, c6));
+    _mm256_storeu_si256((__m256i*) (rows + 5 * DeinterleaveTileFrames), _mm256_unpackhi_epi64(c2, c6));
+    _mm256_storeu_si256((__m256i*) (rows + 6 * DeinterleaveTileFrames), _mm256_unpacklo_epi64(c3, c7));
+    _mm256_storeu_si256((__m256i*) (rows + 7 * DeinterleaveTileFrames), _mm256_unpackhi_epi64(c3, c7));
+}
+
+__attribute__((target("avx2")))
+void convertWordsAVX2(const uint16_t* src, float* dest, int n, int offset, float scale)
+{
+    const __m256i offsetVector = _mm256_set1_epi32(offset);
+    const __m256 scaleVector = _mm256_set1_ps(scale);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i words = _mm256_loadu_si256((const __m256i*) (src + i));
+        __m256i low = _mm256_sub_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(words)), offsetVector);
+        __m256i high = _mm256_sub_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(words, 1)), offsetVector);
+        _mm256_storeu_ps(dest + i, _mm256_mul_ps(scaleVector, _mm256_cvtepi32_ps(low)));
+        _mm256_storeu_ps(dest + i + 8, _mm256_mul_ps(scaleVector, _mm256_cvtepi32_ps(high)));
+    }
+    convertWordsScalar(src + i, dest + i, n - i, offset, scale);
+}
+#endif
+
+struct DeinterleaveKernels
+{
+    void (*transposeTile)(const uint16_t*, int, uint16_t*);
+    void (*convertWords)(const uint16_t*, float*, int, int, float);
+};
+
+// Select the widest kernels this CPU supports.
+DeinterleaveKernels selectDeinterleaveKernels()
+{
+#ifdef RHX_DEINTERLEAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) return { transposeTileAVX2, convertWordsAVX2 };
+#endif
+#ifdef RHX_DEINTERLEAVE_SSE2
+    return { transposeTileSSE2, convertWordsSSE2 };
+#else
+    return { transposeTileScalar, convertWordsScalar };
+#endif
+}
+
+}
+
 RHXDataReader::RHXDataReader(ControllerType type_, int numDataStreams_, const uint16_t* start_, int numSamples_) :
     type(type_),
     numDataStreams(numDataStreams_),
@@ -109,6 +286,7 @@ void RHXDataReader::readDcAmplifierData(float* buffer, int stream, int channel)
 }
 
 // Read AuxIn1, 2, or 3 waveform from raw USB data bytes, converting to volts (ControllerRecordUSB2 and ControllerRecordUSB3 only).
+// One value is written per four amplifier samples, the native AuxIn sample rate.
 void RHXDataReader::readAuxInData(float* buffer, int stream, int auxChannel)
 {
     const uint16_t* pRead = start;
@@ -214,22 +392,15 @@ void RHXDataReader::readAuxInData(float* buffer, int stream, int auxChannel)
     }
     int frameOffset = (auxChannel + auxChFrameOffset) % 4;
     pRead = pReadSaved + frameOffset * dataFrameSizeInWords;   // align with data
-    float auxInValue;
     for (int i = 0; i < numSamples; i += 4) {
-        auxInValue = 0.0000374F * ((float) *pRead); // return value in volts
-        *pWrite = auxInValue;     // write same value four times since AuxIn is sampled at fs/4
-        pWrite++;
-        *pWrite = auxInValue;
-        pWrite++;
-        *pWrite = auxInValue;
-        pWrite++;
-        *pWrite = auxInValue;
+        *pWrite = 0.0000374F * ((float) *pRead); // return value in volts
         pWrite++;
         pRead += 4 * dataFrameSizeInWords;
     }
 }
 
 // Read one supply voltage waveform from raw USB data bytes, converting to volts (ControllerRecordUSB2 and ControllerRecordUSB3 only).
+// One value is written per data block, the native Vdd sample rate.
 void RHXDataReader::readSupplyVoltageData(float* buffer, int stream) const
 {
     const uint16_t* pRead = start;
@@ -238,10 +409,11 @@ void RHXDataReader::readSupplyVoltageData(float* buffer, int stream) const
     pRead += 6; // Skip header and timestamp.
     pRead += (numDataStreams * 1) + stream;     // Align with selected stream and AuxIn data slot.
     pRead += dataFrameSizeInWords * 124;        // Align with "read from Vdd" command.
-    float vdd = 0.0000748F * ((float) *pRead);
-    for (int i = 0; i < RHXDataBlock::samplesPerDataBlock(type); ++i) { // Write same value 128 times since Vdd is sampled at fs/128.
-        *pWrite = vdd;
+    int samplesPerDataBlock = RHXDataBlock::samplesPerDataBlock(type);
+    for (int block = 0; block < numSamples / samplesPerDataBlock; ++block) {
+        *pWrite = 0.0000748F * ((float) *pRead);
         pWrite++;
+        pRead += dataFrameSizeInWords * samplesPerDataBlock;
     }
 }
 
@@ -531,6 +703,171 @@ void RHXDataReader::readStimParamData(uint16_t* buffer, int stream, int channel)
     }
 }
 
+// Find the words within each data frame that a target waveform is built from.  Returns the number of words.
+int RHXDataReader::deinterleaveSourceWords(const DeinterleaveTarget& target, int* offsets) const
+{
+    switch (target.kind) {
+    case DeinterleaveTimeStamp:
+        offsets[0] = 4;
+        offsets[1] = 5;
+        return 2;
+    case DeinterleaveDcAmplifier:
+        offsets[0] = 6 + 2 * (numDataStreams * 3) + 2 * ((numDataStreams * target.channel) + target.stream);
+        return 1;
+    case DeinterleaveStimParams:
+        offsets[0] = 6 + 2 * ((numDataStreams * 1) + target.stream);    // compliance limit (bottom 16 bits)
+        offsets[1] = offsets[0] + 1;                                    // compliance limit (top 16 bits)
+        offsets[2] = dataFrameSizeInWords - 18 - (numDataStreams * 4) + target.stream;  // stim on
+        offsets[3] = offsets[2] + 1 * numDataStreams;                   // stim polarity
+        offsets[4] = offsets[2] + 2 * numDataStreams;                   // amp settle
+        offsets[5] = offsets[2] + 3 * numDataStreams;                   // charge recovery
+        return 6;
+    case DeinterleaveBoardAdc:
+        offsets[0] = dataFrameSizeInWords - 10 + target.channel;
+        return 1;
+    case DeinterleaveBoardDac:
+        offsets[0] = dataFrameSizeInWords - 18 + target.channel;
+        return 1;
+    case DeinterleaveDigInWord:
+        offsets[0] = dataFrameSizeInWords - 2;
+        return 1;
+    case DeinterleaveDigOutWord:
+        offsets[0] = dataFrameSizeInWords - 1;
+        return 1;
+    }
+    return 0;
+}
+
+// Extract every target waveform in a single pass over the data, one tile of DeinterleaveTileFrames frames at a time.
+// Each tile is first transposed with SIMD 8 x 8 word transposes so that the samples of each needed word are
+// contiguous; these rows are then converted with the widest SIMD kernels available.  Words shared by several targets
+// (e.g., the digital input word, or a stream's stimulation flags) are transposed only once.  Results are identical to
+// those of the individual read*Data() functions.
+void RHXDataReader::deinterleave(const DeinterleaveTarget* targets, int numTargets) const
+{
+    static const DeinterleaveKernels kernels = selectDeinterleaveKernels();
+    const int MaxSourceWords = 6;
+
+    // Reused between calls to avoid allocating memory for every data block.
+    thread_local vector<int> chunkIndex;
+    thread_local vector<int> chunks;
+    thread_local vector<int> targetSlots;
+    thread_local vector<uint16_t> scratch;
+
+    // Find the chunks of each frame holding words that are used.  Each of these chunks is transposed into
+    // DeinterleaveChunkWords consecutive rows of scratch memory.
+    const int numChunksInFrame = (dataFrameSizeInWords + DeinterleaveChunkWords - 1) / DeinterleaveChunkWords;
+    int offsets[MaxSourceWords];
+    chunkIndex.assign(numChunksInFrame, -1);
+    for (int k = 0; k < numTargets; ++k) {
+        int numWords = deinterleaveSourceWords(targets[k], offsets);
+        for (int i = 0; i < numWords; ++i) {
+            chunkIndex[offsets[i] / DeinterleaveChunkWords] = 0;
+        }
+    }
+    chunks.clear();
+    for (int chunk = 0; chunk < numChunksInFrame; ++chunk) {
+        if (chunkIndex[chunk] == 0) {
+            chunkIndex[chunk] = (int) chunks.size();
+            chunks.push_back(chunk);
+        }
+    }
+    targetSlots.resize(numTargets * MaxSourceWords);
+    for (int k = 0; k < numTargets; ++k) {
+        int numWords = deinterleaveSourceWords(targets[k], offsets);
+        for (int i = 0; i < numWords; ++i) {
+            targetSlots[k * MaxSourceWords + i] = chunkIndex[offsets[i] / DeinterleaveChunkWords] * DeinterleaveChunkWords +
+                    offsets[i] % DeinterleaveChunkWords;
+        }
+    }
+    const int numChunks = (int) chunks.size();
+    scratch.resize(numChunks * DeinterleaveChunkWords * DeinterleaveTileFrames);
+
+    const int adcOffset = (type == ControllerRecordUSB2) ? 0 : 32768;
+    const float adcScale = (type == ControllerRecordUSB2) ? 50.354e-6F : 312.5e-6F;
+
+    for (int tile = 0; tile < numSamples; tile += DeinterleaveTileFrames) {
+        const int n = min(DeinterleaveTileFrames, numSamples - tile);
+
+        // Transpose this tile of frames.  A partial chunk at the end of the frame (or a partial tile) is copied
+        // word by word so that nothing is read beyond the data.
+        const uint16_t* frames = start + tile * dataFrameSizeInWords;
+        for (int j = 0; j < numChunks; ++j) {
+            const int firstWord = chunks[j] * DeinterleaveChunkWords;
+            const uint16_t* src = frames + firstWord;
+            uint16_t* rows = scratch.data() + j * DeinterleaveChunkWords * DeinterleaveTileFrames;
+            if (n == DeinterleaveTileFrames && firstWord + DeinterleaveChunkWords <= dataFrameSizeInWords) {
+                kernels.transposeTile(src, dataFrameSizeInWords, rows);
+            } else {
+                const int numWords = min(DeinterleaveChunkWords, dataFrameSizeInWords - firstWord);
+                for (int t = 0; t < n; ++t) {
+                    for (int w = 0; w < numWords; ++w) {
+                        rows[w * DeinterleaveTileFrames + t] = src[t * dataFrameSizeInWords + w];
+                    }
+                }
+            }
+        }
+
+        for (int k = 0; k < numTargets; ++k) {
+            const DeinterleaveTarget& target = targets[k];
+            const int* sourceRows = &targetSlots[k * MaxSourceWords];
+            const uint16_t* row = scratch.data() + sourceRows[0] * DeinterleaveTileFrames;
+            switch (target.kind) {
+            case DeinterleaveTimeStamp:
+            {
+                const uint16_t* rowHigh = scratch.data() + sourceRows[1] * DeinterleaveTileFrames;
+                for (int t = 0; t < n; ++t) {
+                    target.timeStamps[tile + t] = (((uint32_t) rowHigh[t]) << 16) | (uint32_t) row[t];
+                }
+                break;
+            }
+            case DeinterleaveDcAmplifier:
+                kernels.convertWords(row, target.analog + tile, n, 512, -0.01923F);  // volts
+                break;
+            case DeinterleaveStimParams:
+                deinterleaveStimParams(scratch.data(), sourceRows, target.channel, target.digital + tile, n);
+                break;
+            case DeinterleaveBoardAdc:
+                kernels.convertWords(row, target.analog + tile, n, adcOffset, adcScale);  // volts
+                break;
+            case DeinterleaveBoardDac:
+                kernels.convertWords(row, target.analog + tile, n, 32768, 312.5e-6F);  // volts
+                break;
+            case DeinterleaveDigInWord:
+            case DeinterleaveDigOutWord:
+                std::copy(row, row + n, target.digital + tile);
+                break;
+            }
+        }
+    }
+}
+
+// Combine transposed stimulation words into the flags written by readStimParamData().
+void RHXDataReader::deinterleaveStimParams(const uint16_t* scratch, const int* sourceRows, int channel, uint16_t* buffer,
+                                           int n)
+{
+    const uint16_t mask = 1U << channel;
+    const uint16_t ComplianceFlag = 1U << 15;
+    const uint16_t ChargeRecoveryFlag = 1U << 14;
+    const uint16_t AmpSettleFlag = 1U << 13;
+    const uint16_t StimPolFlag = 1U << 8;
+    const uint16_t StimOnFlag = 1U << 0;
+
+    const uint16_t* complianceLow = scratch + sourceRows[0] * DeinterleaveTileFrames;
+    const uint16_t* complianceHigh = scratch + sourceRows[1] * DeinterleaveTileFrames;
+    const uint16_t* stimOn = scratch + sourceRows[2] * DeinterleaveTileFrames;
+    const uint16_t* stimPol = scratch + sourceRows[3] * DeinterleaveTileFrames;
+    const uint16_t* ampSettle = scratch + sourceRows[4] * DeinterleaveTileFrames;
+    const uint16_t* chargeRecov = scratch + sourceRows[5] * DeinterleaveTileFrames;
+    for (int t = 0; t < n; ++t) {
+        uint16_t compliance = (complianceHigh[t] == 0 && (complianceLow[t] & mask)) ? ComplianceFlag : 0;
+        buffer[t] = compliance | ((stimOn[t] & mask) ? StimOnFlag : 0)
+                               | ((stimPol[t] & mask) ? 0 : StimPolFlag)
+                               | ((ampSettle[t] & mask) ? AmpSettleFlag : 0)
+                               | ((chargeRecov[t] & mask) ? ChargeRecoveryFlag : 0);
+    }
+}
+
 // ControllerStimRecord only
 void RHXDataReader::readBoardDacData(float* buffer, int channel) const
 {
@@ -34,6 +34,27 @@
 #include <cstdint>
 #include "rhxdatablock.h"
 
+// Waveforms that RHXDataReader::deinterleave() can extract from raw USB data.
+enum DeinterleaveKind {
+    DeinterleaveTimeStamp,
+    DeinterleaveDcAmplifier,
+    DeinterleaveStimParams,
+    DeinterleaveBoardAdc,
+    DeinterleaveBoardDac,
+    DeinterleaveDigInWord,
+    DeinterleaveDigOutWord
+};
+
+struct DeinterleaveTarget
+{
+    DeinterleaveKind kind;
+    int stream;
+    int channel;            // chip channel, or native channel number for board signals
+    float* analog;          // destination of DcAmplifier, BoardAdc, and BoardDac waveforms
+    uint16_t* digital;      // destination of StimParams, DigInWord, and DigOutWord waveforms
+    uint32_t* timeStamps;   // destination of TimeStamp waveform
+};
+
 class RHXDataReader
 {
 public:
@@ -46,8 +67,8 @@ public:
     int readTimeStampData(uint32_t* buffer) const;
     void readAmplifierData(float* buffer, int stream, int channel) const;
     void readDcAmplifierData(float* buffer, int stream, int channel) const;
-    void readAuxInData(float* buffer, int stream, int auxChannel);
-    void readSupplyVoltageData(float* buffer, int stream) const;
+    void readAuxInData(float* buffer, int stream, int auxChannel);      // Writes numSamples / 4 values.
+    void readSupplyVoltageData(float* buffer, int stream) const;        // Writes one value per data block.
     void readBoardAdcData(float* buffer, int channel) const;
     void readBoardDacData(float* buffer, int channel) const;
 
@@ -74,6 +95,9 @@ public:
     // Read ALL stim parameters for individual channels.
     void readStimParamData(uint16_t* buffer, int stream, int channel) const;
 
+    // Extract many waveforms in a single pass over the data, equivalent to calling the read*Data() function for each target.
+    void deinterleave(const DeinterleaveTarget* targets, int numTargets) const;
+
 private:
     ControllerType type;
     int numDataStreams;
@@ -83,6 +107,9 @@ private:
     int channelsPerStream;
     int numAuxChannels;
     int auxChFrameOffset;
+
+    int deinterleaveSourceWords(const DeinterleaveTarget& target, int* offsets) const;
+    static void deinterleaveStimParams(const uint16_t* scratch, const int* sourceRows, int channel, uint16_t* buffer, int n);
 };
 
 #endif // RHXDATAREADER_H
@@ -30,9 +30,7 @@
 
 #include <iostream>
 #include <limits>
-#include "displaylistmanager.h"
 #include "abstractrhxcontroller.h"
-#include "multicolumndisplay.h"
 #include "signalsources.h"
 
 SignalGroup::SignalGroup(const QString &name_, const QString &prefix_, SystemState* state_, bool enabled_) :
@@ -324,6 +322,102 @@ SignalSources::~SignalSources()
     delete undoManager;
 }
 
+void SignalSources::addAmplifierChannels(const vector<ChipType> &chipType, const vector<int> &portIndex,
+                                         const vector<int> &commandStream, const vector<int> &numChannelsOnPort)
+{
+    undoManager->clearUndoStack();
+
+    int numDataStreams = (int) chipType.size();
+
+    for (int port = 0; port < state->numSPIPorts; port++) {
+        SignalGroup* group = portGroupByIndex(port);
+        if (numChannelsOnPort[port] == 0) {
+            group->removeAllChannels();
+            group->setEnabled(false);
+        } else if (group->numChannels(AmplifierSignal) != numChannelsOnPort[port]) {
+            // If number of channels on port has changed...
+            group->removeAllChannels();  // ...clear existing channels...
+            group->setEnabled(true);
+            // ...and create new ones.
+            int channel = 0;
+            // Create amplifier channels for each chip.
+            for (int stream = 0; stream < numDataStreams; stream++) {
+                if (portIndex[stream] == port) {
+                    if (chipType[stream] == RHD2216Chip ||
+                        chipType[stream] == RHS2116Chip) {
+                        for (int i = 0; i < 16; i++) {
+                            group->addAmplifierChannel(channel, stream, commandStream[stream], i);
+                            channel++;
+                        }
+                    } else if (chipType[stream] == RHD2132Chip ||
+                               chipType[stream] == RHD2164Chip ||
+                               chipType[stream] == RHD2164MISOBChip) {
+                        for (int i = 0; i < 32; i++) {
+                            group->addAmplifierChannel(channel, stream, commandStream[stream], i);
+                            channel++;
+                        }
+                    }
+                }
+            }
+            //  Now create auxiliary input channels and supply voltage channels for each chip.
+            int auxName = 1;
+            int vddName = 1;
+            for (int stream = 0; stream < numDataStreams; stream++) {
+                if (portIndex[stream] == port) {
+                    if (chipType[stream] == RHD2216Chip ||
+                        chipType[stream] == RHD2132Chip ||
+                        chipType[stream] == RHD2164Chip) {
+                        group->addAuxInputChannel(channel++, stream, 0, auxName++);
+                        group->addAuxInputChannel(channel++, stream, 1, auxName++);
+                        group->addAuxInputChannel(channel++, stream, 2, auxName++);
+                        group->addSupplyVoltageChannel(channel++, stream, vddName++);
+                    }
+                }
+            }
+        } else {    // If number of channels on port has not changed, don't create new channels (since this
+                    // would clear all user-defined channel names.  But we must update the data stream indices
+                    // on the port.
+            int channel = 0;
+            // Update stream indices for amplifier channels.
+            for (int stream = 0; stream < numDataStreams; stream++) {
+                if (portIndex[stream] == port) {
+                    if (chipType[stream] == RHD2216Chip ||
+                        chipType[stream] == RHS2116Chip) {
+                        for (int i = channel; i < channel + 16; i++) {
+                            Channel* channel = group->channelByIndex(i);
+                            channel->setBoardStream(stream);
+                            channel->setCommandStream(commandStream[stream]);
+                        }
+                        channel += 16;
+                    } else if (chipType[stream] == RHD2132Chip ||
+                               chipType[stream] == RHD2164Chip ||
+                               chipType[stream] == RHD2164MISOBChip) {
+                        for (int i = channel; i < channel + 32; i++) {
+                            Channel* channel = group->channelByIndex(i);
+                            channel->setBoardStream(stream);
+                            channel->setCommandStream(commandStream[stream]);
+                        }
+                        channel += 32;
+                    }
+                }
+            }
+            // Update stream indices for auxiliary channels and supply voltage channels.
+            for (int stream = 0; stream < numDataStreams; ++stream) {
+                if (portIndex[stream] == port) {
+                    if (chipType[stream] == RHD2216Chip ||
+                        chipType[stream] == RHD2132Chip ||
+                        chipType[stream] == RHD2164Chip) {
+                        group->channelByIndex(channel++)->setBoardStream(stream);
+                        group->channelByIndex(channel++)->setBoardStream(stream);
+                        group->channelByIndex(channel++)->setBoardStream(stream);
+                        group->channelByIndex(channel++)->setBoardStream(stream);
+                   }
+                }
+            }
+        }
+    }
+}
+
 void SignalSources::updateChannelMap()
 {
     // Create map of native names to channel pointers for quick access.
@@ -947,16 +1041,7 @@ DisplayState SignalSources::saveState() const
         }
     }
 
-    if (display) {
-        savedState.columns.resize(display->numColumns());
-        for (int i = 0; i < display->numColumns(); ++i) {
-            savedState.columns[i].pinnedWaveNames = display->getPinnedWaveNames(i);
-            savedState.columns[i].showPinned = display->arePinnedShown(i);
-            savedState.columns[i].columnVisible = display->isColumnVisible(i);
-            savedState.columns[i].visiblePortName = display->getSelectedPort(i);
-            savedState.columns[i].scrollBarState = display->getScrollBarState(i);
-        }
-    }
+    if (display) display->saveColumnStates(savedState.columns);
 
     return savedState;
 }
@@ -1013,15 +1098,7 @@ void SignalSources::restoreState(const DisplayState& savedState)
         }
     }
 
-    if (display && ((int) savedState.columns.size() == display->numColumns())) {
-        for (int i = 0; i < (int) savedState.columns.size(); ++i) {
-            display->setPinnedWaveforms(i, savedState.columns[i].pinnedWaveNames);
-            display->setShowPinned(i, savedState.columns[i].showPinned);
-            display->setColumnVisible(i, savedState.columns[i].columnVisible);
-            display->setSelectedPort(i, savedState.columns[i].visiblePortName);
-            display->restoreScrollBarState(i, savedState.columns[i].scrollBarState);
-        }
-    }
+    if (display) display->restoreColumnStates(savedState.columns);
 }
 
 void SignalSources::setOriginalChannelOrder()
@@ -43,7 +43,8 @@
 
 using namespace std;
 
-class MultiColumnDisplay;
+// Maximum number of amplifier channels that may be grouped into a single displayed waveform.
+const int MaxNumWaveformsInGroup = 4;
 
 // Data structure containing a description of all signal channels on a particular signal port (e.g., SPI Port A, or
 // Digital Inputs).
@@ -104,7 +105,7 @@ public:
     ~SignalSources();
 
     DisplayUndoManager* undoManager;
-    void setDisplayForUndo(MultiColumnDisplay* display_) { display = display_; }
+    void setDisplayForUndo(AbstractDisplayColumns* display_) { display = display_; }
     DisplayState saveState() const;
     void restoreState(const DisplayState& savedState);
 
@@ -165,6 +166,8 @@ public:
     QStringList getDisplayListSupplyVoltages(const QString& groupName) const;
     QStringList getDisplayListBaseGroup(const QString& groupName) const;
 
+    void addAmplifierChannels(const vector<ChipType> &chipType, const vector<int> &portIndex,
+                              const vector<int> &commandStream, const vector<int> &numChannelsOnPort);
     void updateChannelMap();    // call after all amplifier signals are added (e.g., ports rescanned)
 
     void clearTCPDataOutput();
@@ -179,7 +182,7 @@ private:
 
     map<string, Channel*> channelMap;   // map from native name to channel pointer, for quick access
 
-    MultiColumnDisplay* display;  // needed for undo/redo operations with pinned waveforms and scroll bar state
+    AbstractDisplayColumns* display;  // needed for undo/redo operations with pinned waveforms and scroll bar state
 
     bool groupIDisPresent(int groupID) const;
     void saveChannelState(const Channel* channel, ChannelState* saveChannel) const;
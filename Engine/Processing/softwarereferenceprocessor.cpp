@@ -28,11 +28,27 @@
 //
 //------------------------------------------------------------------------------
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RHX_SWREF_SSE2
+#endif
 #include "softwarereferenceprocessor.h"
 
 using namespace std;
 
+namespace {
+
+// Medians of longer references are selected one sample at a time, since a sorting network grows as n log^2 n.
+const int MaxMedianNetworkLength = 128;
+
+// Samples per tile when running a sorting network, so the tile's rows for every member stay in L1 cache.
+const int MedianTileSamples = 64;
+
+}
+
 SoftwareReferenceProcessor::SoftwareReferenceProcessor(ControllerType type_, int numDataStreams_, int numSamples_, SystemState* state_) :
     type(type_),
     numDataStreams(numDataStreams_),
@@ -60,6 +76,12 @@ void SoftwareReferenceProcessor::deleteDataArrays()
 }
 
 void SoftwareReferenceProcessor::updateReferenceInfo(const SignalSources* signalSources)
+{
+    readReferenceInfo(signalSources);
+    buildReferencePlan();
+}
+
+void SoftwareReferenceProcessor::readReferenceInfo(const SignalSources* signalSources)
 {
     // Clear reference info from last run.
     signalListSingleReference.clear();
@@ -82,6 +104,12 @@ void SoftwareReferenceProcessor::updateReferenceInfo(const SignalSources* signal
     int allRefIndexShortcut = -1;
     vector<int> portRefIndexShortcut(AbstractRHXController::maxNumSPIPorts(type), -1);
 
+    // Channels marked bad are left out of ALL and PORT X references (but may still be referenced individually).
+    QStringList excludedChannels = state->referenceExcludedChannels->getValueString().split(',', Qt::SkipEmptyParts);
+    for (QString& name : excludedChannels) {
+        name = name.trimmed();
+    }
+
     // Populate with new reference info.
     for (int port = 0; port < signalSources->numPortGroups(); ++port) {
         SignalGroup* group = signalSources->portGroupByIndex(port);
@@ -123,7 +151,8 @@ void SoftwareReferenceProcessor::updateReferenceInfo(const SignalSources* signal
                                     Channel* refChannel = signalSources->channelByName(portPrefix +
                                                                                              QString("%1").arg(i, 3, 10, QChar('0')));
                                     if (refChannel) {
-                                        if (refChannel->isEnabled()) {
+                                        if (refChannel->isEnabled() &&
+                                                !excludedChannels.contains(refChannel->getNativeName(), Qt::CaseInsensitive)) {
                                             StreamChannelPair refAddress;
                                             refAddress.stream = refChannel->getBoardStream();
                                             refAddress.channel = refChannel->getChipChannel();
@@ -145,7 +174,8 @@ void SoftwareReferenceProcessor::updateReferenceInfo(const SignalSources* signal
                                 Channel* refChannel = signalSources->channelByName(portPrefix +
                                                                                          QString("%1").arg(i, 3, 10, QChar('0')));
                                 if (refChannel) {
-                                    if (refChannel->isEnabled()) {
+                                    if (refChannel->isEnabled() &&
+                                            !excludedChannels.contains(refChannel->getNativeName(), Qt::CaseInsensitive)) {
                                         StreamChannelPair refAddress;
                                         refAddress.stream = refChannel->getBoardStream();
                                         refAddress.channel = refChannel->getChipChannel();
@@ -169,6 +199,10 @@ void SoftwareReferenceProcessor::updateReferenceInfo(const SignalSources* signal
                         }
                     }
 
+                    if (!shortcutFound && refList.empty()) {
+                        continue;  // Every channel in this reference is excluded, so leave this signal unreferenced.
+                    }
+
                     if (!shortcutFound) {
                         std::sort(refList.begin(), refList.end());  // Sort list to facilitate quick comparison.
 
@@ -241,18 +275,56 @@ int SoftwareReferenceProcessor::findMultiReference(const vector<StreamChannelPai
     return -1;  // Reference not found in list.
 }
 
-void SoftwareReferenceProcessor::applySoftwareReferences(uint16_t* start)
+// Precompute where every reference member and every referenced signal lives within a USB data frame, so each block
+// is processed in a single pass over its frames.
+void SoftwareReferenceProcessor::buildReferencePlan()
 {
-    calculateReferenceSignals(start);
+    multiReferenceOffsets.resize(multiReferenceList.size());
+    medianNetworks.resize(multiReferenceList.size());
+    size_t maxReferenceSize = 0;
+    for (int i = 0; i < (int) multiReferenceList.size(); ++i) {
+        multiReferenceOffsets[i].clear();
+        for (const StreamChannelPair& address : multiReferenceList[i]) {
+            multiReferenceOffsets[i].push_back(frameOffset(address));
+        }
+        medianNetworks[i] = medianNetwork((int) multiReferenceList[i].size());
+        maxReferenceSize = max(maxReferenceSize, multiReferenceList[i].size());
+    }
+    referenceRows.resize(maxReferenceSize * numSamples);
+    medianScratch.resize(maxReferenceSize);
 
-    for (int i = 0; i < (int) signalListSingleReference.size(); ++i) {
-        const int* refSignal = singleReferenceData[signalListSingleReference[i].referenceIndex];
-        subtractReferenceSignal(signalListSingleReference[i].address, refSignal, start);
+    referencedSignals.clear();
+    for (const SignalWithSoftwareReference& signal : signalListSingleReference) {
+        referencedSignals.push_back({ frameOffset(signal.address), singleReferenceData[signal.referenceIndex] });
+    }
+    for (const SignalWithSoftwareReference& signal : signalListMultiReference) {
+        referencedSignals.push_back({ frameOffset(signal.address), multiReferenceData[signal.referenceIndex] });
     }
+}
 
-    for (int i = 0; i < (int) signalListMultiReference.size(); ++i) {
-        const int* refSignal = multiReferenceData[signalListMultiReference[i].referenceIndex];
-        subtractReferenceSignal(signalListMultiReference[i].address, refSignal, start);
+int SoftwareReferenceProcessor::frameOffset(StreamChannelPair address) const
+{
+    int offset = 6; // Skip header and timestamp.
+    offset += misoWordSize * (numDataStreams * 3);  // Skip auxiliary channels.
+    offset += misoWordSize * ((numDataStreams * address.channel) + address.stream);   // Align with selected stream and channel.
+    if (type == ControllerStimRecord) offset++;  // Skip top 16 bits of 32-bit MISO word from RHS system.
+    return offset;
+}
+
+void SoftwareReferenceProcessor::applySoftwareReferences(uint16_t* start)
+{
+    calculateReferenceSignals(start);
+
+    // All reference signals are calculated from the unreferenced data before any signal is modified.
+    uint16_t* frame = start;
+    for (int t = 0; t < numSamples; ++t) {
+        for (const ReferencedSignal& signal : referencedSignals) {
+            int newVal = ((int) frame[signal.frameOffset]) - signal.refSignal[t];
+            newVal = max(newVal, 0);
+            newVal = min(newVal, 65535);
+            frame[signal.frameOffset] = (uint16_t) newVal;
+        }
+        frame += dataFrameSizeInWords;
     }
 }
 
@@ -262,108 +334,183 @@ void SoftwareReferenceProcessor::calculateReferenceSignals(const uint16_t* start
         readReferenceSignal(singleReferenceList[i], singleReferenceData[i], start);
     }
 
-    if (!state->useMedianReference->getValue()) {
-        // Use average (mean)
-        for (int i = 0; i < (int) multiReferenceList.size(); ++i) {
-            readReferenceSignal(multiReferenceList[i][0], multiReferenceData[i], start);
-            for (int j = 1; j < (int) multiReferenceList[i].size(); ++j) {
-                addReferenceSignal(multiReferenceList[i][j], multiReferenceData[i], start);
-            }
-            double oneOverN = 1.0 / (double) multiReferenceList[i].size();
-            for (int t = 0; t < numSamples; ++t) {
-                multiReferenceData[i][t] = round(((double) multiReferenceData[i][t]) * oneOverN);  // Calculate average.
-            }
+    bool useMedian = state->useMedianReference->getValue();
+    for (int i = 0; i < (int) multiReferenceList.size(); ++i) {
+        gatherReferenceRows(multiReferenceOffsets[i], start);
+        if (!useMedian) {
+            calculateMeanReference((int) multiReferenceOffsets[i].size(), multiReferenceData[i]);
+        } else {
+            calculateMedianReference(medianNetworks[i], (int) multiReferenceOffsets[i].size(), multiReferenceData[i]);
         }
-    } else {
-        // Use median
-        for (int i = 0; i < (int) multiReferenceList.size(); ++i) {
-            vector<int> samples;
-            samples.resize(multiReferenceList[i].size());
-            for (int t = 0; t < numSamples; ++t) {
-                readReferenceSamples(multiReferenceList[i], t, samples, start);
-                multiReferenceData[i][t] = calculateMedian(samples);
-            }
+    }
+}
+
+// Read each reference member once per block into its own contiguous row, converting offset binary to signed, so the
+// mean and median below work on whole vectors of samples.
+void SoftwareReferenceProcessor::gatherReferenceRows(const vector<int>& offsets, const uint16_t* start)
+{
+    for (int j = 0; j < (int) offsets.size(); ++j) {
+        const uint16_t* pRead = start + offsets[j];
+        int16_t* row = &referenceRows[(size_t) j * numSamples];
+        for (int t = 0; t < numSamples; ++t) {
+            row[t] = (int16_t) (*pRead ^ 0x8000U);
+            pRead += dataFrameSizeInWords;
         }
     }
 }
 
-void SoftwareReferenceProcessor::readReferenceSignal(StreamChannelPair address, int* destination, const uint16_t* start)
+// Mean of the first length rows, rounded to the nearest integer.  The sums are vectorized; the final scaling keeps
+// the original double-precision round(), so results match earlier releases exactly.
+void SoftwareReferenceProcessor::calculateMeanReference(int length, int* destination) const
 {
-    const uint16_t* pRead = start;
-    int* pWrite = destination;
+    const int16_t* rows = referenceRows.data();
+    int t = 0;
+#ifdef RHX_SWREF_SSE2
+    for (; t + 8 <= numSamples; t += 8) {
+        __m128i sumLow = _mm_setzero_si128();
+        __m128i sumHigh = _mm_setzero_si128();
+        const int16_t* pRead = rows + t;
+        for (int j = 0; j < length; ++j) {
+            __m128i values = _mm_loadu_si128((const __m128i*) pRead);
+            sumLow = _mm_add_epi32(sumLow, _mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16));
+            sumHigh = _mm_add_epi32(sumHigh, _mm_srai_epi32(_mm_unpackhi_epi16(values, values), 16));
+            pRead += numSamples;
+        }
+        _mm_storeu_si128((__m128i*) (destination + t), sumLow);
+        _mm_storeu_si128((__m128i*) (destination + t + 4), sumHigh);
+    }
+#endif
+    for (; t < numSamples; ++t) {
+        int sum = 0;
+        for (int j = 0; j < length; ++j) {
+            sum += rows[(size_t) j * numSamples + t];
+        }
+        destination[t] = sum;
+    }
 
-    pRead += 6; // Skip header and timestamp.
-    pRead += misoWordSize * (numDataStreams * 3);  // Skip auxiliary channels.
-    pRead += misoWordSize * ((numDataStreams * address.channel) + address.stream);   // Align with selected stream and channel.
-    if (type == ControllerStimRecord) pRead++;  // Skip top 16 bits of 32-bit MISO word from RHS system.
-    for (int i = 0; i < numSamples; ++i) {
-        *pWrite = (((int) *pRead) - 32768);
-        pWrite++;
-        pRead += dataFrameSizeInWords;
+    double oneOverN = 1.0 / (double) length;
+    for (t = 0; t < numSamples; ++t) {
+        destination[t] = round(((double) destination[t]) * oneOverN);  // Calculate average.
     }
 }
 
-void SoftwareReferenceProcessor::addReferenceSignal(StreamChannelPair address, int* destination, const uint16_t* start)
+// Median of the first length rows; for an even number of values, the mean of the two middle values (truncated toward
+// zero).  The sorting network is applied to a tile of samples at a time, leaving the middle rows holding the middle
+// values.  Warning: This function reorders the reference rows!
+void SoftwareReferenceProcessor::calculateMedianReference(const vector<MedianComparator>& network, int length,
+                                                          int* destination)
 {
-    const uint16_t* pRead = start;
-    int* pWrite = destination;
+    int16_t* rows = referenceRows.data();
+    int middle = length / 2;
+    if (network.empty() && length > 1) {
+        int* samples = medianScratch.data();
+        for (int t = 0; t < numSamples; ++t) {
+            for (int j = 0; j < length; ++j) {
+                samples[j] = rows[(size_t) j * numSamples + t];
+            }
+            destination[t] = calculateMedian(samples, length);
+        }
+        return;
+    }
 
-    pRead += 6; // Skip header and timestamp.
-    pRead += misoWordSize * (numDataStreams * 3);  // Skip auxillary channels.
-    pRead += misoWordSize * ((numDataStreams * address.channel) + address.stream);   // Align with selected stream and channel.
-    if (type == ControllerStimRecord) pRead++;  // Skip top 16 bits of 32-bit MISO word from RHS system.
-    for (int i = 0; i < numSamples; ++i) {
-        *pWrite += (((int) *pRead) - 32768);  // Only difference between this function and readReferenceSignal() is this line.
-        pWrite++;
-        pRead += dataFrameSizeInWords;
+    for (int tileStart = 0; tileStart < numSamples; tileStart += MedianTileSamples) {
+        int tileEnd = min(tileStart + MedianTileSamples, numSamples);
+        for (const MedianComparator& comparator : network) {
+            int16_t* low = rows + (size_t) comparator.low * numSamples;
+            int16_t* high = rows + (size_t) comparator.high * numSamples;
+            int t = tileStart;
+#ifdef RHX_SWREF_SSE2
+            for (; t + 8 <= tileEnd; t += 8) {
+                __m128i a = _mm_loadu_si128((const __m128i*) (low + t));
+                __m128i b = _mm_loadu_si128((const __m128i*) (high + t));
+                _mm_storeu_si128((__m128i*) (low + t), _mm_min_epi16(a, b));
+                _mm_storeu_si128((__m128i*) (high + t), _mm_max_epi16(a, b));
+            }
+#endif
+            for (; t < tileEnd; ++t) {
+                int16_t a = low[t];
+                int16_t b = high[t];
+                low[t] = min(a, b);
+                high[t] = max(a, b);
+            }
+        }
+    }
+
+    const int16_t* upperMiddle = rows + (size_t) middle * numSamples;
+    if (length % 2) {
+        for (int t = 0; t < numSamples; ++t) {
+            destination[t] = upperMiddle[t];
+        }
+    } else {
+        const int16_t* lowerMiddle = upperMiddle - numSamples;
+        for (int t = 0; t < numSamples; ++t) {
+            destination[t] = ((int) lowerMiddle[t] + upperMiddle[t]) / 2;
+        }
     }
 }
 
-void SoftwareReferenceProcessor::subtractReferenceSignal(StreamChannelPair address, const int* refSignal, uint16_t* start)
+// Batcher's odd-even merge sort network for length values, keeping only the comparators that the middle value (or
+// two middle values) depend on.  Returns an empty network for references too long to sort this way.
+vector<MedianComparator> SoftwareReferenceProcessor::medianNetwork(int length)
 {
-    uint16_t* pSignal = start;
+    vector<MedianComparator> network;
+    if (length < 2 || length > MaxMedianNetworkLength) return network;
+
+    // Comparators that touch a position beyond the end compare against an implicit largest value, so they never
+    // move anything and are left out.
+    int paddedLength = 1;
+    while (paddedLength < length) paddedLength <<= 1;
+    for (int p = 1; p < paddedLength; p <<= 1) {
+        for (int k = p; k >= 1; k >>= 1) {
+            for (int j = k % p; j + k < paddedLength; j += 2 * k) {
+                for (int i = 0; i < min(k, paddedLength - j - k); ++i) {
+                    int a = i + j;
+                    int b = i + j + k;
+                    if (a / (2 * p) == b / (2 * p) && b < length) {
+                        network.push_back({ a, b });
+                    }
+                }
+            }
+        }
+    }
 
-    pSignal += 6; // Skip header and timestamp.
-    pSignal += misoWordSize * (numDataStreams * 3);  // Skip auxillary channels.
-    pSignal += misoWordSize * ((numDataStreams * address.channel) + address.stream);   // Align with selected stream and channel.
-    if (type == ControllerStimRecord) pSignal++;  // Skip top 16 bits of 32-bit MISO word from RHS system.
-    for (int i = 0; i < numSamples; ++i) {
-        int newVal = ((int) *pSignal) - *refSignal;
-        newVal = max(newVal, 0);
-        newVal = min(newVal, 65535);
-        *pSignal = (uint16_t) newVal;
-        pSignal += dataFrameSizeInWords;
-        refSignal++;
+    // Walk backward from the middle outputs, keeping each comparator that feeds a position still needed.
+    vector<bool> needed(length, false);
+    needed[length / 2] = true;
+    if (length % 2 == 0) needed[length / 2 - 1] = true;
+    vector<MedianComparator> pruned;
+    for (int c = (int) network.size() - 1; c >= 0; --c) {
+        if (needed[network[c].low] || needed[network[c].high]) {
+            needed[network[c].low] = true;
+            needed[network[c].high] = true;
+            pruned.push_back(network[c]);
+        }
     }
+    reverse(pruned.begin(), pruned.end());
+    return pruned;
 }
 
-void SoftwareReferenceProcessor::readReferenceSamples(vector<StreamChannelPair> &addresses, int t, vector<int> &destination,
-                                                      const uint16_t* start)
+void SoftwareReferenceProcessor::readReferenceSignal(StreamChannelPair address, int* destination, const uint16_t* start)
 {
-    const uint16_t* pRead;
-
-    for (uint i = 0; i < addresses.size(); ++i) {
-        pRead = start;
-        pRead += 6; // Skip header and timestamp.
-        pRead += misoWordSize * (numDataStreams * 3);  // Skip auxiliary channels.
-        pRead += misoWordSize * ((numDataStreams * addresses[i].channel) + addresses[i].stream);   // Align with selected stream and channel.
-        if (type == ControllerStimRecord) pRead++;  // Skip top 16 bits of 32-bit MISO word from RHS system.
-        pRead += t * dataFrameSizeInWords;  // Jump to requested time index.
-        destination[i] = (((int) *pRead) - 32768);
+    const uint16_t* pRead = start + frameOffset(address);
+    int* pWrite = destination;
+
+    for (int i = 0; i < numSamples; ++i) {
+        *pWrite = (((int) *pRead) - 32768);
+        pWrite++;
+        pRead += dataFrameSizeInWords;
     }
 }
 
-int SoftwareReferenceProcessor::calculateMedian(vector<int> &data)
+// Median by partial selection rather than a full sort; for an even number of values, the mean of the two middle values
+// (truncated toward zero).  Warning: This function reorders the input array!
+int SoftwareReferenceProcessor::calculateMedian(int* data, int length)
 {
-    int median;
-    std::sort(data.begin(), data.end());    // Warning: This function reorders the input vector!
-
-    int length = (int) data.size();
-    bool isOdd = length % 2;
-    if (isOdd) {
-        median = data[length / 2];
-    } else {
-        median = (data[length / 2 - 1] + data[length / 2]) / 2;
+    int middle = length / 2;
+    nth_element(data, data + middle, data + length);
+    if (length % 2) {
+        return data[middle];
     }
-    return median;
+    int lowerMiddle = *max_element(data, data + middle);  // Largest of the values below the upper middle value.
+    return (lowerMiddle + data[middle]) / 2;
 }
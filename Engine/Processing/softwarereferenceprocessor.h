@@ -43,6 +43,18 @@ struct SignalWithSoftwareReference
     int referenceIndex;
 };
 
+struct ReferencedSignal
+{
+    int frameOffset;        // word offset of the signal within each USB data frame
+    const int* refSignal;
+};
+
+struct MedianComparator
+{
+    int low;                // reference member that receives the smaller of the two values
+    int high;               // reference member that receives the larger of the two values
+};
+
 
 class SoftwareReferenceProcessor
 {
@@ -72,14 +84,26 @@ private:
     vector<vector<StreamChannelPair> > multiReferenceList;
     vector<int*> multiReferenceData;
 
+    // Frame offsets of every multi-channel reference's members, every referenced signal, median sorting networks,
+    // and scratch space; built by updateReferenceInfo() so that processing a block never allocates.
+    vector<vector<int> > multiReferenceOffsets;
+    vector<ReferencedSignal> referencedSignals;
+    vector<vector<MedianComparator> > medianNetworks;   // Empty for references too long for a sorting network.
+    vector<int16_t> referenceRows;  // One row of numSamples signed samples per reference member.
+    vector<int> medianScratch;
+
+    void readReferenceInfo(const SignalSources* signalSources);
+    void buildReferencePlan();
+    int frameOffset(StreamChannelPair address) const;
     int findSingleReference(StreamChannelPair singleRef, const vector<StreamChannelPair>& singleRefList) const;
     int findMultiReference(const vector<StreamChannelPair>& multiRef, const vector<vector<StreamChannelPair> >& multiRefList) const;
     void calculateReferenceSignals(const uint16_t* start);
+    void gatherReferenceRows(const vector<int>& offsets, const uint16_t* start);
+    void calculateMeanReference(int length, int* destination) const;
+    void calculateMedianReference(const vector<MedianComparator>& network, int length, int* destination);
+    static vector<MedianComparator> medianNetwork(int length);
     void readReferenceSignal(StreamChannelPair address, int* destination, const uint16_t* start);
-    void addReferenceSignal(StreamChannelPair address, int* destination, const uint16_t* start);
-    void subtractReferenceSignal(StreamChannelPair address, const int* refSignal, uint16_t* start);
-    void readReferenceSamples(vector<StreamChannelPair> &addresses, int t, vector<int> &destination, const uint16_t* start);
-    int calculateMedian(vector<int> &data);
+    static int calculateMedian(int* data, int length);
     void deleteDataArrays();
 
 };
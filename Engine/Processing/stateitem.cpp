@@ -301,14 +301,6 @@ QString DiscreteItemList::getValidValues() const
     return validValues;
 }
 
-void DiscreteItemList::setupComboBox(QComboBox* comboBox) const
-{
-   for (auto& item : items) {
-       comboBox->addItem(item.displayedValueName);
-   }
-   comboBox->setCurrentIndex(currentIndex);
-}
-
 
 DoubleRangeItem::DoubleRangeItem(const QString &parameterName_, SingleItemList &hList_, SystemState *state_,
                                  double minValue_, double maxValue_, double defaultValue_, XMLGroup xmlGroup_,
@@ -371,13 +363,6 @@ QString DoubleRangeItem::getValidValues() const
     return "[ " + QString::number(minValue) + " , " + QString::number(maxValue) + " ]";
 }
 
-void DoubleRangeItem::setupSpinBox(QDoubleSpinBox *spinBox) const
-{
-    spinBox->setMinimum(minValue);
-    spinBox->setMaximum(maxValue);
-    spinBox->setValue(currentValue);
-}
-
 
 IntRangeItem::IntRangeItem(const QString &parameterName_, SingleItemList &hList_, SystemState *state_,
                            int minValue_, int maxValue_, int defaultValue_, XMLGroup xmlGroup_,
@@ -439,10 +424,3 @@ QString IntRangeItem::getValidValues() const
 {
     return "[ " + QString::number(minValue) + " , " + QString::number(maxValue) + " ]";
 }
-
-void IntRangeItem::setupSpinBox(QSpinBox *spinBox) const
-{
-    spinBox->setMinimum(minValue);
-    spinBox->setMaximum(maxValue);
-    spinBox->setValue(currentValue);
-}
@@ -147,6 +147,7 @@ SystemState::SystemState(const AbstractRHXController* controller_, StimStepSize
     fileFormat->addItem("Traditional", "Traditional");
     fileFormat->addItem("OneFilePerSignalType", "OneFilePerSignalType");
     fileFormat->addItem("OneFilePerChannel", "OneFilePerChannel");
+    fileFormat->addItem("RawFrames", "RawFrames");
     fileFormat->setValue("Traditional");
 
     writeToDiskLatency = new DiscreteItemList("WriteToDiskLatency", globalItems, this);
@@ -313,6 +314,9 @@ SystemState::SystemState(const AbstractRHXController* controller_, StimStepSize
     // Referencing
     useMedianReference = new BooleanItem("UseMedianReference", globalItems, this, false);
     useMedianReference->setRestricted(RestrictIfRunning, RunningErrorMessage);
+    // Comma-separated channel names (e.g., "A-003,B-017") left out of ALL and PORT X references.
+    referenceExcludedChannels = new StringItem("ReferenceExcludedChannels", globalItems, this, "");
+    referenceExcludedChannels->setRestricted(RestrictIfRunning, RunningErrorMessage);
 
     // Filtering
 
@@ -427,6 +431,29 @@ SystemState::SystemState(const AbstractRHXController* controller_, StimStepSize
     plottingMode->addItem("High Efficiency", "High Efficiency", 1);
     plottingMode->setValue("Original");
 
+    // Numeric value is the number of data blocks processed per WaveformProcessorThread iteration.
+    processingLatency = new DiscreteItemList("ProcessingLatency", globalItems, this);
+    processingLatency->setRestricted(RestrictIfRunning, RunningErrorMessage);
+    processingLatency->addItem("Lowest", "Lowest", 1.0);
+    processingLatency->addItem("Low", "Low", 2.0);
+    processingLatency->addItem("Medium", "Medium", 4.0);
+    processingLatency->addItem("High", "High", (double) MaxNumBlocksToProcess);
+    processingLatency->setValue("Lowest");
+
+    // Numeric value is the number of threads the CPU filters channels with; 0 selects one thread per physical core.
+    cpuProcessingThreads = new DiscreteItemList("CPUProcessingThreads", globalItems, this);
+    cpuProcessingThreads->setRestricted(RestrictIfRunning, RunningErrorMessage);
+    cpuProcessingThreads->addItem("Auto", "Auto", 0.0);
+    cpuProcessingThreads->addItem("1", "1", 1.0);
+    cpuProcessingThreads->addItem("2", "2", 2.0);
+    cpuProcessingThreads->addItem("4", "4", 4.0);
+    cpuProcessingThreads->addItem("8", "8", 8.0);
+    cpuProcessingThreads->addItem("16", "16", 16.0);
+    cpuProcessingThreads->setValue("Auto");
+
+    pinCPUProcessingThreads = new BooleanItem("PinCPUProcessingThreads", globalItems, this, false);
+    pinCPUProcessingThreads->setRestricted(RestrictIfRunning, RunningErrorMessage);
+
     note1 = new StringItem("Note1", globalItems, this, "");
     note1->setRestricted(RestrictIfRunning, RunningErrorMessage);
     note2 = new StringItem("Note2", globalItems, this, "");
@@ -1033,7 +1060,8 @@ QStringList SystemState::getTCPDataOutputChannels() const
             if (thisChannel->getOutputToTcp()) {
                 channelList.append(thisChannel->getNativeName());
             } else if (thisChannel->getSignalType() == AmplifierSignal) {
-                if (thisChannel->getOutputToTcpLow() || thisChannel->getOutputToTcpHigh() || thisChannel->getOutputToTcpSpike()) {
+                if (thisChannel->getOutputToTcpLow() || thisChannel->getOutputToTcpHigh() || thisChannel->getOutputToTcpLfp() ||
+                    thisChannel->getOutputToTcpSpike()) {
                     channelList.append(thisChannel->getNativeName());
                 } else if (getControllerTypeEnum() == ControllerStimRecord) {
                     if (thisChannel->getOutputToTcpDc() || thisChannel->getOutputToTcpStim()) {
@@ -1128,10 +1156,11 @@ void SystemState::timerEvent(QTimerEvent *event)
     }
 }
 
-void SystemState::setupGlobalSettingsLoadSave(ControllerInterface* controllerInterface)
+void SystemState::setupGlobalSettingsLoadSave(AbstractSettingsInterface* globalSettingsInterface_)
 {
-    // XML interface for saving global settings.
-    globalSettingsInterface = new XMLInterface(this, controllerInterface, XMLIncludeGlobalParameters);
+    // Interface (normally XMLInterface) for saving global settings.  SystemState takes ownership.
+    delete globalSettingsInterface;
+    globalSettingsInterface = globalSettingsInterface_;
 }
 
 bool SystemState::loadGlobalSettings(const QString& filename, QString &errorMessage) const
@@ -1140,7 +1169,7 @@ bool SystemState::loadGlobalSettings(const QString& filename, QString &errorMess
         cerr << "SystemState::loadGlobalSettings: Must run setupGlobalSettingsLoadSave first." << '\n';
         return false;
     }
-    return globalSettingsInterface->loadFile(filename, errorMessage);
+    return globalSettingsInterface->loadSettingsFile(filename, errorMessage);
 }
 
 bool SystemState::saveGlobalSettings(const QString& filename) const
@@ -1149,7 +1178,7 @@ bool SystemState::saveGlobalSettings(const QString& filename) const
         cerr << "SystemState::loadGlobalSettings: Must run setupGlobalSettingsLoadSave first." << '\n';
         return false;
     }
-    return globalSettingsInterface->saveFile(filename);
+    return globalSettingsInterface->saveSettingsFile(filename);
 }
 
 void SystemState::updateForChangeHeadstages()
@@ -1191,7 +1220,7 @@ void SystemState::setupLog()
     logFileName = settings.value("logFileName", "IntanRHXErrorLog.txt").toString();
     QFile *file = new QFile(logFileName);
     if (!file->open(QIODevice::WriteOnly)) {
-        QMessageBox::warning(nullptr, "Problem Saving IntanRHX Error Log", "Cannot open text file for saving errors to disk. Is the file being used, or located in an administrator-only directory?");
+        showWarning("Problem Saving IntanRHX Error Log", "Cannot open text file for saving errors to disk. Is the file being used, or located in an administrator-only directory?");
         logErrors = false;
         if (file) delete file;
         return;
@@ -1208,7 +1237,7 @@ void SystemState::writeToLog(QString message)
 
     QFile *file = new QFile(logFileName);
     if (!file->open(QIODevice::WriteOnly | QIODevice::Append)) {
-        QMessageBox::warning(nullptr, "Saving IntanRHX Error Message Error", "Cannot open text file for saving errors to disk (writeonly, append, SystemState)");
+        showWarning("Saving IntanRHX Error Message Error", "Cannot open text file for saving errors to disk (writeonly, append, SystemState)");
         if (file) delete file;
         return;
     }
@@ -1221,6 +1250,22 @@ void SystemState::writeToLog(QString message)
     return;
 }
 
+SystemState::WarningHandler SystemState::warningHandler = nullptr;
+
+void SystemState::setWarningHandler(WarningHandler handler)
+{
+    warningHandler = handler;
+}
+
+void SystemState::showWarning(const QString& title, const QString& message)
+{
+    if (warningHandler) {
+        warningHandler(title, message);
+    } else {
+        cerr << title.toStdString() << ": " << message.toStdString() << '\n';
+    }
+}
+
 void SystemState::setReportSpikes(bool enable)
 {
     reportSpikes = enable;
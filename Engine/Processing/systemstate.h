@@ -31,8 +31,6 @@
 #ifndef SYSTEMSTATE_H
 #define SYSTEMSTATE_H
 
-#include <QComboBox>
-#include <QDoubleSpinBox>
 #include <QFile>
 #include <map>
 #include <array>
@@ -55,8 +53,7 @@ using namespace std;
 class SignalSources;
 class Channel;
 class BooleanItem;
-class XMLInterface;
-class ControllerInterface;
+class AbstractSettingsInterface;
 class DataFileReader;
 
 struct CPUInfo {
@@ -64,6 +61,7 @@ struct CPUInfo {
     cl_device_id deviceId;
     QString name;
     float diagnosticTime;
+    float batchedDiagnosticTime;
     int rank;
     bool used;
 };
@@ -120,7 +118,7 @@ public:
     void clearProbeMapSettings();
     void printProbeMapSettings() const;
 
-    void setupGlobalSettingsLoadSave(ControllerInterface* controllerInterface);
+    void setupGlobalSettingsLoadSave(AbstractSettingsInterface* globalSettingsInterface_);
     bool loadGlobalSettings(const QString& filename, QString &errorMessage) const;
     bool saveGlobalSettings(const QString& filename) const;
 
@@ -129,6 +127,12 @@ public:
     void enableLogging(bool enable); // Toggled externally, probably from ControlWindow
     void writeToLog(QString message); // Callable from anywhere with access to SystemState
 
+    // Warnings for the user, such as OpenCL setup errors.  The GUI installs a handler (before SystemState is
+    // constructed) that shows them in message boxes; without one, they are printed to cerr.
+    typedef void (*WarningHandler)(const QString& title, const QString& message);
+    static void setWarningHandler(WarningHandler handler);
+    static void showWarning(const QString& title, const QString& message);
+
     void setReportSpikes(bool enable);
     bool getReportSpikes();
 
@@ -280,6 +284,7 @@ public:
 
     // Referencing
     BooleanItem *useMedianReference;
+    StringItem *referenceExcludedChannels;
 
     // Filtering
     BooleanItem *dspEnabled;
@@ -313,6 +318,9 @@ public:
     StringItem* backgroundColor;
     StringItem* displaySettings;  // This is only set when a settings file is saved, and only accessed when a settings file is loaded.
     DiscreteItemList* plottingMode;
+    DiscreteItemList* processingLatency;
+    DiscreteItemList* cpuProcessingThreads;
+    BooleanItem* pinCPUProcessingThreads;
 
     // Playback options
     BooleanItem* runAfterJumpToPosition;
@@ -430,6 +438,8 @@ protected:
 private:
     void setupLog(); // Checks QSettings to see if file should actually be created, and writes first message
 
+    static WarningHandler warningHandler;
+
     bool holdMode;
     bool updateNeeded;
     bool pendingStateChangedSignal;
@@ -441,7 +451,7 @@ private:
 
     int lastTimestamp;
 
-    XMLInterface* globalSettingsInterface;
+    AbstractSettingsInterface* globalSettingsInterface;
 
     void queueStateChangedSignal();
 
@@ -28,6 +28,7 @@
 //
 //------------------------------------------------------------------------------
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include "rhxglobals.h"
@@ -42,6 +43,30 @@ WaveformFifo::WaveformFifo(SignalSources *signalSources_, int bufferSizeInDataBl
     maxWriteSizeInDataBlocks(maxWriteSizeInDataBlocks_),
     numReaders(NumberOfReaders)
 {
+    lowpassEnabled = true;
+    highpassEnabled = true;
+    writingLowpass = true;
+    writingHighpass = true;
+    lowpassStored.from = 0;
+    lowpassStored.until = INT64_MAX;
+    highpassStored.from = 0;
+    highpassStored.until = INT64_MAX;
+    lfpBuffer = nullptr;
+    lfpFactor = 1;
+    lfpEnabled = false;
+    writingLfp = false;
+    rawFrameBuffer = nullptr;
+    rawFrameSize = 0;
+    writingRawFrames = false;
+    auxInputStorage = nullptr;
+    supplyVoltageStorage = nullptr;
+    auxInputStorageSize = 0;
+    supplyVoltageStorageSize = 0;
+    cursors = nullptr;
+    writeCount = 0;
+    writeSequence = 0;
+    numReadersWaiting = 0;
+
     if (numReaders < 1) {
         cerr << "WaveformFifo constructor: numReaders must be one or greater." << '\n';
         numReaders = 1;
@@ -64,9 +89,8 @@ WaveformFifo::WaveformFifo(SignalSources *signalSources_, int bufferSizeInDataBl
     bufferAllocateSize = bufferSize + maxWriteSizeInSamples;
     bufferAllocateSizeInBlocks = bufferSizeInDataBlocks + maxWriteSizeInDataBlocks;
 
-    usedWordsNewData = new Semaphore[numReaders];
+    cursors = new ReaderCursor[numReaders];
     bufferReadIndex.resize(numReaders);
-    bufferMemoryIndex.resize(numReaders);
     numWordsToBeRead.resize(numReaders);
     if (bufferSize < memorySize + 2 * maxWriteSizeInSamples) {
         cerr << "WaveformFifo: bufferSize too small to support requested memorySize and maxWriteSizeInBlocks." << '\n';
@@ -77,7 +101,7 @@ WaveformFifo::WaveformFifo(SignalSources *signalSources_, int bufferSizeInDataBl
 WaveformFifo::~WaveformFifo()
 {
     freeMemory();
-    delete [] usedWordsNewData;
+    delete [] cursors;
 }
 
 void WaveformFifo::allocateAnalogBuffer(vector<float*> &bufferArray, const string& waveName)
@@ -94,6 +118,32 @@ void WaveformFifo::allocateAnalogBuffer(vector<float*> &bufferArray, const strin
     analogWaveformIndices[waveName] = buffer;
 }
 
+// Allocate one block of memory holding numWaveforms buffers stored at 1/divisor of the amplifier sample rate.
+float* WaveformFifo::allocateNativeRateStorage(int numWaveforms, int divisor, int& storageSize)
+{
+    storageSize = numWaveforms * (bufferAllocateSize / divisor);
+    if (storageSize == 0) return nullptr;
+
+    memoryNeededGB += sizeof(float) * storageSize / (1024.0 * 1024.0 * 1024.0);
+    float* storage = nullptr;
+    try {
+        storage = new float [storageSize];
+    } catch (std::bad_alloc&) {
+        memoryAllocated = false;
+        storageSize = 0;
+        cerr << "WaveformFifo::allocateNativeRateStorage(): unable to allocate memory." << '\n';
+    }
+    return storage;
+}
+
+void WaveformFifo::addNativeRateBuffer(vector<float*> &bufferArray, const string& waveName, float* storage, int index,
+                                       int divisor)
+{
+    float* buffer = storage ? &storage[index * (bufferAllocateSize / divisor)] : nullptr;
+    bufferArray.push_back(buffer);
+    analogWaveformIndices[waveName] = buffer;
+}
+
 void WaveformFifo::allocateDigitalBuffer(vector<uint16_t*> &bufferArray, const string& waveName)
 {
     memoryNeededGB += sizeof(uint16_t) * bufferAllocateSize / (1024.0 * 1024.0 * 1024.0);
@@ -120,6 +170,8 @@ void WaveformFifo::allocateMemory()
     gpuAmplifierHighpassBuffer = nullptr;
     gpuSpikeTimestamps = nullptr;
     gpuSpikeIds = nullptr;
+    lfpBuffer = nullptr;
+    rawFrameBuffer = nullptr;
 
     memoryNeededGB = (sizeof(uint32_t) * bufferAllocateSize +
                       3 * sizeof(uint16_t) * bufferAllocateSize * numAmplifierChannels +
@@ -147,6 +199,24 @@ void WaveformFifo::allocateMemory()
         cerr << "WaveformFifo::allocateMemory(): unable to allocate GPU spike detector output buffer memory." << '\n';
     }
 
+    allocateLfpMemory();
+    allocateRawFrameMemory();
+
+    int numAuxInputs = 0;
+    int numSupplyVoltages = 0;
+    for (int group = 0; group < signalSources->numGroups(); group++) {
+        SignalGroup* signalGroup = signalSources->groupByIndex(group);
+        for (int signal = 0; signal < signalGroup->numChannels(); signal++) {
+            SignalType signalType = signalGroup->channelByIndex(signal)->getSignalType();
+            if (signalType == AuxInputSignal) ++numAuxInputs;
+            else if (signalType == SupplyVoltageSignal) ++numSupplyVoltages;
+        }
+    }
+    auxInputStorage = allocateNativeRateStorage(numAuxInputs, AuxInputDivisor, auxInputStorageSize);
+    supplyVoltageStorage = allocateNativeRateStorage(numSupplyVoltages, samplesPerDataBlock, supplyVoltageStorageSize);
+    int auxInputIndex = 0;
+    int supplyVoltageIndex = 0;
+
     allocateDigitalBuffer(boardDigInWordBuffer, "DIGITAL-IN-WORD");
     allocateDigitalBuffer(boardDigOutWordBuffer, "DIGITAL-OUT-WORD");
 
@@ -164,6 +234,7 @@ void WaveformFifo::allocateMemory()
                 gpuWaveformAddresses[waveName + "|LOW"] = { GpuWaveformLowpass, gpuWaveformIndex };
                 gpuWaveformAddresses[waveName + "|HIGH"] = { GpuWaveformHighpass, gpuWaveformIndex };
                 gpuWaveformAddresses[waveName + "|SPK"] = { GpuWaveformSpike, gpuWaveformIndex };
+                gpuWaveformAddresses[waveName + "|LFP"] = { GpuWaveformLfp, gpuWaveformIndex };
                 allocateDigitalBuffer(amplifierSpikeBuffer, waveName + "|SPK");
                 if (signalSources->getControllerType() == ControllerStimRecord) {
                     allocateAnalogBuffer(dcAmplifierBuffer, waveName + "|DC");
@@ -171,10 +242,11 @@ void WaveformFifo::allocateMemory()
                 }
                 break;
             case AuxInputSignal:
-                allocateAnalogBuffer(auxInputBuffer, waveName);
+                addNativeRateBuffer(auxInputBuffer, waveName, auxInputStorage, auxInputIndex++, AuxInputDivisor);
                 break;
             case SupplyVoltageSignal:
-                allocateAnalogBuffer(supplyVoltageBuffer, waveName);
+                addNativeRateBuffer(supplyVoltageBuffer, waveName, supplyVoltageStorage, supplyVoltageIndex++,
+                                    samplesPerDataBlock);
                 break;
             case BoardAdcSignal:
                 allocateAnalogBuffer(boardAdcBuffer, waveName);
@@ -183,10 +255,10 @@ void WaveformFifo::allocateMemory()
                 allocateAnalogBuffer(boardDacBuffer, waveName);
                 break;
             case BoardDigitalInSignal:
-                allocateAnalogBuffer(boardDigInBuffer, waveName);
+                digitalBitAddresses[waveName] = { digitalWaveformIndices["DIGITAL-IN-WORD"], signalChannel->getNativeChannelNumber() };
                 break;
             case BoardDigitalOutSignal:
-                allocateAnalogBuffer(boardDigOutBuffer, waveName);
+                digitalBitAddresses[waveName] = { digitalWaveformIndices["DIGITAL-OUT-WORD"], signalChannel->getNativeChannelNumber() };
                 break;
             }
         }
@@ -195,6 +267,69 @@ void WaveformFifo::allocateMemory()
     cout << "WaveformFifo: Allocated " << memoryNeededGB << " GBytes for waveform buffers." << '\n';
 }
 
+// Allocate the LFP buffer for the current downsample factor.  With no downsampling, the LFP band is read from the
+// lowpass buffer instead.
+void WaveformFifo::allocateLfpMemory()
+{
+    lfpBuffer = nullptr;
+    if (lfpFactor <= 1) return;
+
+    int lfpAllocateSize = (bufferAllocateSize / lfpFactor) * numAmplifierChannels;
+    memoryNeededGB += sizeof(uint16_t) * lfpAllocateSize / (1024.0 * 1024.0 * 1024.0);
+    try {
+        lfpBuffer = new uint16_t [lfpAllocateSize];
+    } catch (std::bad_alloc&) {
+        lfpBuffer = nullptr;
+        cerr << "WaveformFifo::allocateLfpMemory(): unable to allocate LFP buffer memory." << '\n';
+        return;
+    }
+    fill(lfpBuffer, lfpBuffer + lfpAllocateSize, (uint16_t) 32768U);
+}
+
+void WaveformFifo::setLfpDownsampleFactor(int factor)
+{
+    if (factor < 1 || samplesPerDataBlock % factor != 0) {
+        cerr << "WaveformFifo::setLfpDownsampleFactor: factor " << factor << " does not divide samples per data block." << '\n';
+        return;
+    }
+
+    if (factor == lfpFactor) return;
+    if (lfpBuffer) {
+        memoryNeededGB -= sizeof(uint16_t) * (bufferAllocateSize / lfpFactor) * numAmplifierChannels / (1024.0 * 1024.0 * 1024.0);
+        delete [] lfpBuffer;
+    }
+    lfpFactor = factor;
+    allocateLfpMemory();
+}
+
+// Allocate the raw frame buffer for the current frame size.  Its pages are only touched as frames are written.
+void WaveformFifo::allocateRawFrameMemory()
+{
+    rawFrameBuffer = nullptr;
+    if (rawFrameSize <= 0) return;
+
+    size_t rawFrameAllocateSize = (size_t) bufferAllocateSize * rawFrameSize;
+    memoryNeededGB += sizeof(uint16_t) * rawFrameAllocateSize / (1024.0 * 1024.0 * 1024.0);
+    try {
+        rawFrameBuffer = new uint16_t [rawFrameAllocateSize];
+    } catch (std::bad_alloc&) {
+        rawFrameBuffer = nullptr;
+        cerr << "WaveformFifo::allocateRawFrameMemory(): unable to allocate raw frame buffer memory." << '\n';
+    }
+}
+
+void WaveformFifo::setRawFrameWords(int frameWords)
+{
+    if (frameWords < 0) frameWords = 0;
+    if (frameWords == rawFrameSize) return;
+    if (rawFrameBuffer) {
+        memoryNeededGB -= sizeof(uint16_t) * (size_t) bufferAllocateSize * rawFrameSize / (1024.0 * 1024.0 * 1024.0);
+        delete [] rawFrameBuffer;
+    }
+    rawFrameSize = frameWords;
+    allocateRawFrameMemory();
+}
+
 void WaveformFifo::freeMemory()
 {
     // Free all allocated buffer memory.
@@ -207,37 +342,82 @@ void WaveformFifo::freeMemory()
     delete [] gpuSpikeTimestamps;
     delete [] gpuSpikeIds;
 
+    delete [] lfpBuffer;
+    lfpBuffer = nullptr;
+    delete [] rawFrameBuffer;
+    rawFrameBuffer = nullptr;
+
     for (map<string, float*>::const_iterator i = analogWaveformIndices.begin(); i != analogWaveformIndices.end(); ++i) {
-        delete [] i->second;
+        if (analogWaveformDivisor(i->second) == 1) delete [] i->second;
     }
     analogWaveformIndices.clear();
+    delete [] auxInputStorage;
+    delete [] supplyVoltageStorage;
+    auxInputStorage = nullptr;
+    supplyVoltageStorage = nullptr;
+    auxInputStorageSize = 0;
+    supplyVoltageStorageSize = 0;
     for (map<string, uint16_t*>::const_iterator i = digitalWaveformIndices.begin(); i != digitalWaveformIndices.end(); ++i) {
         delete [] i->second;
     }
     digitalWaveformIndices.clear();
+    digitalBitAddresses.clear();
 }
 
 bool WaveformFifo::requestWriteSpace(int numDataBlocks)
 {
-    lock_guard<mutex> lock(mtx);
-
     if (numDataBlocks > maxWriteSizeInDataBlocks) {
         cerr << "Waveform::requestWriteSpace: numDataBlocks exceeds maxWriteSizeInDataBlocks." << '\n';
         return false;
     }
     int numWords = numDataBlocks * samplesPerDataBlock;
-    if (freeWords.tryAcquire(numWords)) {
+    if (numWords <= numFreeWords()) {
         numWordsToBeWritten = numWords;
+        latchFilterBand(lowpassEnabled, writingLowpass, lowpassStored);
+        latchFilterBand(highpassEnabled, writingHighpass, highpassStored);
+        writingLfp = lfpEnabled && lfpBuffer;
+        writingRawFrames = rawFrameBuffer != nullptr;
         return true;
     } else {
         return false;   // insufficient free space available in buffer
     }
 }
 
-void WaveformFifo::commitNewData()
+// Latch whether a filter band is stored by the coming write, and mark where its stored data starts or ends.
+void WaveformFifo::latchFilterBand(bool enabled, bool& writing, StoredRange& stored)
+{
+    if (enabled == writing) return;
+    int64_t count = writeCount.load(memory_order_relaxed);
+    if (enabled) {
+        // from is set first, so a reader that sees the new until also sees the new from.
+        stored.from.store(count);
+        stored.until.store(INT64_MAX);
+    } else {
+        stored.until.store(count);
+    }
+    writing = enabled;
+}
+
+void WaveformFifo::getStoredGpuAmplifierRange(Reader reader, GpuWaveformType waveformType, int& begin, int& end) const
 {
-    lock_guard<mutex> lock(mtx);
+    // Valid time indices lie within bufferSize of zero, so clamping to that range keeps index arithmetic in int.
+    const StoredRange* stored = nullptr;
+    if (waveformType == GpuWaveformLowpass) stored = &lowpassStored;
+    else if (waveformType == GpuWaveformHighpass) stored = &highpassStored;
+    if (!stored) {
+        begin = -bufferSize;
+        end = bufferSize;
+        return;
+    }
+    int64_t until = stored->until.load();
+    int64_t from = stored->from.load();
+    int64_t readCount = cursors[reader].readCount.load(memory_order_relaxed);
+    begin = (int) clamp(from - readCount, (int64_t) -bufferSize, (int64_t) bufferSize);
+    end = (int) clamp(until - readCount, (int64_t) -bufferSize, (int64_t) bufferSize);
+}
 
+void WaveformFifo::commitNewData()
+{
     bufferWriteIndex += numWordsToBeWritten;
     if (bufferWriteIndex == bufferSize) {
         bufferWriteIndex = 0;
@@ -253,54 +433,95 @@ void WaveformFifo::commitNewData()
         float* analogWaveformBuffer = nullptr;
         for (map<string, float*>::const_iterator i = analogWaveformIndices.begin(); i != analogWaveformIndices.end(); ++i) {
             analogWaveformBuffer = i->second;
-            std::memcpy(analogWaveformBuffer, &analogWaveformBuffer[bufferSize], sizeof(float) * (bufferWriteIndex - bufferSize));
+            int divisor = analogWaveformDivisor(analogWaveformBuffer);
+            std::memcpy(analogWaveformBuffer, &analogWaveformBuffer[bufferSize / divisor],
+                        sizeof(float) * ((bufferWriteIndex - bufferSize) / divisor));
         }
 
         uint16_t* digitalWaveformBuffer = nullptr;
         for (map<string, uint16_t*>::const_iterator i = digitalWaveformIndices.begin(); i != digitalWaveformIndices.end(); ++i) {
             digitalWaveformBuffer = i->second;
-            std::memcpy(digitalWaveformBuffer, &digitalWaveformBuffer[bufferSize], sizeof(float) * (bufferWriteIndex - bufferSize));
+            std::memcpy(digitalWaveformBuffer, &digitalWaveformBuffer[bufferSize], sizeof(uint16_t) * (bufferWriteIndex - bufferSize));
         }
 
         std::memcpy(gpuAmplifierWidebandBuffer, &gpuAmplifierWidebandBuffer[bufferSize * numAmplifierChannels],
                 sizeof(uint16_t) * (bufferWriteIndex - bufferSize) * numAmplifierChannels);
-        std::memcpy(gpuAmplifierLowpassBuffer, &gpuAmplifierLowpassBuffer[bufferSize * numAmplifierChannels],
-                sizeof(uint16_t) * (bufferWriteIndex - bufferSize) * numAmplifierChannels);
-        std::memcpy(gpuAmplifierHighpassBuffer, &gpuAmplifierHighpassBuffer[bufferSize * numAmplifierChannels],
-                sizeof(uint16_t) * (bufferWriteIndex - bufferSize) * numAmplifierChannels);
+        if (writingLowpass) {
+            std::memcpy(gpuAmplifierLowpassBuffer, &gpuAmplifierLowpassBuffer[bufferSize * numAmplifierChannels],
+                    sizeof(uint16_t) * (bufferWriteIndex - bufferSize) * numAmplifierChannels);
+        }
+        if (writingHighpass) {
+            std::memcpy(gpuAmplifierHighpassBuffer, &gpuAmplifierHighpassBuffer[bufferSize * numAmplifierChannels],
+                    sizeof(uint16_t) * (bufferWriteIndex - bufferSize) * numAmplifierChannels);
+        }
+        if (writingLfp) {
+            std::memcpy(lfpBuffer, &lfpBuffer[(bufferSize / lfpFactor) * numAmplifierChannels],
+                    sizeof(uint16_t) * ((bufferWriteIndex - bufferSize) / lfpFactor) * numAmplifierChannels);
+        }
+        if (writingRawFrames) {
+            std::memcpy(rawFrameBuffer, &rawFrameBuffer[(size_t) bufferSize * rawFrameSize],
+                    sizeof(uint16_t) * (size_t) (bufferWriteIndex - bufferSize) * rawFrameSize);
+        }
 
         bufferWriteIndex -= bufferSize;
     }
-    for (int reader = 0; reader < numReaders; ++reader) {
-        usedWordsNewData[reader].release(numWordsToBeWritten);
+
+    // Publish the new data to all readers, waking any that are blocked in waitForNewData().
+    writeCount.fetch_add(numWordsToBeWritten, memory_order_release);
+    writeSequence.fetch_add(1);
+    if (numReadersWaiting.load() > 0) {
+        writeSequence.notify_all();
     }
 }
 
 bool WaveformFifo::requestReadNewData(Reader reader, int numWords, bool lastRead)
 {
-    lock_guard<mutex> lock(mtx);
-
     int necessaryData = lastRead ? numWords : numWords + samplesPerDataBlock; // Add one data block to allow spike detection
                                                                               // pipeline to complete (as long as this isn't the
                                                                               // last data block in a playback recording session).
-    if (usedWordsNewData[reader].available() >= necessaryData) {
-        if (usedWordsNewData[reader].tryAcquire(numWords)) {
-            numWordsToBeRead[reader] = numWords;
-            return true;
-        } else {
-            if (reader == ReaderDisplay) {
-                state->writeToLog("Failed to acquire words. numWords: " + QString::number(numWords));
-            }
-            return false;
-        }
+    int available = numWordsAvailable(reader);
+    if (available >= necessaryData) {
+        numWordsToBeRead[reader] = numWords;
+        return true;
     } else {
         if (reader == ReaderDisplay) {
-            state->writeToLog("Insufficient data available in buffer. Available: " + QString::number(numWords) + " ... requested: " + QString::number(usedWordsNewData[reader].available()));
+            state->writeToLog("Insufficient data available in buffer. Available: " + QString::number(available) + " ... requested: " + QString::number(numWords));
         }
         return false;   // insufficient data available in buffer
     }
 }
 
+// Block the calling reader until requestReadNewData() with the same arguments would succeed, or until wakeReader() is
+// called for it.  Returns true if the data is available.  The writer only issues a wakeup while some reader is parked
+// here, so readers that find data already present never enter the kernel.
+bool WaveformFifo::waitForNewData(Reader reader, int numWords, bool lastRead)
+{
+    int necessaryData = lastRead ? numWords : numWords + samplesPerDataBlock;
+    while (true) {
+        uint32_t sequence = writeSequence.load();
+        if (cursors[reader].wakeRequested.exchange(false)) {
+            return numWordsAvailable(reader) >= necessaryData;
+        }
+        if (numWordsAvailable(reader) >= necessaryData) {
+            return true;
+        }
+        numReadersWaiting.fetch_add(1);
+        if (numWordsAvailable(reader) >= necessaryData) {
+            numReadersWaiting.fetch_sub(1);
+            return true;
+        }
+        writeSequence.wait(sequence);
+        numReadersWaiting.fetch_sub(1);
+    }
+}
+
+void WaveformFifo::wakeReader(Reader reader)
+{
+    cursors[reader].wakeRequested.store(true);
+    writeSequence.fetch_add(1);
+    writeSequence.notify_all();
+}
+
 MinMax<float> WaveformFifo::getMinMaxData(Reader reader, const float* waveform, int timeIndex, int numSamples) const
 {
     MinMax<float> result;
@@ -313,8 +534,9 @@ MinMax<float> WaveformFifo::getMinMaxData(Reader reader, const float* waveform,
     int index = bufferReadIndex[reader] + timeIndex;
     if (index < 0) index += bufferSize;
     else if (index >= bufferSize) index -= bufferSize;
+    int divisor = analogWaveformDivisor(waveform);
     for (int i = 0; i < numSamples; ++i) {
-        result.update(waveform[index]);
+        result.update(waveform[index / divisor]);
         if (++index == bufferSize) index = 0;
     }
     return result;
@@ -328,6 +550,18 @@ void WaveformFifo::getMinMaxGpuAmplifierData(MinMax<float> &init, Reader reader,
         return;
     }
 
+    // Samples from before a filter band was stored read as zero.
+    int begin, end;
+    getStoredGpuAmplifierRange(reader, waveformAddress.waveformType, begin, end);
+    if (timeIndex < begin || timeIndex + numSamples > end) {
+        init.update(0.0F);
+        int first = max(timeIndex, begin);
+        int last = min(timeIndex + numSamples, end);
+        if (first >= last) return;
+        timeIndex = first;
+        numSamples = last - first;
+    }
+
     int index = bufferReadIndex[reader] + timeIndex;
     if (index < 0) index += bufferSize;
     else if (index >= bufferSize) index -= bufferSize;
@@ -361,8 +595,28 @@ void WaveformFifo::getMinMaxData(MinMax<float> &init, Reader reader, const float
     int index = bufferReadIndex[reader] + timeIndex;
     if (index < 0) index += bufferSize;
     else if (index >= bufferSize) index -= bufferSize;
+    int divisor = analogWaveformDivisor(waveform);
     for (int i = 0; i < numSamples; ++i) {
-        init.update(waveform[index]);
+        init.update(waveform[index / divisor]);
+        if (++index == bufferSize) index = 0;
+    }
+}
+
+void WaveformFifo::getMinMaxDigitalBitData(MinMax<float> &init, Reader reader, DigitalBitAddress bitAddress, int timeIndex,
+                                           int numSamples) const
+{
+    if (timeIndex + numSamples > numWordsToBeRead[reader] || timeIndex < -numWordsInMemory(reader)) {
+        cerr << "Error: WaveformFifo::getMinMaxDigitalBitData: timeIndex out of range.  timeIndex = " << timeIndex <<
+             "; numSamples = " << numSamples << '\n';
+        return;
+    }
+
+    int index = bufferReadIndex[reader] + timeIndex;
+    if (index < 0) index += bufferSize;
+    else if (index >= bufferSize) index -= bufferSize;
+    const uint16_t mask = 1U << bitAddress.bit;
+    for (int i = 0; i < numSamples; ++i) {
+        init.update((bitAddress.wordWaveform[index] & mask) ? 1.0F : 0.0F);
         if (++index == bufferSize) index = 0;
     }
 }
@@ -407,27 +661,49 @@ uint16_t WaveformFifo::getRasterData(Reader reader, const uint16_t* rasterData,
 }
 
 bool WaveformFifo::extractGpuSpikeDataOneDataBlock(uint16_t* waveform, GpuWaveformAddress waveformAddress, bool firstTime) const
+{
+    return extractGpuSpikeDataBlock(waveform, waveformAddress, bufferWriteIndex, firstTime);
+}
+
+// Extract spike data for numDataBlocks consecutive data blocks starting at the current write index.  Blocks are
+// handled in order so that spikes detected in one block may be marked in the block before it, including the last
+// block of the previous write.
+bool WaveformFifo::extractGpuSpikeData(uint16_t* waveform, GpuWaveformAddress waveformAddress, int numDataBlocks,
+                                       bool firstTime) const
+{
+    bool spikeFound = false;
+    for (int block = 0; block < numDataBlocks; ++block) {
+        if (extractGpuSpikeDataBlock(waveform, waveformAddress, bufferWriteIndex + block * samplesPerDataBlock,
+                                     firstTime && block == 0)) {
+            spikeFound = true;
+        }
+    }
+    return spikeFound;
+}
+
+bool WaveformFifo::extractGpuSpikeDataBlock(uint16_t* waveform, GpuWaveformAddress waveformAddress, int writeIndex,
+                                            bool firstTime) const
 {
     bool spikeFound = false;
     if (waveformAddress.waveformType != GpuWaveformSpike) {
         cerr << "Error: WaveformFifo::extractGpuSpikeDataOneDataBlock: waveform is not GpuWaveformSpike type." << '\n';
         return spikeFound;
     }
-    if (bufferWriteIndex % samplesPerDataBlock != 0) {
-        cerr << "Error: WaveformFifo::extractGpuSpikeDataOneDataBlock: bufferWriteIndex is not an integer multiple of samplesPerDataBlock." << '\n';
+    if (writeIndex % samplesPerDataBlock != 0) {
+        cerr << "Error: WaveformFifo::extractGpuSpikeDataOneDataBlock: writeIndex is not an integer multiple of samplesPerDataBlock." << '\n';
         return spikeFound;
     }
 
-    int bufferWriteIndexPrev = bufferWriteIndex - samplesPerDataBlock;
-    if (bufferWriteIndexPrev < 0) bufferWriteIndexPrev += bufferSize;
+    int writeIndexPrev = writeIndex - samplesPerDataBlock;
+    if (writeIndexPrev < 0) writeIndexPrev += bufferSize;
 
     // Read GPU spike detector output data and create lists of spike IDs along with corresponding timestamps.
     vector<uint32_t> spikeTimeStampList;
     vector<uint16_t> spikeIdList;
     uint32_t spikeTimeStamp;
     uint8_t spikeId;
-    int bufferWriteIndexBlock = bufferWriteIndex / samplesPerDataBlock;
-    int index = bufferWriteIndexBlock * numAmplifierChannels * maxSpikesPerDataBlock + waveformAddress.waveformIndex;
+    int writeIndexBlock = writeIndex / samplesPerDataBlock;
+    int index = writeIndexBlock * numAmplifierChannels * maxSpikesPerDataBlock + waveformAddress.waveformIndex;
     for (int k = 0; k < maxSpikesPerDataBlock; ++k) {
         spikeId = gpuSpikeIds[index];
         if (spikeId != SpikeIdNoSpike) {
@@ -444,14 +720,14 @@ bool WaveformFifo::extractGpuSpikeDataOneDataBlock(uint16_t* waveform, GpuWavefo
     }
 
     // Initialize spike output to all zeros (i.e., no spikes)
-    for (int i = bufferWriteIndex; i < bufferWriteIndex + samplesPerDataBlock; ++i) {
+    for (int i = writeIndex; i < writeIndex + samplesPerDataBlock; ++i) {
         waveform[i]= 0;
     }
 
     for (int j = 0; j < (int) spikeTimeStampList.size(); ++j) {
         bool found = false;
         // First, search for spike timestamp in current datablock.
-        for (int i = bufferWriteIndex; i < bufferWriteIndex + samplesPerDataBlock; ++i) {
+        for (int i = writeIndex; i < writeIndex + samplesPerDataBlock; ++i) {
             if (timeStampBuffer[i] == spikeTimeStampList[j]) {
                 found = true;
                 waveform[i] = spikeIdList[j];
@@ -459,7 +735,7 @@ bool WaveformFifo::extractGpuSpikeDataOneDataBlock(uint16_t* waveform, GpuWavefo
             }
         }
         if (!found && !firstTime) {   // If we don't find timestamp in current datablock, search previous datablock.
-            for (int i = bufferWriteIndexPrev + samplesPerDataBlock - 1; i >= bufferWriteIndexPrev; --i) {
+            for (int i = writeIndexPrev + samplesPerDataBlock - 1; i >= writeIndexPrev; --i) {
                 if (timeStampBuffer[i] == spikeTimeStampList[j]) {
                     found = true;
                     waveform[i] = spikeIdList[j];
@@ -480,6 +756,9 @@ float WaveformFifo::getGpuAmplifierData(Reader reader, GpuWaveformAddress wavefo
         cerr << "Error: WaveformFifo::getGpuAmplifierData: timeIndex out of range: " << timeIndex << '\n';
         return 0.0F;
     }
+    int begin, end;
+    getStoredGpuAmplifierRange(reader, waveformAddress.waveformType, begin, end);
+    if (timeIndex < begin || timeIndex >= end) return 0.0F;
 
     int index = bufferReadIndex[reader] + timeIndex;
     if (index < 0) index += bufferSize;
@@ -503,6 +782,9 @@ uint16_t WaveformFifo::getGpuAmplifierDataRaw(Reader reader, GpuWaveformAddress
         cerr << "WaveformFifo::getGpuAmplifierDataRaw: time index " << timeIndex << " not present in buffer." << '\n';
         return 32768U;
     }
+    int begin, end;
+    getStoredGpuAmplifierRange(reader, waveformAddress.waveformType, begin, end);
+    if (timeIndex < begin || timeIndex >= end) return 32768U;
 
     int index = bufferReadIndex[reader] + timeIndex;
     if (index < 0) index += bufferSize;
@@ -550,6 +832,14 @@ void WaveformFifo::copyGpuAmplifierData(Reader reader, float* dest, GpuWaveformA
             ++pWrite;
         }
     }
+
+    // Samples from before a filter band was stored read as zero.
+    int begin, end;
+    getStoredGpuAmplifierRange(reader, waveformAddress.waveformType, begin, end);
+    int first = clamp(begin - timeIndex, 0, numSamples);
+    int last = clamp(end - timeIndex, first, numSamples);
+    fill(dest, dest + first, 0.0F);
+    fill(dest + last, dest + numSamples, 0.0F);
 }
 
 void WaveformFifo::copyGpuAmplifierDataRaw(Reader reader, uint16_t* dest, GpuWaveformAddress waveformAddress, int timeIndex,
@@ -635,6 +925,94 @@ void WaveformFifo::copyGpuAmplifierDataArrayRaw(Reader reader, uint16_t* dest, c
     }
 }
 
+bool WaveformFifo::spanInRange(Reader reader, int timeIndex, int numSamples, const char* caller) const
+{
+    if (timeIndex + numSamples > numWordsToBeRead[reader] || timeIndex < -numWordsInMemory(reader) || numSamples < 0) {
+        cerr << "Error: WaveformFifo::" << caller << ": timeIndex out of range." << '\n';
+        return false;
+    }
+    return true;
+}
+
+WaveformSpan<uint32_t> WaveformFifo::getTimeStampSpan(Reader reader, int timeIndex, int numSamples) const
+{
+    if (!spanInRange(reader, timeIndex, numSamples, "getTimeStampSpan")) return WaveformSpan<uint32_t>{ nullptr, 0, nullptr, 0 };
+    return makeSpan<uint32_t>(timeStampBuffer, nativeReadIndex(reader, timeIndex, 1), numSamples, bufferSize);
+}
+
+WaveformSpan<float> WaveformFifo::getAnalogDataSpan(Reader reader, const float* waveform, int timeIndex, int numSamples) const
+{
+    if (!spanInRange(reader, timeIndex, numSamples, "getAnalogDataSpan")) return WaveformSpan<float>{ nullptr, 0, nullptr, 0 };
+    int divisor = analogWaveformDivisor(waveform);
+    return makeSpan<float>(waveform, nativeReadIndex(reader, timeIndex, divisor), numSamples / divisor, bufferSize / divisor);
+}
+
+WaveformSpan<uint16_t> WaveformFifo::getDigitalDataSpan(Reader reader, const uint16_t* waveform, int timeIndex, int numSamples) const
+{
+    if (!spanInRange(reader, timeIndex, numSamples, "getDigitalDataSpan")) return WaveformSpan<uint16_t>{ nullptr, 0, nullptr, 0 };
+    return makeSpan<uint16_t>(waveform, nativeReadIndex(reader, timeIndex, 1), numSamples, bufferSize);
+}
+
+WaveformSpan<uint16_t> WaveformFifo::getGpuAmplifierSpan(Reader reader, GpuWaveformType waveformType, int timeIndex,
+                                                         int numSamples) const
+{
+    const uint16_t* gpuBuffer = nullptr;
+    if (waveformType == GpuWaveformWideband) gpuBuffer = gpuAmplifierWidebandBuffer;
+    else if (waveformType == GpuWaveformLowpass) gpuBuffer = gpuAmplifierLowpassBuffer;
+    else if (waveformType == GpuWaveformHighpass) gpuBuffer = gpuAmplifierHighpassBuffer;
+    if (!gpuBuffer || !spanInRange(reader, timeIndex, numSamples, "getGpuAmplifierSpan")) {
+        return WaveformSpan<uint16_t>{ nullptr, 0, nullptr, 0 };
+    }
+    return makeSpan<uint16_t>(gpuBuffer, numAmplifierChannels * nativeReadIndex(reader, timeIndex, 1),
+                              numAmplifierChannels * numSamples, numAmplifierChannels * bufferSize);
+}
+
+WaveformSpan<uint16_t> WaveformFifo::getRawFrameSpan(Reader reader, int timeIndex, int numSamples) const
+{
+    if (!rawFrameBuffer || !spanInRange(reader, timeIndex, numSamples, "getRawFrameSpan")) {
+        return WaveformSpan<uint16_t>{ nullptr, 0, nullptr, 0 };
+    }
+    // Split in samples rather than words, since the whole buffer can hold more words than an int can count.
+    int startIndex = nativeReadIndex(reader, timeIndex, 1);
+    int firstSamples = min(numSamples, bufferSize - startIndex);
+    WaveformSpan<uint16_t> span;
+    span.first = &rawFrameBuffer[(size_t) startIndex * rawFrameSize];
+    span.firstLength = firstSamples * rawFrameSize;
+    span.second = rawFrameBuffer;
+    span.secondLength = (numSamples - firstSamples) * rawFrameSize;
+    return span;
+}
+
+void WaveformFifo::copyGpuAmplifierDataBlockRaw(Reader reader, uint16_t* dest, const GpuWaveformAddress* waveformAddresses,
+                                                int numWaveforms, int timeIndex, int numSamples) const
+{
+    if (timeIndex + numSamples > numWordsToBeRead[reader] || timeIndex < -numWordsInMemory(reader)) {
+        cerr << "Error: WaveformFifo::copyGpuAmplifierDataBlockRaw: timeIndex out of range." << '\n';
+        return;
+    }
+    if (numWaveforms <= 0) return;
+
+    const uint16_t* gpuBuffer = nullptr;
+    if (waveformAddresses[0].waveformType == GpuWaveformWideband) gpuBuffer = gpuAmplifierWidebandBuffer;
+    else if (waveformAddresses[0].waveformType == GpuWaveformLowpass) gpuBuffer = gpuAmplifierLowpassBuffer;
+    else if (waveformAddresses[0].waveformType == GpuWaveformHighpass) gpuBuffer = gpuAmplifierHighpassBuffer;
+    if (!gpuBuffer) return;
+
+    int index = bufferReadIndex[reader] + timeIndex;
+    if (index < 0) index += bufferSize;
+    else if (index >= bufferSize) index -= bufferSize;
+    // Read each sample row of the GPU buffer once, scattering it across the per-waveform runs of dest.
+    for (int i = 0; i < numSamples; ++i) {
+        const uint16_t* row = gpuBuffer + (size_t) numAmplifierChannels * index;
+        uint16_t* pWrite = dest + i;
+        for (int j = 0; j < numWaveforms; ++j) {
+            *pWrite = row[waveformAddresses[j].waveformIndex];
+            pWrite += numSamples;
+        }
+        if (++index == bufferSize) index = 0;
+    }
+}
+
 void WaveformFifo::copyAnalogData(Reader reader, float* dest, const float* waveform, int timeIndex, int numSamples) const
 {
     if (timeIndex + numSamples > numWordsToBeRead[reader] || timeIndex < -numWordsInMemory(reader)) {
@@ -646,9 +1024,37 @@ void WaveformFifo::copyAnalogData(Reader reader, float* dest, const float* wavef
     int index = bufferReadIndex[reader] + timeIndex;
     if (index < 0) index += bufferSize;
     else if (index >= bufferSize) index -= bufferSize;
-    for (int i = 0; i < numSamples; ++i) {
+    int divisor = analogWaveformDivisor(waveform);
+    if (divisor == 1) {
+        for (int i = 0; i < numSamples; ++i) {
+            *pWrite = waveform[index];
+            if (++index == bufferSize) index = 0;
+            ++pWrite;
+        }
+    } else {
+        // Repeat each native-rate sample to fill the amplifier-rate output.
+        for (int i = 0; i < numSamples; ++i) {
+            *pWrite = waveform[index / divisor];
+            if (++index == bufferSize) index = 0;
+            ++pWrite;
+        }
+    }
+}
+
+void WaveformFifo::copyAnalogDataNative(Reader reader, float* dest, const float* waveform, int timeIndex, int numSamples) const
+{
+    if (timeIndex + numSamples > numWordsToBeRead[reader] || timeIndex < -numWordsInMemory(reader)) {
+        cerr << "Error: WaveformFifo::copyAnalogDataNative: timeIndex out of range." << '\n';
+        return;
+    }
+
+    float* pWrite = dest;
+    int divisor = analogWaveformDivisor(waveform);
+    int nativeBufferSize = bufferSize / divisor;
+    int index = nativeReadIndex(reader, timeIndex, divisor);
+    for (int i = 0; i < numSamples / divisor; ++i) {
         *pWrite = waveform[index];
-        if (++index == bufferSize) index = 0;
+        if (++index == nativeBufferSize) index = 0;
         ++pWrite;
     }
 }
@@ -661,16 +1067,40 @@ void WaveformFifo::copyAnalogDataArray(Reader reader, float* dest, const vector<
         return;
     }
 
+    int startIndex = bufferReadIndex[reader] + timeIndex;
+    if (startIndex < 0) startIndex += bufferSize;
+    else if (startIndex >= bufferSize) startIndex -= bufferSize;
+    // Fill dest one waveform (column) at a time, so each waveform's divisor is resolved only once.
+    const int numWaveforms = (int) waveforms.size();
+    for (int j = 0; j < numWaveforms; ++j) {
+        const float* waveform = waveforms[j];
+        const int divisor = analogWaveformDivisor(waveform);
+        float* pWrite = dest + j;
+        int index = startIndex;
+        for (int i = 0; i < numSamples; ++i) {
+            *pWrite = waveform[index / divisor];
+            pWrite += numWaveforms;
+            if (++index == bufferSize) index = 0;
+        }
+    }
+}
+
+void WaveformFifo::copyDigitalBitData(Reader reader, float* dest, DigitalBitAddress bitAddress, int timeIndex, int numSamples) const
+{
+    if (timeIndex + numSamples > numWordsToBeRead[reader] || timeIndex < -numWordsInMemory(reader)) {
+        cerr << "Error: WaveformFifo::copyDigitalBitData: timeIndex out of range." << '\n';
+        return;
+    }
+
     float* pWrite = dest;
     int index = bufferReadIndex[reader] + timeIndex;
     if (index < 0) index += bufferSize;
     else if (index >= bufferSize) index -= bufferSize;
+    const uint16_t mask = 1U << bitAddress.bit;
     for (int i = 0; i < numSamples; ++i) {
-        for (int j = 0; j < (int) waveforms.size(); ++j) {
-            *pWrite = waveforms[j][index];
-            ++pWrite;
-        }
+        *pWrite = (bitAddress.wordWaveform[index] & mask) ? 1.0F : 0.0F;
         if (++index == bufferSize) index = 0;
+        ++pWrite;
     }
 }
 
@@ -731,94 +1161,143 @@ void WaveformFifo::copyTimeStamps(Reader reader, uint32_t* dest, int timeIndex,
     }
 }
 
-// Call once after all reading is complete.
-void WaveformFifo::freeOldData(Reader reader)
+// Return the index of the first sample at or after timeIndex in a buffer stored at 1/divisor of the amplifier sample rate.
+int WaveformFifo::nativeReadIndex(Reader reader, int timeIndex, int divisor) const
 {
-    lock_guard<mutex> lock(mtx);
+    int index = bufferReadIndex[reader] + timeIndex;
+    if (index < 0) index += bufferSize;
+    else if (index >= bufferSize) index -= bufferSize;
+    index = (index + divisor - 1) / divisor;
+    return (index == bufferSize / divisor) ? 0 : index;
+}
 
-    int bufferWriteIndexFrozen = bufferWriteIndex;  // Save this value in case it changes from another thread.
+void WaveformFifo::copyLfpDataRaw(Reader reader, uint16_t* dest, GpuWaveformAddress waveformAddress, int timeIndex,
+                                  int numSamples) const
+{
+    if (timeIndex + numSamples > numWordsToBeRead[reader] || timeIndex < -numWordsInMemory(reader)) {
+        cerr << "Error: WaveformFifo::copyLfpDataRaw: timeIndex out of range." << '\n';
+        return;
+    }
+    const uint16_t* source = (lfpFactor == 1) ? gpuAmplifierLowpassBuffer : lfpBuffer;
+    if (!source) {
+        cerr << "Error: WaveformFifo::copyLfpDataRaw: LFP buffer not allocated." << '\n';
+        return;
+    }
+
+    uint16_t* pWrite = dest;
+    int lfpBufferSize = bufferSize / lfpFactor;
+    int index = nativeReadIndex(reader, timeIndex, lfpFactor);
+    int channelIndex = waveformAddress.waveformIndex;
+    for (int i = 0; i < numSamples / lfpFactor; ++i) {
+        *pWrite = source[numAmplifierChannels * index + channelIndex];
+        if (++index == lfpBufferSize) index = 0;
+        ++pWrite;
+    }
+}
+
+void WaveformFifo::copyLfpDataArrayRaw(Reader reader, uint16_t* dest, const vector<GpuWaveformAddress>& waveformAddresses,
+                                       int timeIndex, int numSamples) const
+{
+    if (timeIndex + numSamples > numWordsToBeRead[reader] || timeIndex < -numWordsInMemory(reader)) {
+        cerr << "Error: WaveformFifo::copyLfpDataArrayRaw: timeIndex out of range." << '\n';
+        return;
+    }
+    const uint16_t* source = (lfpFactor == 1) ? gpuAmplifierLowpassBuffer : lfpBuffer;
+    if (!source) {
+        cerr << "Error: WaveformFifo::copyLfpDataArrayRaw: LFP buffer not allocated." << '\n';
+        return;
+    }
 
-    // What is the minimum distance between the write index and the memory indexes, currently?
-    int minDistanceOld = bufferSize;
-    for (int r = 0; r < numReaders; ++r) {
-        int distance = bufferMemoryIndex[r] - bufferWriteIndexFrozen;
-        if (distance < 0) distance += bufferSize;
-        if (distance < minDistanceOld) {
-            minDistanceOld = distance;
+    uint16_t* pWrite = dest;
+    int lfpBufferSize = bufferSize / lfpFactor;
+    int index = nativeReadIndex(reader, timeIndex, lfpFactor);
+    for (int i = 0; i < numSamples / lfpFactor; ++i) {
+        const uint16_t* frame = &source[numAmplifierChannels * index];
+        for (int j = 0; j < (int) waveformAddresses.size(); ++j) {
+            *pWrite = frame[waveformAddresses[j].waveformIndex];
+            ++pWrite;
         }
+        if (++index == lfpBufferSize) index = 0;
     }
+}
+
+// Call once after all reading is complete.
+void WaveformFifo::freeOldData(Reader reader)
+{
+    ReaderCursor& cursor = cursors[reader];
 
     bufferReadIndex[reader] += numWordsToBeRead[reader];
     if (bufferReadIndex[reader] >= bufferSize) {
         bufferReadIndex[reader] -= bufferSize;
     }
-    int excess = numWordsInMemory(reader) - memorySize;
-    if (excess > 0) {
-        bufferMemoryIndex[reader] += excess;
-        if (bufferMemoryIndex[reader] >= bufferSize) {
-            bufferMemoryIndex[reader] -= bufferSize;
-        }
-    }
+    int64_t readCount = cursor.readCount.load(memory_order_relaxed) + numWordsToBeRead[reader];
+    int64_t memoryCount = max(cursor.memoryCount.load(memory_order_relaxed), readCount - memorySize);
+    cursor.readCount.store(readCount, memory_order_relaxed);
+    // Release ordering keeps this reader's accesses to the data it gives up ahead of the writer reusing that space.
+    cursor.memoryCount.store(memoryCount, memory_order_release);
 
-    // What is the minimum distance between the write index and the memory indexes after adjusting indexes?
-    int minDistanceNew = bufferSize;
-    int minIndex = 0;
-    for (int r = 0; r < numReaders; ++r) {
-        int distance = bufferMemoryIndex[r] - bufferWriteIndexFrozen;
-        if (distance < 0) distance += bufferSize;
-        if (distance < minDistanceNew) {
-            minDistanceNew = distance;
-            minIndex = r;
-        }
+    int oldestReader;
+    int maxWriteSize = maxWriteSizeInDataBlocks * samplesPerDataBlock;
+    if (numFreeWords(&oldestReader) < maxWriteSize) {
+        cout << "WaveformFifo: Running out of space!  Consumer number " << oldestReader << " is not reading data quickly enough." << '\n';
     }
+}
 
-    int maxWriteSize = maxWriteSizeInDataBlocks * RHXDataBlock::samplesPerDataBlock(signalSources->getControllerType());
-    if (minDistanceNew < maxWriteSize) {
-        cout << "WaveformFifo: Running out of space!  Consumer number " << minIndex << " is not reading data quickly enough." << '\n';
+// Returns number of words the writer may fill before reaching the oldest data some reader still keeps in memory.  If
+// oldestReader is not null, it is set to that reader.
+int WaveformFifo::numFreeWords(int* oldestReader) const
+{
+    int64_t oldestMemoryCount = cursors[0].memoryCount.load(memory_order_acquire);
+    int oldest = 0;
+    for (int r = 1; r < numReaders; ++r) {
+        int64_t memoryCount = cursors[r].memoryCount.load(memory_order_acquire);
+        if (memoryCount < oldestMemoryCount) {
+            oldestMemoryCount = memoryCount;
+            oldest = r;
+        }
     }
-
-//    cout << reader << ": " << minDistanceNew - minDistanceOld << EndOfLine;
-    freeWords.release(minDistanceNew - minDistanceOld);
-//    cout << reader << ":freeWords.release(" << minDistanceNew - minDistanceOld << "); Waveform FIFO is " << percentFull() << "% full." << EndOfLine;
-//    cout << "freeWords.available() = " << freeWords.available() << EndOfLine;
+    if (oldestReader) *oldestReader = oldest;
+    return bufferSize - (int) (writeCount.load(memory_order_relaxed) - oldestMemoryCount);
 }
 
 // Returns number of 'old' words in memory, not including newly written words.
 int WaveformFifo::numWordsInMemory(Reader reader) const
 {
-    if (bufferReadIndex[reader] >= bufferMemoryIndex[reader]) {
-        return bufferReadIndex[reader] - bufferMemoryIndex[reader];
-    } else {
-        return bufferReadIndex[reader] - bufferMemoryIndex[reader] + bufferSize;
-    }
+    return (int) (cursors[reader].readCount.load(memory_order_relaxed) - cursors[reader].memoryCount.load(memory_order_relaxed));
+}
+
+// Returns number of newly written words that this reader has not yet released with freeOldData().
+int WaveformFifo::numWordsAvailable(Reader reader) const
+{
+    return (int) (writeCount.load(memory_order_acquire) - cursors[reader].readCount.load(memory_order_relaxed));
 }
 
 double WaveformFifo::percentFull() const
 {
-//    return 100.0 * (1.0 - ((double)freeWords.available() / (double)bufferSize));
-    return max(100.0 * (1.0 - ((double)freeWords.available() / (double)(bufferSize - memorySize))), 0.0);
+    return max(100.0 * (1.0 - ((double)numFreeWords() / (double)(bufferSize - memorySize))), 0.0);
 }
 
 void WaveformFifo::resetBuffer()
 {
-    lock_guard<mutex> lock(mtx);
-
-    freeWords.acquire(freeWords.available());
     for (int reader = 0; reader < numReaders; ++reader) {
-        usedWordsNewData[reader].acquire(usedWordsNewData[reader].available());
+        cursors[reader].readCount.store(0);
+        cursors[reader].memoryCount.store(0);
         bufferReadIndex[reader] = 0;
-        bufferMemoryIndex[reader] = 0;
         numWordsToBeRead[reader] = 0;
     }
     bufferWriteIndex = 0;
     numWordsToBeWritten = 0;
-    freeWords.release(bufferSize);
+    writeCount.store(0);
+    lowpassStored.from.store(0);
+    lowpassStored.until.store(writingLowpass ? INT64_MAX : 0);
+    highpassStored.from.store(0);
+    highpassStored.until.store(writingHighpass ? INT64_MAX : 0);
 }
 
 void WaveformFifo::pauseBuffer()
 {
     for (int reader = 0; reader < numReaders; ++reader) {
-        requestReadNewData((Reader) reader, usedWordsNewData[reader].available() - samplesPerDataBlock);
+        requestReadNewData((Reader) reader, numWordsAvailable((Reader) reader) - samplesPerDataBlock);
         // Subtract one data block to compensate for data block added for spike detection pipeline (see requestReadNewData()).
         freeOldData((Reader) reader);
     }
@@ -863,6 +1342,15 @@ bool WaveformFifo::gpuWaveformPresent(const string& waveName) const
     return true;
 }
 
+DigitalBitAddress WaveformFifo::getDigitalBitAddress(const string& waveName) const
+{
+    map<string, DigitalBitAddress>::const_iterator p = digitalBitAddresses.find(waveName);
+    if (p == digitalBitAddresses.end()) {
+        return DigitalBitAddress{ nullptr, 0 };
+    }
+    return p->second;
+}
+
 void WaveformFifo::updateForRescan()
 {
     numAmplifierChannels = signalSources->numUSBAmpChannels();
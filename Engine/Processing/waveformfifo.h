@@ -31,12 +31,12 @@
 #ifndef WAVEFORMFIFO_H
 #define WAVEFORMFIFO_H
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <string>
 #include <map>
 #include <vector>
-#include <mutex>
-#include "Semaphore.h"
 #include "minmax.h"
 #include "signalsources.h"
 
@@ -54,7 +54,8 @@ enum GpuWaveformType {
     GpuWaveformWideband,
     GpuWaveformLowpass,
     GpuWaveformHighpass,
-    GpuWaveformSpike
+    GpuWaveformSpike,
+    GpuWaveformLfp
 };
 
 struct GpuWaveformAddress
@@ -63,6 +64,27 @@ struct GpuWaveformAddress
     int waveformIndex;
 };
 
+// Read-only view of a range of FIFO data: up to two contiguous runs of memory, the second used only when the range wraps
+// around the end of the circular buffer.  A span is valid until freeOldData() is called for its reader.
+template <typename T>
+struct WaveformSpan
+{
+    const T* first;
+    int firstLength;
+    const T* second;
+    int secondLength;
+
+    int size() const { return firstLength + secondLength; }
+    const T& operator[](int i) const { return (i < firstLength) ? first[i] : second[i - firstLength]; }
+};
+
+// Individual digital input and output channels are views of one bit of the 16-bit digital word waveforms.
+struct DigitalBitAddress
+{
+    const uint16_t* wordWaveform;
+    int bit;
+};
+
 const uint8_t SpikeIdNoSpike = 0x00u;
 const uint8_t SpikeIdSpikeType1 = 0x01u;
 const uint8_t SpikeIdSpikeType2 = 0x02u;
@@ -92,9 +114,10 @@ public:
     bool requestWriteSpace(int numDataBlocks);   // Call once before writing a block of data
 
     // 2:
+    // Aux input and supply voltage waveforms are written at their native sample rates (see analogWaveformDivisor()).
     inline float* pointerToAnalogWriteSpace(const float* waveform) const  // Call for each waveform, then write data to location.
     {
-        return (float*) (&waveform[bufferWriteIndex]);
+        return (float*) (&waveform[bufferWriteIndex / analogWaveformDivisor(waveform)]);
     }
 
     inline uint16_t* pointerToDigitalWriteSpace(const uint16_t* waveform) const  // Call for each waveform, then write data to location.
@@ -107,14 +130,29 @@ public:
         return &gpuAmplifierWidebandBuffer[bufferWriteIndex * numAmplifierChannels];
     }
 
+    // Lowpass and highpass write space is nullptr if that band is not being stored (see setFilterBandsEnabled()).
     inline uint16_t* pointerToGpuLowpassWriteSpace() const
     {
-        return &gpuAmplifierLowpassBuffer[bufferWriteIndex * numAmplifierChannels];
+        return writingLowpass ? &gpuAmplifierLowpassBuffer[bufferWriteIndex * numAmplifierChannels] : nullptr;
     }
 
     inline uint16_t* pointerToGpuHighpassWriteSpace() const
     {
-        return &gpuAmplifierHighpassBuffer[bufferWriteIndex * numAmplifierChannels];
+        return writingHighpass ? &gpuAmplifierHighpassBuffer[bufferWriteIndex * numAmplifierChannels] : nullptr;
+    }
+
+    // LFP write space holds (number of samples written) / lfpDownsampleFactor() samples per channel, and is nullptr if
+    // the LFP band is not being stored (see setLfpBandEnabled()).
+    inline uint16_t* pointerToLfpWriteSpace() const
+    {
+        return writingLfp ? &lfpBuffer[(bufferWriteIndex / lfpFactor) * numAmplifierChannels] : nullptr;
+    }
+
+    // Raw frame write space holds one USB frame of rawFrameWords() words per sample, and is nullptr if raw frames are
+    // not being stored (see setRawFrameWords()).
+    inline uint16_t* pointerToRawFrameWriteSpace() const
+    {
+        return writingRawFrames ? &rawFrameBuffer[(size_t) bufferWriteIndex * rawFrameSize] : nullptr;
     }
 
     inline uint32_t* pointerToGpuSpikeTimestampsWriteSpace() const
@@ -128,6 +166,7 @@ public:
     }
 
     bool extractGpuSpikeDataOneDataBlock(uint16_t* waveform, GpuWaveformAddress waveformAddress, bool firstTime) const;
+    bool extractGpuSpikeData(uint16_t* waveform, GpuWaveformAddress waveformAddress, int numDataBlocks, bool firstTime) const;
 
     inline uint32_t* pointerToTimeStampWriteSpace() const
     {
@@ -143,6 +182,10 @@ public:
     // 1:
     bool requestReadNewData(Reader reader, int numWords, bool lastRead = false); // Call once before reading a block of data.
 
+    // Optionally block until requestReadNewData() with the same arguments would succeed, rather than polling it.
+    bool waitForNewData(Reader reader, int numWords, bool lastRead = false);
+    void wakeReader(Reader reader); // Release a reader blocked in waitForNewData() (e.g., when its thread is being stopped).
+
     // 2:
 
     // Return one word from an analog waveform buffer.  Valid values of timeIndex range from -numWordsInMemory()
@@ -158,7 +201,7 @@ public:
         int index = bufferReadIndex[reader] + timeIndex;
         if (index < 0) index += bufferSize;
         else if (index >= bufferSize) index -= bufferSize;
-        return waveform[index];
+        return waveform[index / analogWaveformDivisor(waveform)];
     }
 
     // Return one word from a digital waveform buffer.  Valid values of timeIndex range from -numWordsInMemory()
@@ -190,7 +233,7 @@ public:
         int index = bufferReadIndex[reader] + timeIndex;
         if (index < 0) index += bufferSize;
         else if (index >= bufferSize) index -= bufferSize;
-        return (waveform[index] >= threshold) ? 0x01u : 0;
+        return (waveform[index / analogWaveformDivisor(waveform)] >= threshold) ? 0x01u : 0;
     }
 
     inline uint32_t getTimeStamp(Reader reader, int timeIndex) const
@@ -206,6 +249,19 @@ public:
         return timeStampBuffer[index];
     }
 
+    // Return spans of numSamples samples starting at timeIndex, for bulk reading without per-sample bounds checks or
+    // wraparound arithmetic.  Analog spans are at the native rate of the waveform (see analogWaveformDivisor()), starting
+    // from the first native sample at or after timeIndex.  An empty span is returned if the range is invalid.
+    WaveformSpan<uint32_t> getTimeStampSpan(Reader reader, int timeIndex, int numSamples) const;
+    WaveformSpan<float> getAnalogDataSpan(Reader reader, const float* waveform, int timeIndex, int numSamples) const;
+    WaveformSpan<uint16_t> getDigitalDataSpan(Reader reader, const uint16_t* waveform, int timeIndex, int numSamples) const;
+    // The GPU amplifier bands are sample-major, so their spans hold numSamples rows of numGpuAmplifierChannels() words.
+    // Rows are never split between the two runs of the span.
+    WaveformSpan<uint16_t> getGpuAmplifierSpan(Reader reader, GpuWaveformType waveformType, int timeIndex, int numSamples) const;
+    int numGpuAmplifierChannels() const { return numAmplifierChannels; }
+    // Raw frame spans hold numSamples USB frames of rawFrameWords() words, and are empty if raw frames are not stored.
+    WaveformSpan<uint16_t> getRawFrameSpan(Reader reader, int timeIndex, int numSamples) const;
+
     float getGpuAmplifierData(Reader reader, GpuWaveformAddress waveformAddress, int timeIndex) const;
     uint16_t getGpuAmplifierDataRaw(Reader reader, GpuWaveformAddress waveformAddress, int timeIndex) const;
 
@@ -215,15 +271,34 @@ public:
                                  int numSamples, int downsampleFactor = 1) const;
     void copyGpuAmplifierDataArrayRaw(Reader reader, uint16_t* dest, const vector<GpuWaveformAddress>& waveformAddresses,
                                       int timeIndex, int numSamples, int downsampleFactor = 1) const;
+    // Like copyGpuAmplifierDataArrayRaw(), but dest holds all numSamples samples of the first waveform, then all samples
+    // of the second, and so on, as in the data blocks of the Intan file formats.
+    void copyGpuAmplifierDataBlockRaw(Reader reader, uint16_t* dest, const GpuWaveformAddress* waveformAddresses,
+                                      int numWaveforms, int timeIndex, int numSamples) const;
     void copyAnalogData(Reader reader, float* dest, const float* waveform, int timeIndex, int numSamples) const;
     void copyAnalogDataArray(Reader reader, float* dest, const vector<float*>& waveforms, int timeIndex, int numSamples) const;
     void copyDigitalData(Reader reader, uint16_t* dest, const uint16_t* waveform, int timeIndex, int numSamples) const;
     void copyDigitalDataArray(Reader reader, uint16_t* dest, const vector<uint16_t*>& waveforms, int timeIndex, int numSamples) const;
     void copyTimeStamps(Reader reader, uint32_t* dest, int timeIndex, int numSamples) const;
 
+    // Copy numSamples / lfpDownsampleFactor() samples of the LFP band, starting from the first LFP sample at or after
+    // timeIndex.  timeIndex and numSamples are counted in amplifier samples, as for the other copy methods.  With a
+    // downsample factor of one, the LFP band is the lowpass band.
+    void copyLfpDataRaw(Reader reader, uint16_t* dest, GpuWaveformAddress waveformAddress, int timeIndex, int numSamples) const;
+    void copyLfpDataArrayRaw(Reader reader, uint16_t* dest, const vector<GpuWaveformAddress>& waveformAddresses,
+                             int timeIndex, int numSamples) const;
+
+    // Copy numSamples / analogWaveformDivisor(waveform) samples of an analog waveform at its native sample rate,
+    // starting from the first native sample at or after timeIndex.
+    void copyAnalogDataNative(Reader reader, float* dest, const float* waveform, int timeIndex, int numSamples) const;
+
+    // Copy one digital channel as 0.0 or 1.0 values, for plotting.
+    void copyDigitalBitData(Reader reader, float* dest, DigitalBitAddress bitAddress, int timeIndex, int numSamples) const;
+
     MinMax<float> getMinMaxData(Reader reader, const float* waveform, int timeIndex, int numSamples) const;
     void getMinMaxGpuAmplifierData(MinMax<float> &init, Reader reader, GpuWaveformAddress waveformAddress, int timeIndex, int numSamples) const;
     void getMinMaxData(MinMax<float> &init, Reader reader,  const float* waveform, int timeIndex, int numSamples) const;
+    void getMinMaxDigitalBitData(MinMax<float> &init, Reader reader, DigitalBitAddress bitAddress, int timeIndex, int numSamples) const;
     uint16_t getStimData(Reader reader, const uint16_t* stimFlags, int timeIndex, int numSamples) const;
     uint16_t getRasterData(Reader reader, const uint16_t* rasterData, int timeIndex, int numSamples) const;
 
@@ -231,23 +306,62 @@ public:
     void freeOldData(Reader reader); // Call once after all reading is complete.
 
     int numWordsInMemory(Reader reader) const; // Return length of old data stored in memory.
+    int numWordsAvailable(Reader reader) const; // Return length of new data not yet read.
     double percentFull() const;
 
-    void resetBuffer();
+    void resetBuffer(); // Call only while no thread is writing to or reading from the FIFO.
     void pauseBuffer();
 
     float* getAnalogWaveformPointer(const string& waveName) const;
     uint16_t* getDigitalWaveformPointer(const string& waveName) const;
     GpuWaveformAddress getGpuWaveformAddress(const string& waveName) const;
     bool gpuWaveformPresent(const string& waveName) const;
+    DigitalBitAddress getDigitalBitAddress(const string& waveName) const;  // wordWaveform is nullptr if not found
+
+    // Aux inputs are sampled once every AuxInputDivisor amplifier samples, and supply voltages once per data block.
+    // Their buffers hold one value per native sample; the analog read methods above (other than copyAnalogDataNative())
+    // still take amplifier-rate time indices and return the most recent native sample.  Return the number of amplifier
+    // samples per stored sample of an analog waveform, or one for full-rate waveforms.
+    static const int AuxInputDivisor = 4;
+    inline int analogWaveformDivisor(const float* waveform) const
+    {
+        if (waveform >= auxInputStorage && waveform < auxInputStorage + auxInputStorageSize) return AuxInputDivisor;
+        if (waveform >= supplyVoltageStorage && waveform < supplyVoltageStorage + supplyVoltageStorageSize) return samplesPerDataBlock;
+        return 1;
+    }
+    int analogWaveformDivisor(const string& waveName) const { return analogWaveformDivisor(getAnalogWaveformPointer(waveName)); }
 
     void updateForRescan();
 
+    // Select which of the lowpass and highpass amplifier bands are stored from the next write onwards.  A band that is
+    // not stored keeps whatever data it last held, and its buffer pages are never touched if it is never enabled.
+    void setFilterBandsEnabled(bool lowpass, bool highpass) { lowpassEnabled = lowpass; highpassEnabled = highpass; }
+    bool lowpassBandEnabled() const { return lowpassEnabled; }
+    bool highpassBandEnabled() const { return highpassEnabled; }
+
+    // Find the time indices [begin, end) for which a GPU amplifier band holds data stored while that band was enabled.
+    // Lowpass and highpass samples outside this range are stale: getGpuAmplifierData(), getGpuAmplifierDataRaw(),
+    // copyGpuAmplifierData(), and getMinMaxGpuAmplifierData() read them as zero.  The other raw methods are used only
+    // for saving, and the saved bands cannot change while running.
+    void getStoredGpuAmplifierRange(Reader reader, GpuWaveformType waveformType, int& begin, int& end) const;
+
+    // The LFP band is stored at the amplifier sample rate divided by a downsample factor that must divide the number of
+    // samples per data block.  Set the factor only while no data is being written or read; it is kept until changed.
+    void setLfpDownsampleFactor(int factor);
+    int lfpDownsampleFactor() const { return lfpFactor; }
+    void setLfpBandEnabled(bool enabled) { lfpEnabled = enabled; }
+    bool lfpBandEnabled() const { return lfpEnabled; }
+
+    // Raw USB frames (one frame of frameWords words per sample, as read from the controller) are stored only for raw
+    // frame recordings.  Set the frame size only while no data is being written or read; zero frees the raw frame
+    // buffer.
+    void setRawFrameWords(int frameWords);
+    int rawFrameWords() const { return rawFrameSize; }
+
     bool memoryWasAllocated(double& memoryRequestedGB) const { memoryRequestedGB += memoryNeededGB; return memoryAllocated; }
 
 private:
     SystemState *state;
-    mutex mtx;
     SignalSources *signalSources;
     int numAmplifierChannels;
     int maxSpikesPerDataBlock;
@@ -261,6 +375,34 @@ private:
     uint16_t* gpuAmplifierLowpassBuffer;
     uint16_t* gpuAmplifierHighpassBuffer;
 
+    // Requested lowpass and highpass bands, latched by requestWriteSpace() so they hold for a whole write.
+    atomic<bool> lowpassEnabled;
+    atomic<bool> highpassEnabled;
+    bool writingLowpass;
+    bool writingHighpass;
+
+    // Samples [from, until) of a lowpass or highpass band, counted as writeCount, were stored while the band was
+    // enabled.  until is INT64_MAX while the band is still being stored.
+    struct StoredRange
+    {
+        atomic<int64_t> from;
+        atomic<int64_t> until;
+    };
+    StoredRange lowpassStored;
+    StoredRange highpassStored;
+    void latchFilterBand(bool enabled, bool& writing, StoredRange& stored);
+
+    // Decimated LFP band, one sample per lfpFactor amplifier samples; allocated only for factors greater than one.
+    uint16_t* lfpBuffer;
+    int lfpFactor;
+    atomic<bool> lfpEnabled;
+    bool writingLfp;
+
+    // Raw USB frames, rawFrameSize words per sample; allocated only while raw frames are being stored.
+    uint16_t* rawFrameBuffer;
+    int rawFrameSize;
+    bool writingRawFrames;
+
     // Buffers for GPU-processed spike detection data
     uint32_t* gpuSpikeTimestamps;
     uint8_t* gpuSpikeIds;
@@ -283,13 +425,18 @@ private:
     // Buffers for supply voltages on chips (with stream and channel indexing)
     vector<float*> supplyVoltageBuffer;
 
+    // Aux input and supply voltage buffers are carved from one block of memory per sample rate, so the rate of a
+    // waveform can be found from its pointer.
+    float* auxInputStorage;
+    float* supplyVoltageStorage;
+    int auxInputStorageSize;
+    int supplyVoltageStorageSize;
+
     // Buffers for controller-based analog and digital inputs and outputs (implicit indexing)
     vector<float*> boardDacBuffer;
     vector<float*> boardAdcBuffer;
-    vector<float*> boardDigInBuffer;            // individual digital in channels (using float for easy plotting)
-    vector<float*> boardDigOutBuffer;           // individual digital out channels (using float for easy plotting)
-    vector<uint16_t*> boardDigInWordBuffer;     // all 16 digital in channels saved as uint16 word (for quick saving)
-    vector<uint16_t*> boardDigOutWordBuffer;    // all 16 digital out channels saved as uint16 word (for quick saving)
+    vector<uint16_t*> boardDigInWordBuffer;     // all 16 digital in channels saved as uint16 word
+    vector<uint16_t*> boardDigOutWordBuffer;    // all 16 digital out channels saved as uint16 word
 
     int bufferSizeInDataBlocks;
     int memorySizeInDataBlocks;
@@ -300,25 +447,58 @@ private:
     int bufferAllocateSize;
     int bufferAllocateSizeInBlocks;
 
-    Semaphore freeWords;
-    Semaphore* usedWordsNewData;
-    int bufferWriteIndex;
-    vector<int> bufferReadIndex;
-    vector<int> bufferMemoryIndex;
+    // One writer (WaveformProcessorThread) and several readers coordinate through cursors that count samples since
+    // resetBuffer(), so no thread takes a lock.  Each cursor is stored only by its owner: writeCount by the writer, and
+    // readCount and memoryCount by each reader.  Readers may read up to writeCount, and the writer may reuse space up
+    // to the oldest memoryCount.
+    struct alignas(64) ReaderCursor
+    {
+        atomic<int64_t> readCount;      // Samples released by freeOldData()
+        atomic<int64_t> memoryCount;    // Oldest sample still kept as memory for this reader
+        atomic<bool> wakeRequested;
+    };
+
+    int bufferWriteIndex;               // Only touched by the writer
     int numWordsToBeWritten;
+    vector<int> bufferReadIndex;        // Only touched by each reader
     vector<int> numWordsToBeRead;
+    ReaderCursor* cursors;
+    alignas(64) atomic<int64_t> writeCount;
+    alignas(64) atomic<uint32_t> writeSequence;   // Bumped on every commit; blocked readers wait on this
+    atomic<int> numReadersWaiting;
+
+    int numFreeWords(int* oldestReader = nullptr) const;
 
     map<string, float*> analogWaveformIndices;
     map<string, uint16_t*> digitalWaveformIndices;
     map<string, GpuWaveformAddress> gpuWaveformAddresses;
+    map<string, DigitalBitAddress> digitalBitAddresses;
 
     bool memoryAllocated;
     double memoryNeededGB;
 
     void allocateAnalogBuffer(vector<float*> &bufferArray, const string& waveName);
+    float* allocateNativeRateStorage(int numWaveforms, int divisor, int& storageSize);
+    void addNativeRateBuffer(vector<float*> &bufferArray, const string& waveName, float* storage, int index, int divisor);
     void allocateDigitalBuffer(vector<uint16_t*> &bufferArray, const string& waveName);
     void allocateMemory();
+    void allocateLfpMemory();
+    void allocateRawFrameMemory();
     void freeMemory();
+    bool extractGpuSpikeDataBlock(uint16_t* waveform, GpuWaveformAddress waveformAddress, int writeIndex, bool firstTime) const;
+    int nativeReadIndex(Reader reader, int timeIndex, int divisor) const;
+    bool spanInRange(Reader reader, int timeIndex, int numSamples, const char* caller) const;
+
+    template <typename T>
+    static WaveformSpan<T> makeSpan(const T* buffer, int startIndex, int numSamples, int size)
+    {
+        WaveformSpan<T> span;
+        span.first = &buffer[startIndex];
+        span.firstLength = min(numSamples, size - startIndex);
+        span.second = buffer;
+        span.secondLength = numSamples - span.firstLength;
+        return span;
+    }
 };
 
 #endif // WAVEFORMFIFO_H
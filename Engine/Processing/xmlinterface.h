@@ -50,11 +50,24 @@ enum XMLIncludeParameters {
     XMLIncludeProbeMapSettings
 };
 
-class XMLInterface
+// Loads and saves the global settings file.  SystemState reaches XMLInterface only through this class, so the engine
+// code that saves settings along with recordings does not depend on the GUI classes XMLInterface uses when loading.
+class AbstractSettingsInterface
+{
+public:
+    virtual ~AbstractSettingsInterface() {}
+    virtual bool loadSettingsFile(const QString& filename, QString &errorMessage) const = 0;
+    virtual bool saveSettingsFile(const QString& filename) const = 0;
+};
+
+class XMLInterface : public AbstractSettingsInterface
 {
 public:
     XMLInterface(SystemState* state_, ControllerInterface* controllerInterface_, XMLIncludeParameters includeParameters_);
 
+    bool loadSettingsFile(const QString& filename, QString &errorMessage) const override { return loadFile(filename, errorMessage); }
+    bool saveSettingsFile(const QString& filename) const override { return saveFile(filename); }
+
     bool loadFile(const QString& filename, QString &errorMessage, bool stimLegacy = false, bool probeMap = false, bool stimOnly = false) const;
     bool saveFile(const QString& filename) const;
 
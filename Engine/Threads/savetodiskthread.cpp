@@ -32,6 +32,7 @@
 #include "intanfilesavemanager.h"
 #include "filepersignaltypesavemanager.h"
 #include "fileperchannelsavemanager.h"
+#include "rawframesavemanager.h"
 #include "savetodiskthread.h"
 
 SaveToDiskThread::SaveToDiskThread(WaveformFifo* waveformFifo_, SystemState* state_, QObject *parent) :
@@ -96,6 +97,7 @@ void SaveToDiskThread::run()
 //            workTimer.start();
 //            reportTimer.start();
             statusBarUpdateTimer.start();
+            SaveFileWriter::resetStatistics();
             while (keepGoing && !stopThread) {
 //                workTimer.restart();
                 int64_t playbackBlocks = state->getPlaybackBlocks();
@@ -255,7 +257,8 @@ void SaveToDiskThread::run()
 //                        reportTimer.restart();
 //                    }
                 } else {
-                    usleep(1000);    // If new data is not ready, wait 1000 microseconds and try again.
+                    // If new data is not ready, sleep until the waveform processor commits more (or this thread is stopped).
+                    waveformFifo->waitForNewData(WaveformFifo::ReaderDisk, NumSamples, lastRead);
                 }
             }
 
@@ -264,6 +267,21 @@ void SaveToDiskThread::run()
                 saveManager->closeAllSaveFiles();
                 isRecording = false;
             }
+
+            SaveFileWriterStatistics diskStatistics = SaveFileWriter::statistics();
+            if (diskStatistics.bytesWritten > 0) {
+                state->writeToLog("Disk writes: " + QString::number(diskStatistics.throughputMBPerSecond, 'f', 2) +
+                                  " MB/s sustained, longest write " + QString::number(diskStatistics.maxWriteMs, 'f', 2) +
+                                  " ms, longest flush stall " + QString::number(diskStatistics.maxFlushStallMs, 'f', 2) + " ms");
+                if (diskStatistics.ioThreads.size() > 1) {
+                    for (int i = 0; i < (int) diskStatistics.ioThreads.size(); ++i) {
+                        const SaveFileIOThreadStatistics& ioThread = diskStatistics.ioThreads[i];
+                        state->writeToLog("Disk I/O thread " + QString::number(i) + ": " +
+                                          QString::number(ioThread.throughputMBPerSecond, 'f', 2) + " MB/s, " +
+                                          QString::number(100.0 * ioThread.busyFraction, 'f', 1) + "% busy");
+                    }
+                }
+            }
             running = false;
             state->recording = false;
             state->triggered = false;
@@ -310,6 +328,9 @@ void SaveToDiskThread::startRunning()
     case FileFormatFilePerChannel:
         saveManager = new FilePerChannelSaveManager(waveformFifo, state);
         break;
+    case FileFormatRawFrames:
+        saveManager = new RawFrameSaveManager(waveformFifo, state);
+        break;
     default:
         cerr << "SaveToDiskThread::startRunning: invalid file format enum: " << state->getFileFormatEnum() << '\n';
         break;
@@ -321,12 +342,14 @@ void SaveToDiskThread::startRunning()
 void SaveToDiskThread::stopRunning()
 {
     keepGoing = false;
+    waveformFifo->wakeReader(WaveformFifo::ReaderDisk);
 }
 
 void SaveToDiskThread::close()
 {
     keepGoing = false;
     stopThread = true;
+    waveformFifo->wakeReader(WaveformFifo::ReaderDisk);
 }
 
 bool SaveToDiskThread::isActive() const
@@ -393,6 +416,7 @@ void SaveToDiskThread::setStatusBarRecording(double bytesPerMinute, const QStrin
         break;
     case FileFormatFilePerSignalType:
     case FileFormatFilePerChannel:
+    case FileFormatRawFrames:
         if (state->createNewDirectory->getValue()) {
             statusFilename += dateTimeStamp;
         }
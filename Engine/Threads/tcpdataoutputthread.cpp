@@ -34,6 +34,8 @@ TCPDataOutputThread::TCPDataOutputThread(WaveformFifo *waveformFifo_, const doub
     QThread(parent),
     tcpWaveformDataCommunicator(state_->tcpWaveformDataCommunicator),
     tcpSpikeDataCommunicator(state_->tcpSpikeDataCommunicator),
+    boardDigitalInWaveform(nullptr),
+    boardDigitalOutWaveform(nullptr),
     previousSample(nullptr),
     waveformFifo(waveformFifo_),
     signalSources(state_->signalSources),
@@ -96,13 +98,33 @@ void TCPDataOutputThread::run()
                             continue;
                         }
 
-                        for (int i = 0; i < FramesPerBlock * state->tcpNumDataBlocksWrite->getValue(); ++i) {
+                        int numFrames = FramesPerBlock * state->tcpNumDataBlocksWrite->getValue();
+
+                        // Get spans over this read for each waveform once, rather than reading each sample separately.
+                        WaveformSpan<uint32_t> timeStamps = waveformFifo->getTimeStampSpan(WaveformFifo::ReaderTCP, 0, numFrames);
+                        WaveformSpan<uint16_t> digitalInWords =
+                                waveformFifo->getDigitalDataSpan(WaveformFifo::ReaderTCP, boardDigitalInWaveform, 0, numFrames);
+                        WaveformSpan<uint16_t> digitalOutWords =
+                                waveformFifo->getDigitalDataSpan(WaveformFifo::ReaderTCP, boardDigitalOutWaveform, 0, numFrames);
+                        for (ChannelWaveforms& waveforms : channelWaveforms) {
+                            if (waveforms.analog) {
+                                waveforms.analogSpan = waveformFifo->getAnalogDataSpan(WaveformFifo::ReaderTCP, waveforms.analog, 0, numFrames);
+                            }
+                            if (waveforms.spike) {
+                                waveforms.spikeSpan = waveformFifo->getDigitalDataSpan(WaveformFifo::ReaderTCP, waveforms.spike, 0, numFrames);
+                            }
+                            if (waveforms.stim) {
+                                waveforms.stimSpan = waveformFifo->getDigitalDataSpan(WaveformFifo::ReaderTCP, waveforms.stim, 0, numFrames);
+                            }
+                        }
+
+                        for (int i = 0; i < numFrames; ++i) {
                             if ((i % FramesPerBlock) == 0) {
                                 waveformArray.replace(waveformArrayIndex, sizeof(TCPWaveformMagicNumber), (const char*)(&TCPWaveformMagicNumber), sizeof(TCPWaveformMagicNumber));
                                 waveformArrayIndex += sizeof(TCPWaveformMagicNumber);
                             }
                             lastTimestamp = timestamp;
-                            timestamp = waveformFifo->getTimeStamp(WaveformFifo::ReaderTCP, i);
+                            timestamp = timeStamps[i];
                             //uint32_t timestamp = waveformFifo->getTimeStamp(WaveformFifo::ReaderTCP, i);
                             waveformArray.replace(waveformArrayIndex, sizeof(timestamp), (const char*)(&timestamp), sizeof(timestamp));
                             if (timestamp != lastTimestamp + 1) {
@@ -112,56 +134,44 @@ void TCPDataOutputThread::run()
                             waveformArrayIndex += sizeof(timestamp);
 
                             // Grab digital in word and digital out word
-                            uint16_t* boardDigitalInWaveform = waveformFifo->getDigitalWaveformPointer("DIGITAL-IN-WORD");
-                            uint16_t digitalInWord = waveformFifo->getDigitalData(WaveformFifo::ReaderTCP, boardDigitalInWaveform, i);
+                            uint16_t digitalInWord = digitalInWords[i];
                             bool digitalInWordSent = false;
-                            uint16_t* boardDigitalOutWaveform = waveformFifo->getDigitalWaveformPointer("DIGITAL-OUT-WORD");
-                            uint16_t digitalOutWord = waveformFifo->getDigitalData(WaveformFifo::ReaderTCP, boardDigitalOutWaveform, i);
+                            uint16_t digitalOutWord = digitalOutWords[i];
                             bool digitalOutWordSent = false;
 
                             int stimChannelIndex = 0;
 
                             for (int channel = 0; channel < enabledChannelNames.size(); ++channel) {
 
-                                Channel *thisChannel = signalSources->channelByName(enabledChannelNames[channel]);
+                                const ChannelWaveforms& waveforms = channelWaveforms[channel];
+                                Channel *thisChannel = waveforms.channel;
 
                                 // If this channel is an amplifier signal, read all enabled bands
                                 if (thisChannel->getSignalType() == AmplifierSignal) {
 
                                     if (thisChannel->getOutputToTcp()) {
-                                        string waveName = QString(enabledChannelNames[channel] + "|WIDE").toStdString();
-                                        if (!waveformFifo->gpuWaveformPresent(waveName)) continue; // Error happened here - we should flag that there was a problem.
-                                        GpuWaveformAddress waveformAddress = waveformFifo->getGpuWaveformAddress(waveName);
-                                        if (waveformAddress.waveformIndex < 0) continue; // Error happened here - we should flag that there was a problem.
-                                        uint16_t thisSample = waveformFifo->getGpuAmplifierDataRaw(WaveformFifo::ReaderTCP, waveformAddress, i);
+                                        if (waveforms.wide.waveformIndex < 0) continue; // Error happened here - we should flag that there was a problem.
+                                        uint16_t thisSample = waveformFifo->getGpuAmplifierDataRaw(WaveformFifo::ReaderTCP, waveforms.wide, i);
                                         waveformArray.replace(waveformArrayIndex, sizeof(thisSample), (const char*)(&thisSample), sizeof(thisSample));
                                         waveformArrayIndex += sizeof(thisSample);
                                     }
 
                                     if (thisChannel->getOutputToTcpLow()) {
-                                        string waveName = QString(enabledChannelNames[channel] + "|LOW").toStdString();
-                                        if (!waveformFifo->gpuWaveformPresent(waveName)) continue; // Error happened here - we should flag that there was a problem.
-                                        GpuWaveformAddress waveformAddress = waveformFifo->getGpuWaveformAddress(waveName);
-                                        if (waveformAddress.waveformIndex < 0) continue; // Error happened here - we should flag that there was a problem.
-                                        uint16_t thisSample = waveformFifo->getGpuAmplifierDataRaw(WaveformFifo::ReaderTCP, waveformAddress, i);
+                                        if (waveforms.low.waveformIndex < 0) continue; // Error happened here - we should flag that there was a problem.
+                                        uint16_t thisSample = waveformFifo->getGpuAmplifierDataRaw(WaveformFifo::ReaderTCP, waveforms.low, i);
                                         waveformArray.replace(waveformArrayIndex, sizeof(thisSample), (const char*)(&thisSample), sizeof(thisSample));
                                         waveformArrayIndex += sizeof(thisSample);
                                     }
 
                                     if (thisChannel->getOutputToTcpHigh()) {
-                                        string waveName = QString(enabledChannelNames[channel] + "|HIGH").toStdString();
-                                        if (!waveformFifo->gpuWaveformPresent(waveName)) continue; // Error happened here - we should flag that there was a problem.
-                                        GpuWaveformAddress waveformAddress = waveformFifo->getGpuWaveformAddress(waveName);
-                                        if (waveformAddress.waveformIndex < 0) continue; // Error happened here - we should flag that there was a problem.
-                                        uint16_t thisSample = waveformFifo->getGpuAmplifierDataRaw(WaveformFifo::ReaderTCP, waveformAddress, i);
+                                        if (waveforms.high.waveformIndex < 0) continue; // Error happened here - we should flag that there was a problem.
+                                        uint16_t thisSample = waveformFifo->getGpuAmplifierDataRaw(WaveformFifo::ReaderTCP, waveforms.high, i);
                                         waveformArray.replace(waveformArrayIndex, sizeof(thisSample), (const char*)(&thisSample), sizeof(thisSample));
                                         waveformArrayIndex += sizeof(thisSample);
                                     }
 
                                     if (thisChannel->getOutputToTcpSpike()) {
-                                        string waveName = QString(enabledChannelNames[channel] + "|SPK").toStdString();
-                                        uint16_t* spikeWaveform = waveformFifo->getDigitalWaveformPointer(waveName);
-                                        uint8_t spikeId = (uint8_t) waveformFifo->getDigitalData(WaveformFifo::ReaderTCP, spikeWaveform, i);
+                                        uint8_t spikeId = (uint8_t) waveforms.spikeSpan[i];
                                         if (spikeId != SpikeIdNoSpike) {
                                             // Create 14-byte chunk with magic num, native name, timestamp, and spike ID
                                             char nativeName[5];
@@ -183,18 +193,14 @@ void TCPDataOutputThread::run()
                                     }
 
                                     if (thisChannel->getOutputToTcpDc()) {
-                                        string waveName = QString(enabledChannelNames[channel] + "|DC").toStdString();
-                                        float *dcWaveform = waveformFifo->getAnalogWaveformPointer(waveName);
-                                        float thisSampleFloat = waveformFifo->getAnalogData(WaveformFifo::ReaderTCP, dcWaveform, i);
+                                        float thisSampleFloat = waveforms.analogSpan[i];
                                         uint16_t thisSample = round((thisSampleFloat / -0.01923) + 512);
                                         waveformArray.replace(waveformArrayIndex, sizeof(thisSample), (const char*)(&thisSample), sizeof(thisSample));
                                         waveformArrayIndex += sizeof(thisSample);
                                     }
 
                                     if (thisChannel->getOutputToTcpStim()) {
-                                        string waveName = QString(enabledChannelNames[channel] + "|STIM").toStdString();
-                                        uint16_t *stimWaveform = waveformFifo->getDigitalWaveformPointer(waveName);
-                                        uint16_t thisSampleUSB = waveformFifo->getDigitalData(WaveformFifo::ReaderTCP, stimWaveform, i);
+                                        uint16_t thisSampleUSB = waveforms.stimSpan[i];
                                         bool stimPolarityNegative = thisSampleUSB & (1 << 8);
                                         bool stimOn = thisSampleUSB & 1;
                                         uint8_t stimMagnitude;
@@ -215,11 +221,9 @@ void TCPDataOutputThread::run()
                                 if (thisChannel->getSignalType() == AuxInputSignal) {
 
                                     if (thisChannel->getOutputToTcp()) {
-                                        // Once every 4 samples, aux input actually gets a sample.
-                                        if (i % 4 == 0) {
-                                            string waveName = QString(enabledChannelNames[channel]).toStdString();
-                                            float *auxWaveform = waveformFifo->getAnalogWaveformPointer(waveName);
-                                            float thisSampleFloat = waveformFifo->getAnalogData(WaveformFifo::ReaderTCP, auxWaveform, i / 4);
+                                        // Aux inputs are stored at their native rate; read a new sample only when one exists.
+                                        if (i % waveforms.analogDivisor == 0) {
+                                            float thisSampleFloat = waveforms.analogSpan[i / waveforms.analogDivisor];
                                             uint16_t thisSample = round((thisSampleFloat / 37.4e-6));
                                             waveformArray.replace(waveformArrayIndex, sizeof(thisSample), (const char*)(&thisSample), sizeof(thisSample));
                                             waveformArrayIndex += sizeof(thisSample);
@@ -238,10 +242,8 @@ void TCPDataOutputThread::run()
 
                                     if (thisChannel->getOutputToTcp()) {
                                         // Once every data block, supply voltage actually gets a sample
-                                        if (i % FramesPerBlock == 0) {
-                                            string waveName = QString(enabledChannelNames[channel]).toStdString();
-                                            float *vddWaveform = waveformFifo->getAnalogWaveformPointer(waveName);
-                                            float thisSampleFloat = waveformFifo->getAnalogData(WaveformFifo::ReaderTCP, vddWaveform, i / FramesPerBlock);
+                                        if (i % waveforms.analogDivisor == 0) {
+                                            float thisSampleFloat = waveforms.analogSpan[i / waveforms.analogDivisor];
                                             uint16_t thisSample = round((thisSampleFloat / 74.8e-6));
                                             waveformArray.replace(waveformArrayIndex, sizeof(thisSample), (const char*)(&thisSample), sizeof(thisSample));
                                             waveformArrayIndex += sizeof(thisSample);
@@ -259,9 +261,7 @@ void TCPDataOutputThread::run()
                                 if (thisChannel->getSignalType() == BoardAdcSignal) {
 
                                     if (thisChannel->getOutputToTcp()) {
-                                        string waveName = QString(enabledChannelNames[channel]).toStdString();
-                                        float *adcWaveform = waveformFifo->getAnalogWaveformPointer(waveName);
-                                        float thisSampleFloat = waveformFifo->getAnalogData(WaveformFifo::ReaderTCP, adcWaveform, i);
+                                        float thisSampleFloat = waveforms.analogSpan[i];
                                         uint16_t thisSample;
                                         if (state->getControllerTypeEnum() == ControllerRecordUSB2) {
                                             thisSample = round(thisSampleFloat / 50.354e-6);
@@ -277,9 +277,7 @@ void TCPDataOutputThread::run()
                                 if (thisChannel->getSignalType() == BoardDacSignal) {
 
                                     if (thisChannel->getOutputToTcp()) {
-                                        string waveName = QString(enabledChannelNames[channel]).toStdString();
-                                        float *dacWaveform = waveformFifo->getAnalogWaveformPointer(waveName);
-                                        float thisSampleFloat = waveformFifo->getAnalogData(WaveformFifo::ReaderTCP, dacWaveform, i);
+                                        float thisSampleFloat = waveforms.analogSpan[i];
                                         uint16_t thisSample = round(thisSampleFloat * 3200) + 32768;
                                         waveformArray.replace(waveformArrayIndex, sizeof(thisSample), (const char*)(&thisSample), sizeof(thisSample));
                                         waveformArrayIndex += sizeof(thisSample);
@@ -311,6 +309,15 @@ void TCPDataOutputThread::run()
                                     }
                                 }
                             }
+
+                            // After the last frame of each data block, append that block's LFP samples in time order.
+                            if (!lfpAddresses.empty() && (i + 1) % FramesPerBlock == 0) {
+                                waveformFifo->copyLfpDataArrayRaw(WaveformFifo::ReaderTCP, lfpBlock.data(), lfpAddresses,
+                                                                  i + 1 - FramesPerBlock, FramesPerBlock);
+                                int lfpBytes = (int) (sizeof(uint16_t) * lfpBlock.size());
+                                waveformArray.replace(waveformArrayIndex, lfpBytes, (const char*)(lfpBlock.data()), lfpBytes);
+                                waveformArrayIndex += lfpBytes;
+                            }
                         }
                         if (tcpWaveformDataCommunicator->status == TCPCommunicator::Connected)
                             tcpWaveformDataCommunicator->writeData(waveformArray.data(), waveformArrayIndex);
@@ -347,6 +354,7 @@ void TCPDataOutputThread::updateEnabledChannels()
 
     enabledChannelNames.clear();
     enabledStimChannelNames.clear();
+    lfpAddresses.clear();
 
     posStimAmplitudes.resize(0);
     negStimAmplitudes.resize(0);
@@ -369,6 +377,10 @@ void TCPDataOutputThread::updateEnabledChannels()
             thisChannelBands = thisChannel->getTcpBandNames();
             if (thisChannelBands.size() > 0) enabledChannelNames.append(thisChannel->getNativeName());
             totalEnabledBands += thisChannelBands.size();
+            if (thisChannel->getOutputToTcpLfp()) {
+                lfpAddresses.push_back(waveformFifo->getGpuWaveformAddress(thisChannel->getNativeName().toStdString() + "|LFP"));
+                totalEnabledBands -= 1;
+            }
 
             // Get stim amplitudes for this channel
             if (state->getControllerTypeEnum() == ControllerStimRecord) {
@@ -447,6 +459,41 @@ void TCPDataOutputThread::updateEnabledChannels()
         previousSample[i] = 0;
     }
 
+    // Resolve each enabled channel's waveforms here so the frame loop in run() needs no name lookups.
+    channelWaveforms.clear();
+    for (int i = 0; i < enabledChannelNames.size(); ++i) {
+        Channel* thisChannel = signalSources->channelByName(enabledChannelNames[i]);
+        string nativeName = enabledChannelNames[i].toStdString();
+        ChannelWaveforms waveforms = {};
+        waveforms.channel = thisChannel;
+        waveforms.wide = GpuWaveformAddress{ GpuWaveformWideband, -1 };
+        waveforms.low = GpuWaveformAddress{ GpuWaveformWideband, -1 };
+        waveforms.high = GpuWaveformAddress{ GpuWaveformWideband, -1 };
+        waveforms.analogDivisor = 1;
+        switch (thisChannel->getSignalType()) {
+        case AmplifierSignal:
+            if (thisChannel->getOutputToTcp()) waveforms.wide = waveformFifo->getGpuWaveformAddress(nativeName + "|WIDE");
+            if (thisChannel->getOutputToTcpLow()) waveforms.low = waveformFifo->getGpuWaveformAddress(nativeName + "|LOW");
+            if (thisChannel->getOutputToTcpHigh()) waveforms.high = waveformFifo->getGpuWaveformAddress(nativeName + "|HIGH");
+            if (thisChannel->getOutputToTcpSpike()) waveforms.spike = waveformFifo->getDigitalWaveformPointer(nativeName + "|SPK");
+            if (thisChannel->getOutputToTcpDc()) waveforms.analog = waveformFifo->getAnalogWaveformPointer(nativeName + "|DC");
+            if (thisChannel->getOutputToTcpStim()) waveforms.stim = waveformFifo->getDigitalWaveformPointer(nativeName + "|STIM");
+            break;
+        case AuxInputSignal:
+        case SupplyVoltageSignal:
+        case BoardAdcSignal:
+        case BoardDacSignal:
+            waveforms.analog = waveformFifo->getAnalogWaveformPointer(nativeName);
+            break;
+        default:
+            break;
+        }
+        if (waveforms.analog) waveforms.analogDivisor = waveformFifo->analogWaveformDivisor(waveforms.analog);
+        channelWaveforms.push_back(waveforms);
+    }
+    boardDigitalInWaveform = waveformFifo->getDigitalWaveformPointer("DIGITAL-IN-WORD");
+    boardDigitalOutWaveform = waveformFifo->getDigitalWaveformPointer("DIGITAL-OUT-WORD");
+
     digInWordPresent = 0;
     if (numDigitalInChannels > 0) {
         digInWordPresent = 1;
@@ -459,8 +506,10 @@ void TCPDataOutputThread::updateEnabledChannels()
 
     // Each frame has 4 bytes for timestamp, then 2 bytes per uint16 word.
     numBytesPerFrame = 4 + 2 * (totalEnabledBands + numAuxChannels + numVddChannels + numAdcChannels + numDacChannels + digInWordPresent + digOutWordPresent);
-    // Each data block has 4 bytes for magic number, then 128 frames
-    numBytesPerDataBlock = 4 + (FramesPerBlock * numBytesPerFrame);
+    // Each data block has 4 bytes for magic number, then 128 frames, then 2 bytes per LFP channel for each LFP sample
+    int lfpSamplesPerBlock = FramesPerBlock / waveformFifo->lfpDownsampleFactor();
+    lfpBlock.resize(lfpSamplesPerBlock * lfpAddresses.size());
+    numBytesPerDataBlock = 4 + (FramesPerBlock * numBytesPerFrame) + (int) (2 * lfpBlock.size());
 
     waveformArray.clear();
     waveformArray.resize(state->tcpNumDataBlocksWrite->getValue() * numBytesPerDataBlock);
@@ -72,6 +72,31 @@ private:
 
     QStringList previousEnabledBands;
 
+    // Waveforms of each enabled channel, resolved once when the enabled channels change, and the spans read from them
+    // each time a block of frames is written.
+    struct ChannelWaveforms
+    {
+        Channel* channel;
+        GpuWaveformAddress wide;
+        GpuWaveformAddress low;
+        GpuWaveformAddress high;
+        const float* analog; // DC amplifier waveform, or the channel's own waveform for other analog signals
+        int analogDivisor;
+        const uint16_t* spike;
+        const uint16_t* stim;
+
+        WaveformSpan<float> analogSpan;
+        WaveformSpan<uint16_t> spikeSpan;
+        WaveformSpan<uint16_t> stimSpan;
+    };
+    vector<ChannelWaveforms> channelWaveforms;
+    const uint16_t* boardDigitalInWaveform;
+    const uint16_t* boardDigitalOutWaveform;
+
+    // LFP samples are sent after the frames of each data block, since they are not present in every frame.
+    vector<GpuWaveformAddress> lfpAddresses;
+    vector<uint16_t> lfpBlock;
+
     int totalEnabledBands;
     int numAuxChannels;
     int numVddChannels;
@@ -33,7 +33,9 @@
 #include <fmt/core.h>
 
 #include <QElapsedTimer>
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 
 #include "rhxglobals.h"
@@ -51,7 +53,9 @@ USBDataThread::USBDataThread(
       running(false),
       stopThread(false),
       numUsbBlocksToRead(1),
-      usbBufferIndex(0)
+      usbBufferIndex(0),
+      numResyncs(0),
+      numBytesDiscarded(0)
 {
     bufferSize =
         (BufferSizeInBlocks + 1) * BytesPerWord *
@@ -94,8 +98,6 @@ void USBDataThread::run()
         if (keepGoing) {
             emit hardwareFifoReport(0.0);
             running = true;
-            int numBytesRead = 0;
-            int bytesInBuffer = 0;
             ControllerType type = controller->getType();
             const int intan_frame_size =
                 BytesPerWord *
@@ -106,6 +108,9 @@ void USBDataThread::run()
             const auto is_xdaq = !(controller->isSynthetic() || controller->isPlayback());
             const auto use_frame_size = is_xdaq ? xdaq_frame_size : intan_frame_size;
 
+            numResyncs = 0;
+            numBytesDiscarded = 0;
+
             controller->setStimCmdMode(true);
             controller->setContinuousRunMode(true);
             controller->run();
@@ -118,101 +123,184 @@ void USBDataThread::run()
             //                            controller->getSampleRate();
             const auto streams = controller->getNumEnabledDataStreams();
 
+            const int frameBytes = (int) use_frame_size;
+            const int intanFrameWords = intan_frame_size / BytesPerWord;
+
+            // Copy one frame into dest in the Intan layout, stripping XDAQ padding and folding the
+            // 32-bit digital input and output words into 16 bits.  The Intan layout and everything
+            // downstream of it hold 16 digital inputs and outputs, so the upper 16 bits are dropped.
+            auto repackFrame = [&](const uint8_t *frame, uint8_t *dest) {
+                if (is_xdaq && (type == ControllerRecordUSB3)) {
+                    const int dio_off = (int) xdaq_frame_size - 8;
+                    const int io_off = dio_off - 16;
+                    const int pad_off = io_off - ((streams + 2) % 4) * 2;
+                    // magic ~ amplifiers, plus the filler words expected in the Intan layout
+                    const int head = pad_off + (streams % 4) * 2;
+                    std::memcpy(dest, frame, head);
+                    // skip padding, ADCs and 16 DI, then 16 DO
+                    std::memcpy(dest + head, frame + io_off, 16 + 2);
+                    std::memcpy(dest + head + 16 + 2, frame + dio_off + 4, 2);
+                } else if (is_xdaq && (type == ControllerStimRecord)) {
+                    const int dio_off = (int) xdaq_frame_size - 8;
+                    const int io_off = dio_off - 16 - 16;
+                    const int pad_off = io_off - 4;
+                    // magic ~ amplifiers
+                    std::memcpy(dest, frame, pad_off);
+                    // skip 4 bytes padding, AIO and 16 DI, then 16 DO
+                    std::memcpy(dest + pad_off, frame + io_off, 16 + 16 + 2);
+                    std::memcpy(dest + pad_off + 16 + 16 + 2, frame + dio_off + 4, 2);
+                } else {
+                    std::memcpy(dest, frame, intan_frame_size);
+                }
+            };
+
+            // Frames are repacked directly into space leased from the FIFO, so every run of frames in
+            // a transfer reaches the FIFO as a single contiguous write.  A lease is sized for the
+            // most frames that can remain in the transfer and only the frames written are committed.
+            const int maxLeaseFrames = usbFifo->maxWriteLength() / intanFrameWords;
+            uint16_t *lease = nullptr;
+            int leaseFrames = 0;
+            int leaseFramesUsed = 0;
+
+            auto endLease = [&]() {
+                if (lease && leaseFramesUsed > 0) {
+                    usbFifo->commitWrite(leaseFramesUsed * intanFrameWords);
+                }
+                lease = nullptr;
+                leaseFrames = 0;
+                leaseFramesUsed = 0;
+            };
+
+            // Write one frame to the FIFO, where framesRemaining bounds the number of frames left in
+            // the current transfer (including this one).  Returns false on FIFO overrun.
+            auto writeFrame = [&](const uint8_t *frame, int framesRemaining) -> bool {
+                if (leaseFramesUsed == leaseFrames) {
+                    endLease();
+                    leaseFrames = std::min(framesRemaining, maxLeaseFrames);
+                    lease = usbFifo->pointerToWriteSpace(leaseFrames * intanFrameWords);
+                    if (!lease) {
+                        cerr << "USBDataThread: USB FIFO overrun (2)." << '\n';
+                        leaseFrames = 0;
+                        return false;
+                    }
+                }
+                repackFrame(frame, (uint8_t *) (lease + leaseFramesUsed * intanFrameWords));
+                ++leaseFramesUsed;
+                return true;
+            };
+
+            // True from a failed header check until the next frame with valid headers, so that one
+            // loss of synchronization counts as one resync however many candidates are rejected.
+            bool resyncing = false;
+
+            // Check each USB data block for the correct header bytes before writing.  Frames are
+            // scanned starting at index while they start before startLimit and the frame plus the
+            // header of the following frame lie within length bytes.  Returns the first unscanned
+            // index.
+            auto scanFrames = [&](uint8_t *base, int index, int startLimit, int length) -> int {
+                const int endIndex =
+                    std::min(startLimit, length - frameBytes - USBHeaderSizeInBytes + 1);
+                while (index < endIndex) {
+                    if (RHXDataBlock::checkUsbHeader(base, index, type) &&
+                        RHXDataBlock::checkUsbHeader(base, index + frameBytes, type)) {
+                        writeFrame(base + index, (endIndex - index + frameBytes - 1) / frameBytes);
+                        index += frameBytes;
+                        resyncing = false;
+                    } else {
+                        // If headers are not found, skip ahead to the next candidate header.
+                        const int next =
+                            RHXDataBlock::findUsbHeader(base, index + 2, endIndex, type);
+                        if (!resyncing) numResyncs.fetch_add(1, std::memory_order_relaxed);
+                        resyncing = true;
+                        numBytesDiscarded.fetch_add(next - index, std::memory_order_relaxed);
+                        index = next;
+                    }
+                }
+                endLease();
+                return index;
+            };
+
             auto newStream = controller->start_read_stream(0xa0, [&](auto &&event) {
                 if (!std::holds_alternative<xdaq::DataStream::Events::OwnedData>(event)) return;
                 auto &&data = std::get<xdaq::DataStream::Events::OwnedData>(event);
-                std::copy(
-                    data.buffer.get(), data.buffer.get() + data.length, usbBuffer + usbBufferIndex
-                );
-                bytesInBuffer = usbBufferIndex + data.length;
+                // Frames are read in place from the buffer handed to us by the stream; only the
+                // bytes of a frame split across two transfers are staged in usbBuffer.
+                uint8_t *transfer = data.buffer.get();
+                const int length = (int) data.length;
 
                 if (!errorChecking) {
                     // If not checking for USB data glitches, just write all the data to the FIFO
-                    // buffer.
-                    // TODO: read 32-channel digital IO
-                    if (!usbFifo->writeToBuffer(
-                            &usbBuffer[usbBufferIndex],
-                            (data.length + usbBufferIndex) / BytesPerWord
-                        )) {
-                        cerr << "USBDataThread: USB FIFO overrun (1)." << '\n';
+                    // buffer.  XDAQ frames still need to be repacked into the Intan layout.
+                    if (!is_xdaq) {
+                        if (!usbFifo->writeToBuffer(transfer, length / BytesPerWord)) {
+                            cerr << "USBDataThread: USB FIFO overrun (1)." << '\n';
+                        }
+                    } else {
+                        // A frame split across two transfers is completed in usbBuffer, as in the
+                        // error checking path.
+                        int index = 0;
+                        bool carriedFrame = false;
+                        if (usbBufferIndex > 0) {
+                            const int needed = std::min(frameBytes - usbBufferIndex, length);
+                            std::copy(transfer, transfer + needed, usbBuffer + usbBufferIndex);
+                            usbBufferIndex += needed;
+                            index = needed;
+                            carriedFrame = usbBufferIndex == frameBytes;
+                        }
+                        const int numFrames = (length - index) / frameBytes;
+                        if (carriedFrame) {
+                            writeFrame(usbBuffer, numFrames + 1);
+                            usbBufferIndex = 0;
+                        }
+                        for (int frame = 0; frame < numFrames; ++frame) {
+                            writeFrame(transfer + index + frame * frameBytes, numFrames - frame);
+                        }
+                        endLease();
+                        index += numFrames * frameBytes;
+                        if (index < length) {
+                            // Save the start of the next frame for the next transfer.
+                            std::copy(transfer + index, transfer + length, usbBuffer);
+                            usbBufferIndex = length - index;
+                        }
                     }
-                    usbBufferIndex = 0;
                 } else {
-                    usbBufferIndex = 0;
-                    // Otherwise, check each USB data block for the correct header bytes before
-                    // writing.
-                    while (usbBufferIndex <= bytesInBuffer - use_frame_size - USBHeaderSizeInBytes
-                    ) {
-                        if (RHXDataBlock::checkUsbHeader(usbBuffer, usbBufferIndex, type) &&
-                            RHXDataBlock::checkUsbHeader(
-                                usbBuffer, usbBufferIndex + use_frame_size, type
-                            )) {
-                            const auto frame = usbBuffer + usbBufferIndex;
-                            if (is_xdaq && (type == ControllerRecordUSB3)) {
-                                const auto dio_off = xdaq_frame_size - 8;
-                                const auto io_off = dio_off - 16;
-                                const auto pad_off = io_off - ((streams + 2) % 4) * 2;
-                                if (!usbFifo->writeToBuffer(
-                                        frame + 0, (pad_off - 0 + (streams % 4) * 2) / BytesPerWord
-                                    )) {
-                                    cerr << "USBDataThread: USB FIFO overrun (2)." << '\n';
-                                }
-                                frame[dio_off + 2] = frame[dio_off + 4];
-                                frame[dio_off + 3] = frame[dio_off + 5];
-                                if (!usbFifo->writeToBuffer(
-                                        frame + io_off, (16 + 4) / BytesPerWord
-                                    )) {
-                                    cerr << "USBDataThread: USB FIFO overrun (2)." << '\n';
-                                }
-                                usbBufferIndex += xdaq_frame_size;
-                            } else if (is_xdaq && (type == ControllerStimRecord)) {
-                                const auto dio_off = xdaq_frame_size - 8;
-                                const auto io_off = dio_off - 16 - 16;
-                                const auto pad_off = io_off - 4;
-                                // write magic ~ amplifiers to buffer
-                                if (!usbFifo->writeToBuffer(
-                                        frame + 0, (pad_off - 0) / BytesPerWord
-                                    )) {
-                                    cerr << "USBDataThread: USB FIFO overrun (2)." << '\n';
-                                }
-                                // move 32 DIO as 16 DIO
-                                frame[dio_off + 2] = frame[dio_off + 4];
-                                frame[dio_off + 3] = frame[dio_off + 5];
-                                // skip 4 bytes padding, write AIO / 16 DIO to buffer
-                                if (!usbFifo->writeToBuffer(
-                                        frame + io_off, (16 + 16 + 4) / BytesPerWord
-                                    )) {
-                                    cerr << "USBDataThread: USB FIFO overrun (2)." << '\n';
-                                }
-                                usbBufferIndex += xdaq_frame_size;
+                    int index = 0;
+                    bool transferConsumed = false;
+                    if (usbBufferIndex > 0) {
+                        // Join just enough of the new transfer to the bytes left over from the
+                        // previous one to scan every frame that starts in those leftover bytes.
+                        const int carried = usbBufferIndex;
+                        const int joined = std::min(length, frameBytes + USBHeaderSizeInBytes);
+                        if (carried + joined > bufferSize) {
+                            cerr << "USBDataThread: USB buffer overrun (3)." << '\n';
+                            usbBufferIndex = 0;
+                        } else {
+                            std::copy(transfer, transfer + joined, usbBuffer + carried);
+                            const int carryIndex =
+                                scanFrames(usbBuffer, 0, carried, carried + joined);
+                            if (carryIndex < carried) {
+                                // Not enough data to complete a frame yet; keep it all for the
+                                // next transfer.
+                                std::memmove(
+                                    usbBuffer, usbBuffer + carryIndex, carried + joined - carryIndex
+                                );
+                                usbBufferIndex = carried + joined - carryIndex;
+                                transferConsumed = true;
                             } else {
-                                if (!usbFifo->writeToBuffer(
-                                        frame, intan_frame_size / BytesPerWord
-                                    )) {
-                                    cerr << "USBDataThread: USB FIFO overrun (2)." << '\n';
-                                }
-                                usbBufferIndex += intan_frame_size;
+                                index = carryIndex - carried;
                             }
-                        } else {
-                            // If headers are not found, advance word by word until we
-                            // find them
-                            usbBufferIndex += 2;
                         }
                     }
-                    // If any data remains in usbBuffer, shift it to the front.
-                    if (usbBufferIndex > 0) {
-                        int j = 0;
-                        for (int i = usbBufferIndex; i < bytesInBuffer; ++i) {
-                            usbBuffer[j++] = usbBuffer[i];
+                    if (!transferConsumed) {
+                        index = scanFrames(transfer, index, length, length);
+                        // If any data remains in the transfer, save it for the next one.
+                        usbBufferIndex = length - index;
+                        if (usbBufferIndex > bufferSize) {
+                            cerr << "USBDataThread: USB buffer overrun (3)." << '\n';
+                            usbBufferIndex = 0;
+                        } else {
+                            std::copy(transfer + index, transfer + length, usbBuffer);
                         }
-                        usbBufferIndex = j;
-                    } else {
-                        // If usbBufferIndex == 0, we didn't have enough data to work
-                        // with; append more.
-                        usbBufferIndex = bytesInBuffer;
-                    }
-                    if (usbBufferIndex + numBytesRead >= bufferSize) {
-                        cerr << "USBDataThread: USB buffer overrun (3)." << '\n';
                     }
                 }
 
@@ -255,6 +343,11 @@ void USBDataThread::run()
             controller->flush();  // Flush USB FIFO on Opal Kelly board.
             usbBufferIndex = 0;
 
+            if (numResyncs > 0) {
+                cerr << "USBDataThread: " << numResyncs << " USB header resynchronizations, "
+                     << numBytesDiscarded << " bytes discarded." << '\n';
+            }
+
             running = false;
         } else {
             usleep(100);
@@ -33,6 +33,7 @@
 
 #include <QObject>
 #include <QThread>
+#include <atomic>
 #include "rhxdatablock.h"
 #include "abstractrhxcontroller.h"
 #include "datastreamfifo.h"
@@ -58,6 +59,10 @@ public:
 
     bool memoryWasAllocated(double& memoryRequestedGB) const { memoryRequestedGB += memoryNeededGB; return memoryAllocated; }
 
+    // USB header resynchronization statistics for the current (or most recent) run
+    uint64_t resyncCount() const { return numResyncs; }
+    uint64_t bytesDiscardedCount() const { return numBytesDiscarded; }
+
 signals:
     void hardwareFifoReport(double percentFull);
 
@@ -73,6 +78,9 @@ private:
     int bufferSize;
     int usbBufferIndex;
 
+    std::atomic<uint64_t> numResyncs;
+    std::atomic<uint64_t> numBytesDiscarded;
+
     bool memoryAllocated;
     double memoryNeededGB;
 };
@@ -29,7 +29,10 @@
 //------------------------------------------------------------------------------
 
 #include <QElapsedTimer>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include "lfpdecimator.h"
 #include "rhxdatablock.h"
 #include "softwarereferenceprocessor.h"
 #include "rhxdatareader.h"
@@ -48,6 +51,8 @@ WaveformProcessorThread::WaveformProcessorThread(SystemState* state_, int numDat
     waveformFifo(waveformFifo_),
     numDataStreams(numDataStreams_),
     xpuController(xpuController_),
+    digitalInWordWaveform(nullptr),
+    digitalOutWordWaveform(nullptr),
     keepGoing(false),
     running(false),
     stopThread(false)
@@ -57,17 +62,12 @@ WaveformProcessorThread::WaveformProcessorThread(SystemState* state_, int numDat
 
 void WaveformProcessorThread::run()
 {
-    const int NumBlocks = 1;  // Note: GPU spike extraction works on single data blocks only; this value must be 1 if spikes are read.
-    const int NumSamples = NumBlocks * RHXDataBlock::samplesPerDataBlock(type);
     uint16_t* usbData = nullptr;
     bool firstTime = true;
     bool softwareRefInfoUpdated = false;
-    SoftwareReferenceProcessor swRefProcessor(type, numDataStreams, NumSamples, state);
     QElapsedTimer loopTimer, workTimer, reportTimer;
 
     while (!stopThread) {
-        int numUsbWords = RHXDataBlock::dataBlockSizeInWords(type, numDataStreams);
-
         fill(cpuLoadHistory.begin(), cpuLoadHistory.end(), 0.0);
 
         if (keepGoing) {
@@ -75,16 +75,52 @@ void WaveformProcessorThread::run()
             firstTime = true;
             softwareRefInfoUpdated = false;
 
+            // Process several data blocks per iteration if a higher processing latency is selected.  Playback always
+            // uses single blocks so the end of a data file is never held back waiting for a full batch.
+            int numBlocks = state->playback->getValue() ? 1 : (int) state->processingLatency->getNumericValue();
+            numBlocks = max(1, min(numBlocks, MaxNumBlocksToProcess));
+            const int numSamples = numBlocks * RHXDataBlock::samplesPerDataBlock(type);
+            const int numUsbWords = numBlocks * RHXDataBlock::dataBlockSizeInWords(type, numDataStreams);
+            SoftwareReferenceProcessor swRefProcessor(type, numDataStreams, numSamples, state);
+            LfpDecimator lfpDecimator(numDataStreams * RHXDataBlock::channelsPerStream(type), sampleRate,
+                                      waveformFifo->lfpDownsampleFactor(), state);
+            bool lfpWritten = false;
+
+            // Channels cannot be added or removed while running, so waveform locations are resolved once per run.
+            buildChannelPlan();
+            int64_t processingTimeNsec = 0;
+            int64_t numBlocksProcessed = 0;
+
             loopTimer.start();
             workTimer.start();
             reportTimer.start();
 
             xpuController->resetPrev();
 
+            // Once data processing fails the run is stopped, and the filter outputs are left unwritten until it ends.
+            bool processingFailed = false;
+
+            bool rawFramesMatch = waveformFifo->rawFrameWords() * numSamples == numUsbWords;
+            if (waveformFifo->rawFrameWords() > 0 && !rawFramesMatch) {
+                QString message = tr("Raw frame recording stopped: the waveform FIFO was set up for frames of ") +
+                        QString::number(waveformFifo->rawFrameWords()) + tr(" words, but the controller is sending frames of ") +
+                        QString::number(numUsbWords / numSamples) + tr(" words.");
+                cerr << "WaveformProcessorThread: " << message.toStdString() << '\n';
+                emit error(message);
+                emit sendSetCommand("RunMode", "Stop");
+            }
+
             // Determine how many microseconds of data one block represents.
 //            float oneBlockus = (numSamples / sampleRate) * 1e6;
 
-            while (keepGoing && !stopThread) {
+            // Once acquisition stops, any blocks left in the USB FIFO that do not fill a whole batch are processed as
+            // one final, shorter batch.  Software referencing works sample by sample, so that batch is referenced one
+            // block at a time by a single-block processor.
+            const int samplesPerBlock = RHXDataBlock::samplesPerDataBlock(type);
+            const int usbWordsPerBlock = RHXDataBlock::dataBlockSizeInWords(type, numDataStreams);
+            unique_ptr<SoftwareReferenceProcessor> finalBatchSwRefProcessor;
+
+            while (!stopThread) {
                 // workTimer.restart();
 
                 if (!softwareRefInfoUpdated) {
@@ -93,21 +129,51 @@ void WaveformProcessorThread::run()
                     softwareRefInfoUpdated = true;
                 }
 
-                usbData = usbFifo->pointerToData(numUsbWords);  // Get pointer to new USB data, if available.
+                int batchBlocks = numBlocks;
+                if (!keepGoing) {
+                    batchBlocks = min(numBlocks, usbFifo->wordsAvailable() / usbWordsPerBlock);
+                    if (batchBlocks == 0) break;
+                }
+                const int batchSamples = batchBlocks * samplesPerBlock;
+                const int batchUsbWords = batchBlocks * usbWordsPerBlock;
+
+                usbData = usbFifo->pointerToData(batchUsbWords);  // Get pointer to new USB data, if available.
                 if (usbData) {
                     if (state->getReportSpikes()) {
                         state->advanceSpikeTimer();
                     }
                     workTimer.restart();
 
-                    // Perform any software referencing prior to filtering.
-                    swRefProcessor.applySoftwareReferences(usbData);
-
                     // Check for space to write the waveform data.
-                    while (!waveformFifo->requestWriteSpace(NumBlocks)) {
+                    while (!waveformFifo->requestWriteSpace(batchBlocks)) {
                         usleep(100);
                     }
 
+                    // Raw frame recordings save the frames as read from the controller, before software referencing.
+                    // Frames of the wrong size are never saved; the run has already been stopped (see above), and
+                    // zeros (which playback rejects) are stored in their place until it ends.
+                    uint16_t* rawFrames = waveformFifo->pointerToRawFrameWriteSpace();
+                    if (rawFrames) {
+                        if (rawFramesMatch) {
+                            std::memcpy(rawFrames, usbData, sizeof(uint16_t) * batchUsbWords);
+                        } else {
+                            std::memset(rawFrames, 0, sizeof(uint16_t) * (size_t) waveformFifo->rawFrameWords() * batchSamples);
+                        }
+                    }
+
+                    // Perform any software referencing prior to filtering.
+                    if (batchBlocks == numBlocks) {
+                        swRefProcessor.applySoftwareReferences(usbData);
+                    } else {
+                        if (!finalBatchSwRefProcessor) {
+                            finalBatchSwRefProcessor.reset(new SoftwareReferenceProcessor(type, numDataStreams, samplesPerBlock, state));
+                            finalBatchSwRefProcessor->updateReferenceInfo(signalSources);
+                        }
+                        for (int block = 0; block < batchBlocks; ++block) {
+                            finalBatchSwRefProcessor->applySoftwareReferences(usbData + block * usbWordsPerBlock);
+                        }
+                    }
+
                     // Get wide, low, and high pointers from WaveformFifo.
                     uint16_t* wide = waveformFifo->pointerToGpuWidebandWriteSpace();
                     uint16_t* low = waveformFifo->pointerToGpuLowpassWriteSpace();
@@ -116,12 +182,28 @@ void WaveformProcessorThread::run()
                     uint32_t* spike = waveformFifo->pointerToGpuSpikeTimestampsWriteSpace();
                     uint8_t* spikeID = waveformFifo->pointerToGpuSpikeIdsWriteSpace();
 
-                    // Process one data block through GPU, and write the results to WaveformFifo.
+                    // Process data blocks through GPU, and write the results to WaveformFifo.
 //                    auto start = chrono::steady_clock::now();
 
-                    xpuController->processDataBlock(usbData, low, wide, high, spike, spikeID);
+                    if (!processingFailed && !xpuController->processDataBlocks(usbData, low, wide, high, spike, spikeID, batchBlocks)) {
+                        QString message = tr("Data processing stopped: ") + xpuController->processingErrorMessage();
+                        cerr << "WaveformProcessorThread: " << message.toStdString() << '\n';
+                        emit error(message);
+                        emit sendSetCommand("RunMode", "Stop");
+                        processingFailed = true;
+                    }
 //                    auto end = chrono::steady_clock::now();
 
+                    // Decimate the LFP band from the wideband output, if it is being stored.  If it was not stored for
+                    // the previous blocks, the filters restart from silence.
+                    uint16_t* lfp = waveformFifo->pointerToLfpWriteSpace();
+                    if (lfp) {
+                        if (!lfpWritten) lfpDecimator.reset();
+                        lfpDecimator.updateFilters();
+                        lfpDecimator.process(wide, lfp, batchSamples);
+                    }
+                    lfpWritten = lfp != nullptr;
+
                     // Determine how long this processing took, and report if it's approaching real-time.
 //                    float elapsedus = (float) chrono::duration_cast<chrono::microseconds>(end - start).count();
 //                    float gpuAccel = oneBlockus / elapsedus;
@@ -129,83 +211,65 @@ void WaveformProcessorThread::run()
 //                        qDebug() << "Warning: GPU process time approaching real-time. Real-time data block length: " << oneBlockus << " us. Processing time: " << elapsedus << " us. GPU is " << gpuAccel << "x faster";
 
                     // Read and process waveform data from USB buffer, and write data to waveform FIFO.
-                    RHXDataReader dataReader(type, numDataStreams, usbData, NumSamples);
-
-                    float* analogWaveform = nullptr;
-                    uint16_t* digitalWaveform = nullptr;
-
-                    int lastTimestamp = dataReader.readTimeStampData(waveformFifo->pointerToTimeStampWriteSpace());
-                    state->setLastTimestamp(lastTimestamp);
+                    RHXDataReader dataReader(type, numDataStreams, usbData, batchSamples);
+
+                    // Waveforms sampled at the full rate are extracted together in one pass over the USB data; the
+                    // sub-sampled aux input and supply voltage waveforms are read individually.
+                    uint32_t* timeStamps = waveformFifo->pointerToTimeStampWriteSpace();
+                    deinterleaveTargets.clear();
+                    deinterleaveTargets.push_back({ DeinterleaveTimeStamp, 0, 0, nullptr, nullptr, timeStamps });
+                    deinterleaveTargets.push_back({ DeinterleaveDigInWord, 0, 0, nullptr,
+                                                    waveformFifo->pointerToDigitalWriteSpace(digitalInWordWaveform), nullptr });
+                    deinterleaveTargets.push_back({ DeinterleaveDigOutWord, 0, 0, nullptr,
+                                                    waveformFifo->pointerToDigitalWriteSpace(digitalOutWordWaveform), nullptr });
 
                     QString spikingChannelNames("");
 
-                    for (int group = 0; group < signalSources->numGroups(); group++) {
-                        SignalGroup* signalGroup = signalSources->groupByIndex(group);
-                        for (int signal = 0; signal < signalGroup->numChannels(); signal++) {
-                            Channel* channel = signalGroup->channelByIndex(signal);
-                            string waveName = channel->getNativeNameString();
-                            if (channel->getSignalType() == AmplifierSignal) {
-                                GpuWaveformAddress gpuWaveformAddress = waveformFifo->getGpuWaveformAddress(waveName + "|SPK");
-                                digitalWaveform = waveformFifo->getDigitalWaveformPointer(waveName + "|SPK");
-                                // Note: GPU spike extraction only works on single data blocks.
-                                bool spikeFound = waveformFifo->extractGpuSpikeDataOneDataBlock(digitalWaveform, gpuWaveformAddress, firstTime);
-
+                    for (const ChannelPlanEntry& entry : channelPlan) {
+                        switch (entry.signalType) {
+                        case AmplifierSignal:
+                            if (waveformFifo->extractGpuSpikeData(entry.spikeWaveform, entry.spikeGpuWaveformAddress, batchBlocks, firstTime)) {
                                 if (state->getReportSpikes()) {
-                                    if (spikeFound) {
-                                        spikingChannelNames.append(QString::fromStdString(waveName) + ",");
-                                        //state->spikeReport(QString::fromStdString(waveName));
-                                    }
-                                    // Find if a spike happened on this channel. If so, get its name
-                                    // If there's a name, send the spikeReport() signal.
-                                    // This signal should be ultimately received by ProbeMapWindow, which will then internally handle the time decay
-                                }
-
-                                if (signalSources->getControllerType() == ControllerStimRecord) {
-                                    // Load DC amplifier data and stimulation markers.
-                                    analogWaveform = waveformFifo->getAnalogWaveformPointer(waveName + "|DC");
-                                    dataReader.readDcAmplifierData(waveformFifo->pointerToAnalogWriteSpace(analogWaveform),
-                                                                   channel->getBoardStream(), channel->getChipChannel());
-                                    digitalWaveform = waveformFifo->getDigitalWaveformPointer(waveName + "|STIM");
-                                    dataReader.readStimParamData(waveformFifo->pointerToDigitalWriteSpace(digitalWaveform),
-                                                              channel->getBoardStream(), channel->getChipChannel());
+                                    // This report is ultimately received by ProbeMapWindow, which internally handles the time decay.
+                                    spikingChannelNames.append(entry.name + ",");
                                 }
-                            } else if (channel->getSignalType() == AuxInputSignal) {
-                                analogWaveform = waveformFifo->getAnalogWaveformPointer(waveName);
-                                dataReader.readAuxInData(waveformFifo->pointerToAnalogWriteSpace(analogWaveform),
-                                                         channel->getBoardStream(), channel->getChipChannel());
-                            } else if (channel->getSignalType() == SupplyVoltageSignal) {
-                                analogWaveform = waveformFifo->getAnalogWaveformPointer(waveName);
-                                dataReader.readSupplyVoltageData(waveformFifo->pointerToAnalogWriteSpace(analogWaveform),
-                                                                 channel->getBoardStream());
-                            } else if (channel->getSignalType() == BoardAdcSignal) {
-                                analogWaveform = waveformFifo->getAnalogWaveformPointer(waveName);
-                                dataReader.readBoardAdcData(waveformFifo->pointerToAnalogWriteSpace(analogWaveform),
-                                                            channel->getNativeChannelNumber());
-                            } else if (channel->getSignalType() == BoardDacSignal) {
-                                analogWaveform = waveformFifo->getAnalogWaveformPointer(waveName);
-                                dataReader.readBoardDacData(waveformFifo->pointerToAnalogWriteSpace(analogWaveform),
-                                                            channel->getNativeChannelNumber());
-                            } else if (channel->getSignalType() == BoardDigitalInSignal) {
-                                analogWaveform = waveformFifo->getAnalogWaveformPointer(waveName);
-                                dataReader.readDigInData(waveformFifo->pointerToAnalogWriteSpace(analogWaveform),
-                                                         channel->getNativeChannelNumber());
-                            } else if (channel->getSignalType() == BoardDigitalOutSignal) {
-                                analogWaveform = waveformFifo->getAnalogWaveformPointer(waveName);
-                                dataReader.readDigOutData(waveformFifo->pointerToAnalogWriteSpace(analogWaveform),
-                                                         channel->getNativeChannelNumber());
                             }
+                            if (type == ControllerStimRecord) {
+                                // Load DC amplifier data and stimulation markers.
+                                deinterleaveTargets.push_back({ DeinterleaveDcAmplifier, entry.stream, entry.channel,
+                                                                waveformFifo->pointerToAnalogWriteSpace(entry.analogWaveform), nullptr, nullptr });
+                                deinterleaveTargets.push_back({ DeinterleaveStimParams, entry.stream, entry.channel,
+                                                                nullptr, waveformFifo->pointerToDigitalWriteSpace(entry.stimWaveform), nullptr });
+                            }
+                            break;
+                        case AuxInputSignal:
+                            dataReader.readAuxInData(waveformFifo->pointerToAnalogWriteSpace(entry.analogWaveform),
+                                                     entry.stream, entry.channel);
+                            break;
+                        case SupplyVoltageSignal:
+                            dataReader.readSupplyVoltageData(waveformFifo->pointerToAnalogWriteSpace(entry.analogWaveform),
+                                                             entry.stream);
+                            break;
+                        case BoardAdcSignal:
+                            deinterleaveTargets.push_back({ DeinterleaveBoardAdc, 0, entry.channel,
+                                                            waveformFifo->pointerToAnalogWriteSpace(entry.analogWaveform), nullptr, nullptr });
+                            break;
+                        case BoardDacSignal:
+                            deinterleaveTargets.push_back({ DeinterleaveBoardDac, 0, entry.channel,
+                                                            waveformFifo->pointerToAnalogWriteSpace(entry.analogWaveform), nullptr, nullptr });
+                            break;
+                        default:
+                            break;
                         }
                     }
 
+                    dataReader.deinterleave(deinterleaveTargets.data(), (int) deinterleaveTargets.size());
+                    state->setLastTimestamp(timeStamps[batchSamples - 1]);
+
                     if (state->getReportSpikes()) {
                         state->spikeReport(spikingChannelNames);
                     }
 
-                    digitalWaveform = waveformFifo->getDigitalWaveformPointer("DIGITAL-IN-WORD");
-                    dataReader.readDigInData(waveformFifo->pointerToDigitalWriteSpace(digitalWaveform));
-                    digitalWaveform = waveformFifo->getDigitalWaveformPointer("DIGITAL-OUT-WORD");
-                    dataReader.readDigOutData(waveformFifo->pointerToDigitalWriteSpace(digitalWaveform));
-
                     // Done reading and processing all waveforms.
                     waveformFifo->commitNewData();  // Commit waveform data we have just written.
                     usbFifo->freeData();  // Free raw data we just read from the USB buffer.
@@ -215,6 +279,9 @@ void WaveformProcessorThread::run()
                     double workTime = (double) workTimer.nsecsElapsed();
                     double loopTime = (double) loopTimer.nsecsElapsed();
 
+                    processingTimeNsec += (int64_t) workTime;
+                    numBlocksProcessed += batchBlocks;
+
                     if (reportTimer.elapsed() >= 50) {
                         double cpuUsage = 100.0 * workTime / loopTime;
 
@@ -238,12 +305,20 @@ void WaveformProcessorThread::run()
                     }
                     workTimer.restart();
                     loopTimer.restart();
+                } else if (keepGoing) {
+                    usbFifo->waitForData(numUsbWords);  // Sleep until the USB thread delivers a full batch of blocks.
                 } else {
-                    usleep(100);    // Wait 100 microseconds.
+                    break;
                 }
             }
             running = false;
 
+            if (numBlocksProcessed > 0) {
+                double meanBlockTimeUs = 1.0e-3 * (double) processingTimeNsec / (double) numBlocksProcessed;
+                state->writeToLog("Waveform processing: " + QString::number(meanBlockTimeUs, 'f', 1) +
+                                  " us mean per data block (" + QString::number(numBlocks) + " blocks per iteration)");
+            }
+
             fill(cpuLoadHistory.begin(), cpuLoadHistory.end(), 0.0);
             emit cpuLoadPercent(0.0);
         } else {
@@ -252,6 +327,49 @@ void WaveformProcessorThread::run()
     }
 }
 
+// Resolve the waveform FIFO locations of every channel's data, so the per-block loop in run() can write each waveform
+// without building waveform names or searching the FIFO's waveform maps.
+void WaveformProcessorThread::buildChannelPlan()
+{
+    channelPlan.clear();
+    for (int group = 0; group < signalSources->numGroups(); group++) {
+        SignalGroup* signalGroup = signalSources->groupByIndex(group);
+        for (int signal = 0; signal < signalGroup->numChannels(); signal++) {
+            Channel* channel = signalGroup->channelByIndex(signal);
+            string waveName = channel->getNativeNameString();
+            ChannelPlanEntry entry;
+            entry.signalType = channel->getSignalType();
+            entry.analogWaveform = nullptr;
+            entry.spikeWaveform = nullptr;
+            entry.stimWaveform = nullptr;
+            entry.spikeGpuWaveformAddress = { GpuWaveformSpike, 0 };
+            entry.name = QString::fromStdString(waveName);
+            if (entry.signalType == AmplifierSignal || entry.signalType == AuxInputSignal ||
+                    entry.signalType == SupplyVoltageSignal) {
+                entry.stream = channel->getBoardStream();
+                entry.channel = channel->getChipChannel();
+            } else {
+                entry.stream = 0;
+                entry.channel = channel->getNativeChannelNumber();
+            }
+            if (entry.signalType == AmplifierSignal) {
+                entry.spikeGpuWaveformAddress = waveformFifo->getGpuWaveformAddress(waveName + "|SPK");
+                entry.spikeWaveform = waveformFifo->getDigitalWaveformPointer(waveName + "|SPK");
+                if (type == ControllerStimRecord) {
+                    entry.analogWaveform = waveformFifo->getAnalogWaveformPointer(waveName + "|DC");
+                    entry.stimWaveform = waveformFifo->getDigitalWaveformPointer(waveName + "|STIM");
+                }
+            } else if (entry.signalType != BoardDigitalInSignal && entry.signalType != BoardDigitalOutSignal) {
+                // Individual digital channels are read from the digital word waveforms.
+                entry.analogWaveform = waveformFifo->getAnalogWaveformPointer(waveName);
+            }
+            channelPlan.push_back(entry);
+        }
+    }
+    digitalInWordWaveform = waveformFifo->getDigitalWaveformPointer("DIGITAL-IN-WORD");
+    digitalOutWordWaveform = waveformFifo->getDigitalWaveformPointer("DIGITAL-OUT-WORD");
+}
+
 void WaveformProcessorThread::startRunning(int numDataStreams_)
 {
     numDataStreams = numDataStreams_;
@@ -261,12 +379,14 @@ void WaveformProcessorThread::startRunning(int numDataStreams_)
 void WaveformProcessorThread::stopRunning()
 {
     keepGoing = false;
+    usbFifo->wakeReader();
 }
 
 void WaveformProcessorThread::close()
 {
     keepGoing = false;
     stopThread = true;
+    usbFifo->wakeReader();
 }
 
 bool WaveformProcessorThread::isActive() const
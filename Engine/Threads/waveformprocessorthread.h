@@ -37,6 +37,7 @@
 #include "waveformfifo.h"
 #include "systemstate.h"
 #include "xpucontroller.h"
+#include "rhxdatareader.h"
 
 using namespace std;
 
@@ -56,6 +57,8 @@ public:
 
 signals:
     void cpuLoadPercent(double percent);
+    void error(QString);
+    void sendSetCommand(QString, QString);
 
 private:
     SystemState* state;
@@ -70,6 +73,26 @@ private:
 
     XPUController* xpuController;
 
+    // Waveform FIFO locations and data source for one channel, resolved once per run so that the per-block loop
+    // needs no string building or map lookups.
+    struct ChannelPlanEntry
+    {
+        SignalType signalType;
+        int stream;                 // board stream (amplifier, aux input, supply voltage)
+        int channel;                // chip channel, or native channel number for board signals
+        float* analogWaveform;      // DC amplifier waveform for amplifier channels
+        uint16_t* spikeWaveform;
+        uint16_t* stimWaveform;
+        GpuWaveformAddress spikeGpuWaveformAddress;
+        QString name;
+    };
+    vector<ChannelPlanEntry> channelPlan;
+    uint16_t* digitalInWordWaveform;
+    uint16_t* digitalOutWordWaveform;
+    vector<DeinterleaveTarget> deinterleaveTargets;
+
+    void buildChannelPlan();
+
     volatile bool keepGoing;
     volatile bool running;
     volatile bool stopThread;
@@ -35,6 +35,7 @@
 #include <xdaq/device_manager.h>
 
 #include <QBoxLayout>
+#include <QComboBox>
 #include <QCoreApplication>
 #include <QLabel>
 #include <QObject>
@@ -60,10 +60,23 @@ PerformanceOptimizationDialog::PerformanceOptimizationDialog(SystemState* state_
     plottingModeComboBox = new QComboBox(this);
     state->plottingMode->setupComboBox(plottingModeComboBox);
 
+    processingLatencyComboBox = new QComboBox(this);
+    state->processingLatency->setupComboBox(processingLatencyComboBox);
+
+    cpuThreadsComboBox = new QComboBox(this);
+    state->cpuProcessingThreads->setupComboBox(cpuThreadsComboBox);
+
+    pinCPUThreadsCheckBox = new QCheckBox(tr("Bind CPU threads to processors"), this);
+
     QHBoxLayout *XPUSelectionRow = new QHBoxLayout;
     XPUSelectionRow->addWidget(new QLabel(tr("Selected XPU:"), this));
     XPUSelectionRow->addWidget(XPUSelectionComboBox);
 
+    QHBoxLayout *cpuThreadsRow = new QHBoxLayout;
+    cpuThreadsRow->addWidget(new QLabel(tr("CPU Threads:"), this));
+    cpuThreadsRow->addWidget(cpuThreadsComboBox);
+    cpuThreadsRow->addWidget(pinCPUThreadsCheckBox);
+
     QHBoxLayout *writeLatencySelectionRow = new QHBoxLayout;
     writeLatencySelectionRow->addWidget(new QLabel(tr("Write Latency:"), this));
     writeLatencySelectionRow->addWidget(writeLatencyComboBox);
@@ -72,12 +85,28 @@ PerformanceOptimizationDialog::PerformanceOptimizationDialog(SystemState* state_
     plottingModeRow->addWidget(new QLabel(tr("Plotting Mode:"), this));
     plottingModeRow->addWidget(plottingModeComboBox);
 
+    QHBoxLayout *processingLatencyRow = new QHBoxLayout;
+    processingLatencyRow->addWidget(new QLabel(tr("Processing Latency:"), this));
+    processingLatencyRow->addWidget(processingLatencyComboBox);
+
     QVBoxLayout *XPUGroupBoxLayout = new QVBoxLayout;
     XPUGroupBoxLayout->addWidget(new QLabel(tr(         "This software can use any connected XPU (CPU or GPU) to accelerate filtering\n"
                                                         "and spike detection. Upon startup, a diganostic is run and the fastest XPU is\n"
                                                         "detected to be used by default. However, the user can override this choice by\n"
                                                         "selecting the XPU to use manually."), this));
     XPUGroupBoxLayout->addLayout(XPUSelectionRow);
+    XPUGroupBoxLayout->addWidget(new QLabel(tr(         "When the CPU is used, channels are divided among several threads. Auto uses\n"
+                                                        "one thread per physical core. Binding each thread to its own processor can\n"
+                                                        "give more consistent timing on dedicated acquisition computers."), this));
+    XPUGroupBoxLayout->addLayout(cpuThreadsRow);
+
+    QVBoxLayout *processingLatencyGroupBoxLayout = new QVBoxLayout;
+    processingLatencyGroupBoxLayout->addWidget(new QLabel(tr("Incoming data is normally filtered one 128-sample data block at a time. Higher\n"
+                                                             "processing latencies filter several data blocks together, which reduces the\n"
+                                                             "per-block overhead of filtering and spike detection and lowers CPU load when\n"
+                                                             "many channels are acquired. This comes at the cost of a longer delay before\n"
+                                                             "new data is displayed, saved, or streamed."), this));
+    processingLatencyGroupBoxLayout->addLayout(processingLatencyRow);
 
     QVBoxLayout *writeLatencyGroupBoxLayout = new QVBoxLayout;
     writeLatencyGroupBoxLayout->addWidget(new QLabel(tr("By reducing the write-to-disk latency, it is possible to eliminate some of the\n"
@@ -98,6 +127,9 @@ PerformanceOptimizationDialog::PerformanceOptimizationDialog(SystemState* state_
     QGroupBox *XPUGroupBox = new QGroupBox(tr("XPU"), this);
     XPUGroupBox->setLayout(XPUGroupBoxLayout);
 
+    QGroupBox *processingLatencyGroupBox = new QGroupBox(tr("Processing Latency"), this);
+    processingLatencyGroupBox->setLayout(processingLatencyGroupBoxLayout);
+
     QGroupBox *writeLatencyGroupBox = new QGroupBox(tr("Write to Disk Latency"), this);
     writeLatencyGroupBox->setLayout(writeLatencyGroupBoxLayout);
 
@@ -111,6 +143,7 @@ PerformanceOptimizationDialog::PerformanceOptimizationDialog(SystemState* state_
 
     QVBoxLayout *mainLayout = new QVBoxLayout;
     mainLayout->addWidget(XPUGroupBox);
+    mainLayout->addWidget(processingLatencyGroupBox);
     mainLayout->addWidget(writeLatencyGroupBox);
     mainLayout->addWidget(plottingModeGroupBox);
     mainLayout->addWidget(buttonBox);
@@ -129,6 +162,13 @@ void PerformanceOptimizationDialog::initialize()
     else
         qDebug() << "Error: Invalid usedXPUIndex value";
 
+    // Find the current processing latency and make the selected entry in its combo box.
+    processingLatencyComboBox->setCurrentIndex(state->processingLatency->getIndex());
+
+    // Find the current CPU threading settings.
+    cpuThreadsComboBox->setCurrentIndex(state->cpuProcessingThreads->getIndex());
+    pinCPUThreadsCheckBox->setChecked(state->pinCPUProcessingThreads->getValue());
+
     // Find the current write-to-disk latency and make the selected entry in its combo box.
     writeLatencyComboBox->setCurrentIndex(state->writeToDiskLatency->getIndex());
 
@@ -137,6 +177,9 @@ void PerformanceOptimizationDialog::initialize()
 
     if (state->testMode->getValue()) {
         writeLatencyComboBox->setEnabled(false);
+        processingLatencyComboBox->setEnabled(false);
+        cpuThreadsComboBox->setEnabled(false);
+        pinCPUThreadsCheckBox->setEnabled(false);
         plottingModeComboBox->setEnabled(false);
     }
 }
@@ -40,6 +40,7 @@
 class QGroupBox;
 class QLabel;
 class QComboBox;
+class QCheckBox;
 class QDialogButtonBox;
 
 class PerformanceOptimizationDialog : public QDialog
@@ -51,6 +52,9 @@ public:
     QComboBox *XPUSelectionComboBox;
     QComboBox *writeLatencyComboBox;
     QComboBox *plottingModeComboBox;
+    QComboBox *processingLatencyComboBox;
+    QComboBox *cpuThreadsComboBox;
+    QCheckBox *pinCPUThreadsCheckBox;
 
 signals:
     void usedXPUIndexChanged(int index);
@@ -43,14 +43,17 @@ SetFileFormatDialog::SetFileFormatDialog(SystemState *state_, QWidget *parent) :
     fileFormatIntanButton = new QRadioButton(tr("Traditional Intan File Format"), this);
     fileFormatNeuroScopeButton = new QRadioButton(tr("\"One File Per Signal Type\" Format"), this);
     fileFormatOpenEphysButton = new QRadioButton(tr("\"One File Per Channel\" Format"), this);
+    fileFormatRawFramesButton = new QRadioButton(tr("Raw USB Frame Format"), this);
 
     buttonGroup = new QButtonGroup(this);
     buttonGroup->addButton(fileFormatIntanButton);
     buttonGroup->addButton(fileFormatNeuroScopeButton);
     buttonGroup->addButton(fileFormatOpenEphysButton);
+    buttonGroup->addButton(fileFormatRawFramesButton);
     buttonGroup->setId(fileFormatIntanButton, (int) FileFormatIntan);
     buttonGroup->setId(fileFormatNeuroScopeButton, (int) FileFormatFilePerSignalType);
     buttonGroup->setId(fileFormatOpenEphysButton, (int) FileFormatFilePerChannel);
+    buttonGroup->setId(fileFormatRawFramesButton, (int) FileFormatRawFrames);
 
     recordTimeSpinBox = new QSpinBox(this);
     state->newSaveFilePeriodMinutes->setupSpinBox(recordTimeSpinBox);
@@ -135,6 +138,12 @@ SetFileFormatDialog::SetFileFormatDialog(SystemState *state_, QWidget *parent) :
                                    "file containing a timestamp\nvector, and an info.") + fileSuffix + tr(" file containing "
                                    "records of sampling rate, amplifier\nbandwidth, channel names, etc."), this);
 
+    QLabel *rawFramesDescription = new QLabel(tr("This option creates a subdirectory and saves the data frames read from "
+                                   "the\ncontroller, before software referencing or filtering, in a rawframes.dat file,\n"
+                                   "along with an info.") + fileSuffix +
+                                   tr(" file.  This format places the\nlowest load on the computer during recording.  "
+                                   "These recordings may be played back\nand recorded again in any of the formats above."), this);
+
     QVBoxLayout *traditionalBoxLayout = new QVBoxLayout;
     traditionalBoxLayout->addWidget(fileFormatIntanButton);
     traditionalBoxLayout->addWidget(traditionalFormatDescription);
@@ -153,12 +162,18 @@ SetFileFormatDialog::SetFileFormatDialog(SystemState *state_, QWidget *parent) :
     oneFilePerChannelBoxLayout->addWidget(fileFormatOpenEphysButton);
     oneFilePerChannelBoxLayout->addWidget(oneFilePerChannelDescription);
 
+    QVBoxLayout *rawFramesBoxLayout = new QVBoxLayout;
+    rawFramesBoxLayout->addWidget(fileFormatRawFramesButton);
+    rawFramesBoxLayout->addWidget(rawFramesDescription);
+
     QGroupBox *traditionalBox = new QGroupBox();
     traditionalBox->setLayout(traditionalBoxLayout);
     QGroupBox *oneFilePerSignalTypeBox = new QGroupBox();
     oneFilePerSignalTypeBox->setLayout(oneFilePerSignalTypeBoxLayout);
     QGroupBox *oneFilePerChannelBox = new QGroupBox();
     oneFilePerChannelBox->setLayout(oneFilePerChannelBoxLayout);
+    QGroupBox *rawFramesBox = new QGroupBox();
+    rawFramesBox->setLayout(rawFramesBoxLayout);
 
     QHBoxLayout *lowpassSaveLayout = new QHBoxLayout;
     lowpassSaveLayout->addWidget(saveLowpassAmplifierWaveformsCheckBox);
@@ -187,6 +202,7 @@ SetFileFormatDialog::SetFileFormatDialog(SystemState *state_, QWidget *parent) :
     mainLayout->addWidget(traditionalBox);
     mainLayout->addWidget(oneFilePerSignalTypeBox);
     mainLayout->addWidget(oneFilePerChannelBox);
+    mainLayout->addWidget(rawFramesBox);
     mainLayout->addWidget(createNewDirectoryCheckBox);
     mainLayout->addWidget(saveWidebandAmplifierWaveformsCheckBox);
     mainLayout->addLayout(lowpassSaveLayout);
@@ -227,6 +243,8 @@ void SetFileFormatDialog::updateFromState()
         fileFormatNeuroScopeButton->setChecked(true);
     } else if (state->getFileFormatEnum() == FileFormatFilePerChannel) {
         fileFormatOpenEphysButton->setChecked(true);
+    } else if (state->getFileFormatEnum() == FileFormatRawFrames) {
+        fileFormatRawFramesButton->setChecked(true);
     }
 
     if (state->getControllerTypeEnum() != ControllerStimRecord) {
@@ -367,8 +385,9 @@ void SetFileFormatDialog::updateOldFileFormat()
         saveAuxInWithAmpCheckBox->setEnabled(buttonGroup->checkedButton() == fileFormatNeuroScopeButton);
     }
 
-    // Traditional Intan format does not support saving lowpass, highpass, or spike data.
-    bool oldFileFormat = (buttonGroup->checkedButton() == fileFormatIntanButton);
+    // Traditional Intan and raw frame formats do not support saving lowpass, highpass, or spike data.
+    bool oldFileFormat = (buttonGroup->checkedButton() == fileFormatIntanButton ||
+                          buttonGroup->checkedButton() == fileFormatRawFramesButton);
 
     saveWidebandAmplifierWaveformsCheckBox->setEnabled(!oldFileFormat);
     saveLowpassAmplifierWaveformsCheckBox->setEnabled(!oldFileFormat);
@@ -93,6 +93,7 @@ private:
     QRadioButton *fileFormatIntanButton;
     QRadioButton *fileFormatNeuroScopeButton;
     QRadioButton *fileFormatOpenEphysButton;
+    QRadioButton *fileFormatRawFramesButton;
     QDialogButtonBox *buttonBox;
 
     QLabel *downsampleLabel;
@@ -30,10 +30,12 @@
 
 #include "controlpanelKONTEXtab.h"
 
+#include <QComboBox>
 #include <QGroupBox>
 #include <QHBoxLayout>
 #include <QPushButton>
 #include <QRadioButton>
+#include <QSpinBox>
 #include <QVBoxLayout>
 #include <iostream>
 #include <vector>
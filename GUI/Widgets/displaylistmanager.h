@@ -36,8 +36,6 @@
 
 using namespace std;
 
-const int MaxNumWaveformsInGroup = 4;
-
 struct WaveIndex {
     int index;
     bool inPinned;
@@ -295,6 +295,30 @@ void MultiColumnDisplay::setColumnVisible(int column, bool visible)
     state->forceUpdate();
 }
 
+void MultiColumnDisplay::saveColumnStates(vector<DisplayColumnState>& columns) const
+{
+    columns.resize(numColumns());
+    for (int i = 0; i < numColumns(); ++i) {
+        columns[i].pinnedWaveNames = getPinnedWaveNames(i);
+        columns[i].showPinned = arePinnedShown(i);
+        columns[i].columnVisible = isColumnVisible(i);
+        columns[i].visiblePortName = getSelectedPort(i);
+        columns[i].scrollBarState = getScrollBarState(i);
+    }
+}
+
+void MultiColumnDisplay::restoreColumnStates(const vector<DisplayColumnState>& columns)
+{
+    if ((int) columns.size() != numColumns()) return;
+    for (int i = 0; i < (int) columns.size(); ++i) {
+        setPinnedWaveforms(i, columns[i].pinnedWaveNames);
+        setShowPinned(i, columns[i].showPinned);
+        setColumnVisible(i, columns[i].columnVisible);
+        setSelectedPort(i, columns[i].visiblePortName);
+        restoreScrollBarState(i, columns[i].scrollBarState);
+    }
+}
+
 void MultiColumnDisplay::updatePortSelectionBoxes(bool switchToFirstPort)
 {
     for (int i = 0; i < numColumns(); ++i) {
@@ -35,7 +35,7 @@
 #include "waveformdisplaymanager.h"
 #include "waveformdisplaycolumn.h"
 
-class MultiColumnDisplay : public QWidget
+class MultiColumnDisplay : public QWidget, public AbstractDisplayColumns
 {
     Q_OBJECT
 public:
@@ -95,6 +95,9 @@ public:
     inline ScrollBarState getScrollBarState(int column) const { return displayColumns[column]->getScrollBarState(); }
     inline void restoreScrollBarState(int column, const ScrollBarState& state) { displayColumns[column]->restoreScrollBarState(state); }
 
+    void saveColumnStates(vector<DisplayColumnState>& columns) const override;
+    void restoreColumnStates(const vector<DisplayColumnState>& columns) override;
+
     void updatePortSelectionBoxes(bool switchToFirstPort = false);
 
     QString getDisplaySettingsString() const;
@@ -1425,7 +1425,9 @@ void MultiWaveformPlot::drawWaveformLabel(QPainter &painter, const QString& name
         bool darkText = textColor == Qt::black;
         int xOffset = 0;
         if (channel->isEnabled()) {
-            bool oldSaveFile = (state->fileFormat->getValue().toLower() == "traditional");  // Old .rhd/.rhs file format does not support LOW, HIGH, SPK.
+            // Old .rhd/.rhs and raw frame file formats do not support LOW, HIGH, SPK.
+            bool oldSaveFile = (state->fileFormat->getValue().toLower() == "traditional" ||
+                                state->fileFormat->getValue().toLower() == "rawframes");
             if (((state->saveWidebandAmplifierWaveforms->getValue() || oldSaveFile) && filterText == "WIDE") ||
                 (state->saveLowpassAmplifierWaveforms->getValue() && filterText == "LOW" && !oldSaveFile) ||
                 (state->saveHighpassAmplifierWaveforms->getValue() && filterText == "HIGH" && !oldSaveFile) ||
@@ -1570,6 +1572,7 @@ void MultiWaveformPlot::loadWaveformData(WaveformFifo* waveformFifo)
             waveformManager->loadNewData(waveformFifo, pinnedList.at(i).waveName);
         }
     }
+    // Filter bands that are not being stored read as zero (see ControllerInterface::updateFilterBandsInUse()).
     bool loadAllFilters = true;
     bool dcWaveformsPreset = state->getControllerTypeEnum() == ControllerStimRecord;
     for (int i = 0; i < displayList.size(); ++i) {
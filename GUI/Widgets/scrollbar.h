@@ -33,21 +33,13 @@
 
 #include <vector>
 #include <QtWidgets>
+#include "displayundomanager.h"
 #include "systemstate.h"
 
 using namespace std;
 
 class MultiWaveformPlot;
 
-struct ScrollBarState
-{
-    int range;                // Scroll bar operates from 0 to this value.
-    vector<int> topPosition;  // Current position of scroll bar on each page; always between 0 and (range - pageSize)
-    int pageSize;             // Size of one page.  Must be <= range.  Sets scroll bar size.  Increment of movement for page up/down.
-    int stepSize;             // Increment of movement from up/down button or cursor up/down
-    double zoomFactor;        // Number from 1.0 to ZoomLimit used to expand display
-};
-
 class ScrollBar
 {
 public:
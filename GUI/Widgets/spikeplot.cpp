@@ -394,12 +394,17 @@ bool SpikePlot::updateWaveforms(WaveformFifo* waveformFifo, int numSamples)
     if (offset > numWordsInMemory) {
         tStart = 0;
     }
+    // High-pass data from before that band was stored (as when the spike scope is first opened) is stale, so
+    // snippets and the RMS level below use only stored samples.
+    int storedBegin, storedEnd;
+    waveformFifo->getStoredGpuAmplifierRange(WaveformFifo::ReaderDisplay, GpuWaveformHighpass, storedBegin, storedEnd);
     bool showArtifacts = state->artifactsShown->getValue();
     int numSpikesDisplayed = (int) state->numSpikesDisplayed->getNumericValue();
     int spikeId;
     for (int t = tStart; t < numSamples - offset; ++t) {
         spikeId = (int) waveformFifo->getDigitalData(WaveformFifo::ReaderDisplay, spikeRaster, t);
-        if (spikeId != SpikeIdNoSpike && (t - samplesPreDetect >= -numWordsInMemory)) {
+        if (spikeId != SpikeIdNoSpike && (t - samplesPreDetect >= -numWordsInMemory) &&
+                t - samplesPreDetect >= storedBegin && t + samplesPostDetect <= storedEnd) {
             if (showArtifacts || spikeId != SpikeIdLikelyArtifact) {
                 vector<float> newSnippet(samplesPreDetect + samplesPostDetect);
                 int index = 0;
@@ -425,15 +430,17 @@ bool SpikePlot::updateWaveforms(WaveformFifo* waveformFifo, int numSamples)
         int numSpikes = 0;
         double sumOfSquares = 0.0;
         for (int t = -numWordsForRms; t < 0; ++t) {
-            float sample = waveformFifo->getGpuAmplifierData(WaveformFifo::ReaderDisplay, waveformAddress, t);
-            sumOfSquares += sample * sample;
+            if (t >= storedBegin && t < storedEnd) {
+                float sample = waveformFifo->getGpuAmplifierData(WaveformFifo::ReaderDisplay, waveformAddress, t);
+                sumOfSquares += sample * sample;
+                ++numSamples;
+            }
             int spikeId = waveformFifo->getDigitalData(WaveformFifo::ReaderDisplay, spikeRaster, t);
             if (spikeId != SpikeIdNoSpike && spikeId != SpikeIdLikelyArtifact) {
                 ++numSpikes;
             }
-            ++numSamples;
         }
-        latestRmsCalculation = sqrt(sumOfSquares / (double)numSamples);
+        if (numSamples > 0) latestRmsCalculation = sqrt(sumOfSquares / (double)numSamples);
         latestSpikeRateCalculation = numSpikes;
     }
 
@@ -103,6 +103,7 @@ TCPDisplay::TCPDisplay(SystemState* state_, QWidget *parent) :
     filterSelectComboBox->addItem("WIDE");
     filterSelectComboBox->addItem("LOW");
     filterSelectComboBox->addItem("HIGH");
+    filterSelectComboBox->addItem("LFP");
     filterSelectComboBox->addItem("SPK");
     if (state->getControllerTypeEnum() == ControllerStimRecord) {
         filterSelectComboBox->addItem("DC");
@@ -578,6 +579,8 @@ void TCPDisplay::addChannel(const QString& channelName)
             thisChannel->setOutputToTcpLow(true);
         } else if (filterSelectComboBox->currentText() == "HIGH") {
             thisChannel->setOutputToTcpHigh(true);
+        } else if (filterSelectComboBox->currentText() == "LFP") {
+            thisChannel->setOutputToTcpLfp(true);
         } else if (filterSelectComboBox->currentText() == "SPK") {
             thisChannel->setOutputToTcpSpike(true);
         } else if (filterSelectComboBox->currentText() == "DC") {
@@ -619,6 +622,8 @@ void TCPDisplay::removeChannel(const QString& channelName)
             signalSources->channelByName(nativeChannelName)->setOutputToTcpLow(false);
         else if (filterName == "HIGH")
             signalSources->channelByName(nativeChannelName)->setOutputToTcpHigh(false);
+        else if (filterName == "LFP")
+            signalSources->channelByName(nativeChannelName)->setOutputToTcpLfp(false);
         else if (filterName == "SPK")
             signalSources->channelByName(nativeChannelName)->setOutputToTcpSpike(false);
         else if (filterName == "DC")
@@ -708,7 +713,7 @@ void TCPDisplay::updatePresentChannelsTable()
         bool fullyOutput = false;
         if (thisChannel->getSignalType() == AmplifierSignal) {
             if (thisChannel->getOutputToTcp() && thisChannel->getOutputToTcpLow() &&
-                    thisChannel->getOutputToTcpHigh() && thisChannel->getOutputToTcpSpike()) {
+                    thisChannel->getOutputToTcpHigh() && thisChannel->getOutputToTcpLfp() && thisChannel->getOutputToTcpSpike()) {
                 if (state->getControllerTypeEnum() == ControllerStimRecord) {
                     if (thisChannel->getOutputToTcpDc() && thisChannel->getOutputToTcpStim()) {
                         fullyOutput = true;
@@ -748,6 +753,8 @@ void TCPDisplay::updateChannelsToStreamTable()
                     channelsToStreamVector.insert(channelsToStreamVector.end(), thisChannel->getNativeNameString() + "|LOW");
                 if (thisChannel->getOutputToTcpHigh())
                     channelsToStreamVector.insert(channelsToStreamVector.end(), thisChannel->getNativeNameString() + "|HIGH");
+                if (thisChannel->getOutputToTcpLfp())
+                    channelsToStreamVector.insert(channelsToStreamVector.end(), thisChannel->getNativeNameString() + "|LFP");
                 if (thisChannel->getOutputToTcpSpike())
                     channelsToStreamVector.insert(channelsToStreamVector.end(), thisChannel->getNativeNameString() + "|SPK");
                 if (state->getControllerTypeEnum() == ControllerStimRecord) {
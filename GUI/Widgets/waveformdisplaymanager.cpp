@@ -28,6 +28,7 @@
 //
 //------------------------------------------------------------------------------
 
+#include <QMessageBox>
 #include <QPainter>
 #include "waveformdisplaymanager.h"
 
@@ -368,6 +369,7 @@ void WaveformDisplayManager::loadDataSegment(const WaveformFifo* waveformFifo, c
 
     bool gpuMode = false;
     GpuWaveformAddress gpuWaveformAddress;
+    DigitalBitAddress bitAddress = { nullptr, 0 };
     float* waveform = nullptr;
     uint16_t* rasterData = nullptr;
     uint16_t* stimFlags = nullptr;
@@ -379,7 +381,10 @@ void WaveformDisplayManager::loadDataSegment(const WaveformFifo* waveformFifo, c
         if (gpuWaveformAddress.waveformIndex >= 0) {
             gpuMode = true;
         } else {
-            waveform = waveformFifo->getAnalogWaveformPointer(waveName.toStdString());
+            bitAddress = waveformFifo->getDigitalBitAddress(waveName.toStdString());
+            if (!bitAddress.wordWaveform) {
+                waveform = waveformFifo->getAnalogWaveformPointer(waveName.toStdString());
+            }
         }
         if (ds->hasStimFlags) {
             stimFlags = waveformFifo->getDigitalWaveformPointer(waveName.section('|', 0, 0).toStdString() + "|STIM");
@@ -415,6 +420,8 @@ void WaveformDisplayManager::loadDataSegment(const WaveformFifo* waveformFifo, c
                 int samples = round((double)samplesToGo / (double)pixelsToGo);
                 if (gpuMode) {
                     waveformFifo->getMinMaxGpuAmplifierData(y, WaveformFifo::ReaderDisplay, gpuWaveformAddress, timeIndex, samples);
+                } else if (bitAddress.wordWaveform) {
+                    waveformFifo->getMinMaxDigitalBitData(y, WaveformFifo::ReaderDisplay, bitAddress, timeIndex, samples);
                 } else {
                     waveformFifo->getMinMaxData(y, WaveformFifo::ReaderDisplay, waveform, timeIndex, samples);
                 }
@@ -435,6 +442,9 @@ void WaveformDisplayManager::loadDataSegment(const WaveformFifo* waveformFifo, c
             if (gpuMode) {
                 waveformFifo->copyGpuAmplifierData(WaveformFifo::ReaderDisplay, &ds->yData[displayStartPos], gpuWaveformAddress,
                                                    startTime, displaySpan);
+            } else if (bitAddress.wordWaveform) {
+                waveformFifo->copyDigitalBitData(WaveformFifo::ReaderDisplay, &ds->yData[displayStartPos], bitAddress,
+                                                 startTime, displaySpan);
             } else {
                 waveformFifo->copyAnalogData(WaveformFifo::ReaderDisplay, &ds->yData[displayStartPos], waveform,
                                              startTime, displaySpan);
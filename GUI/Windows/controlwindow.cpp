@@ -1227,6 +1227,9 @@ void ControlWindow::performance()
         changeUsedXPUIndex(performanceDialog.XPUSelectionComboBox->currentIndex());
         state->writeToDiskLatency->setIndex(performanceDialog.writeLatencyComboBox->currentIndex());
         state->plottingMode->setIndex(performanceDialog.plottingModeComboBox->currentIndex());
+        state->processingLatency->setIndex(performanceDialog.processingLatencyComboBox->currentIndex());
+        state->cpuProcessingThreads->setIndex(performanceDialog.cpuThreadsComboBox->currentIndex());
+        state->pinCPUProcessingThreads->setValue(performanceDialog.pinCPUThreadsCheckBox->isChecked());
     }
 }
 
@@ -1305,6 +1308,7 @@ void ControlWindow::selectBaseFilenameSlot()
         break;
 
     case FileFormatFilePerSignalType:
+    case FileFormatRawFrames:
         if (state->createNewDirectory->getValue()) {
             newFilename = QFileDialog::getSaveFileName(this, tr("Select Base Filename"), defaultDirectory, tr("Intan Data Files (*") + suffix + ")");
         } else {
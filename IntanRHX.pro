@@ -41,11 +41,14 @@ SOURCES += main.cpp \
     Engine/Processing/DataFileReaders/datafilereader.cpp \
     Engine/Processing/DataFileReaders/fileperchannelmanager.cpp \
     Engine/Processing/DataFileReaders/filepersignaltypemanager.cpp \
+    Engine/Processing/DataFileReaders/rawframefilemanager.cpp \
     Engine/Processing/DataFileReaders/traditionalintanfilemanager.cpp \
     Engine/Processing/SaveManagers/fileperchannelsavemanager.cpp \
     Engine/Processing/SaveManagers/filepersignaltypesavemanager.cpp \
     Engine/Processing/SaveManagers/intanfilesavemanager.cpp \
+    Engine/Processing/SaveManagers/rawframesavemanager.cpp \
     Engine/Processing/SaveManagers/savefile.cpp \
+    Engine/Processing/SaveManagers/savefilewriter.cpp \
     Engine/Processing/SaveManagers/savemanager.cpp \
     Engine/Processing/XPUInterfaces/abstractxpuinterface.cpp \
     Engine/Processing/XPUInterfaces/cpuinterface.cpp \
@@ -58,6 +61,7 @@ SOURCES += main.cpp \
     Engine/Processing/displayundomanager.cpp \
     Engine/Processing/fastfouriertransform.cpp \
     Engine/Processing/filter.cpp \
+    Engine/Processing/lfpdecimator.cpp \
     Engine/Processing/matfilewriter.cpp \
     Engine/Processing/rhxdatareader.cpp \
     Engine/Processing/signalsources.cpp \
@@ -128,6 +132,7 @@ SOURCES += main.cpp \
     GUI/Widgets/smartspinbox.cpp \
     GUI/Widgets/spikegradient.cpp \
     GUI/Widgets/spikeplot.cpp \
+    GUI/Widgets/stateitemwidgets.cpp \
     GUI/Widgets/statusbars.cpp \
     GUI/Widgets/stimfigure.cpp \
     GUI/Widgets/tcpdisplay.cpp \
@@ -158,11 +163,14 @@ HEADERS += \
     Engine/Processing/DataFileReaders/datafilereader.h \
     Engine/Processing/DataFileReaders/fileperchannelmanager.h \
     Engine/Processing/DataFileReaders/filepersignaltypemanager.h \
+    Engine/Processing/DataFileReaders/rawframefilemanager.h \
     Engine/Processing/DataFileReaders/traditionalintanfilemanager.h \
     Engine/Processing/SaveManagers/fileperchannelsavemanager.h \
     Engine/Processing/SaveManagers/filepersignaltypesavemanager.h \
     Engine/Processing/SaveManagers/intanfilesavemanager.h \
+    Engine/Processing/SaveManagers/rawframesavemanager.h \
     Engine/Processing/SaveManagers/savefile.h \
+    Engine/Processing/SaveManagers/savefilewriter.h \
     Engine/Processing/SaveManagers/savemanager.h \
     Engine/Processing/XPUInterfaces/abstractxpuinterface.h \
     Engine/Processing/XPUInterfaces/cpuinterface.h \
@@ -175,6 +183,7 @@ HEADERS += \
     Engine/Processing/displayundomanager.h \
     Engine/Processing/fastfouriertransform.h \
     Engine/Processing/filter.h \
+    Engine/Processing/lfpdecimator.h \
     Engine/Processing/matfilewriter.h \
     Engine/Processing/minmax.h \
     Engine/Processing/probemapdatastructures.h \
@@ -96,13 +96,17 @@ typedef struct _channel_detection
 // There's no way for const variables (must be const to create an array of that length) to be communicated as args.
 #define samples_per_block 128
 
+// Bit 0 of store_bands is set if the low-pass band is stored, and bit 1 if the high-pass band is stored.  An unused
+// low-pass band is not computed.  An unused high-pass band is still computed for spike detection, but only its last
+// snippet_size samples (copied for the next block's spike detection) are stored.
 //__kernel void process_block(const global_param_struct global_parameters, const filter_param_struct filter_parameters,
 __kernel void process_block(__global global_param_struct* restrict global_parameters,
                             __global filter_param_struct* restrict filter_parameters,
                             __global channel_hoops_struct* restrict hoops,
                             __global ushort* raw_block, __global float* prev_last_2, __global ushort* prev_high,
                             __global ushort* low, __global ushort* wide, __global ushort* high, __global uint* spike,
-                            __global uchar* spikeIDs, __global ushort* start_search_pos)
+                            __global uchar* spikeIDs, __global ushort* start_search_pos,
+                            __global const uint* active_channels, const uint num_channels, const uint store_bands)
 {
     ushort words_per_frame = global_parameters->words_per_frame;
     char type = global_parameters->type;
@@ -151,7 +155,10 @@ __kernel void process_block(__global global_param_struct* restrict global_parame
         high_a1[filter_index] = filter_parameters->high_params[filter_index].a1;
     }
 
-    uint channel_index = get_global_id(0);
+    // One work item per enabled channel; outputs are still laid out for all num_channels channels.
+    uint channel_index = active_channels[get_global_id(0)];
+    bool store_low = (store_bands & 1) != 0;
+    bool store_high = (store_bands & 2) != 0;
     const int snippets_per_block = (int) ceil((float) ((float) samples_per_block / (float) snippet_size) + 1.0f);
 
     float in_float[samples_per_block];
@@ -206,12 +213,12 @@ __kernel void process_block(__global global_param_struct* restrict global_parame
     bool use_hoops = (hoops[channel_index].use_hoops == 1) ? true : false;
 
     for (s = 0; s < snippets_per_block; ++s) {
-        spike[s * get_global_size(0) + channel_index] = 0;
-        spikeIDs[s * get_global_size(0) + channel_index] = 0;
+        spike[s * num_channels + channel_index] = 0;
+        spikeIDs[s * num_channels + channel_index] = 0;
     }
 
     for (s = 0; s < snippet_size; ++s) {
-        prev_high_float[s] = (float) (0.195f * (((float)prev_high[s * get_global_size(0) + channel_index]) - 32768));
+        prev_high_float[s] = (float) (0.195f * (((float)prev_high[s * num_channels + channel_index]) - 32768));
     }
 
     int in_index_stream;
@@ -247,16 +254,18 @@ __kernel void process_block(__global global_param_struct* restrict global_parame
     wide_float[0] = notch_b2 * in_2nd_to_last + notch_b1 * in_last + notch_b0 * in_float[0] - notch_a2 * wide_2nd_to_last - notch_a1 * wide_last;
 
     // (2) IIR Nth-order low-pass
-    // 1st iteration: use wide_float as input.
-    low_float[0][0] = low_b2[0] * wide_2nd_to_last + low_b1[0] * wide_last + low_b0[0] * wide_float[0] - low_a2[0] * low_2nd_to_last[0] -low_a1[0] * low_last[0];
-
-    // All other iterations: use low_float[filter_index - 1] as input.
-    for (uint filter_index = 1; filter_index < num_low_filter_iterations; ++filter_index) {
-        low_float[filter_index][0] = low_b2[filter_index] * low_2nd_to_last[filter_index - 1] +
-                low_b1[filter_index] * low_last[filter_index - 1] +
-                low_b0[filter_index] * low_float[filter_index - 1][0] -
-                low_a2[filter_index] * low_2nd_to_last[filter_index] -
-                low_a1[filter_index] * low_last[filter_index];
+    if (store_low) {
+        // 1st iteration: use wide_float as input.
+        low_float[0][0] = low_b2[0] * wide_2nd_to_last + low_b1[0] * wide_last + low_b0[0] * wide_float[0] - low_a2[0] * low_2nd_to_last[0] -low_a1[0] * low_last[0];
+
+        // All other iterations: use low_float[filter_index - 1] as input.
+        for (uint filter_index = 1; filter_index < num_low_filter_iterations; ++filter_index) {
+            low_float[filter_index][0] = low_b2[filter_index] * low_2nd_to_last[filter_index - 1] +
+                    low_b1[filter_index] * low_last[filter_index - 1] +
+                    low_b0[filter_index] * low_float[filter_index - 1][0] -
+                    low_a2[filter_index] * low_2nd_to_last[filter_index] -
+                    low_a1[filter_index] * low_last[filter_index];
+        }
     }
 
     // (3) IIR Nth-order high-pass
@@ -278,16 +287,18 @@ __kernel void process_block(__global global_param_struct* restrict global_parame
     wide_float[1] = notch_b2 * in_last + notch_b1 * in_float[0] + notch_b0 * in_float[1] - notch_a2 * wide_last - notch_a1 * wide_float[0];
 
     // (2) IIR Nth-order low-pass
-    // 1st iteration: use wide_float as input.
-    low_float[0][1] = low_b2[0] * wide_last + low_b1[0] * wide_float[0] + low_b0[0] * wide_float[1] - low_a2[0] * low_last[0] - low_a1[0] * low_float[0][0];
-
-    // All other iterations: use low_float[filter_index - 1] as input.
-    for (uint filter_index = 1; filter_index < num_low_filter_iterations; ++filter_index) {
-        low_float[filter_index][1] = low_b2[filter_index] * low_last[filter_index - 1] +
-                low_b1[filter_index] * low_float[filter_index - 1][0] +
-                low_b0[filter_index] * low_float[filter_index - 1][1] -
-                low_a2[filter_index] * low_last[filter_index] -
-                low_a1[filter_index] * low_float[filter_index][0];
+    if (store_low) {
+        // 1st iteration: use wide_float as input.
+        low_float[0][1] = low_b2[0] * wide_last + low_b1[0] * wide_float[0] + low_b0[0] * wide_float[1] - low_a2[0] * low_last[0] - low_a1[0] * low_float[0][0];
+
+        // All other iterations: use low_float[filter_index - 1] as input.
+        for (uint filter_index = 1; filter_index < num_low_filter_iterations; ++filter_index) {
+            low_float[filter_index][1] = low_b2[filter_index] * low_last[filter_index - 1] +
+                    low_b1[filter_index] * low_float[filter_index - 1][0] +
+                    low_b0[filter_index] * low_float[filter_index - 1][1] -
+                    low_a2[filter_index] * low_last[filter_index] -
+                    low_a1[filter_index] * low_float[filter_index][0];
+        }
     }
 
     // (3) IIR Nth-order high-pass
@@ -310,16 +321,18 @@ __kernel void process_block(__global global_param_struct* restrict global_parame
         wide_float[s] = notch_b2 * in_float[s - 2] + notch_b1 * in_float[s - 1] + notch_b0 * in_float[s] - notch_a2 * wide_float[s - 2] - notch_a1 * wide_float[s - 1];
 
         // (2) IIR Nth-order low-pass
-        // 1st iteration: use wide_float as input.
-        low_float[0][s] = low_b2[0] * wide_float[s - 2] + low_b1[0] * wide_float[s - 1] + low_b0[0] * wide_float[s] - low_a2[0] * low_float[0][s - 2] - low_a1[0] * low_float[0][s - 1];
-
-        // All other iterations: use low_float[filter_index - 1] as input.
-        for (uint filter_index = 1; filter_index < num_low_filter_iterations; ++filter_index) {
-            low_float[filter_index][s] = low_b2[filter_index] * low_float[filter_index - 1][s - 2] +
-                    low_b1[filter_index] * low_float[filter_index - 1][s - 1] +
-                    low_b0[filter_index] * low_float[filter_index - 1][s] -
-                    low_a2[filter_index] * low_float[filter_index][s - 2] -
-                    low_a1[filter_index] * low_float[filter_index][s - 1];
+        if (store_low) {
+            // 1st iteration: use wide_float as input.
+            low_float[0][s] = low_b2[0] * wide_float[s - 2] + low_b1[0] * wide_float[s - 1] + low_b0[0] * wide_float[s] - low_a2[0] * low_float[0][s - 2] - low_a1[0] * low_float[0][s - 1];
+
+            // All other iterations: use low_float[filter_index - 1] as input.
+            for (uint filter_index = 1; filter_index < num_low_filter_iterations; ++filter_index) {
+                low_float[filter_index][s] = low_b2[filter_index] * low_float[filter_index - 1][s - 2] +
+                        low_b1[filter_index] * low_float[filter_index - 1][s - 1] +
+                        low_b0[filter_index] * low_float[filter_index - 1][s] -
+                        low_a2[filter_index] * low_float[filter_index][s - 2] -
+                        low_a1[filter_index] * low_float[filter_index][s - 1];
+            }
         }
 
         // (3) IIR Nth-order high-pass
@@ -341,7 +354,7 @@ __kernel void process_block(__global global_param_struct* restrict global_parame
 
     for (int s = 0; s < samples_per_block; ++s) {
         filtered_high[s] = high_float[num_high_filter_iterations - 1][s];
-        filtered_low[s] = low_float[num_low_filter_iterations - 1][s];
+        filtered_low[s] = store_low ? low_float[num_low_filter_iterations - 1][s] : 0.0f;
     }
 
     // Across this block, look for any valid rectangle and look back to this block and the previous block to
@@ -541,10 +554,10 @@ __kernel void process_block(__global global_param_struct* restrict global_parame
             timestamp += thresh_s;
 
             // Write spike detection at this timestamp.
-            spike[snippet_index * get_global_size(0) + channel_index] = timestamp;
+            spike[snippet_index * num_channels + channel_index] = timestamp;
 
             // Populate spikeID with correct ID.
-            spikeIDs[snippet_index * get_global_size(0) + channel_index] = ID;
+            spikeIDs[snippet_index * num_channels + channel_index] = ID;
 
             // Advance by snippet_size samples since activity up until then will already be flagged as a spike.
             thresh_s += snippet_size;
@@ -575,19 +588,21 @@ __kernel void process_block(__global global_param_struct* restrict global_parame
         else if (filtered_high[s] < -6389.0f) filtered_high[s] = -6389.0f;
 
         // (4) Convert outputs to uint16_t.
-        out_index = s * get_global_size(0) + channel_index;
+        out_index = s * num_channels + channel_index;
 
         //  = round((low_float[s] / 0.195f) + 32768) with optimizations for speed
-        low[out_index] = (ushort)(fma(filtered_low[s], 5.1282f, 32768.5f)); // TEMP disable low to use for debugging
+        if (store_low) low[out_index] = (ushort)(fma(filtered_low[s], 5.1282f, 32768.5f)); // TEMP disable low to use for debugging
         wide[out_index] = (ushort)(fma(wide_float[s], 5.1282f, 32768.5f));
-        high[out_index] = (ushort)(fma(filtered_high[s], 5.1282f, 32768.5f));
+        if (store_high || s >= samples_per_block - snippet_size) high[out_index] = (ushort)(fma(filtered_high[s], 5.1282f, 32768.5f));
     }
 
 
     // Update 'prev_last_2' array with this block's samples.
     for (int filter_index = 0; filter_index < 4; ++filter_index) {
-        prev_last_2[low_2nd_to_last_index[filter_index]] = low_float[filter_index][samples_per_block - 2];
-        prev_last_2[low_last_index[filter_index]] = low_float[filter_index][samples_per_block - 1];
+        if (store_low) {
+            prev_last_2[low_2nd_to_last_index[filter_index]] = low_float[filter_index][samples_per_block - 2];
+            prev_last_2[low_last_index[filter_index]] = low_float[filter_index][samples_per_block - 1];
+        }
         prev_last_2[high_2nd_to_last_index[filter_index]] = high_float[filter_index][samples_per_block - 2];
         prev_last_2[high_last_index[filter_index]] = high_float[filter_index][samples_per_block - 1];
     }
@@ -36,6 +36,8 @@
 #include <xdaq/device_manager.h>
 
 #include <QApplication>
+#include <QMessageBox>
+#include <QThread>
 #include <memory>
 #include <nlohmann/json.hpp>
 
@@ -47,6 +49,7 @@
 #include "datafilereader.h"
 #include "rhxglobals.h"
 #include "systemstate.h"
+#include "xmlinterface.h"
 
 
 
@@ -71,6 +74,17 @@ auto startSoftware(
 {
     RHXAPP app{.rhxController = std::unique_ptr<AbstractRHXController>(rhxController)};
 
+    // Engine warnings are shown in message boxes, on the GUI thread even when raised by a worker thread.
+    SystemState::setWarningHandler([](const QString& title, const QString& message) {
+        if (QThread::currentThread() == qApp->thread()) {
+            QMessageBox::warning(nullptr, title, message);
+        } else {
+            QMetaObject::invokeMethod(
+                qApp, [title, message]() { QMessageBox::warning(nullptr, title, message); }, Qt::QueuedConnection
+            );
+        }
+    });
+
     app.state = std::make_unique<SystemState>(
         app.rhxController.get(),
         stimStepSize,
@@ -94,7 +108,7 @@ auto startSoftware(
         app.state.get(),
         false
     );
-    app.state->setupGlobalSettingsLoadSave(controllerInterface);
+    app.state->setupGlobalSettingsLoadSave(new XMLInterface(app.state.get(), controllerInterface, XMLIncludeGlobalParameters));
     auto parser = new CommandParser(app.state.get(), controllerInterface, controllerInterface);
     app.controlWindow =
         new ControlWindow(app.state.get(), parser, controllerInterface, app.rhxController.get());
@@ -253,6 +267,18 @@ auto startSoftware(
         controlWindow,
         SLOT(queueErrorMessage(QString))
     );
+    QObject::connect(
+        controllerInterface->waveformThread(),
+        SIGNAL(sendSetCommand(QString, QString)),
+        parser,
+        SLOT(setCommandSlot(QString, QString))
+    );
+    QObject::connect(
+        controllerInterface->waveformThread(),
+        SIGNAL(error(QString)),
+        controlWindow,
+        SLOT(queueErrorMessage(QString))
+    );
 
     controlWindow->show();
     if (!defaultSettingsFile.isEmpty()) {